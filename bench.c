@@ -0,0 +1,1248 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <math.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+#include <fcntl.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "gru.h"
+#include "palette.h"
+#include "pack.h"
+#include "window.h"
+#include "infer_queue.h"
+#include "frame_ring.h"
+#include "checkpoint.h"
+#include "layer_stream.h"
+#include "model_registry.h"
+#include "bulk_score.h"
+#include "graph.h"
+#include "bidirectional.h"
+#include "lstmp.h"
+#include "conv1d.h"
+#include "attention.h"
+#include "packed_seq.h"
+#include "ensemble.h"
+#include "tune.h"
+#include "stepper.h"
+#include "util.h"
+
+#define BENCH_STEPS 2000
+
+static double now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static void fill_random(float* x, int size, float scale) {
+    for (int i = 0; i < size; i++) {
+        x[i] = scale * ((float)rand() / RAND_MAX * 2.0f - 1.0f);
+    }
+}
+
+static void fill_random_gru_layer(GRULayer* layer) {
+    int input_size = layer->config.input_size;
+    int hidden_size = layer->config.hidden_size;
+    float scale = 1.0f / sqrtf((float)hidden_size);
+    GRULayerWeights* w = &layer->weights;
+    float* input_weights[3] = {w->W_ir, w->W_iz, w->W_in};
+    float* hidden_weights[3] = {w->W_hr, w->W_hz, w->W_hn};
+    float* biases[6] = {w->b_ir, w->b_iz, w->b_in, w->b_hr, w->b_hz, w->b_hn};
+    for (int i = 0; i < 3; i++) {
+        fill_random(input_weights[i], input_size * hidden_size, scale);
+        fill_random(hidden_weights[i], hidden_size * hidden_size, scale);
+    }
+    for (int i = 0; i < 6; i++) {
+        fill_random(biases[i], hidden_size, scale);
+    }
+}
+
+// Runs BENCH_STEPS recurrent steps, returns microseconds per step and leaves the final state in h
+static double time_gru_steps(GRULayer* layer, float* input, float* h) {
+    int hidden_size = layer->config.hidden_size;
+    memset(h, 0, hidden_size * sizeof(float));
+    double start = now_us();
+    for (int t = 0; t < BENCH_STEPS; t++) {
+        gru_layer_forward(layer, input, h);
+        memcpy(h, layer->state.hidden_state_buffer, hidden_size * sizeof(float));
+    }
+    return (now_us() - start) / BENCH_STEPS;
+}
+
+static size_t gru_palette_bytes(GRULayer* layer, bool per_row) {
+    int input_size = layer->config.input_size;
+    int hidden_size = layer->config.hidden_size;
+    return 3 * palette_matrix_bytes(input_size, hidden_size, per_row ? input_size : 1)
+         + 3 * palette_matrix_bytes(hidden_size, hidden_size, per_row ? hidden_size : 1);
+}
+
+// float32 weights against 4-bit codebook weights (per tensor and per row)
+static void bench_palette(int input_size, int hidden_size) {
+    GRULayer layer;
+    init_gru_layer(&layer, 1, input_size, hidden_size);
+    fill_random_gru_layer(&layer);
+
+    float* input = (float*)malloc(input_size * sizeof(float));
+    float* h_ref = (float*)malloc(hidden_size * sizeof(float));
+    float* h = (float*)malloc(hidden_size * sizeof(float));
+    fill_random(input, input_size, 1.0f);
+
+    size_t float_bytes = 3 * (size_t)(input_size + hidden_size) * hidden_size * sizeof(float);
+    double float_us = time_gru_steps(&layer, input, h_ref);
+    printf("gru %3d->%-4d float32      %8.2f us/step  %8zu weight bytes\n", input_size, hidden_size, float_us, float_bytes);
+
+    for (int per_row = 0; per_row <= 1; per_row++) {
+        palettize_gru_layer(&layer, per_row, 20);
+        double us = time_gru_steps(&layer, input, h);
+        float max_err = 0.0f;
+        for (int i = 0; i < hidden_size; i++) {
+            max_err = fmaxf(max_err, fabsf(h[i] - h_ref[i]));
+        }
+        printf("gru %3d->%-4d palette/%-4s %8.2f us/step  %8zu weight bytes  max |dh| %.4f\n",
+               input_size, hidden_size, per_row ? "row" : "tens", us, gru_palette_bytes(&layer, per_row), max_err);
+        free_gru_layer_palette(&layer);
+    }
+
+    free(input);
+    free(h_ref);
+    free(h);
+    free_gru_layer(&layer, true);
+}
+
+// column-walking matmul against GEMV panels
+static void bench_packed(int input_size, int hidden_size) {
+    GRULayer layer;
+    init_gru_layer(&layer, 1, input_size, hidden_size);
+    fill_random_gru_layer(&layer);
+
+    float* input = (float*)malloc(input_size * sizeof(float));
+    float* h_ref = (float*)malloc(hidden_size * sizeof(float));
+    float* h = (float*)malloc(hidden_size * sizeof(float));
+    fill_random(input, input_size, 1.0f);
+
+    double float_us = time_gru_steps(&layer, input, h_ref);
+    PackArena arena;
+    init_pack_arena(&arena, gru_layer_packed_bytes(&layer.config));
+    pack_gru_layer(&layer, &arena);
+    double packed_us = time_gru_steps(&layer, input, h);
+    float max_err = 0.0f;
+    for (int i = 0; i < hidden_size; i++) {
+        max_err = fmaxf(max_err, fabsf(h[i] - h_ref[i]));
+    }
+    printf("gru %3d->%-4d float32 %8.2f us/step  packed %8.2f us/step  max |dh| %.2g\n",
+           input_size, hidden_size, float_us, packed_us, max_err);
+
+    free(input);
+    free(h_ref);
+    free(h);
+    free_gru_layer(&layer, true);
+    free_pack_arena(&arena);
+}
+
+// naive triple loop against the blocked GEMM, in GFLOP/s
+static void bench_gemm(int M, int N, int K) {
+    float* A = (float*)malloc((size_t)M * K * sizeof(float));
+    float* B = (float*)malloc((size_t)K * N * sizeof(float));
+    float* C = (float*)malloc((size_t)M * N * sizeof(float));
+    fill_random(A, M * K, 1.0f);
+    fill_random(B, K * N, 1.0f);
+    double flops = 2.0 * M * N * K;
+
+    double start = now_us();
+    MathStatus status = matmul(C, A, B, M, K, N);
+    double matmul_us = now_us() - start;
+
+    start = now_us();
+    gemm(M, N, K, 1.0f, A, K, B, N, 0.0f, C, N);
+    double gemm_us = now_us() - start;
+
+    if (status == MATH_SUCCESS) {
+        printf("gemm %4dx%4dx%4d  matmul %7.2f GFLOP/s  gemm %7.2f GFLOP/s\n",
+               M, N, K, flops / matmul_us / 1e3, flops / gemm_us / 1e3);
+    } else {
+        printf("gemm %4dx%4dx%4d  matmul    n/a (status %d)  gemm %7.2f GFLOP/s\n",
+               M, N, K, status, flops / gemm_us / 1e3);
+    }
+    free(A);
+    free(B);
+    free(C);
+}
+
+// per-step forward loop against the hoisted sequence forward
+static void bench_sequence(int input_size, int hidden_size, int seq_len) {
+    GRULayer layer;
+    init_gru_layer(&layer, 1, input_size, hidden_size);
+    fill_random_gru_layer(&layer);
+
+    float* inputs = (float*)malloc((size_t)seq_len * input_size * sizeof(float));
+    float* outputs = (float*)malloc((size_t)seq_len * hidden_size * sizeof(float));
+    float* h = (float*)calloc(hidden_size, sizeof(float));
+    fill_random(inputs, seq_len * input_size, 1.0f);
+
+    double start = now_us();
+    for (int t = 0; t < seq_len; t++) {
+        gru_layer_forward(&layer, inputs + t * input_size, h);
+        memcpy(h, layer.state.hidden_state_buffer, hidden_size * sizeof(float));
+    }
+    double step_us = now_us() - start;
+
+    memset(h, 0, hidden_size * sizeof(float));
+    start = now_us();
+    gru_layer_forward_sequence(&layer, inputs, h, outputs, seq_len);
+    double seq_us = now_us() - start;
+
+    printf("gru %3d->%-4d x %4d steps  step loop %9.1f us  sequence %9.1f us\n",
+           input_size, hidden_size, seq_len, step_us, seq_us);
+    free(inputs);
+    free(outputs);
+    free(h);
+    free_gru_layer(&layer, true);
+}
+
+// windowed inference, time per push of the batched window, a from-scratch
+// recompute of every window, and the single-step stateful mode
+static void bench_window(int input_size, int hidden_size, int num_layers, int window) {
+    RNNModelConfig config = {RNN_CELL_GRU, 1, input_size, hidden_size, 4, num_layers};
+    RNNModel model;
+    init_rnn_model(&model, config);
+    for (int l = 0; l < num_layers; l++) {
+        fill_random_gru_layer(&model.gru_layers[l]);
+    }
+    fill_random(model.output_layer.weights.weights, hidden_size * 4, 0.1f);
+
+    enum { PUSHES = 256 };
+    float* inputs = (float*)malloc((size_t)PUSHES * input_size * sizeof(float));
+    float output[4];
+    fill_random(inputs, PUSHES * input_size, 1.0f);
+
+    double us[3];
+    WindowMode modes[2] = {WINDOW_EXACT, WINDOW_STATEFUL};
+    for (int m = 0; m < 3; m++) {
+        SlidingWindow sw;
+        init_sliding_window(&sw, &model, window, modes[m == 2]);
+        double start = now_us();
+        for (int t = 0; t < PUSHES; t++) {
+            if (m == 1) {
+                sw.steps = window + t; // the ring only feeds the recompute here
+                sliding_window_recompute(&sw, output);
+            } else {
+                sliding_window_push(&sw, inputs + t * input_size, output);
+            }
+        }
+        us[m] = (now_us() - start) / PUSHES;
+        free_sliding_window(&sw);
+    }
+    printf("window %3d gru %dx%3d->%-4d  batched %8.1f us  recompute %8.1f us  stateful %6.1f us per window\n",
+           window, num_layers, input_size, hidden_size, us[0], us[1], us[2]);
+    free(inputs);
+    free_rnn_model(&model, true);
+}
+
+// delta-network steps on a slowly varying signal, against the dense step
+static void bench_delta(int input_size, int hidden_size, float threshold) {
+    GRULayer dense;
+    GRULayer delta;
+    init_gru_layer(&dense, 1, input_size, hidden_size);
+    fill_random_gru_layer(&dense);
+    init_gru_layer(&delta, 1, input_size, hidden_size);
+    delta.weights = dense.weights;
+    enable_gru_layer_delta(&delta, threshold);
+
+    float* inputs = (float*)malloc((size_t)BENCH_STEPS * input_size * sizeof(float));
+    for (int t = 0; t < BENCH_STEPS; t++) {
+        for (int i = 0; i < input_size; i++) {
+            inputs[t * input_size + i] = sinf(0.01f * t * (1 + i % 4) + i) + 0.002f * ((float)rand() / RAND_MAX);
+        }
+    }
+    float* h = (float*)calloc(hidden_size, sizeof(float));
+    float* hd = (float*)calloc(hidden_size, sizeof(float));
+    float* trace = (float*)malloc((size_t)BENCH_STEPS * hidden_size * sizeof(float));
+
+    double start = now_us();
+    for (int t = 0; t < BENCH_STEPS; t++) {
+        gru_layer_forward_inplace(&dense, inputs + t * input_size, h);
+        memcpy(trace + (size_t)t * hidden_size, h, hidden_size * sizeof(float));
+    }
+    double dense_us = (now_us() - start) / BENCH_STEPS;
+
+    float drift = 0.0f;
+    start = now_us();
+    for (int t = 0; t < BENCH_STEPS; t++) {
+        gru_layer_forward_inplace(&delta, inputs + t * input_size, hd);
+        for (int i = 0; i < hidden_size; i++) {
+            drift = fmaxf(drift, fabsf(hd[i] - trace[(size_t)t * hidden_size + i]));
+        }
+    }
+    double delta_us = (now_us() - start) / BENCH_STEPS;
+
+    printf("delta gru %3d->%-4d threshold %.3f  dense %7.2f us  delta %7.2f us  skipped %5.1f%%  max drift %.4f\n",
+           input_size, hidden_size, threshold, dense_us, delta_us, 100.0f * gru_layer_delta_skip_ratio(&delta), drift);
+    free(inputs);
+    free(h);
+    free(hd);
+    free(trace);
+    free_gru_layer_run_state(&delta.state);
+    free_gru_layer(&dense, true);
+}
+
+// early exit on the 5-layer GRU of main.c, per-step latency against the exit distribution
+static void bench_early_exit(float threshold) {
+    enum { IN = 15, H = 64, O = 4, L = 5 };
+    RNNModelConfig config = {RNN_CELL_GRU, 1, IN, H, O, L};
+    RNNModel model;
+    init_rnn_model(&model, config);
+    for (int l = 0; l < L; l++) {
+        fill_random_gru_layer(&model.gru_layers[l]);
+    }
+    fill_random(model.output_layer.weights.weights, H * O, 1.0f);
+    init_rnn_early_exit(&model, EXIT_MAX_SOFTMAX, threshold);
+    for (int l = 0; l < L - 1; l++) {
+        LinearLayer* head = add_rnn_exit_head(&model, l);
+        fill_random(head->weights.weights, H * O, 0.5f + 0.5f * l); // deeper heads are more decisive
+    }
+
+    float* state = (float*)calloc(rnn_model_state_size(&config), sizeof(float));
+    float input[IN];
+    float output[O];
+    double start = now_us();
+    for (int t = 0; t < BENCH_STEPS; t++) {
+        fill_random(input, IN, 1.0f);
+        rnn_model_step(&model, input, state, output);
+    }
+    double us = (now_us() - start) / BENCH_STEPS;
+    printf("early exit threshold %.2f  %6.2f us per step\n", threshold, us);
+    print_rnn_exit_stats(&model);
+    free(state);
+    free_rnn_model(&model, true);
+}
+
+typedef struct {
+    InferQueue* queue;
+    uint64_t stream_id;
+    int steps;
+    float* latency_us;
+} BenchProducer;
+
+static void* bench_producer(void* arg) {
+    BenchProducer* producer = (BenchProducer*)arg;
+    int input_size = producer->queue->sessions->model->config.input_size;
+    float input[input_size];
+    float output[producer->queue->sessions->model->config.output_size];
+    InferRequest request;
+    memset(&request, 0, sizeof(request));
+    request.stream_id = producer->stream_id;
+    request.input = input;
+    request.output = output;
+    for (int t = 0; t < producer->steps; t++) {
+        for (int i = 0; i < input_size; i++) {
+            input[i] = 0.01f * ((t + i) % 100);
+        }
+        infer_submit(producer->queue, &request);
+        infer_wait(producer->queue, &request);
+        producer->latency_us[t] = (float)(request.complete_us - request.submit_us);
+    }
+    return NULL;
+}
+
+static int compare_float(const void* a, const void* b) {
+    float x = *(const float*)a;
+    float y = *(const float*)b;
+    return (x > y) - (x < y);
+}
+
+// producers each driving one stream through the async queue, throughput and tail latency
+static void bench_infer_queue(int producers, int max_batch, int max_delay_us) {
+    enum { IN = 15, H = 256, O = 4, L = 2, STEPS = 200 };
+    RNNModelConfig config = {RNN_CELL_GRU, 1, IN, H, O, L};
+    RNNModel model;
+    init_rnn_model(&model, config);
+    for (int l = 0; l < L; l++) {
+        fill_random_gru_layer(&model.gru_layers[l]);
+    }
+    SessionManager sessions;
+    init_session_manager(&sessions, &model, 1 << 24);
+    for (int p = 0; p < producers; p++) {
+        session_create(&sessions, p);
+    }
+
+    InferQueue queue;
+    start_infer_queue(&queue, &sessions, max_batch, max_delay_us);
+    pthread_t threads[producers];
+    BenchProducer args[producers];
+    float* latency = (float*)malloc((size_t)producers * STEPS * sizeof(float));
+    double start = now_us();
+    for (int p = 0; p < producers; p++) {
+        args[p] = (BenchProducer){&queue, (uint64_t)p, STEPS, latency + p * STEPS};
+        pthread_create(&threads[p], NULL, bench_producer, &args[p]);
+    }
+    for (int p = 0; p < producers; p++) {
+        pthread_join(threads[p], NULL);
+    }
+    double elapsed = now_us() - start;
+    stop_infer_queue(&queue);
+
+    int total = producers * STEPS;
+    qsort(latency, total, sizeof(float), compare_float);
+    printf("queue %2d producers  batch %2d  delay %4d us  %8.0f req/s  mean batch %5.1f  p50 %7.0f us  p99 %7.0f us\n",
+           producers, max_batch, max_delay_us, total / elapsed * 1e6, (double)queue.requests / queue.batches,
+           latency[total / 2], latency[total * 99 / 100]);
+    free(latency);
+    free_session_manager(&sessions);
+    free_rnn_model(&model, true);
+}
+
+typedef struct {
+    FrameRing* ring;
+    int frames;
+} BenchRingProducer;
+
+static void* bench_ring_producer(void* arg) {
+    BenchRingProducer* args = (BenchRingProducer*)arg;
+    for (int t = 0; t < args->frames; t++) {
+        float* slot;
+        while ((slot = frame_ring_acquire_write(args->ring)) == NULL) {
+            sched_yield();
+        }
+        slot[0] = (float)t;
+        frame_ring_publish(args->ring);
+    }
+    return NULL;
+}
+
+// Frames handed from a sensor thread to the inference loop; with a model the
+// consumer steps straight from the ring slot
+static void bench_frame_ring(int input_size, int hidden_size, int capacity, bool step) {
+    enum { FRAMES = 200000 };
+    RNNModelConfig config = {RNN_CELL_GRU, 1, input_size, hidden_size, 4, 2};
+    RNNModel model;
+    init_rnn_model(&model, config);
+    for (int l = 0; l < config.num_layers; l++) {
+        fill_random_gru_layer(&model.gru_layers[l]);
+    }
+    float* state = (float*)calloc(rnn_model_state_size(&config), sizeof(float));
+    float out[4];
+    int frames = step ? FRAMES / 20 : FRAMES;
+
+    FrameRing ring;
+    init_frame_ring(&ring, input_size, capacity);
+    BenchRingProducer args = {&ring, frames};
+    pthread_t producer;
+    double start = now_us();
+    pthread_create(&producer, NULL, bench_ring_producer, &args);
+    float checksum = 0.0f;
+    for (int t = 0; t < frames; t++) {
+        float* frame;
+        while ((frame = frame_ring_acquire_read(&ring)) == NULL) {
+            sched_yield();
+        }
+        if (step) {
+            rnn_model_step(&model, frame, state, out);
+        }
+        checksum += frame[0];
+        frame_ring_release(&ring);
+    }
+    pthread_join(producer, NULL);
+    double elapsed = now_us() - start;
+    printf("frame ring in %3d  hidden %3d  capacity %4d  %-5s  %8.1f ns/frame  %9.0f frames/s  (checksum %.0f)\n",
+           input_size, hidden_size, capacity, step ? "step" : "ring", elapsed * 1e3 / frames, frames / elapsed * 1e6,
+           checksum);
+    free_frame_ring(&ring);
+    free(state);
+    free_rnn_model(&model, true);
+}
+
+// Cold start of a GRU checkpoint under each load mode: the file is dropped from the
+// page cache first, then load time, the first step and the steady step are timed
+static void bench_checkpoint_load(int input_size, int hidden_size, int num_layers) {
+    char* path = "/tmp/bench_checkpoint.bin";
+    RNNModelConfig config = {RNN_CELL_GRU, 1, input_size, hidden_size, 4, num_layers};
+    RNNModel model;
+    init_rnn_model(&model, config);
+    for (int l = 0; l < num_layers; l++) {
+        free_gru_layer_weights(&model.gru_layers[l].weights); // replaced by the mapped file
+    }
+    free_linear_layer_weights(&model.output_layer.weights);
+
+    size_t floats = config.output_size * (size_t)(hidden_size + 1);
+    for (int l = 0; l < num_layers; l++) {
+        int cell_size = (l == 0) ? input_size : hidden_size;
+        floats += 3 * ((size_t)cell_size * hidden_size + (size_t)hidden_size * hidden_size + 2 * hidden_size);
+    }
+    float* weights = (float*)malloc(floats * sizeof(float));
+    fill_random(weights, (int)floats, 1.0f / sqrtf((float)hidden_size));
+    FILE* file = fopen(path, "wb");
+    fwrite(weights, sizeof(float), floats, file);
+    fclose(file);
+    free(weights);
+
+    unsigned modes[7] = {LOAD_LAZY, LOAD_SEQUENTIAL, LOAD_WILLNEED, LOAD_POPULATE, LOAD_POPULATE | LOAD_HUGEPAGE,
+                         LOAD_POPULATE | LOAD_MLOCK, LOAD_ANON | LOAD_HUGEPAGE | LOAD_MLOCK};
+    char* names[7] = {"lazy", "sequential", "willneed", "populate", "populate+thp", "populate+mlock", "anon huge+mlock"};
+    float* state = (float*)calloc(rnn_model_state_size(&config), sizeof(float));
+    float input[64];
+    float out[4];
+    fill_random(input, input_size, 1.0f);
+    for (int m = 0; m < 7; m++) {
+        int fd = open(path, O_RDONLY);
+        fdatasync(fd);
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        close(fd);
+
+        MappedCheckpoint ckpt;
+        double start = now_us();
+        map_checkpoint(&ckpt, path, modes[m]);
+        memory_map_rnn_weights(&model, (float*)ckpt.base);
+        double load_us = now_us() - start;
+
+        memset(state, 0, rnn_model_state_size(&config) * sizeof(float));
+        start = now_us();
+        rnn_model_step(&model, input, state, out);
+        double first_us = now_us() - start;
+        start = now_us();
+        for (int t = 0; t < 20; t++) {
+            rnn_model_step(&model, input, state, out);
+        }
+        double steady_us = (now_us() - start) / 20;
+        printf("load %-16s %6.1f MB  load %9.1f us  first step %9.1f us  steady step %8.1f us  applied 0x%02x%s\n",
+               names[m], ckpt.size / 1e6, load_us, first_us, steady_us, ckpt.applied, ckpt.huge_tlb ? " hugetlb" : "");
+        unmap_checkpoint(&ckpt);
+    }
+    remove(path);
+    free(state);
+    free_rnn_model(&model, false);
+}
+
+// Streamed weights against the whole checkpoint in memory; depth 1 reads and computes
+// in turn, deeper rings overlap the reads with the layers still computing
+static void bench_layer_stream(int input_size, int hidden_size, int num_layers) {
+    enum { STEPS = 20 };
+    char* path = "/tmp/bench_layer_stream.bin";
+    RNNModelConfig config = {RNN_CELL_GRU, 1, input_size, hidden_size, 4, num_layers};
+    size_t floats = 0;
+    for (int l = 0; l <= num_layers; l++) {
+        floats += rnn_model_layer_floats(&config, l);
+    }
+    float* weights = (float*)malloc(floats * sizeof(float));
+    fill_random(weights, (int)floats, 1.0f / sqrtf((float)hidden_size));
+    FILE* file = fopen(path, "wb");
+    fwrite(weights, sizeof(float), floats, file);
+    fclose(file);
+
+    RNNModel model;
+    init_rnn_model(&model, config);
+    memory_map_rnn_weights(&model, weights);
+    float* state = (float*)calloc(rnn_model_state_size(&config), sizeof(float));
+    float input[64];
+    float out[4];
+    fill_random(input, input_size, 1.0f);
+    double start = now_us();
+    for (int t = 0; t < STEPS; t++) {
+        rnn_model_step(&model, input, state, out);
+    }
+    printf("stream %d x %3d  resident      %7.1f MB  %9.1f us/step\n", num_layers, hidden_size,
+           floats * sizeof(float) / 1e6, (now_us() - start) / STEPS);
+
+    int depths[3] = {1, 2, 3};
+    for (int d = 0; d < 3; d++) {
+        LayerStream stream;
+        open_layer_stream(&stream, &model, path, depths[d]);
+        memset(state, 0, rnn_model_state_size(&config) * sizeof(float));
+        start = now_us();
+        for (int t = 0; t < STEPS; t++) {
+            layer_stream_step(&stream, input, state, out);
+        }
+        double step_us = (now_us() - start) / STEPS;
+        printf("stream %d x %3d  depth %d       %7.1f MB  %9.1f us/step  stalls %4ld  stalled %9.1f us/step\n",
+               num_layers, hidden_size, depths[d], layer_stream_resident_bytes(&stream) / 1e6, step_us,
+               stream.stalls, stream.stall_us / STEPS);
+        close_layer_stream(&stream);
+    }
+    remove(path);
+    free(state);
+    free(weights);
+    free_rnn_model(&model, false);
+}
+
+// Cost the serving path pays for hot reload: an acquire/release pair per step
+static void bench_model_registry(void) {
+    enum { PAIRS = 1000000, RELOADS = 20 };
+    char* path = "/tmp/bench_registry.bin";
+    RNNModelConfig config = {RNN_CELL_GRU, 1, 15, 64, 4, 5};
+    size_t floats = 0;
+    for (int l = 0; l <= config.num_layers; l++) {
+        floats += rnn_model_layer_floats(&config, l);
+    }
+    float* weights = (float*)malloc(floats * sizeof(float));
+    fill_random(weights, (int)floats, 0.125f);
+    FILE* file = fopen(path, "wb");
+    fwrite(weights, sizeof(float), floats, file);
+    fclose(file);
+    free(weights);
+
+    ModelRegistry registry;
+    init_model_registry(&registry, 4);
+    model_registry_load(&registry, "gru", path, config, LOAD_POPULATE);
+    RegistryEntry* entry = model_registry_find(&registry, "gru");
+    double start = now_us();
+    for (int i = 0; i < PAIRS; i++) {
+        ModelVersion* version = model_registry_acquire(&registry, entry);
+        model_registry_release(&registry, version);
+    }
+    double pair_ns = (now_us() - start) * 1e3 / PAIRS;
+
+    // same file, so a reload only builds a new version on the shared mapping
+    start = now_us();
+    for (int i = 0; i < RELOADS; i++) {
+        model_registry_load(&registry, "gru", path, config, LOAD_POPULATE);
+    }
+    double reload_us = (now_us() - start) / RELOADS;
+
+    float* state = (float*)calloc(rnn_model_state_size(&config), sizeof(float));
+    float input[15];
+    float out[4];
+    fill_random(input, 15, 1.0f);
+    start = now_us();
+    for (int t = 0; t < BENCH_STEPS; t++) {
+        ModelVersion* version = model_registry_acquire(&registry, entry);
+        rnn_model_step(&version->model, input, state, out);
+        model_registry_release(&registry, version);
+    }
+    double step_us = (now_us() - start) / BENCH_STEPS;
+    printf("registry acquire+release %6.1f ns  reload %8.1f us  step %8.1f us\n", pair_ns, reload_us, step_us);
+    free(state);
+    free_model_registry(&registry);
+    remove(path);
+}
+
+// Bulk scoring against a plain read of the same feature file (the I/O floor) and
+// against scoring it row by row with rnn_model_step
+static void bench_bulk_score(int streams, int rows_per_stream, int hidden_size, int threads) {
+    enum { F = 15, O = 4, L = 2 };
+    char* path = "/tmp/bench_features.bin";
+    char* out_path = "/tmp/bench_scores.bin";
+    uint64_t rows = (uint64_t)streams * rows_per_stream;
+    uint64_t* stream_ids = (uint64_t*)malloc(rows * sizeof(uint64_t));
+    float* features = (float*)malloc(rows * F * sizeof(float));
+    for (uint64_t r = 0; r < rows; r++) {
+        stream_ids[r] = r / rows_per_stream;
+    }
+    fill_random(features, (int)(rows * F), 1.0f);
+    write_feature_file(path, stream_ids, features, rows, F);
+    free(stream_ids);
+    free(features);
+
+    RNNModelConfig config = {RNN_CELL_GRU, 1, F, hidden_size, O, L};
+    RNNModel model;
+    init_rnn_model(&model, config);
+    for (int l = 0; l < L; l++) {
+        fill_random_gru_layer(&model.gru_layers[l]);
+    }
+
+    FeatureTable table;
+    double start = now_us();
+    open_feature_file(&table, path, F, threads);
+    float sum = 0.0f;
+    for (uint64_t i = 0; i < rows * F; i++) {
+        sum += table.features[i];
+    }
+    double read_us = now_us() - start;
+
+    BulkScoreOptions options = {threads, 1024, NULL, NULL};
+    BulkScoreStats stats;
+    bulk_score(&model, &table, out_path, &options, &stats);
+
+    float* state = (float*)malloc(rnn_model_state_size(&config) * sizeof(float));
+    float out[O];
+    start = now_us();
+    for (uint64_t r = 0; r < rows; r++) {
+        if (r % rows_per_stream == 0) {
+            memset(state, 0, rnn_model_state_size(&config) * sizeof(float));
+        }
+        rnn_model_step(&model, table.features + r * F, state, out);
+    }
+    double step_us = now_us() - start;
+
+    printf("bulk %6llu rows  hidden %3d  threads %d  read %10.0f rows/s  score %9.0f rows/s  step loop %9.0f rows/s  (sum %.1f)\n",
+           (unsigned long long)rows, hidden_size, threads, rows / read_us * 1e6, rows / stats.score_s,
+           rows / step_us * 1e6, sum);
+    close_feature_file(&table);
+    remove(path);
+    remove(out_path);
+    free(state);
+    free_rnn_model(&model, true);
+}
+
+// The planned graph step against rnn_model_step on the same weights, and the cost of
+// adding an RMSNorm and a softmax to the head
+static void bench_layer_graph(int input_size, int hidden_size, int num_layers) {
+    RNNModelConfig config = {RNN_CELL_GRU, 1, input_size, hidden_size, 4, num_layers};
+    RNNModel model;
+    init_rnn_model(&model, config);
+    GraphLayerSpec specs[num_layers + 3];
+    for (int l = 0; l < num_layers; l++) {
+        specs[l] = (GraphLayerSpec){GRAPH_GRU, hidden_size, 0};
+    }
+    LayerGraph plain;
+    LayerGraph normed;
+    specs[num_layers] = (GraphLayerSpec){GRAPH_LINEAR, 4, 0};
+    init_layer_graph(&plain, input_size, specs, num_layers + 1);
+    specs[num_layers] = (GraphLayerSpec){GRAPH_RMS_NORM, 0, 0};
+    specs[num_layers + 1] = (GraphLayerSpec){GRAPH_LINEAR, 4, 0};
+    specs[num_layers + 2] = (GraphLayerSpec){GRAPH_SOFTMAX, 0, 0};
+    init_layer_graph(&normed, input_size, specs, num_layers + 3);
+
+    size_t floats = layer_graph_checkpoint_floats(&normed);
+    float* data = (float*)malloc(floats * sizeof(float));
+    fill_random(data, (int)floats, 0.1f);
+    MappedCheckpoint ckpt = {0};
+    ckpt.base = (uint8_t*)data;
+    ckpt.size = floats * sizeof(float);
+    attach_rnn_checkpoint(&model, &ckpt);
+    attach_layer_graph_checkpoint(&plain, &ckpt);
+    attach_layer_graph_checkpoint(&normed, &ckpt);
+
+    float* state = (float*)calloc(plain.state_size, sizeof(float));
+    float* input = (float*)malloc(input_size * sizeof(float));
+    float output[4];
+    fill_random(input, input_size, 1.0f);
+    double us[3];
+    for (int m = 0; m < 3; m++) {
+        memset(state, 0, plain.state_size * sizeof(float));
+        double start = now_us();
+        for (int t = 0; t < BENCH_STEPS; t++) {
+            if (m == 0) {
+                rnn_model_step(&model, input, state, output);
+            } else {
+                layer_graph_step(m == 1 ? &plain : &normed, input, state, output);
+            }
+        }
+        us[m] = (now_us() - start) / BENCH_STEPS;
+    }
+    printf("graph gru %dx%3d->%-4d  rnn_model %7.2f us  graph %7.2f us  graph+norm+softmax %7.2f us per step\n",
+           num_layers, input_size, hidden_size, us[0], us[1], us[2]);
+    free(state);
+    free(input);
+    free(data);
+    free_layer_graph(&plain, false);
+    free_layer_graph(&normed, false);
+    free_rnn_model(&model, false);
+}
+
+// A bidirectional GRU over a sequence, serial and with the directions on two threads,
+// against one direction alone
+static void bench_bidirectional(int input_size, int hidden_size, int seq_len) {
+    BidirectionalLayer layer;
+    init_bidirectional_layer(&layer, RNN_CELL_GRU, input_size, hidden_size, false);
+    fill_random_gru_layer(&layer.gru_layers[0]);
+    fill_random_gru_layer(&layer.gru_layers[1]);
+    refresh_bidirectional_layer(&layer);
+
+    float* inputs = (float*)malloc((size_t)seq_len * input_size * sizeof(float));
+    float* outputs = (float*)malloc((size_t)seq_len * 2 * hidden_size * sizeof(float));
+    fill_random(inputs, seq_len * input_size, 1.0f);
+    enum { REPEATS = 10 };
+    double us[3];
+    for (int m = 0; m < 3; m++) {
+        layer.parallel = (m == 2);
+        double start = now_us();
+        for (int r = 0; r < REPEATS; r++) {
+            if (m == 0) {
+                gru_layer_forward_sequence(&layer.gru_layers[0], inputs, layer.zeros, outputs, seq_len);
+            } else {
+                bidirectional_layer_forward_sequence(&layer, inputs, NULL, outputs, seq_len);
+            }
+        }
+        us[m] = (now_us() - start) / REPEATS;
+    }
+    printf("bidirectional gru %3d->%-4d T=%-5d  one direction %9.1f us  serial %9.1f us  two threads %9.1f us\n",
+           input_size, hidden_size, seq_len, us[0], us[1], us[2]);
+    free(inputs);
+    free(outputs);
+    free_bidirectional_layer(&layer, true);
+}
+
+// LSTM step against LSTMP steps at shrinking projection widths, with the recurrent weight bytes
+static void bench_lstmp(int input_size, int hidden_size) {
+    float* input = (float*)malloc(input_size * sizeof(float));
+    float* h = (float*)calloc(hidden_size, sizeof(float));
+    float* c = (float*)calloc(hidden_size, sizeof(float));
+    fill_random(input, input_size, 1.0f);
+    float scale = 1.0f / sqrtf((float)hidden_size);
+
+    LSTMLayer lstm;
+    init_lstm_layer(&lstm, 1, input_size, hidden_size);
+    LSTMLayerWeights* w = &lstm.weights;
+    float* hidden_weights[4] = {w->W_hi, w->W_hf, w->W_hg, w->W_ho};
+    for (int g = 0; g < 4; g++) {
+        fill_random(hidden_weights[g], hidden_size * hidden_size, scale);
+    }
+    double start = now_us();
+    for (int t = 0; t < BENCH_STEPS; t++) {
+        lstm_layer_forward_inplace(&lstm, input, h, c);
+    }
+    double lstm_us = (now_us() - start) / BENCH_STEPS;
+    printf("lstm  %3d->%-4d          %8.1f us per step  recurrent %7.1f KB\n",
+           input_size, hidden_size, lstm_us, 4.0 * hidden_size * hidden_size * sizeof(float) / 1024);
+    free_lstm_layer(&lstm, true);
+
+    // proj == hidden separates the gain of the fused kernel from the smaller matrices
+    for (int p = hidden_size; p >= hidden_size / 8; p /= 2) {
+        LSTMPLayer layer;
+        init_lstmp_layer(&layer, input_size, hidden_size, p);
+        fill_random(layer.weights.W_x, input_size * 4 * hidden_size, scale);
+        fill_random(layer.weights.W_h, p * 4 * hidden_size, scale);
+        fill_random(layer.weights.W_p, hidden_size * p, scale);
+        memset(h, 0, hidden_size * sizeof(float));
+        memset(c, 0, hidden_size * sizeof(float));
+        start = now_us();
+        for (int t = 0; t < BENCH_STEPS; t++) {
+            lstmp_layer_forward_inplace(&layer, input, h, c);
+        }
+        double us = (now_us() - start) / BENCH_STEPS;
+        printf("lstmp %3d->%-4d proj %-4d %8.1f us per step  recurrent %7.1f KB  %.2fx\n", input_size, hidden_size, p, us,
+               (4.0 * p * hidden_size + (double)hidden_size * p) * sizeof(float) / 1024, lstm_us / us);
+        free_lstmp_layer(&layer, true);
+    }
+    free(input);
+    free(h);
+    free(c);
+}
+
+// A stack of TCN blocks with doubling dilations: streaming steps against recomputing
+// the receptive field for every new frame, and one GEMM pass over a whole sequence
+static void bench_tcn(int channels, int kernel_size, int num_blocks, int seq_len) {
+    TCNBlock blocks[num_blocks];
+    TCNBlockStream streams[num_blocks];
+    int field = 1;
+    float scale = 1.0f / sqrtf((float)(kernel_size * channels));
+    for (int b = 0; b < num_blocks; b++) {
+        init_tcn_block(&blocks[b], channels, channels, kernel_size, 1 << b);
+        init_tcn_block_stream(&streams[b], &blocks[b]);
+        fill_random(blocks[b].conv1.weights.weights, kernel_size * channels * channels, scale);
+        fill_random(blocks[b].conv2.weights.weights, kernel_size * channels * channels, scale);
+        field += 2 * (kernel_size - 1) << b;
+    }
+    float* inputs = (float*)malloc((size_t)(seq_len + field) * channels * sizeof(float));
+    float* a = (float*)malloc((size_t)(seq_len + field) * channels * sizeof(float));
+    float* b_out = (float*)malloc((size_t)(seq_len + field) * channels * sizeof(float));
+    fill_random(inputs, (seq_len + field) * channels, 1.0f);
+
+    double start = now_us();
+    for (int t = 0; t < seq_len; t++) {
+        float* x = inputs + (size_t)t * channels;
+        for (int b = 0; b < num_blocks; b++) {
+            tcn_block_step(&blocks[b], &streams[b], x, a);
+            x = a;
+        }
+    }
+    double step_us = (now_us() - start) / seq_len;
+
+    enum { RECOMPUTES = 20 };
+    start = now_us();
+    for (int t = 0; t < RECOMPUTES; t++) {
+        float* x = inputs + (size_t)t * channels;
+        for (int b = 0; b < num_blocks; b++) {
+            float* y = (b % 2 == 0) ? a : b_out;
+            tcn_block_forward_sequence(&blocks[b], NULL, x, y, field);
+            x = y;
+        }
+    }
+    double recompute_us = (now_us() - start) / RECOMPUTES;
+
+    start = now_us();
+    float* x = inputs;
+    for (int b = 0; b < num_blocks; b++) {
+        float* y = (b % 2 == 0) ? a : b_out;
+        tcn_block_forward_sequence(&blocks[b], NULL, x, y, seq_len);
+        x = y;
+    }
+    double sequence_us = (now_us() - start) / seq_len;
+    printf("tcn %d blocks c=%-3d k=%d field %-4d  step %8.2f us  recompute field %9.1f us  sequence %7.2f us per frame\n",
+           num_blocks, channels, kernel_size, field, step_us, recompute_us, sequence_us);
+    for (int b = 0; b < num_blocks; b++) {
+        free_tcn_block_stream(&streams[b]);
+        free_tcn_block(&blocks[b], true);
+    }
+    free(inputs);
+    free(a);
+    free(b_out);
+}
+
+// Streaming attention steps over the KV ring against re-projecting every key and value
+// of the window at each step, with a GRU step of the same width for scale
+static void bench_attention(int model_size, int num_heads, int window) {
+    AttentionLayer layer;
+    init_attention_layer(&layer, model_size, num_heads, window);
+    float scale = 1.0f / sqrtf((float)model_size);
+    fill_random(layer.weights.W_qkv, model_size * 3 * model_size, scale);
+    fill_random(layer.weights.W_o, model_size * model_size, scale);
+    KVCache cache;
+    init_kv_cache(&cache, &layer);
+    int steps = window + BENCH_STEPS / 4;
+    float* inputs = (float*)malloc((size_t)steps * model_size * sizeof(float));
+    float* output = (float*)malloc(model_size * sizeof(float));
+    fill_random(inputs, steps * model_size, 1.0f);
+
+    for (int t = 0; t < window; t++) {
+        attention_layer_step(&layer, &cache, inputs + (size_t)t * model_size, output); // fill the window
+    }
+    double start = now_us();
+    for (int t = window; t < steps; t++) {
+        attention_layer_step(&layer, &cache, inputs + (size_t)t * model_size, output);
+    }
+    double step_us = (now_us() - start) / (steps - window);
+
+    enum { RECOMPUTES = 10 };
+    start = now_us();
+    for (int r = 0; r < RECOMPUTES; r++) {
+        reset_kv_cache(&cache);
+        for (int t = 0; t < window; t++) {
+            attention_layer_step(&layer, &cache, inputs + (size_t)(r + t) * model_size, output);
+        }
+    }
+    double recompute_us = (now_us() - start) / RECOMPUTES;
+
+    GRULayer gru;
+    init_gru_layer(&gru, 1, model_size, model_size);
+    fill_random_gru_layer(&gru);
+    float* h = (float*)calloc(model_size, sizeof(float));
+    double gru_us = time_gru_steps(&gru, inputs, h);
+    printf("attention d=%-3d heads %d window %-4d  step %8.1f us  recompute window %9.1f us  gru step %7.1f us\n",
+           model_size, num_heads, window, step_us, recompute_us, gru_us);
+    free(h);
+    free_gru_layer(&gru, true);
+    free(inputs);
+    free(output);
+    free_kv_cache(&cache);
+    free_attention_layer(&layer, true);
+}
+
+// Packed forward over sequences of mixed lengths against the same batch padded to the longest
+static double time_packed_forward(RNNBatch* batch, int* lengths, int count, float** states, float* outputs) {
+    RNNModelConfig* config = &batch->model->config;
+    PackedSequences packed;
+    init_packed_sequences(&packed, lengths, count);
+    float* inputs = (float*)malloc(packed.total * config->input_size * sizeof(float));
+    fill_random(inputs, (int)(packed.total * config->input_size), 1.0f);
+    for (int i = 0; i < count; i++) {
+        memset(states[i], 0, rnn_model_state_size(config) * sizeof(float));
+    }
+    double start = now_us();
+    rnn_batch_forward_packed(batch, &packed, inputs, states, outputs);
+    double us = now_us() - start;
+    free(inputs);
+    free_packed_sequences(&packed);
+    return us;
+}
+
+static void bench_packed_sequences(RNNCellType cell_type, int hidden_size, int count, int max_len) {
+    enum { F = 15, O = 4, L = 2 };
+    RNNModelConfig config = {cell_type, 1, F, hidden_size, O, L};
+    RNNModel model;
+    init_rnn_model(&model, config);
+    for (int l = 0; l < L && cell_type == RNN_CELL_GRU; l++) {
+        fill_random_gru_layer(&model.gru_layers[l]);
+    }
+    RNNBatch batch;
+    init_rnn_batch(&batch, &model, count);
+    int* lengths = (int*)malloc(count * sizeof(int));
+    int* padded = (int*)malloc(count * sizeof(int));
+    float** states = (float**)malloc(count * sizeof(float*));
+    float* outputs = (float*)malloc(count * O * sizeof(float));
+    long tokens = 0;
+    for (int i = 0; i < count; i++) {
+        lengths[i] = 1 + rand() % max_len;
+        padded[i] = max_len;
+        tokens += lengths[i];
+        states[i] = (float*)malloc(rnn_model_state_size(&config) * sizeof(float));
+    }
+    double packed_us = time_packed_forward(&batch, lengths, count, states, outputs);
+    double padded_us = time_packed_forward(&batch, padded, count, states, outputs);
+    printf("packed %s hidden %3d  %3d seqs  %6ld of %6ld tokens  packed %9.0f tokens/s  padded %9.0f tokens/s  speedup %.2fx\n",
+           cell_type == RNN_CELL_GRU ? "GRU " : "LSTM", hidden_size, count, tokens, (long)count * max_len,
+           tokens / packed_us * 1e6, tokens / padded_us * 1e6, padded_us / packed_us);
+    for (int i = 0; i < count; i++) {
+        free(states[i]);
+    }
+    free(states);
+    free(outputs);
+    free(lengths);
+    free(padded);
+    free_rnn_batch(&batch);
+    free_rnn_model(&model, true);
+}
+
+// An ensemble of small GRUs on one input: separate scaled runs against the stacked step and sequence paths
+static void bench_ensemble(int num_models, int hidden_size, int seq_len) {
+    enum { F = 15, O = 4 };
+    RNNModelConfig config = {RNN_CELL_GRU, 1, F, hidden_size, O, 1};
+    RNNModel* models = (RNNModel*)malloc(num_models * sizeof(RNNModel));
+    RNNModel** members = (RNNModel**)malloc(num_models * sizeof(RNNModel*));
+    for (int m = 0; m < num_models; m++) {
+        init_rnn_model(&models[m], config);
+        fill_random_gru_layer(&models[m].gru_layers[0]);
+        members[m] = &models[m];
+    }
+    float mean[F] = {0};
+    float std[F];
+    for (int i = 0; i < F; i++) {
+        std[i] = 1.0f;
+    }
+    ModelEnsemble ensemble;
+    init_model_ensemble(&ensemble, members, num_models, ENSEMBLE_MEAN);
+    ensemble.mean = mean;
+    ensemble.std = std;
+    float* inputs = (float*)malloc((size_t)seq_len * F * sizeof(float));
+    float* outputs = (float*)malloc((size_t)seq_len * O * sizeof(float));
+    float* state = (float*)calloc(ensemble.state_size, sizeof(float));
+    fill_random(inputs, seq_len * F, 1.0f);
+
+    float scaled[F];
+    float out[O];
+    double start = now_us();
+    for (int t = 0; t < seq_len; t++) {
+        for (int m = 0; m < num_models; m++) {
+            standard_scaler(scaled, inputs + t * F, F, mean, std);
+            rnn_model_step(&models[m], scaled, model_ensemble_member_state(&ensemble, state, m), out);
+        }
+    }
+    double separate_us = (now_us() - start) / seq_len;
+    start = now_us();
+    for (int t = 0; t < seq_len; t++) {
+        model_ensemble_step(&ensemble, inputs + t * F, state, outputs);
+    }
+    double step_us = (now_us() - start) / seq_len;
+    start = now_us();
+    model_ensemble_forward_sequence(&ensemble, inputs, state, outputs, seq_len);
+    double sequence_us = (now_us() - start) / seq_len;
+
+    printf("ensemble %2d x GRU %3d  separate %7.1f us/step  stacked step %7.1f us  stacked sequence %7.1f us\n",
+           num_models, hidden_size, separate_us, step_us, sequence_us);
+    free_model_ensemble(&ensemble);
+    for (int m = 0; m < num_models; m++) {
+        free_rnn_model(&models[m], true);
+    }
+    free(models);
+    free(members);
+    free(inputs);
+    free(outputs);
+    free(state);
+}
+
+// Time to tune a model from scratch, what it picked, and a cache hit on the next load
+static void bench_tune(int input_size, int hidden_size, int num_layers) {
+    char* path = "/tmp/bench_tune_cache.txt";
+    remove(path);
+    RNNModelConfig config = {RNN_CELL_GRU, 1, input_size, hidden_size, 4, num_layers};
+    RNNModel model;
+    init_rnn_model(&model, config);
+    for (int l = 0; l < num_layers; l++) {
+        fill_random_gru_layer(&model.gru_layers[l]);
+    }
+    int mc, kc;
+    gemm_get_blocking(&mc, &kc);
+    TuneResult result;
+    PackArena arena;
+    double start = now_us();
+    autotune_rnn_model(path, &model, &arena, &result);
+    double tune_us = now_us() - start;
+    free_rnn_model_packed(&model);
+    free_pack_arena(&arena);
+    start = now_us();
+    autotune_rnn_model(path, &model, &arena, &result);
+    double cached_us = now_us() - start;
+    printf("tune GRU %3dx%-3d x%d  tuned in %7.0f ms  cached load %6.0f us  packed %d  mc %3d kc %3d  chunk %4d  threads %d\n",
+           input_size, hidden_size, num_layers, tune_us / 1000, cached_us, result.packed, result.gemm_mc, result.gemm_kc,
+           result.chunk, result.threads);
+    gemm_set_blocking(mc, kc);
+    free_rnn_model_packed(&model);
+    free_pack_arena(&arena);
+    free_rnn_model(&model, true);
+    remove(path);
+}
+
+// Cycle counter for worst-case slice costs, the monotonic clock in ns where there is no TSC
+static unsigned long long now_cycles(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+#endif
+}
+
+static int compare_cycles(const void* a, const void* b) {
+    unsigned long long x = *(const unsigned long long*)a;
+    unsigned long long y = *(const unsigned long long*)b;
+    return (x > y) - (x < y);
+}
+
+// Worst-case, 99.9th percentile and mean cost of one resumable slice against a whole
+// blocking step. On a shared machine the worst case includes preemptions.
+static void bench_stepper(int input_size, int hidden_size, int num_layers, int slice_units) {
+    RNNModelConfig config = {RNN_CELL_GRU, 1, input_size, hidden_size, 4, num_layers};
+    RNNModel model;
+    init_rnn_model(&model, config);
+    for (int l = 0; l < num_layers; l++) {
+        fill_random_gru_layer(&model.gru_layers[l]);
+    }
+    RNNStepper stepper;
+    init_rnn_stepper(&stepper, &model, slice_units);
+    float* inputs = (float*)malloc((size_t)BENCH_STEPS * input_size * sizeof(float));
+    float* state = (float*)calloc(rnn_model_state_size(&config), sizeof(float));
+    float output[4];
+    fill_random(inputs, BENCH_STEPS * input_size, 1.0f);
+
+    unsigned long long* step_cycles = (unsigned long long*)malloc(BENCH_STEPS * sizeof(unsigned long long));
+    unsigned long long total_step = 0;
+    for (int t = 0; t < BENCH_STEPS; t++) {
+        unsigned long long start = now_cycles();
+        rnn_model_step(&model, inputs + (size_t)t * input_size, state, output);
+        step_cycles[t] = now_cycles() - start;
+        total_step += step_cycles[t];
+    }
+    // one step to count the slices
+    long per_step = 0;
+    rnn_stepper_begin(&stepper, inputs, state, output);
+    while (rnn_stepper_resume(&stepper) == STEPPER_PENDING) {
+        per_step++;
+    }
+    per_step++;
+    long slices = per_step * BENCH_STEPS;
+    unsigned long long* slice_cycles = (unsigned long long*)malloc(slices * sizeof(unsigned long long));
+    unsigned long long total_slice = 0;
+    long n = 0;
+    for (int t = 0; t < BENCH_STEPS; t++) {
+        rnn_stepper_begin(&stepper, inputs + (size_t)t * input_size, state, output);
+        StepperStatus status;
+        do {
+            unsigned long long start = now_cycles();
+            status = rnn_stepper_resume(&stepper);
+            slice_cycles[n] = now_cycles() - start;
+            total_slice += slice_cycles[n++];
+        } while (status == STEPPER_PENDING);
+    }
+    qsort(step_cycles, BENCH_STEPS, sizeof(unsigned long long), compare_cycles);
+    qsort(slice_cycles, slices, sizeof(unsigned long long), compare_cycles);
+    printf("stepper GRU %3dx%-3d x%d  slice %3d units  %3ld slices/step  slice worst %8llu p99.9 %7llu mean %7llu cycles  "
+           "step worst %8llu p99.9 %8llu mean %8llu cycles\n",
+           input_size, hidden_size, num_layers, slice_units, per_step, slice_cycles[slices - 1],
+           slice_cycles[slices * 999 / 1000], total_slice / slices, step_cycles[BENCH_STEPS - 1],
+           step_cycles[BENCH_STEPS * 999 / 1000], total_step / BENCH_STEPS);
+    free(step_cycles);
+    free(slice_cycles);
+    free(inputs);
+    free(state);
+    free_rnn_stepper(&stepper);
+    free_rnn_model(&model, true);
+}
+
+// Step time with and without the numerics guard, and scan throughput on its own
+static void bench_numerics(RNNCellType cell_type, int hidden_size, int num_layers) {
+    enum { F = 15, O = 4 };
+    RNNModelConfig config = {cell_type, 1, F, hidden_size, O, num_layers};
+    RNNModel model;
+    init_rnn_model(&model, config);
+    for (int l = 0; l < num_layers && cell_type == RNN_CELL_GRU; l++) {
+        fill_random_gru_layer(&model.gru_layers[l]);
+    }
+    float* inputs = (float*)malloc((size_t)BENCH_STEPS * F * sizeof(float));
+    float* state = (float*)calloc(rnn_model_state_size(&config), sizeof(float));
+    float output[O];
+    fill_random(inputs, BENCH_STEPS * F, 1.0f);
+
+    double start = now_us();
+    for (int t = 0; t < BENCH_STEPS; t++) {
+        rnn_model_step(&model, inputs + t * F, state, output);
+    }
+    double plain_us = (now_us() - start) / BENCH_STEPS;
+    enable_rnn_numerics_guard(&model, 0.999f);
+    start = now_us();
+    for (int t = 0; t < BENCH_STEPS; t++) {
+        rnn_model_step(&model, inputs + t * F, state, output);
+    }
+    double guarded_us = (now_us() - start) / BENCH_STEPS;
+
+    NumericsCounts counts = {0, 0, 0};
+    start = now_us();
+    for (int t = 0; t < BENCH_STEPS; t++) {
+        numerics_scan(state, rnn_model_state_size(&config), 0.999f, &counts);
+    }
+    double scan_ns = (now_us() - start) * 1000.0 / BENCH_STEPS / rnn_model_state_size(&config);
+
+    printf("numerics %s %3d x %d  plain %7.2f us/step  guarded %7.2f us/step  scan %.3f ns/float\n",
+           (cell_type == RNN_CELL_GRU) ? "GRU " : "LSTM", hidden_size, num_layers, plain_us, guarded_us, scan_ns);
+    free_rnn_model(&model, true);
+    free(inputs);
+    free(state);
+}
+
+int main() {
+    srand(1234);
+    bench_palette(15, 64);
+    bench_palette(64, 256);
+    bench_palette(256, 512);
+    bench_packed(15, 64);
+    bench_packed(64, 256);
+    bench_packed(256, 512);
+    bench_gemm(64, 512, 512);
+    bench_gemm(256, 256, 256);
+    bench_gemm(2048, 1024, 512);
+    bench_sequence(15, 64, 1024);
+    bench_sequence(256, 256, 256);
+    bench_window(15, 64, 2, 64);
+    bench_window(15, 128, 3, 64);
+    bench_delta(15, 64, 0.0f);
+    bench_delta(15, 64, 0.01f);
+    bench_delta(15, 64, 0.05f);
+    bench_delta(64, 256, 0.0f);
+    bench_delta(64, 256, 0.01f);
+    bench_delta(64, 256, 0.05f);
+    bench_early_exit(1.01f);
+    bench_early_exit(0.7f);
+    bench_early_exit(0.5f);
+    bench_early_exit(0.0f);
+    bench_infer_queue(32, 1, 0);
+    bench_infer_queue(32, 8, 200);
+    bench_infer_queue(32, 32, 1000);
+    bench_frame_ring(15, 64, 16, false);
+    bench_frame_ring(15, 64, 1024, false);
+    bench_frame_ring(15, 64, 1024, true);
+    bench_checkpoint_load(64, 512, 4);
+    bench_layer_stream(64, 512, 6);
+    bench_model_registry();
+    bench_bulk_score(500, 100, 64, 1);
+    bench_bulk_score(500, 100, 64, 2);
+    bench_layer_graph(15, 64, 5);
+    bench_layer_graph(64, 256, 3);
+    bench_bidirectional(15, 64, 1024);
+    bench_bidirectional(64, 256, 256);
+    bench_lstmp(64, 256);
+    bench_lstmp(64, 512);
+    bench_tcn(32, 3, 6, 2048);
+    bench_tcn(128, 3, 4, 1024);
+    bench_attention(64, 4, 128);
+    bench_attention(128, 8, 512);
+    bench_packed_sequences(RNN_CELL_GRU, 64, 32, 512);
+    bench_packed_sequences(RNN_CELL_LSTM, 256, 32, 256);
+    bench_ensemble(8, 32, 1024);
+    bench_ensemble(16, 64, 512);
+    bench_tune(15, 64, 5);
+    bench_tune(64, 512, 2);
+    bench_stepper(15, 64, 5, 0);
+    bench_stepper(15, 64, 5, 16);
+    bench_stepper(64, 256, 3, 0);
+    bench_stepper(64, 256, 3, 32);
+    bench_numerics(RNN_CELL_GRU, 64, 5);
+    bench_numerics(RNN_CELL_LSTM, 256, 3);
+    return 0;
+}
@@ -0,0 +1,61 @@
+#ifndef ATTENTION_H
+#define ATTENTION_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include "math_nn.h"
+
+typedef struct {
+    int model_size;
+    int num_heads;
+    int head_size;   // model_size / num_heads
+    int window;      // past steps a query can attend to, the current one included
+} AttentionLayerConfig;
+
+typedef struct {
+    float* W_qkv;    // [model_size x 3 * model_size], columns [q | k | v], heads contiguous within each
+    float* b_qkv;    // [3 * model_size]
+    float* W_o;      // [model_size x model_size]
+    float* b_o;      // [model_size]
+} AttentionLayerWeights;
+
+typedef struct {
+    float* qkv;      // projections of the current step
+    float* scores;   // [window] attention weights of one head
+    float* context;  // [model_size] concatenated head outputs
+} AttentionLayerRunState;
+
+// Causal multi-head self-attention over a sliding window, one step at a time
+typedef struct {
+    AttentionLayerConfig config;
+    AttentionLayerWeights weights;
+    AttentionLayerRunState state;
+} AttentionLayer;
+
+// Keys and values of the last window steps of one stream. A step appends its own row
+// over the oldest, so past projections are never recomputed. Attention does not
+// depend on the order of the rows, so the ring is read as is.
+typedef struct {
+    int window;
+    int model_size;
+    int head;        // slot the next step writes
+    long steps;
+    float* keys;     // [window x model_size]
+    float* values;
+} KVCache;
+
+MathStatus init_attention_layer(AttentionLayer* layer, int model_size, int num_heads, int window);
+void free_attention_layer(AttentionLayer* layer, bool free_weights);
+
+// Checkpoint layout: W_qkv, b_qkv, W_o, b_o
+size_t attention_layer_floats(AttentionLayerConfig* config);
+size_t memory_map_attention_layer(AttentionLayer* layer, float* data_ptr);
+
+MathStatus init_kv_cache(KVCache* cache, AttentionLayer* layer);
+void free_kv_cache(KVCache* cache);
+void reset_kv_cache(KVCache* cache);
+
+// Attend from input over the cached window and itself, model_size floats in and out
+void attention_layer_step(AttentionLayer* layer, KVCache* cache, float* input, float* output);
+
+#endif // ATTENTION_H
@@ -0,0 +1,39 @@
+#ifndef BIDIRECTIONAL_H
+#define BIDIRECTIONAL_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include "rnn_model.h"
+
+// A GRU or LSTM layer run over a whole sequence in both directions. One GEMM projects
+// the inputs for both directions at once, then the forward and backward recurrences
+// run concurrently, each writing its half of every output row in place, so the
+// [seq_len x 2 * hidden_size] output is already the input of a next bidirectional layer.
+typedef struct {
+    RNNCellType cell_type;
+    int input_size;
+    int hidden_size;
+    bool parallel;           // run the backward direction on a second thread
+    GRULayer* gru_layers;    // [forward, backward] for RNN_CELL_GRU, NULL otherwise
+    LSTMLayer* lstm_layers;  // same for RNN_CELL_LSTM
+    float* input_weights;    // [input_size x 2 * gates * hidden_size], both directions side by side
+    float* zeros;            // default initial state
+} BidirectionalLayer;
+
+MathStatus init_bidirectional_layer(BidirectionalLayer* layer, RNNCellType cell_type, int input_size,
+                                    int hidden_size, bool parallel);
+void free_bidirectional_layer(BidirectionalLayer* layer, bool free_weights);
+
+// Checkpoint layout: the forward direction then the backward one, each as in rnn_model.h
+size_t bidirectional_layer_floats(BidirectionalLayer* layer);
+size_t memory_map_bidirectional_layer(BidirectionalLayer* layer, float* data_ptr);
+// Rebuild the shared input projection after the direction weights changed, map does it itself
+void refresh_bidirectional_layer(BidirectionalLayer* layer);
+
+// inputs[seq_len][input_size] -> outputs[seq_len][2 * hidden_size], forward half first.
+// state holds the initial forward and backward hidden states, then the cell states for
+// LSTM, and is only read; NULL starts both directions from zero.
+MathStatus bidirectional_layer_forward_sequence(BidirectionalLayer* layer, float* inputs, float* state,
+                                                float* outputs, int seq_len);
+
+#endif // BIDIRECTIONAL_H
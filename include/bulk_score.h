@@ -0,0 +1,64 @@
+#ifndef BULK_SCORE_H
+#define BULK_SCORE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "rnn_model.h"
+#include "checkpoint.h"
+
+#define FEATURE_MAGIC 0x54464e45  // "ENFT"
+#define SCORE_MAGIC 0x43534e45    // "ENSC"
+#define FEATURE_VERSION 1
+#define FEATURE_ALIGN 64
+
+// Binary feature file: this header, uint64 stream_ids[num_rows], then
+// float features[num_rows][num_features], each array on a 64-byte boundary.
+// A stream's rows are contiguous and in time order, an id that comes back after
+// other streams starts a new sequence.
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t num_features;
+    uint32_t reserved;
+    uint64_t num_rows;
+} FeatureFileHeader;
+
+// Score file: the same header with SCORE_MAGIC and num_features = output_size,
+// then float outputs[num_rows][output_size] at offset FEATURE_ALIGN, row for row.
+
+// Columnar view of a feature file. Binary files are mapped and used in place,
+// CSV files (stream_id,f1,...,fn per line) are parsed into owned columns.
+typedef struct {
+    uint64_t num_rows;
+    int num_features;
+    uint64_t* stream_ids;
+    float* features;
+    MappedCheckpoint map;
+    bool owns_data;
+} FeatureTable;
+
+typedef struct {
+    int threads;
+    int chunk;       // rows per sequence-forward call, bounds the scratch per thread
+    float* mean;     // optional per-feature standard scaling, NULL to score raw features
+    float* std;
+} BulkScoreOptions;
+
+typedef struct {
+    uint64_t rows;
+    uint64_t sequences;
+    double score_s;  // splitting, scoring and writing
+} BulkScoreStats;
+
+MathStatus write_feature_file(char* path, uint64_t* stream_ids, float* features, uint64_t num_rows, int num_features);
+// A path ending in .csv is parsed with threads threads, anything else must be a binary feature file
+MathStatus open_feature_file(FeatureTable* table, char* path, int num_features, int threads);
+void close_feature_file(FeatureTable* table);
+
+// Score every stream of the table from a zero state with the layer-by-layer sequence
+// path, in parallel over streams, into an mmap'd score file at out_path. When a worker
+// runs out of memory its status is returned and the score file is incomplete.
+MathStatus bulk_score(RNNModel* model, FeatureTable* table, char* out_path, BulkScoreOptions* options, BulkScoreStats* stats);
+
+#endif // BULK_SCORE_H
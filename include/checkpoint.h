@@ -0,0 +1,39 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "math_nn.h"
+
+// How a checkpoint is brought into memory. A plain mapping (LOAD_LAZY) faults
+// every weight page in on first use, so the first steps after a start, or after
+// the kernel dropped pages, pay for the disk and the faults.
+typedef enum {
+    LOAD_LAZY = 0,
+    LOAD_POPULATE = 1 << 0,   // MAP_POPULATE: fault the whole file in before returning
+    LOAD_WILLNEED = 1 << 1,   // madvise(WILLNEED): start async readahead of the whole file
+    LOAD_SEQUENTIAL = 1 << 2, // madvise(SEQUENTIAL): aggressive readahead on faults
+    LOAD_HUGEPAGE = 1 << 3,   // madvise(HUGEPAGE): ask for transparent huge pages
+    LOAD_MLOCK = 1 << 4,      // mlock the weights so they are never evicted
+    LOAD_ANON = 1 << 5,       // copy into anonymous memory, on explicit huge pages when reserved,
+                              // otherwise 2 MB aligned and THP backed
+} CheckpointLoad;
+
+typedef struct {
+    uint8_t* base;     // file contents
+    size_t size;       // file bytes
+    uint8_t* map;      // start of the mapping, base may sit past an alignment gap
+    size_t map_size;
+    unsigned flags;    // CheckpointLoad bits requested
+    unsigned applied;  // the bits that took effect
+    bool huge_tlb;     // LOAD_ANON got explicit huge pages
+} MappedCheckpoint;
+
+// Map path read-only with the given CheckpointLoad flags. A flag the kernel
+// refuses (e.g. mlock over RLIMIT_MEMLOCK) is reported and left out of applied.
+MathStatus map_checkpoint(MappedCheckpoint* ckpt, char* path, unsigned flags);
+void unmap_checkpoint(MappedCheckpoint* ckpt);
+void print_checkpoint_load(MappedCheckpoint* ckpt);
+
+#endif // CHECKPOINT_H
@@ -0,0 +1,83 @@
+#ifndef CONV1D_H
+#define CONV1D_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include "math_nn.h"
+
+typedef struct {
+    int in_channels;
+    int out_channels;
+    int kernel_size;
+    int dilation;
+} Conv1DLayerConfig;
+
+// Tap k looks (kernel_size - 1 - k) * dilation steps back, the last tap is the current input
+typedef struct {
+    float* weights;  // [kernel_size * in_channels x out_channels], the rows of tap k start at k * in_channels
+    float* bias;     // [out_channels]
+} Conv1DLayerWeights;
+
+// Causal dilated 1D convolution over a stream of in_channels frames
+typedef struct {
+    Conv1DLayerConfig config;
+    Conv1DLayerWeights weights;
+} Conv1DLayer;
+
+// The inputs a streaming step still needs: a ring of the last receptive field frames
+typedef struct {
+    int frames;      // (kernel_size - 1) * dilation + 1
+    int channels;
+    int head;        // slot of the newest frame
+    float* ring;     // [frames x channels]
+} Conv1DStream;
+
+// Residual TCN block: relu(residual(x) + relu(conv2(relu(conv1(x))))), both convolutions
+// with the same kernel size and dilation. The residual is a 1x1 convolution when the
+// channel count changes and the input itself otherwise.
+typedef struct {
+    Conv1DLayer conv1;
+    Conv1DLayer conv2;
+    Conv1DLayer* downsample; // NULL when in_channels == channels
+    float* buffer;           // step scratch, 3 x channels
+} TCNBlock;
+
+typedef struct {
+    Conv1DStream conv1;
+    Conv1DStream conv2;
+    Conv1DStream downsample;
+} TCNBlockStream;
+
+void init_conv1d_layer(Conv1DLayer* layer, int in_channels, int out_channels, int kernel_size, int dilation);
+void free_conv1d_layer(Conv1DLayer* layer, bool free_weights);
+int conv1d_receptive_field(Conv1DLayerConfig* config);
+
+// Checkpoint layout: weights then bias
+size_t conv1d_layer_floats(Conv1DLayerConfig* config);
+size_t memory_map_conv1d_layer(Conv1DLayer* layer, float* data_ptr);
+
+// A stream starts from zero history, as if the sequence were left-padded with zeros
+MathStatus init_conv1d_stream(Conv1DStream* stream, Conv1DLayer* layer);
+void free_conv1d_stream(Conv1DStream* stream);
+void reset_conv1d_stream(Conv1DStream* stream);
+
+// One new frame: pushes input into the ring and writes out_channels floats to output
+void conv1d_layer_step(Conv1DLayer* layer, Conv1DStream* stream, float* input, float* output);
+// inputs[seq_len][in_channels] -> outputs[seq_len][out_channels] as one im2col GEMM. The
+// frames before the sequence come from stream, which then moves past it; a NULL stream
+// reads zeros. Equivalent to seq_len steps.
+MathStatus conv1d_layer_forward_sequence(Conv1DLayer* layer, Conv1DStream* stream, float* inputs, float* outputs, int seq_len);
+
+MathStatus init_tcn_block(TCNBlock* block, int in_channels, int channels, int kernel_size, int dilation);
+void free_tcn_block(TCNBlock* block, bool free_weights);
+// Checkpoint layout: conv1, conv2, then the downsample convolution when there is one
+size_t tcn_block_floats(TCNBlock* block);
+size_t memory_map_tcn_block(TCNBlock* block, float* data_ptr);
+
+MathStatus init_tcn_block_stream(TCNBlockStream* stream, TCNBlock* block);
+void free_tcn_block_stream(TCNBlockStream* stream);
+void reset_tcn_block_stream(TCNBlockStream* stream);
+void tcn_block_step(TCNBlock* block, TCNBlockStream* stream, float* input, float* output);
+MathStatus tcn_block_forward_sequence(TCNBlock* block, TCNBlockStream* stream, float* inputs, float* outputs, int seq_len);
+
+#endif // CONV1D_H
@@ -0,0 +1,51 @@
+#ifndef ENSEMBLE_H
+#define ENSEMBLE_H
+
+#include <stddef.h>
+#include "rnn_model.h"
+
+typedef enum {
+    ENSEMBLE_MEAN,   // average of the member outputs
+    ENSEMBLE_VOTE    // share of members whose largest output is each class
+} EnsembleReduce;
+
+// Members sharing one input stream. The input is scaled once, one GEMM projects it for
+// the first layer of every member, then each time step runs all members before the next
+// one and reduces their outputs. Members may mix cell types and hidden sizes but must
+// share input_size and output_size and have input_dim 1. They are not owned. The first
+// layer of every member must run on float32 weights, init gives MATH_INVALID_RANGE for
+// a packed or palettized one.
+typedef struct {
+    int num_models;
+    RNNModel** models;
+    EnsembleReduce reduce;
+    float* mean;             // optional per-feature standard scaling, NULL to use raw inputs
+    float* std;
+    int input_size;
+    int output_size;
+    int width;               // projection columns over all members
+    int* columns;            // [num_models] first projection column of each member
+    int* states;             // [num_models] first state float of each member
+    int state_size;
+    float* input_weights;    // [input_size x width], the first-layer input weights side by side
+    float* scaled;           // [input_size] step scratch
+    float* x_proj;           // [width]
+    float* member_outputs;   // [num_models x output_size]
+} ModelEnsemble;
+
+MathStatus init_model_ensemble(ModelEnsemble* ensemble, RNNModel** models, int num_models, EnsembleReduce reduce);
+void free_model_ensemble(ModelEnsemble* ensemble);
+// Rebuild the stacked input weights after member weights changed, init does it itself.
+// Members must not have been packed or palettized since init.
+void refresh_model_ensemble(ModelEnsemble* ensemble);
+
+// The members' states back to back, each laid out as in rnn_model_state_size
+float* model_ensemble_member_state(ModelEnsemble* ensemble, float* state, int member);
+
+// One step of every member on input[input_size], output[output_size] is the reduced output
+void model_ensemble_step(ModelEnsemble* ensemble, float* input, float* state, float* output);
+// inputs[seq_len][input_size] -> outputs[seq_len][output_size], one projection GEMM for the
+// whole sequence, then steps as above
+MathStatus model_ensemble_forward_sequence(ModelEnsemble* ensemble, float* inputs, float* state, float* outputs, int seq_len);
+
+#endif // ENSEMBLE_H
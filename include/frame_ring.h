@@ -0,0 +1,42 @@
+#ifndef FRAME_RING_H
+#define FRAME_RING_H
+
+#include <stddef.h>
+#include <stdatomic.h>
+#include "math_nn.h"
+
+#define FRAME_RING_LINE 64
+
+// Lock-free single-producer single-consumer ring of fixed-size float frames.
+// The producer fills a slot in place and publishes it, the consumer reads the slot
+// in place (e.g. passes it straight to rnn_model_step) and releases it, so a frame
+// is never copied between the sensor and the first layer's projection.
+// head and tail each own a cache line, next to a cached copy of the other side's
+// index so the fast path touches no shared line.
+typedef struct {
+    _Alignas(FRAME_RING_LINE) atomic_size_t head; // next slot to publish, written by the producer
+    size_t cached_tail;                            // producer's last view of tail
+    _Alignas(FRAME_RING_LINE) atomic_size_t tail; // next slot to release, written by the consumer
+    size_t cached_head;                            // consumer's last view of head
+    _Alignas(FRAME_RING_LINE) float* frames;      // capacity slots, each stride floats
+    size_t capacity;                               // power of two
+    size_t mask;
+    size_t stride;                                 // frame_size rounded up to a cache line
+    int frame_size;                                // floats per frame
+} FrameRing;
+
+// capacity is rounded up to a power of two
+MathStatus init_frame_ring(FrameRing* ring, int frame_size, size_t capacity);
+void free_frame_ring(FrameRing* ring);
+
+// Producer side. NULL when the ring is full; otherwise the slot stays private
+// until frame_ring_publish.
+float* frame_ring_acquire_write(FrameRing* ring);
+void frame_ring_publish(FrameRing* ring);
+
+// Consumer side. NULL when the ring is empty; otherwise the slot stays valid
+// until frame_ring_release.
+float* frame_ring_acquire_read(FrameRing* ring);
+void frame_ring_release(FrameRing* ring);
+
+#endif // FRAME_RING_H
@@ -0,0 +1,105 @@
+#ifndef GRAPH_H
+#define GRAPH_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include "gru.h"
+#include "lstm.h"
+#include "linear.h"
+#include "lstmp.h"
+#include "checkpoint.h"
+
+typedef enum {
+    GRAPH_GRU = 0,
+    GRAPH_LSTM = 1,
+    GRAPH_LINEAR = 2,
+    GRAPH_RMS_NORM = 3,  // rms_norm followed by a per-feature gain
+    GRAPH_SOFTMAX = 4,
+    GRAPH_SCALER = 5,    // standard_scaler with a per-feature mean and std
+    GRAPH_LSTMP = 6,     // LSTM with a recurrent projection, see lstmp.h
+} GraphLayerType;
+
+// size is the hidden size of a recurrent layer and the output size of a linear one,
+// the other layers keep the width of their input and ignore it
+typedef struct {
+    GraphLayerType type;
+    int size;
+    int proj_size;           // GRAPH_LSTMP only, the width it passes on
+} GraphLayerSpec;
+
+typedef struct GraphNode {
+    GraphLayerType type;
+    int input_size;
+    int output_size;
+    int state_offset;        // hidden state in the stream state, -1 for stateless nodes
+    int cell_offset;         // LSTM and LSTMP cell state, -1 otherwise
+    union {
+        GRULayer gru;
+        LSTMLayer lstm;
+        LinearLayer linear;
+        LSTMPLayer lstmp;
+    };
+    float* gain;             // RMSNorm
+    float* mean;             // scaler
+    float* std;
+} GraphNode;
+
+// Where an op reads or writes: an offset into one of the buffers bound at step time
+typedef enum {
+    GRAPH_BUF_INPUT = 0,
+    GRAPH_BUF_STATE = 1,
+    GRAPH_BUF_OUTPUT = 2,
+    GRAPH_BUF_ARENA = 3,
+} GraphBuffer;
+
+typedef struct {
+    GraphBuffer buffer;
+    int offset;
+} GraphSlot;
+
+typedef struct GraphOp {
+    void (*run)(GraphNode* node, float* in, float* out, float* cell);
+    GraphNode* node;
+    GraphSlot in;
+    GraphSlot out;
+    GraphSlot cell;
+} GraphOp;
+
+// A sequential model built from a list of layers. init plans every intermediate
+// activation once: recurrent layers update their hidden state in place, the
+// stateless ones ping-pong between two arena buffers, or run in place where the
+// op allows it, and the last op writes straight into the caller's output. A step
+// then walks the resulting op list without looking at the layer types again.
+typedef struct {
+    int input_size;
+    int output_size;
+    int num_nodes;
+    GraphNode* nodes;
+    int num_ops;
+    int stateful_ops;        // ops up to the last recurrent layer, all a step without output runs
+    GraphOp* ops;
+    int state_size;          // floats per stream: every hidden state, then every LSTM cell state
+    float* arena;            // intermediate activations shared by all ops
+    int arena_size;
+} LayerGraph;
+
+MathStatus init_layer_graph(LayerGraph* graph, int input_size, GraphLayerSpec* specs, int num_layers);
+void free_layer_graph(LayerGraph* graph, bool free_weights);
+
+// Checkpoint layout: the nodes in order, recurrent and linear nodes as in rnn_model.h,
+// LSTMP as in lstmp.h, RMSNorm its gain, scaler its mean then its std, softmax nothing.
+// A GRU or LSTM stack followed by a linear layer therefore reads the same file as the
+// RNNModel of that stack.
+size_t layer_graph_checkpoint_floats(LayerGraph* graph);
+size_t memory_map_layer_graph(LayerGraph* graph, float* data_ptr);
+// Free the weights init_layer_graph allocated and map the nodes onto a mapped checkpoint.
+// MATH_INVALID_DIM when the file is too short for the graph.
+MathStatus attach_layer_graph_checkpoint(LayerGraph* graph, MappedCheckpoint* ckpt);
+
+float* layer_graph_hidden_state(LayerGraph* graph, float* state, int node);
+
+// One step of the plan, updating state in place. output (output_size floats) may be
+// NULL, then the stateless layers after the last recurrent one are skipped.
+void layer_graph_step(LayerGraph* graph, float* input, float* state, float* output);
+
+#endif // GRAPH_H
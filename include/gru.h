@@ -1,6 +1,9 @@
 #ifndef GRU_H
 #define GRU_H
 
+#include "palette.h"
+#include "pack.h"
+
 typedef struct {
     int input_dim;
     int input_size;
@@ -20,14 +23,62 @@ typedef struct {
     float* b_hr;
     float* b_hz;
     float* b_hn;
+    struct GRULayerPalette* palette; // optional 4-bit weights, NULL to run on float32
+    struct GRULayerPacked* packed;   // optional GEMV panels, takes precedence when set
 } GRULayerWeights;
 
+// 4-bit codebook copies of the six weight matrices
+typedef struct GRULayerPalette {
+    PaletteMatrix W_ir;
+    PaletteMatrix W_iz;
+    PaletteMatrix W_in;
+    PaletteMatrix W_hr;
+    PaletteMatrix W_hz;
+    PaletteMatrix W_hn;
+} GRULayerPalette;
+
+// Panel-packed weights and their biases, all living in a PackArena
+typedef struct GRULayerPacked {
+    PackedMatrix W_ir;
+    PackedMatrix W_iz;
+    PackedMatrix W_in;
+    PackedMatrix W_hr;
+    PackedMatrix W_hz;
+    PackedMatrix W_hn;
+    float* b_ir;
+    float* b_iz;
+    float* b_in;
+    float* b_hr;
+    float* b_hz;
+    float* b_hn;
+} GRULayerPacked;
+
+// Delta-network state: the last propagated input/hidden values and the gate
+// pre-activations built from them. A step only reads the weight rows of entries
+// that moved more than threshold. It tracks a single stream.
+typedef struct GRULayerDelta {
+    float threshold;
+    float* x_ref;
+    float* h_ref;
+    float* rh_ref;      // r * h_prev, the input of W_hn
+    float* m_r;         // W_ir x + W_hr h + b_ir + b_hr
+    float* m_z;
+    float* m_xn;        // W_in x + b_in
+    float* m_hn;        // W_hn (r * h) + b_hn
+    int* idx;
+    float* dx;
+    long columns;       // weight rows a dense step would have read
+    long skipped;       // of which skipped
+} GRULayerDelta;
+
 typedef struct {
     float* hidden_state_buffer;
-    float* input_buffer;
     float* reset_gate_buffer;
     float* update_gate_buffer;
     float* candidate_hidden_state_buffer;
+    float* projection_buffer;   // hidden-to-hidden projection of the step
+    float* reset_hidden_buffer; // r * h_prev
+    struct GRULayerDelta* delta; // optional delta-network mode, NULL for dense steps
 } GRULayerRunState;
 
 typedef struct {
@@ -40,9 +91,45 @@ void init_gru_layer_config(GRULayerConfig* config, int input_dim, int input_size
 void init_gru_layer_weights(GRULayerWeights* weights, GRULayerConfig* config);
 void init_gru_layer_run_state(GRULayerRunState* state, GRULayerConfig* config);
 void init_gru_layer(GRULayer* layer, int input_dim, int input_size, int hidden_size);
+// A layer running `rows` independent states at once on the weights of another layer,
+// release it with free_gru_layer_run_state(&batch->state)
+void init_gru_layer_batch(GRULayer* batch, GRULayer* layer, int rows);
 void free_gru_layer_weights(GRULayerWeights* weights);
 void free_gru_layer_run_state(GRULayerRunState* state);
 void free_gru_layer(GRULayer* layer, bool free_weights);
+// Point the weights at tensors in checkpoint order: input weights, hidden weights,
+// input biases, hidden biases, each in gate order r, z, n. Returns the floats consumed.
+size_t memory_map_gru_layer(GRULayer* layer, float* data_ptr);
 void gru_layer_forward(GRULayer* layer, float* input, float* h_prev);
+// Same step, but the new hidden state overwrites h instead of going to hidden_state_buffer
+void gru_layer_forward_inplace(GRULayer* layer, float* input, float* h);
+// Input projections without biases of rows inputs, x_r, x_z and x_n are [rows x hidden_size]
+void gru_layer_project_inputs(GRULayer* layer, float* inputs, int rows, float* x_r, float* x_z, float* x_n);
+// Recurrent half of a step from precomputed input projections, h_prev and h_out may alias
+void gru_layer_step(GRULayer* layer, float* x_r, float* x_z, float* x_n, float* h_prev, float* h_out);
+// inputs[seq_len][input_dim][input_size] -> outputs[seq_len][input_dim][hidden_size], starting from h0
+// MATH_NULL_POINTER when the projection buffer can not be allocated
+MathStatus gru_layer_forward_sequence(GRULayer* layer, float* inputs, float* h0, float* outputs, int seq_len);
+
+// Delta-network mode for gru_layer_forward and gru_layer_forward_inplace, on the
+// float32 weights of a single-row layer. A threshold of 0 reproduces the dense step.
+MathStatus enable_gru_layer_delta(GRULayer* layer, float threshold);
+// Forget the propagated values, for a new stream
+void reset_gru_layer_delta(GRULayer* layer);
+void disable_gru_layer_delta(GRULayer* layer);
+// Fraction of weight rows skipped since the delta mode was enabled or reset
+float gru_layer_delta_skip_ratio(GRULayer* layer);
+
+// 4-bit palettized weights, the float32 weights are left untouched
+MathStatus palettize_gru_layer(GRULayer* layer, bool per_row, int iterations);
+// Bytes of data used, 0 when out of memory
+size_t map_gru_layer_palette(GRULayer* layer, void* data, bool per_row);
+size_t write_gru_layer_palette(FILE* file, GRULayer* layer);
+void free_gru_layer_palette(GRULayer* layer);
+
+// Panel-packed weights, pack calls must be made in the same order for a pre-packed arena
+size_t gru_layer_packed_bytes(GRULayerConfig* config);
+MathStatus pack_gru_layer(GRULayer* layer, PackArena* arena);
+void free_gru_layer_packed(GRULayer* layer);
 
 #endif // GRU_H
\ No newline at end of file
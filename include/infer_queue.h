@@ -0,0 +1,60 @@
+#ifndef INFER_QUEUE_H
+#define INFER_QUEUE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include "session.h"
+
+// One step of one stream. The input and output buffers stay owned by the caller
+// and must live until the request completes.
+typedef struct InferRequest {
+    struct InferRequest* _Atomic next; // queue link
+    struct InferRequest* defer_next;    // batcher-only link while deferred
+    uint64_t stream_id;
+    float* input;            // input_size floats
+    float* output;           // output_size floats, may be NULL
+    void (*callback)(struct InferRequest* request, void* ctx); // run on the batcher thread, may be NULL
+    void* ctx;
+    double submit_us;
+    double complete_us;
+    MathStatus status;
+    atomic_bool done;
+} InferRequest;
+
+// In-process inference front end. Producers push requests onto a lock-free MPSC
+// queue; a single batcher thread collects up to max_batch of them, or whatever
+// arrived before the oldest one has waited max_delay_us, and runs them as one
+// batched step through the session manager.
+typedef struct {
+    SessionManager* sessions;   // only touched by the batcher thread
+    RNNBatch batch;
+    int max_batch;
+    int max_delay_us;
+    InferRequest* _Atomic tail; // producers swap themselves in here
+    InferRequest* head;         // consumer side
+    InferRequest stub;
+    InferRequest* carry;        // popped but deferred to the next batch, in order
+    sem_t pending;              // one count per submitted request
+    pthread_t thread;
+    atomic_bool running;
+    pthread_mutex_t done_lock;
+    pthread_cond_t done_cond;
+    float* inputs;              // [max_batch x input_size] gathered batch
+    float* outputs;
+    long batches;
+    long requests;
+} InferQueue;
+
+MathStatus start_infer_queue(InferQueue* queue, SessionManager* sessions, int max_batch, int max_delay_us);
+// Finish every submitted request, then stop the batcher thread
+void stop_infer_queue(InferQueue* queue);
+
+// Thread safe and lock free. Steps of one stream run in submission order.
+void infer_submit(InferQueue* queue, InferRequest* request);
+// Block until the request has completed, returns its status
+MathStatus infer_wait(InferQueue* queue, InferRequest* request);
+
+#endif // INFER_QUEUE_H
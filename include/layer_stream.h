@@ -0,0 +1,46 @@
+#ifndef LAYER_STREAM_H
+#define LAYER_STREAM_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include "rnn_model.h"
+
+// Runs a float checkpoint too large to keep resident with only `depth` layers of
+// weights in memory. A loader thread preads the layers into a ring of depth slots in
+// the order the steps consume them (0..L-1, 0..L-1, ...), so while layer l computes,
+// layers l+1 .. l+depth-1 are being read. A slot is refilled once its layer finished.
+// The output layer is small and stays resident.
+typedef struct {
+    RNNModel* model;      // float32 weights only, no palette or packed panels
+    int fd;
+    int depth;            // layer slots, clamped to num_layers
+    size_t* offsets;      // byte offset of every layer in the file
+    size_t slot_floats;   // the largest layer
+    float* slots;         // [depth][slot_floats]
+    int* slot_layer;      // layer held by each slot, -1 when empty
+    float* output_weights;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;  // signalled on every load and every release
+    long loaded;          // layer loads completed, load k holds layer k % num_layers in slot k % depth
+    long released;        // loads the steps are done with
+    bool running;
+    MathStatus error;     // set by the loader on a failed read
+    long reads;           // slots actually read from the file
+    size_t bytes_read;
+    long stalls;          // layers a step had to wait for
+    double stall_us;
+} LayerStream;
+
+// The model hands its float weights over to the stream: open frees them, a layer only
+// points at its slot while it steps, and close releases the resident output layer.
+MathStatus open_layer_stream(LayerStream* stream, RNNModel* model, char* path, int depth);
+void close_layer_stream(LayerStream* stream);
+
+// rnn_model_step through the streamed weights. Steps must not run concurrently.
+MathStatus layer_stream_step(LayerStream* stream, float* input, float* state, float* output);
+// Weight bytes held in memory, independent of the checkpoint size
+size_t layer_stream_resident_bytes(LayerStream* stream);
+
+#endif // LAYER_STREAM_H
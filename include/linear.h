@@ -2,6 +2,8 @@
 #ifndef LINEAR_H
 #define LINEAR_H
 
+#include "pack.h"
+
 typedef struct {
     int input_size;
     int output_size;
@@ -10,8 +12,15 @@ typedef struct {
 typedef struct {
     float* weights;
     float* bias;
+    struct LinearLayerPacked* packed; // optional GEMV panels, takes precedence when set
 } LinearLayerWeights;
 
+// Panel-packed weights and bias, living in a PackArena
+typedef struct LinearLayerPacked {
+    PackedMatrix weights;
+    float* bias;
+} LinearLayerPacked;
+
 typedef struct {
     LinearLayerConfig config;
     LinearLayerWeights weights;
@@ -22,6 +31,13 @@ void init_linear_layer_weights(LinearLayerWeights* weights, LinearLayerConfig* c
 void init_linear_layer(LinearLayer* layer, int input_size, int output_size);
 void free_linear_layer_weights(LinearLayerWeights* weights);
 void free_linear_layer(LinearLayer* layer);
+// Weights [input_size x output_size] then the bias, returns the floats consumed
+size_t memory_map_linear_layer(LinearLayer* layer, float* data_ptr);
 void linear_layer_forward(LinearLayer* layer, float* input, float* output);
 
+// Panel-packed weights
+size_t linear_layer_packed_bytes(LinearLayerConfig* config);
+MathStatus pack_linear_layer(LinearLayer* layer, PackArena* arena);
+void free_linear_layer_packed(LinearLayer* layer);
+
 #endif // LINEAR_H
\ No newline at end of file
@@ -1,6 +1,9 @@
 #ifndef LSTM_H
 #define LSTM_H
 
+#include "palette.h"
+#include "pack.h"
+
 typedef struct {
     int input_dim;
     int input_size;
@@ -25,17 +28,69 @@ typedef struct {
     float* b_hf;    //bias for hidden forget gate
     float* b_hg;    //bias for hidden cell gate
     float* b_ho;    //bias for hidden output gate
+    struct LSTMLayerPalette* palette; // optional 4-bit weights, NULL to run on float32
+    struct LSTMLayerPacked* packed;   // optional GEMV panels, takes precedence when set
 } LSTMLayerWeights;
 
+// 4-bit codebook copies of the eight weight matrices
+typedef struct LSTMLayerPalette {
+    PaletteMatrix W_ii;
+    PaletteMatrix W_if;
+    PaletteMatrix W_ig;
+    PaletteMatrix W_io;
+    PaletteMatrix W_hi;
+    PaletteMatrix W_hf;
+    PaletteMatrix W_hg;
+    PaletteMatrix W_ho;
+} LSTMLayerPalette;
+
+// Panel-packed weights and their biases, all living in a PackArena
+typedef struct LSTMLayerPacked {
+    PackedMatrix W_ii;
+    PackedMatrix W_if;
+    PackedMatrix W_ig;
+    PackedMatrix W_io;
+    PackedMatrix W_hi;
+    PackedMatrix W_hf;
+    PackedMatrix W_hg;
+    PackedMatrix W_ho;
+    float* b_ii;
+    float* b_if;
+    float* b_ig;
+    float* b_io;
+    float* b_hi;
+    float* b_hf;
+    float* b_hg;
+    float* b_ho;
+} LSTMLayerPacked;
+
+
+// Delta-network state: the last propagated input/hidden values and the gate
+// pre-activations built from them. A step only reads the weight rows of entries
+// that moved more than threshold. It tracks a single stream.
+typedef struct LSTMLayerDelta {
+    float threshold;
+    float* x_ref;
+    float* h_ref;
+    float* m_i;         // W_ii x + W_hi h + b_ii + b_hi
+    float* m_f;
+    float* m_g;
+    float* m_o;
+    int* idx;
+    float* dx;
+    long columns;       // weight rows a dense step would have read
+    long skipped;       // of which skipped
+} LSTMLayerDelta;
 
 typedef struct {
-    float* input_buffer;
     float* forget_gate_buffer;
     float* input_gate_buffer;
     float* output_gate_buffer;
     float* input_node_buffer; // New buffer
     float* cell_state_buffer;
     float* hidden_state_buffer;
+    float* projection_buffer; // hidden-to-hidden projection of the step
+    struct LSTMLayerDelta* delta; // optional delta-network mode, NULL for dense steps
 } LSTMLayerRunState;
 
 
@@ -50,9 +105,45 @@ void init_lstm_layer_config(LSTMLayerConfig* config, int input_dim, int input_si
 void init_lstm_layer_weights(LSTMLayerWeights* weights, LSTMLayerConfig* config);
 void init_lstm_layer_run_state(LSTMLayerRunState* state, LSTMLayerConfig* config);
 void init_lstm_layer(LSTMLayer* layer, int input_dim, int input_size, int hidden_size);
+// A layer running `rows` independent states at once on the weights of another layer,
+// release it with free_lstm_layer_run_state(&batch->state)
+void init_lstm_layer_batch(LSTMLayer* batch, LSTMLayer* layer, int rows);
 void free_lstm_layer_weights(LSTMLayerWeights* weights);
 void free_lstm_layer_run_state(LSTMLayerRunState* state);
 void free_lstm_layer(LSTMLayer* layer, bool free_weights);
+// Same as memory_map_gru_layer, gates in the order i, f, g, o
+size_t memory_map_lstm_layer(LSTMLayer* layer, float* data_ptr);
 void lstm_layer_forward(LSTMLayer* layer, float* input, float* h_prev, float* c_prev);
+// Same step, but the new states overwrite h and c instead of going to the run state buffers
+void lstm_layer_forward_inplace(LSTMLayer* layer, float* input, float* h, float* c);
+// Input projections without biases of rows inputs, x_i, x_f, x_g and x_o are [rows x hidden_size]
+void lstm_layer_project_inputs(LSTMLayer* layer, float* inputs, int rows, float* x_i, float* x_f, float* x_g, float* x_o);
+// Recurrent half of a step from precomputed input projections, h/c in and out may alias
+void lstm_layer_step(LSTMLayer* layer, float* x_i, float* x_f, float* x_g, float* x_o,
+                     float* h_prev, float* c_prev, float* h_out, float* c_out);
+// inputs[seq_len][input_dim][input_size] -> outputs[seq_len][input_dim][hidden_size], starting from h0/c0
+// MATH_NULL_POINTER when the projection buffer can not be allocated
+MathStatus lstm_layer_forward_sequence(LSTMLayer* layer, float* inputs, float* h0, float* c0, float* outputs, int seq_len);
+
+// Delta-network mode for lstm_layer_forward and lstm_layer_forward_inplace, on the
+// float32 weights of a single-row layer. A threshold of 0 reproduces the dense step.
+MathStatus enable_lstm_layer_delta(LSTMLayer* layer, float threshold);
+// Forget the propagated values, for a new stream
+void reset_lstm_layer_delta(LSTMLayer* layer);
+void disable_lstm_layer_delta(LSTMLayer* layer);
+// Fraction of weight rows skipped since the delta mode was enabled or reset
+float lstm_layer_delta_skip_ratio(LSTMLayer* layer);
+
+// 4-bit palettized weights, the float32 weights are left untouched
+MathStatus palettize_lstm_layer(LSTMLayer* layer, bool per_row, int iterations);
+// Bytes of data used, 0 when out of memory
+size_t map_lstm_layer_palette(LSTMLayer* layer, void* data, bool per_row);
+size_t write_lstm_layer_palette(FILE* file, LSTMLayer* layer);
+void free_lstm_layer_palette(LSTMLayer* layer);
+
+// Panel-packed weights, pack calls must be made in the same order for a pre-packed arena
+size_t lstm_layer_packed_bytes(LSTMLayerConfig* config);
+MathStatus pack_lstm_layer(LSTMLayer* layer, PackArena* arena);
+void free_lstm_layer_packed(LSTMLayer* layer);
 
 #endif // LSTM_H
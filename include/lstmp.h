@@ -0,0 +1,56 @@
+#ifndef LSTMP_H
+#define LSTMP_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include "math_nn.h"
+
+// LSTM with a recurrent projection: the cell keeps hidden_size units, but the state
+// fed back and passed up is h_t = W_p (o_t * tanh(c_t)) of proj_size units. The
+// recurrent matrix shrinks from [hidden x 4 hidden] to [proj x 4 hidden].
+typedef struct {
+    int input_size;
+    int hidden_size;
+    int proj_size;
+} LSTMPLayerConfig;
+
+// The gate matrices are fused, columns [i | f | g | o] of hidden_size each
+typedef struct {
+    float* W_x;      // [input_size x 4 * hidden_size]
+    float* W_h;      // [proj_size x 4 * hidden_size]
+    float* b_x;      // [4 * hidden_size]
+    float* b_h;      // [4 * hidden_size]
+    float* W_p;      // [hidden_size x proj_size]
+} LSTMPLayerWeights;
+
+typedef struct {
+    float* gate_buffer;       // [4 * hidden_size] pre-activations of the step
+    float* cell_out_buffer;   // o * tanh(c), the input of the projection
+    float* cell_state_buffer; // c_t of a sequence run
+} LSTMPLayerRunState;
+
+typedef struct {
+    LSTMPLayerConfig config;
+    LSTMPLayerWeights weights;
+    LSTMPLayerRunState state;
+} LSTMPLayer;
+
+void init_lstmp_layer(LSTMPLayer* layer, int input_size, int hidden_size, int proj_size);
+void free_lstmp_layer_weights(LSTMPLayerWeights* weights);
+void free_lstmp_layer(LSTMPLayer* layer, bool free_weights);
+
+// Checkpoint layout: W_x, W_h, b_x, b_h, W_p
+size_t lstmp_layer_floats(LSTMPLayerConfig* config);
+size_t memory_map_lstmp_layer(LSTMPLayer* layer, float* data_ptr);
+
+// Input projections without biases, x is [rows x 4 * hidden_size]
+void lstmp_layer_project_inputs(LSTMPLayer* layer, float* inputs, int rows, float* x);
+// Recurrent half of a step, h is proj_size floats and c hidden_size. The previous
+// states are fully consumed before the new ones are written, so they may alias.
+void lstmp_layer_step(LSTMPLayer* layer, float* x, float* h_prev, float* c_prev, float* h_out, float* c_out);
+void lstmp_layer_forward_inplace(LSTMPLayer* layer, float* input, float* h, float* c);
+// inputs[seq_len][input_size] -> outputs[seq_len][proj_size], starting from h0/c0
+// MATH_NULL_POINTER when the projection buffer can not be allocated
+MathStatus lstmp_layer_forward_sequence(LSTMPLayer* layer, float* inputs, float* h0, float* c0, float* outputs, int seq_len);
+
+#endif // LSTMP_H
@@ -3,6 +3,20 @@
 
 #define MAX_DIM 1024
 
+// Build with -DMATH_UNCHECKED (MATH_FLAGS in the Makefile) for the release kernels:
+// matmul, add, mul, the activations, rms_norm and softmax then skip their argument,
+// MAX_DIM and overflow checks, and matmul runs a vectorizable row-update loop.
+// Pair it with the numerics guard, see numerics_scan and rnn_model.h.
+
+// Blocking of the GEMM: MR x NR register tile, KC x NR panels of B stay in L1,
+// MC x KC blocks of A in L2
+#define GEMM_MR 6
+#define GEMM_NR 16
+#define GEMM_KC 256 // defaults of the runtime KC and MC, see gemm_set_blocking
+#define GEMM_MC 72
+#define GEMM_NC 4096
+#define GEMM_MIN_ROWS 4 // below this many rows a GEMV beats packing B
+
 // define math status struct 
 typedef enum {
     MATH_SUCCESS = 0,
@@ -23,6 +37,27 @@ float tanh_act(float x);
 // float out[m][p] = a[m][n] * b[n][p]
 MathStatus matmul(float* out, float* a, float* b, int m, int n, int p);
 
+// Function to perform a blocked general matrix multiplication, no MAX_DIM limit
+// C[M, N] = alpha * A[M, K] * B[K, N] + beta * C[M, N], row-major with leading dimensions
+MathStatus gemm(int M, int N, int K, float alpha, float* A, int lda, float* B, int ldb,
+                float beta, float* C, int ldc);
+// Cache blocking of later gemm calls, process-wide and safe to change while other threads
+// run gemm: each call reads it once. MR and NR are fixed by the micro-kernel.
+MathStatus gemm_set_blocking(int mc, int kc);
+void gemm_get_blocking(int* mc, int* kc);
+// gemm with an explicit MC x KC blocking, leaving the process-wide one alone
+MathStatus gemm_with_blocking(int mc, int kc, int M, int N, int K, float alpha, float* A, int lda,
+                              float* B, int ldb, float beta, float* C, int ldc);
+
+// Delta-network helpers
+// Collect the entries of x that moved more than threshold away from ref, as indices
+// and changes, and move ref to x for those entries. Returns the number collected.
+int delta_encode(int* idx, float* dx, float* x, float* ref, int size, float threshold);
+// m[cols] += dx[k] * W[idx[k], :] over the count collected rows of W[rows, cols]
+void delta_accumulate(float* m, float* W, int cols, int* idx, float* dx, int count);
+// out[cols] += a[rows] * W[rows, cols], the single-row GEMV of the conv and LSTMP steps
+void accumulate_rows(float* out, float* a, float* W, int rows, int cols);
+
 // Function to perform element-wise addition
 //float out[size] = a[size] + b[size]
 MathStatus add(float* out, float* a, float* b, int size);
@@ -43,4 +78,23 @@ MathStatus rms_norm(float* out, float* x, int size);
 // Function to perform softmax
 MathStatus softmax(float* out, float* x, int size);
 
+// NaN, Inf and |x| >= limit entries seen by numerics_scan
+typedef struct {
+    long nan;
+    long inf;
+    long saturated;     // finite entries at or beyond the limit
+} NumericsCounts;
+
+// One pass over x adding to counts: MATH_OVERFLOW_RISK when x holds a NaN or an Inf,
+// MATH_INVALID_RANGE when only saturated entries, MATH_SUCCESS otherwise. AVX2 when available.
+MathStatus numerics_scan(float* x, int size, float limit, NumericsCounts* counts);
+
+// Streaming kernels without the MAX_DIM limit, AVX2/FMA when available
+// sum of a[i] * b[i]
+float dot_product(float* a, float* b, int size);
+// y[size] += alpha * x[size]
+void axpy(float* y, float alpha, float* x, int size);
+// Softmax of x in place, with a polynomial exp on AVX2 (relative error below 1e-6)
+void softmax_inplace(float* x, int size);
+
 #endif // MATH_NN_H
\ No newline at end of file
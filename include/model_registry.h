@@ -0,0 +1,71 @@
+#ifndef MODEL_REGISTRY_H
+#define MODEL_REGISTRY_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include "rnn_model.h"
+#include "checkpoint.h"
+
+#define REGISTRY_NAME_LEN 64
+#define REGISTRY_PATH_LEN 256
+
+// One mapped checkpoint file, shared by every model version loaded from it
+typedef struct SharedMapping {
+    char path[REGISTRY_PATH_LEN];
+    uint64_t dev;          // file identity, a rewritten file is mapped again
+    uint64_t ino;
+    int64_t mtime_sec;     // rewrites within one second only differ in the nanoseconds
+    int64_t mtime_nsec;
+    MappedCheckpoint ckpt;
+    int users;             // versions built on this mapping
+    struct SharedMapping* next;
+} SharedMapping;
+
+// An immutable loaded model. Its run-state buffers are shared, so steps on one
+// version must be serialized by the caller (one serving thread, or an InferQueue).
+typedef struct ModelVersion {
+    RNNModel model;
+    SharedMapping* mapping;
+    int version;           // 1 for the first load of a name, +1 per reload
+    atomic_long refs;      // one for the registry while current, one per acquire
+} ModelVersion;
+
+typedef struct {
+    char name[REGISTRY_NAME_LEN];
+    ModelVersion* _Atomic current;
+} RegistryEntry;
+
+// Named models with RCU-style hot reload. The serving path acquires the current
+// version with a few atomic adds and no lock. A reload swaps the pointer and
+// waits for the acquires already in progress. The old version is freed by the
+// last release, and its mapping is unmapped once no version uses it.
+typedef struct {
+    RegistryEntry* entries;    // fixed capacity, entry pointers stay valid
+    int capacity;
+    int count;
+    SharedMapping* mappings;
+    pthread_mutex_t lock;      // loads, reloads and frees, never taken by acquire
+    atomic_int epoch;          // readers count themselves into slot epoch & 1
+    atomic_long readers[2];
+    long reloads;
+} ModelRegistry;
+
+MathStatus init_model_registry(ModelRegistry* registry, int capacity);
+// Every acquired version must have been released
+void free_model_registry(ModelRegistry* registry);
+
+// Map path as a float checkpoint for config, and publish it as the first version of
+// name or swap it in as the next one. load_flags are CheckpointLoad bits.
+MathStatus model_registry_load(ModelRegistry* registry, const char* name, const char* path,
+                               RNNModelConfig config, unsigned load_flags);
+// Look a name up once and keep the entry, NULL when it was never loaded
+RegistryEntry* model_registry_find(ModelRegistry* registry, const char* name);
+
+// Serving hot path: pin the current version for the duration of a step or batch
+ModelVersion* model_registry_acquire(ModelRegistry* registry, RegistryEntry* entry);
+void model_registry_release(ModelRegistry* registry, ModelVersion* version);
+
+#endif // MODEL_REGISTRY_H
@@ -0,0 +1,69 @@
+#ifndef PACK_H
+#define PACK_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "math_nn.h"
+#include "checkpoint.h"
+
+#define PACK_PANEL 16          // output columns per panel, one 64-byte cache line of floats
+#define PACK_ALIGN 64          // alignment of every tensor in a pack arena
+#define PACK_MAGIC 0x4b504e45  // "ENPK"
+#define PACK_VERSION 2
+
+// A [rows x cols] weight matrix re-laid out for GEMV: ceil(cols / 16) panels,
+// each holding rows x 16 floats, so out[j0..j0+15] is accumulated from one
+// contiguous stream. The last panel is zero padded.
+typedef struct PackedMatrix {
+    int rows;
+    int cols;
+    float* data;
+} PackedMatrix;
+
+// Aligned bump allocator holding all packed tensors of a model. An arena can
+// also be attached to an existing pre-packed image, in which case packing
+// just hands out the pointers the same sequence of calls produced before.
+typedef struct {
+    uint8_t* base;
+    size_t size;
+    size_t used;
+    bool prepacked;   // contents already laid out, pack calls don't copy
+    bool owns_data;   // false when attached to a mapped checkpoint
+    MappedCheckpoint mapping; // the pre-packed file behind base, if any
+} PackArena;
+
+// On-disk header of a pre-packed checkpoint, the arena image follows at offset PACK_ALIGN
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t size;
+    uint64_t source_size;       // size and mtime of the float checkpoint the panels came from,
+    int64_t source_mtime_sec;   // all zero when the image isn't tied to one
+    int64_t source_mtime_nsec;
+} PackedCheckpointHeader;
+
+size_t packed_matrix_bytes(int rows, int cols);
+size_t packed_vector_bytes(int size);
+
+MathStatus init_pack_arena(PackArena* arena, size_t size);
+void attach_pack_arena(PackArena* arena, void* data, size_t size);
+void free_pack_arena(PackArena* arena);
+
+// Lay w[rows][cols] out as panels in the arena
+MathStatus pack_matrix(PackedMatrix* out, PackArena* arena, float* w, int rows, int cols);
+// Copy a bias vector into the arena, returns its new location
+float* pack_vector(PackArena* arena, float* v, int size);
+
+// Write the arena image next to the original checkpoint, and map it back without copying.
+// source is the float checkpoint it was packed from (or NULL), opening fails with
+// MATH_INVALID_RANGE once that file's size or mtime no longer match the stamp.
+// load_flags are CheckpointLoad bits, see checkpoint.h.
+MathStatus save_packed_checkpoint(char* path, PackArena* arena, char* source);
+MathStatus open_packed_checkpoint(char* path, PackArena* arena, size_t expected_size, char* source, unsigned load_flags);
+void close_packed_checkpoint(PackArena* arena);
+
+// out[m, p] = a[m, n] * b[n, p] on the packed layout
+MathStatus matmul_packed(float* out, float* a, PackedMatrix* b, int m);
+
+#endif // PACK_H
@@ -0,0 +1,36 @@
+#ifndef PACKED_SEQ_H
+#define PACKED_SEQ_H
+
+#include <stddef.h>
+#include "rnn_model.h"
+
+// A batch of variable-length sequences packed time-major without padding. Sequences
+// are sorted longest first, so the ones still running at step t are the first
+// batch_sizes[t] slots and step t's rows are contiguous from offsets[t].
+typedef struct {
+    int count;           // sequences
+    int max_len;
+    long total;          // tokens over all sequences, the rows of the packed data
+    int* order;          // [count] caller index of the sequence in each slot
+    int* lengths;        // [count] length of each slot, non-increasing
+    int* batch_sizes;    // [max_len] sequences still running at step t
+    long* offsets;       // [max_len] first packed row of step t
+} PackedSequences;
+
+// lengths[count] in caller order, every length must be positive. Equal lengths keep caller order.
+MathStatus init_packed_sequences(PackedSequences* packed, int* lengths, int count);
+void free_packed_sequences(PackedSequences* packed);
+
+// sequences[i] is [lengths[i] x width] in caller order, data is [total x width] packed
+void pack_sequences(PackedSequences* packed, float** sequences, int width, float* data);
+void unpack_sequences(PackedSequences* packed, float* data, int width, float** sequences);
+
+// Run every sequence through the model, one projection GEMM per layer over all tokens
+// and one recurrent step per time step over the sequences still running. inputs are
+// packed [total x input_size]. states[i] is sequence i's state as in rnn_model_state_size,
+// read as the initial state and overwritten with the state after its last token.
+// outputs [count x output_size] in caller order gets the output of each last token, or NULL.
+// count must be at most the batch's max_rows.
+MathStatus rnn_batch_forward_packed(RNNBatch* batch, PackedSequences* packed, float* inputs, float** states, float* outputs);
+
+#endif // PACKED_SEQ_H
@@ -0,0 +1,48 @@
+#ifndef PALETTE_H
+#define PALETTE_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "math_nn.h"
+
+#define PALETTE_SIZE 16 // 4-bit indices address a 16-entry codebook
+
+// A [rows x cols] weight matrix stored as 4-bit indices into float codebooks.
+// Indices are packed two per byte along a row (low nibble first), each row
+// padded to a whole byte. There is either one codebook for the whole tensor
+// or one codebook per row.
+typedef struct {
+    int rows;
+    int cols;
+    int num_codebooks;  // 1 (per-tensor) or rows (per-row)
+    float* codebook;    // num_codebooks * PALETTE_SIZE floats
+    uint8_t* indices;   // rows * palette_row_stride(cols) bytes
+    bool owns_data;     // false when mapped from a checkpoint
+} PaletteMatrix;
+
+// Bytes used by one row of packed indices
+int palette_row_stride(int cols);
+
+// Bytes of the serialized form: codebooks followed by packed indices
+size_t palette_matrix_bytes(int rows, int cols, int num_codebooks);
+
+// Cluster w[rows][cols] into 16 values with k-means (per tensor, or per row),
+// MATH_INVALID_RANGE when w holds a NaN or Inf
+MathStatus palettize_matrix(PaletteMatrix* out, float* w, int rows, int cols, bool per_row, int iterations);
+
+// Expand a palettized matrix back into float32 w[rows][cols]
+MathStatus depalettize_matrix(float* w, PaletteMatrix* m);
+
+// Point a palettized matrix at serialized data, returns the bytes consumed
+size_t map_palette_matrix(PaletteMatrix* m, void* data, int rows, int cols, int num_codebooks);
+
+// Serialize codebooks and indices, returns the bytes written
+size_t write_palette_matrix(FILE* file, PaletteMatrix* m);
+
+void free_palette_matrix(PaletteMatrix* m);
+
+// out[m, p] = a[m, n] * b[n, p], with b decoded through its codebook
+MathStatus matmul_palette(float* out, float* a, PaletteMatrix* b, int m);
+
+#endif // PALETTE_H
@@ -0,0 +1,139 @@
+#ifndef RNN_MODEL_H
+#define RNN_MODEL_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include "gru.h"
+#include "lstm.h"
+#include "linear.h"
+#include "pack.h"
+#include "checkpoint.h"
+
+typedef enum {
+    RNN_CELL_GRU = 0,
+    RNN_CELL_LSTM = 1,
+} RNNCellType;
+
+typedef struct {
+    RNNCellType cell_type;
+    int input_dim;
+    int input_size;
+    int hidden_size;
+    int output_size;
+    int num_layers;
+} RNNModelConfig;
+
+typedef enum {
+    EXIT_MAX_SOFTMAX = 0,  // exit when the top softmax probability reaches the threshold
+    EXIT_MARGIN = 1,       // exit when the top two softmax probabilities are threshold apart
+} ExitCriterion;
+
+// Extra output heads on intermediate layers. A step stops at the first head whose
+// output passes the confidence test. The layers above it are not run and hold
+// their recurrent state until a later step reaches them again.
+typedef struct RNNEarlyExit {
+    ExitCriterion criterion;
+    float threshold;
+    LinearLayer* heads;      // heads[l] reads the hidden state of layer l, num_layers - 1 entries
+    bool* has_head;
+    float* logits;           // scratch for steps run without an output buffer
+    float* probs;
+    long* exits;             // steps that stopped at each layer, the last entry ran the full stack
+    long steps;
+} RNNEarlyExit;
+
+// Scan of every layer's new states and of the output after each step, one vectorized
+// pass per vector. Catches NaN and Inf wherever they come from, which the checked
+// matmul misses, and counts saturated hidden units.
+typedef struct RNNNumericsGuard {
+    float limit;             // |h| or |c| at or beyond this counts as saturated
+    MathStatus* status;      // [num_layers + 1] result of each layer's last scan, the output layer last
+    NumericsCounts* counts;  // [num_layers + 1] totals since the guard was enabled
+    long steps;              // stream steps, a batch of rows counts rows
+} RNNNumericsGuard;
+
+// A stack of GRU or LSTM layers followed by a linear output layer
+typedef struct {
+    RNNModelConfig config;
+    GRULayer* gru_layers;    // num_layers entries for RNN_CELL_GRU, NULL otherwise
+    LSTMLayer* lstm_layers;  // num_layers entries for RNN_CELL_LSTM, NULL otherwise
+    LinearLayer output_layer;
+    struct RNNEarlyExit* early_exit; // optional, NULL to always run every layer
+    struct RNNNumericsGuard* guard;  // optional, NULL to skip the numerics scans
+} RNNModel;
+
+// Batched steps of independent streams through one model. The states are gathered
+// into [rows x hidden] blocks so every layer runs one GEMM over the batch.
+typedef struct {
+    RNNModel* model;
+    int max_rows;
+    GRULayer* gru_layers;    // batch views sharing the model weights
+    LSTMLayer* lstm_layers;
+    float* hidden;           // [num_layers][max_rows x hidden_size]
+    float* cell;             // same for LSTM, NULL for GRU
+} RNNBatch;
+
+void init_rnn_model(RNNModel* model, RNNModelConfig config);
+void free_rnn_model(RNNModel* model, bool free_weights);
+
+// Point every layer at its tensors in a float checkpoint, returns the floats consumed
+size_t memory_map_rnn_weights(RNNModel* model, float* data_ptr);
+// The same for one layer, layer num_layers being the output layer. Checkpoint
+// layers are contiguous, so layer l starts after the floats of layers 0..l-1.
+size_t rnn_model_layer_floats(RNNModelConfig* config, int layer);
+size_t memory_map_rnn_layer(RNNModel* model, int layer, float* data_ptr);
+// Free the weights init_rnn_model allocated and map the layers onto a mapped float
+// checkpoint instead. MATH_INVALID_DIM when the file is too short for the model.
+MathStatus attach_rnn_checkpoint(RNNModel* model, MappedCheckpoint* ckpt);
+
+// Panel-packed copy of every layer, see pack.h
+size_t rnn_model_packed_bytes(RNNModel* model);
+MathStatus pack_rnn_model(RNNModel* model, PackArena* arena);
+// Back to the float32 weights, the arena is left to the caller
+void free_rnn_model_packed(RNNModel* model);
+
+// Floats of recurrent state per stream: all hidden states, then all cell states for LSTM
+int rnn_model_state_size(RNNModelConfig* config);
+float* rnn_model_hidden_state(RNNModel* model, float* state, int layer);
+float* rnn_model_cell_state(RNNModel* model, float* state, int layer);
+
+// One step through every layer and the output layer, updating state in place.
+// With early exit enabled this is rnn_model_step_early_exit.
+void rnn_model_step(RNNModel* model, float* input, float* state, float* output);
+// Advance one layer of state, input is the layer below's new hidden state or the model input
+void rnn_model_layer_step(RNNModel* model, int layer, float* input, float* state);
+
+// Batched steps, the model must have input_dim 1. inputs are [rows x input_size], states[r]
+// is a stream state laid out as in rnn_model_state_size, outputs [rows x output_size] or NULL.
+// rows must be 1..max_rows.
+MathStatus init_rnn_batch(RNNBatch* batch, RNNModel* model, int max_rows);
+void free_rnn_batch(RNNBatch* batch);
+MathStatus rnn_batch_step(RNNBatch* batch, int rows, float* inputs, float** states, float* outputs);
+
+// Early exit
+MathStatus init_rnn_early_exit(RNNModel* model, ExitCriterion criterion, float threshold);
+void free_rnn_early_exit(RNNModel* model);
+// Add a head on an intermediate layer, its weights are left for the caller to fill
+LinearLayer* add_rnn_exit_head(RNNModel* model, int layer);
+// Step that stops at the first confident head, returns the layer it exited at
+int rnn_model_step_early_exit(RNNModel* model, float* input, float* state, float* output);
+// Share of steps that exited at each layer and the mean number of layers run
+void print_rnn_exit_stats(RNNModel* model);
+
+// Numerics guard. The output layer is only checked for NaN and Inf. Guarded: rnn_model_step
+// with or without early exit (the exit head's logits stand for the output), rnn_batch_step
+// and so session_step_batch and the InferQueue, the stepper, the ensemble and the layer
+// stream. Not guarded: bulk_score, rnn_batch_forward_packed, the stateless sliding window
+// and the layer sequence forwards, which run on their own layer views.
+MathStatus enable_rnn_numerics_guard(RNNModel* model, float limit);
+void free_rnn_numerics_guard(RNNModel* model);
+// Worst status of the last step over all layers, MATH_OVERFLOW_RISK first
+MathStatus rnn_numerics_status(RNNModel* model);
+void print_rnn_numerics_stats(RNNModel* model);
+// Hooks for paths that step the layers themselves, no-ops without a guard: scan a layer's
+// new states of rows streams (c NULL for GRU), then close the step with its output
+// (NULL when none was computed). Layers from layers_run on are reported as not run.
+void rnn_numerics_scan_layer(RNNModel* model, int layer, float* h, float* c, int rows);
+void rnn_numerics_scan_output(RNNModel* model, float* output, int rows, int layers_run);
+
+#endif // RNN_MODEL_H
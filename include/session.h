@@ -0,0 +1,60 @@
+#ifndef SESSION_H
+#define SESSION_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "rnn_model.h"
+
+#define SESSION_SLAB_SLOTS 1024 // stream states carved per slab allocation
+
+struct StateStore;
+
+typedef struct {
+    uint64_t stream_id;
+    uint64_t last_step;  // manager step clock at the last use, for idle eviction
+    int prev;            // LRU list, most recently used at the head
+    int next;
+    bool in_use;
+} SessionSlot;
+
+// Recurrent state of many streams running through one shared model. States
+// live in fixed-size slots carved from slabs, looked up by stream id in an
+// open-addressing table. When the memory cap is reached the least recently
+// stepped stream is evicted to make room.
+typedef struct {
+    RNNModel* model;
+    int state_size;       // floats per stream, see rnn_model_state_size
+    int max_slots;        // memory_cap / slot bytes
+    int num_slots;        // slots carved from slabs so far
+    float** slabs;
+    SessionSlot* slots;
+    int* free_slots;      // stack of closed or evicted slots
+    int num_free;
+    int* table;           // slot index or -1, linear probing
+    int table_mask;
+    int lru_head;
+    int lru_tail;
+    int active;
+    uint64_t clock;
+    uint64_t evictions;
+    struct StateStore* store; // optional, closed and evicted streams are removed from it
+} SessionManager;
+
+MathStatus init_session_manager(SessionManager* manager, RNNModel* model, size_t memory_cap);
+void free_session_manager(SessionManager* manager);
+
+// Start (or restart) a stream with zeroed state, evicting the least recently used one when full
+MathStatus session_create(SessionManager* manager, uint64_t stream_id);
+// Run one step of a stream, output may be NULL. Unknown or evicted streams give MATH_INVALID_RANGE.
+MathStatus session_step(SessionManager* manager, uint64_t stream_id, float* input, float* output);
+// Step count distinct streams as one batch, inputs [count x input_size], outputs [count x output_size]
+// or NULL. Nothing is stepped when one of the streams is unknown (MATH_INVALID_RANGE).
+MathStatus session_step_batch(SessionManager* manager, RNNBatch* batch, int count, uint64_t* stream_ids, float* inputs, float* outputs);
+// State of a stream laid out as in rnn_model_state_size, NULL when the stream is unknown
+float* session_state(SessionManager* manager, uint64_t stream_id);
+MathStatus session_close(SessionManager* manager, uint64_t stream_id);
+// Evict streams that have not been stepped in the last max_idle_steps steps, returns how many
+int session_evict_idle(SessionManager* manager, uint64_t max_idle_steps);
+
+#endif // SESSION_H
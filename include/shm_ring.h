@@ -0,0 +1,89 @@
+#ifndef SHM_RING_H
+#define SHM_RING_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <semaphore.h>
+#include "math_nn.h"
+
+#define SHM_RING_MAGIC 0x474e5253  // "SRNG"
+#define SHM_RING_LINE 64
+
+typedef enum {
+    SHM_OP_STEP = 0,   // step the stream, creating it on first use
+    SHM_OP_RESET = 1,  // restart the stream from a zero state, then step it
+    SHM_OP_CLOSE = 2,  // drop the stream, no output
+} ShmOp;
+
+// Per-slot header, input_size floats and then output_size floats follow it
+typedef struct {
+    uint64_t stream_id;
+    int32_t op;
+    int32_t status;    // MathStatus, written by the worker
+    _Alignas(SHM_RING_LINE) float data[];
+} ShmSlot;
+
+// Lives at the start of the shared region, the slots follow on the next cache line.
+// The client publishes slots at head, the worker steps them in place and advances
+// tail. The semaphores are process shared so neither side spins.
+typedef struct {
+    uint32_t magic;
+    uint32_t capacity;     // power of two
+    uint32_t input_size;
+    uint32_t output_size;
+    uint64_t slot_bytes;
+    sem_t submitted;       // one post per published slot
+    sem_t completed;       // one post per finished slot
+    _Alignas(SHM_RING_LINE) atomic_ulong head;
+    _Alignas(SHM_RING_LINE) atomic_ulong tail;
+} ShmRingHeader;
+
+// One side's view of a ring. A worker creates it per connection and passes the
+// descriptor to the client, tensors then go through it without serialization.
+// The geometry is copied out of the shared header when the ring is created or
+// attached and slots are only ever located from these copies, since the other
+// process can rewrite the header at any time.
+typedef struct {
+    int fd;
+    uint8_t* base;
+    size_t size;
+    ShmRingHeader* header;
+    uint8_t* slots;
+    uint32_t capacity;
+    uint32_t input_size;
+    uint32_t output_size;
+    size_t slot_bytes;
+    uint64_t consumed;     // client side: completed slots already read back
+} ShmRing;
+
+MathStatus create_shm_ring(ShmRing* ring, int capacity, int input_size, int output_size);
+MathStatus attach_shm_ring(ShmRing* ring, int fd);
+void close_shm_ring(ShmRing* ring);
+
+// Hand the ring descriptor over a connected Unix socket (SCM_RIGHTS), and take it on the other end
+MathStatus send_shm_ring(int sock, ShmRing* ring);
+MathStatus receive_shm_ring(int sock, ShmRing* ring);
+
+static inline float* shm_slot_input(ShmSlot* slot) {
+    return slot->data;
+}
+static inline float* shm_slot_output(ShmRing* ring, ShmSlot* slot) {
+    return slot->data + ring->input_size;
+}
+
+// Client side. acquire returns NULL when every slot is in flight or unread; fill
+// the slot in place, then submit it. complete blocks for the oldest submitted slot,
+// and release hands it back once its output has been read.
+ShmSlot* shm_ring_acquire(ShmRing* ring);
+void shm_ring_submit(ShmRing* ring);
+ShmSlot* shm_ring_complete(ShmRing* ring);
+void shm_ring_release(ShmRing* ring);
+
+// Worker side. next waits up to timeout_ms for a submitted slot (NULL on timeout,
+// 0 only polls), done marks it finished and wakes the client. Slot contents,
+// stream_id and op included, are written by the client and must be validated.
+ShmSlot* shm_ring_next(ShmRing* ring, int timeout_ms);
+void shm_ring_done(ShmRing* ring);
+
+#endif // SHM_RING_H
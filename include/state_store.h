@@ -0,0 +1,71 @@
+#ifndef STATE_STORE_H
+#define STATE_STORE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "math_nn.h"
+#include "session.h"
+
+#define STATE_STORE_MAGIC 0x45545352 // "RSTE"
+#define STATE_STORE_VERSION 1
+
+typedef enum {
+    STATE_FP32 = 0,
+    STATE_FP16 = 1,  // half the file size, about 3 decimal digits per value
+} StatePrecision;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t precision;
+    int32_t state_size;  // floats per stream, see rnn_model_state_size
+    int32_t capacity;    // directory entries, a power of two
+    int32_t count;
+} StateStoreHeader;
+
+typedef struct {
+    uint64_t stream_id;
+    uint64_t used;
+} StateStoreEntry;
+
+// Per-stream recurrent states kept in a memory-mapped file. The directory is an
+// open-addressing table stored in the file itself and entry i owns state slot i,
+// so reopening the file is a single mmap with no index to rebuild. Writes mark
+// the pages they touch and state_store_sync flushes only those pages.
+typedef struct StateStore {
+    uint8_t* base;
+    size_t size;
+    StateStoreHeader* header;
+    StateStoreEntry* entries;
+    uint8_t* states;
+    size_t slot_bytes;
+    size_t page_size;
+    uint8_t* dirty;       // one bit per page of the file
+    size_t num_pages;
+} StateStore;
+
+// Reattach to the store at path, or create it when missing. An existing file with a
+// different state_size or precision gives MATH_INVALID_DIM, a corrupt directory MATH_INVALID_RANGE.
+MathStatus open_state_store(StateStore* store, char* path, int state_size, int capacity, StatePrecision precision);
+// Sync dirty pages and unmap
+void close_state_store(StateStore* store);
+
+// Copy a state in (converting to the store precision), MATH_EXCEEDS_MAX_DIM when full
+MathStatus state_store_put(StateStore* store, uint64_t stream_id, float* state);
+// Copy a state out, MATH_INVALID_RANGE when the stream is not stored
+MathStatus state_store_get(StateStore* store, uint64_t stream_id, float* state);
+MathStatus state_store_remove(StateStore* store, uint64_t stream_id);
+// Write back the pages changed since the last sync, returns the number of pages written
+int state_store_sync(StateStore* store, bool wait);
+
+// Save every active stream of a session manager, and bring them back after a restart.
+// restore stops when the manager's pool is full and returns the number of streams restored.
+// Set manager->store as well so streams closed or evicted in between are dropped from the file.
+MathStatus snapshot_sessions(SessionManager* manager, StateStore* store);
+int restore_sessions(SessionManager* manager, StateStore* store);
+
+void float_to_half(uint16_t* out, float* in, int size);
+void half_to_float(float* out, uint16_t* in, int size);
+
+#endif // STATE_STORE_H
@@ -0,0 +1,44 @@
+#ifndef STEPPER_H
+#define STEPPER_H
+
+#include <stdbool.h>
+#include "rnn_model.h"
+
+typedef enum {
+    STEPPER_DONE = 0,     // the step is complete, state and output are updated
+    STEPPER_PENDING = 1   // more slices to run, call rnn_stepper_resume again
+} StepperStatus;
+
+// One model step cut into bounded slices for a cooperative super-loop. A slice is one
+// whole layer, or with slice_units > 0 the gates of that many hidden units of one layer
+// (two passes for GRU, the reset gate first), or that many outputs of the output layer.
+// New hidden and cell states are kept in the stepper until a layer's last slice, so the
+// state passed to begin stays consistent between slices.
+typedef struct {
+    RNNModel* model;
+    int slice_units;         // units per slice, 0 for a whole layer per slice
+    float* input;            // the step in progress
+    float* state;
+    float* output;
+    int layer;               // layer of the next slice, num_layers for the output layer
+    int phase;               // GRU: 0 reset gate, 1 update gate and candidate
+    int unit;                // first unit of the next slice
+    bool done;
+    float* reset;            // [hidden_size] r of the layer in progress
+    float* reset_hidden;     // r * h_prev
+    float* hidden;           // new hidden state of the layer in progress
+    float* cell;             // new cell state, LSTM
+    float* gates;            // [4 x hidden_size] gate pre-activations of one slice
+} RNNStepper;
+
+// The model must have input_dim 1. Layers with packed or palettized weights, or in
+// delta mode, run whole in one slice whatever slice_units is. Early exit is not used.
+MathStatus init_rnn_stepper(RNNStepper* stepper, RNNModel* model, int slice_units);
+void free_rnn_stepper(RNNStepper* stepper);
+
+// Start a step, same arguments as rnn_model_step. No work is done until resume.
+void rnn_stepper_begin(RNNStepper* stepper, float* input, float* state, float* output);
+// Run one slice of the step in progress
+StepperStatus rnn_stepper_resume(RNNStepper* stepper);
+
+#endif // STEPPER_H
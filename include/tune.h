@@ -0,0 +1,40 @@
+#ifndef TUNE_H
+#define TUNE_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include "rnn_model.h"
+#include "pack.h"
+
+#define TUNE_KEY_SIZE 256
+
+// Execution choices for one model on one machine
+typedef struct {
+    bool packed;     // panel-packed weights instead of the float32 ones
+    int gemm_mc;     // GEMM cache blocking, see gemm_set_blocking
+    int gemm_kc;
+    int chunk;       // bulk scoring rows per sequence-forward call
+    int threads;     // bulk scoring threads
+} TuneResult;
+
+// "cpu model name|simd|cell input_dim x input x hidden x output x layers"
+void tune_key(RNNModelConfig* config, char* key, size_t size);
+
+// Time the candidates of every choice on this machine, a second or so for small models.
+// The model must hold float32 weights and is left as it was.
+MathStatus tune_rnn_model(RNNModel* model, TuneResult* result);
+
+// Tuning cache: a text file with one "key\tpacked mc kc chunk threads" line per key.
+// load returns false when the file or the key is missing.
+bool load_tune_cache(char* path, char* key, TuneResult* result);
+// Adds or replaces the key's line
+MathStatus save_tune_cache(char* path, char* key, TuneResult* result);
+
+// Set the GEMM blocking and, when packed, pack the model into arena. free_pack_arena
+// is safe on the arena either way. The blocking is process-wide, the last applied
+// model sets it for every model; tuning itself leaves it alone.
+MathStatus apply_tuning(RNNModel* model, PackArena* arena, TuneResult* result);
+// Cached choices for the model when there are any, otherwise tune and save them; then apply
+MathStatus autotune_rnn_model(char* path, RNNModel* model, PackArena* arena, TuneResult* result);
+
+#endif // TUNE_H
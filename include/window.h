@@ -0,0 +1,40 @@
+#ifndef WINDOW_H
+#define WINDOW_H
+
+#include <stdbool.h>
+#include "rnn_model.h"
+
+typedef enum {
+    // Every window starts from a zero state, as if it had been run on its own.
+    // The window states are staggered by one input each and advanced together
+    // as one batch, so a push costs a single [window x hidden] step per layer.
+    WINDOW_EXACT = 0,
+    // One stream state carried across windows, a push is a single-row step.
+    // Matches WINDOW_EXACT only while the model's memory is shorter than the window.
+    WINDOW_STATEFUL = 1,
+} WindowMode;
+
+// Overlapping windows of length `window` and stride 1 over an input stream
+typedef struct {
+    RNNModel* model;
+    WindowMode mode;
+    int window;
+    long steps;              // inputs pushed so far
+    GRULayer* gru_batch;     // per layer, window rows sharing the model weights
+    LSTMLayer* lstm_batch;
+    float* states;           // WINDOW_EXACT: [window] model states, row r starts at inputs r, r + window, ...
+    float* projections;      // input projections of the newest input, computed once for all rows
+    float* gate_inputs;      // [gates][window x hidden] projections fed to the batched step
+    float* inputs;           // ring of the last window inputs
+} SlidingWindow;
+
+MathStatus init_sliding_window(SlidingWindow* sw, RNNModel* model, int window, WindowMode mode);
+void free_sliding_window(SlidingWindow* sw);
+
+// Push the next input. Returns true once a full window ends at this input and its
+// output was written to output (output_size floats).
+bool sliding_window_push(SlidingWindow* sw, float* input, float* output);
+// Reference output of the latest window, recomputed from scratch over the input ring
+MathStatus sliding_window_recompute(SlidingWindow* sw, float* output);
+
+#endif // WINDOW_H
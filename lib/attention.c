@@ -0,0 +1,130 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <math.h>
+#include "attention.h"
+
+MathStatus init_attention_layer(AttentionLayer* layer, int model_size, int num_heads, int window) {
+    if (layer == NULL) {
+        return MATH_NULL_POINTER;
+    }
+    if (model_size <= 0 || num_heads <= 0 || model_size % num_heads != 0 || window <= 0) {
+        return MATH_INVALID_DIM;
+    }
+    AttentionLayerConfig* config = &layer->config;
+    config->model_size = model_size;
+    config->num_heads = num_heads;
+    config->head_size = model_size / num_heads;
+    config->window = window;
+
+    size_t d = model_size;
+    AttentionLayerWeights* w = &layer->weights;
+    w->W_qkv = (float*)calloc(d * 3 * d, sizeof(float));
+    w->b_qkv = (float*)calloc(3 * d, sizeof(float));
+    w->W_o = (float*)calloc(d * d, sizeof(float));
+    w->b_o = (float*)calloc(d, sizeof(float));
+    layer->state.qkv = (float*)calloc(3 * d, sizeof(float));
+    layer->state.scores = (float*)calloc(window, sizeof(float));
+    layer->state.context = (float*)calloc(d, sizeof(float));
+    if (w->W_qkv == NULL || w->b_qkv == NULL || w->W_o == NULL || w->b_o == NULL
+        || layer->state.qkv == NULL || layer->state.scores == NULL || layer->state.context == NULL) {
+        free_attention_layer(layer, true);
+        return MATH_NULL_POINTER;
+    }
+    return MATH_SUCCESS;
+}
+
+void free_attention_layer(AttentionLayer* layer, bool free_weights) {
+    if (free_weights) {
+        free(layer->weights.W_qkv);
+        free(layer->weights.b_qkv);
+        free(layer->weights.W_o);
+        free(layer->weights.b_o);
+    }
+    free(layer->state.qkv);
+    free(layer->state.scores);
+    free(layer->state.context);
+    layer->state.qkv = NULL;
+    layer->state.scores = NULL;
+    layer->state.context = NULL;
+}
+
+size_t attention_layer_floats(AttentionLayerConfig* config) {
+    size_t d = config->model_size;
+    return d * 3 * d + 3 * d + d * d + d;
+}
+
+size_t memory_map_attention_layer(AttentionLayer* layer, float* data_ptr) {
+    size_t d = layer->config.model_size;
+    AttentionLayerWeights* w = &layer->weights;
+    w->W_qkv = data_ptr;
+    w->b_qkv = w->W_qkv + d * 3 * d;
+    w->W_o = w->b_qkv + 3 * d;
+    w->b_o = w->W_o + d * d;
+    return attention_layer_floats(&layer->config);
+}
+
+MathStatus init_kv_cache(KVCache* cache, AttentionLayer* layer) {
+    cache->window = layer->config.window;
+    cache->model_size = layer->config.model_size;
+    cache->head = 0;
+    cache->steps = 0;
+    size_t rows = (size_t)cache->window * cache->model_size;
+    cache->keys = (float*)malloc(2 * rows * sizeof(float));
+    if (cache->keys == NULL) {
+        return MATH_NULL_POINTER;
+    }
+    cache->values = cache->keys + rows;
+    return MATH_SUCCESS;
+}
+
+void free_kv_cache(KVCache* cache) {
+    free(cache->keys);
+    cache->keys = NULL;
+    cache->values = NULL;
+}
+
+void reset_kv_cache(KVCache* cache) {
+    cache->head = 0;
+    cache->steps = 0; // rows past steps are never read
+}
+
+// out[cols] = bias + x[rows] * W[rows, cols]
+static void project(float* out, float* x, float* W, float* bias, int rows, int cols) {
+    memcpy(out, bias, cols * sizeof(float));
+    for (int k = 0; k < rows; k++) {
+        axpy(out, x[k], W + (size_t)k * cols, cols);
+    }
+}
+
+void attention_layer_step(AttentionLayer* layer, KVCache* cache, float* input, float* output) {
+    AttentionLayerConfig* config = &layer->config;
+    int d = config->model_size;
+    int head_size = config->head_size;
+    float* qkv = layer->state.qkv;
+    float* scores = layer->state.scores;
+    float* context = layer->state.context;
+
+    project(qkv, input, layer->weights.W_qkv, layer->weights.b_qkv, d, 3 * d);
+    memcpy(cache->keys + (size_t)cache->head * d, qkv + d, d * sizeof(float));
+    memcpy(cache->values + (size_t)cache->head * d, qkv + 2 * d, d * sizeof(float));
+    cache->head = (cache->head + 1) % cache->window;
+    cache->steps++;
+    int rows = (cache->steps < cache->window) ? (int)cache->steps : cache->window;
+
+    float scale = 1.0f / sqrtf((float)head_size);
+    for (int h = 0; h < config->num_heads; h++) {
+        float* q = qkv + h * head_size;
+        for (int j = 0; j < rows; j++) {
+            scores[j] = scale * dot_product(q, cache->keys + (size_t)j * d + h * head_size, head_size);
+        }
+        softmax_inplace(scores, rows);
+        float* ctx = context + h * head_size;
+        memset(ctx, 0, head_size * sizeof(float));
+        for (int j = 0; j < rows; j++) {
+            axpy(ctx, scores[j], cache->values + (size_t)j * d + h * head_size, head_size);
+        }
+    }
+    project(output, context, layer->weights.W_o, layer->weights.b_o, d, d);
+}
@@ -0,0 +1,192 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include "bidirectional.h"
+#include "math_nn.h"
+
+static int bidirectional_gates(BidirectionalLayer* layer) {
+    return (layer->cell_type == RNN_CELL_GRU) ? 3 : 4;
+}
+
+MathStatus init_bidirectional_layer(BidirectionalLayer* layer, RNNCellType cell_type, int input_size,
+                                    int hidden_size, bool parallel) {
+    if (layer == NULL) {
+        return MATH_NULL_POINTER;
+    }
+    if (input_size <= 0 || hidden_size <= 0) {
+        return MATH_INVALID_DIM;
+    }
+    memset(layer, 0, sizeof(BidirectionalLayer));
+    layer->cell_type = cell_type;
+    layer->input_size = input_size;
+    layer->hidden_size = hidden_size;
+    layer->parallel = parallel;
+
+    int gates = bidirectional_gates(layer);
+    layer->input_weights = (float*)calloc((size_t)input_size * 2 * gates * hidden_size, sizeof(float));
+    layer->zeros = (float*)calloc(hidden_size, sizeof(float));
+    if (cell_type == RNN_CELL_GRU) {
+        layer->gru_layers = (GRULayer*)malloc(2 * sizeof(GRULayer));
+    } else {
+        layer->lstm_layers = (LSTMLayer*)malloc(2 * sizeof(LSTMLayer));
+    }
+    if (layer->input_weights == NULL || layer->zeros == NULL || (layer->gru_layers == NULL && layer->lstm_layers == NULL)) {
+        free(layer->input_weights);
+        free(layer->zeros);
+        free(layer->gru_layers);
+        free(layer->lstm_layers);
+        return MATH_NULL_POINTER;
+    }
+    for (int d = 0; d < 2; d++) {
+        if (cell_type == RNN_CELL_GRU) {
+            init_gru_layer(&layer->gru_layers[d], 1, input_size, hidden_size);
+        } else {
+            init_lstm_layer(&layer->lstm_layers[d], 1, input_size, hidden_size);
+        }
+    }
+    return MATH_SUCCESS;
+}
+
+void free_bidirectional_layer(BidirectionalLayer* layer, bool free_weights) {
+    for (int d = 0; d < 2; d++) {
+        if (layer->gru_layers != NULL) {
+            free_gru_layer(&layer->gru_layers[d], free_weights);
+        }
+        if (layer->lstm_layers != NULL) {
+            free_lstm_layer(&layer->lstm_layers[d], free_weights);
+        }
+    }
+    free(layer->gru_layers);
+    free(layer->lstm_layers);
+    free(layer->input_weights);
+    free(layer->zeros);
+    layer->gru_layers = NULL;
+    layer->lstm_layers = NULL;
+    layer->input_weights = NULL;
+    layer->zeros = NULL;
+}
+
+size_t bidirectional_layer_floats(BidirectionalLayer* layer) {
+    size_t in = layer->input_size;
+    size_t h = layer->hidden_size;
+    return 2 * bidirectional_gates(layer) * (in * h + h * h + 2 * h);
+}
+
+size_t memory_map_bidirectional_layer(BidirectionalLayer* layer, float* data_ptr) {
+    size_t ptr_offset = 0;
+    for (int d = 0; d < 2; d++) {
+        if (layer->cell_type == RNN_CELL_GRU) {
+            ptr_offset += memory_map_gru_layer(&layer->gru_layers[d], data_ptr + ptr_offset);
+        } else {
+            ptr_offset += memory_map_lstm_layer(&layer->lstm_layers[d], data_ptr + ptr_offset);
+        }
+    }
+    refresh_bidirectional_layer(layer);
+    return ptr_offset;
+}
+
+void refresh_bidirectional_layer(BidirectionalLayer* layer) {
+    int input_size = layer->input_size;
+    int hidden_size = layer->hidden_size;
+    int gates = bidirectional_gates(layer);
+    int width = 2 * gates * hidden_size;
+    for (int d = 0; d < 2; d++) {
+        float* W[4];
+        if (layer->cell_type == RNN_CELL_GRU) {
+            GRULayerWeights* w = &layer->gru_layers[d].weights;
+            W[0] = w->W_ir;
+            W[1] = w->W_iz;
+            W[2] = w->W_in;
+        } else {
+            LSTMLayerWeights* w = &layer->lstm_layers[d].weights;
+            W[0] = w->W_ii;
+            W[1] = w->W_if;
+            W[2] = w->W_ig;
+            W[3] = w->W_io;
+        }
+        for (int g = 0; g < gates; g++) {
+            for (int i = 0; i < input_size; i++) {
+                memcpy(layer->input_weights + (size_t)i * width + (d * gates + g) * hidden_size,
+                       W[g] + (size_t)i * hidden_size, hidden_size * sizeof(float));
+            }
+        }
+    }
+}
+
+typedef struct {
+    BidirectionalLayer* layer;
+    int direction;           // 0 forward, 1 backward
+    float* x_proj;           // [seq_len x 2 * gates * hidden_size]
+    float* h0;
+    float* c0;
+    float* outputs;
+    int seq_len;
+} DirectionRun;
+
+// One direction's recurrence. Step k of the backward direction is time seq_len - 1 - k,
+// and both read their gate inputs and write their hidden state at their own column offset.
+static void* run_direction(void* arg) {
+    DirectionRun* run = (DirectionRun*)arg;
+    BidirectionalLayer* layer = run->layer;
+    int d = run->direction;
+    int h = layer->hidden_size;
+    int gates = bidirectional_gates(layer);
+    size_t width = 2 * (size_t)gates * h;
+
+    float* h_prev = run->h0;
+    float* c_prev = run->c0;
+    for (int k = 0; k < run->seq_len; k++) {
+        int t = (d == 0) ? k : run->seq_len - 1 - k;
+        float* x = run->x_proj + t * width + d * gates * h;
+        float* h_out = run->outputs + (size_t)t * 2 * h + d * h;
+        if (layer->cell_type == RNN_CELL_GRU) {
+            gru_layer_step(&layer->gru_layers[d], x, x + h, x + 2 * h, h_prev, h_out);
+        } else {
+            LSTMLayer* lstm = &layer->lstm_layers[d];
+            lstm_layer_step(lstm, x, x + h, x + 2 * h, x + 3 * h, h_prev, c_prev, h_out, lstm->state.cell_state_buffer);
+            c_prev = lstm->state.cell_state_buffer; // c_t is updated in place from here on
+        }
+        h_prev = h_out;
+    }
+    return NULL;
+}
+
+MathStatus bidirectional_layer_forward_sequence(BidirectionalLayer* layer, float* inputs, float* state,
+                                                float* outputs, int seq_len) {
+    if (layer == NULL || inputs == NULL || outputs == NULL) {
+        return MATH_NULL_POINTER;
+    }
+    if (seq_len <= 0) {
+        return MATH_INVALID_DIM;
+    }
+    int h = layer->hidden_size;
+    int width = 2 * bidirectional_gates(layer) * h;
+    float* x_proj = (float*)malloc((size_t)seq_len * width * sizeof(float));
+    if (x_proj == NULL) {
+        return MATH_NULL_POINTER;
+    }
+    // input projections of every time step for both directions in one GEMM
+    gemm(seq_len, width, layer->input_size, 1.0f, inputs, layer->input_size, layer->input_weights, width, 0.0f, x_proj, width);
+
+    DirectionRun runs[2];
+    for (int d = 0; d < 2; d++) {
+        runs[d] = (DirectionRun){layer, d, x_proj, layer->zeros, layer->zeros, outputs, seq_len};
+        if (state != NULL) {
+            runs[d].h0 = state + d * h;
+            runs[d].c0 = state + (2 + d) * h;
+        }
+    }
+
+    pthread_t thread;
+    bool threaded = layer->parallel && pthread_create(&thread, NULL, run_direction, &runs[1]) == 0;
+    run_direction(&runs[0]);
+    if (threaded) {
+        pthread_join(thread, NULL);
+    } else {
+        run_direction(&runs[1]);
+    }
+    free(x_proj);
+    return MATH_SUCCESS;
+}
@@ -0,0 +1,506 @@
+#define _POSIX_C_SOURCE 200809L // ftruncate, clock_gettime
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include "bulk_score.h"
+#include "math_nn.h"
+#include "util.h"
+
+static size_t align_up(size_t bytes) {
+    return (bytes + FEATURE_ALIGN - 1) / FEATURE_ALIGN * FEATURE_ALIGN;
+}
+
+static size_t ids_offset(void) {
+    return align_up(sizeof(FeatureFileHeader));
+}
+
+static size_t features_offset(uint64_t num_rows) {
+    return ids_offset() + align_up(num_rows * sizeof(uint64_t));
+}
+
+MathStatus write_feature_file(char* path, uint64_t* stream_ids, float* features, uint64_t num_rows, int num_features) {
+    if (path == NULL || stream_ids == NULL || features == NULL) {
+        return MATH_NULL_POINTER;
+    }
+    FILE* file = fopen(path, "wb");
+    if (!file) {
+        fprintf(stderr, "Couldn't open file %s\n", path);
+        return MATH_NULL_POINTER;
+    }
+    static const uint8_t zeros[FEATURE_ALIGN] = {0};
+    FeatureFileHeader header = {FEATURE_MAGIC, FEATURE_VERSION, (uint32_t)num_features, 0, num_rows};
+    size_t ids_bytes = num_rows * sizeof(uint64_t);
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1
+              && fwrite(zeros, 1, ids_offset() - sizeof(header), file) == ids_offset() - sizeof(header)
+              && fwrite(stream_ids, sizeof(uint64_t), num_rows, file) == num_rows
+              && fwrite(zeros, 1, align_up(ids_bytes) - ids_bytes, file) == align_up(ids_bytes) - ids_bytes
+              && fwrite(features, sizeof(float) * num_features, num_rows, file) == num_rows;
+    ok = (fclose(file) == 0) && ok;
+    if (!ok) {
+        fprintf(stderr, "Short write to %s\n", path);
+        return MATH_INVALID_DIM;
+    }
+    return MATH_SUCCESS;
+}
+
+// CSV parsing, bounded by end since a mapped file has no terminator
+
+static const char* parse_uint64(const char* p, const char* end, uint64_t* out) {
+    uint64_t v = 0;
+    const char* start = p;
+    while (p < end && *p >= '0' && *p <= '9') {
+        v = v * 10 + (uint64_t)(*p++ - '0');
+    }
+    *out = v;
+    return p == start ? NULL : p;
+}
+
+static const char* parse_float(const char* p, const char* end, float* out) {
+    static const double pow10[] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+                                   1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+    while (p < end && *p == ' ') {
+        p++;
+    }
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+')) {
+        negative = (*p++ == '-');
+    }
+    uint64_t mantissa = 0;
+    int exponent = 0;
+    int digits = 0;
+    const char* start = p;
+    for (; p < end && *p >= '0' && *p <= '9'; p++) {
+        if (digits < 18) {
+            mantissa = mantissa * 10 + (uint64_t)(*p - '0');
+            digits += (mantissa != 0);
+        } else {
+            exponent++;
+        }
+    }
+    if (p < end && *p == '.') {
+        for (p++; p < end && *p >= '0' && *p <= '9'; p++) {
+            if (digits < 18) {
+                mantissa = mantissa * 10 + (uint64_t)(*p - '0');
+                digits += (mantissa != 0);
+                exponent--;
+            }
+        }
+    }
+    if (p == start) {
+        return NULL;
+    }
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        p++;
+        bool exp_negative = false;
+        if (p < end && (*p == '-' || *p == '+')) {
+            exp_negative = (*p++ == '-');
+        }
+        int e = 0;
+        for (; p < end && *p >= '0' && *p <= '9'; p++) {
+            e = (e < 10000) ? e * 10 + (*p - '0') : e;
+        }
+        exponent += exp_negative ? -e : e;
+    }
+    double v = (double)mantissa;
+    while (exponent > 22) {
+        v *= 1e22;
+        exponent -= 22;
+    }
+    while (exponent < -22) {
+        v /= 1e22;
+        exponent += 22;
+    }
+    v = (exponent >= 0) ? v * pow10[exponent] : v / pow10[-exponent];
+    *out = (float)(negative ? -v : v);
+    return p;
+}
+
+static const char* next_line(const char* p, const char* end) {
+    const char* nl = memchr(p, '\n', end - p);
+    return nl == NULL ? end : nl + 1;
+}
+
+static bool blank_line(const char* p, const char* end) {
+    return p == end || *p == '\n' || *p == '\r';
+}
+
+typedef struct {
+    FeatureTable* table;
+    const char* begin;   // first line of the chunk
+    const char* end;
+    uint64_t first_row;
+    uint64_t rows;
+    MathStatus status;
+} CsvChunk;
+
+static void* count_csv_rows(void* arg) {
+    CsvChunk* chunk = (CsvChunk*)arg;
+    for (const char* p = chunk->begin; p < chunk->end; p = next_line(p, chunk->end)) {
+        chunk->rows += !blank_line(p, chunk->end);
+    }
+    return NULL;
+}
+
+static void* parse_csv_rows(void* arg) {
+    CsvChunk* chunk = (CsvChunk*)arg;
+    FeatureTable* table = chunk->table;
+    uint64_t row = chunk->first_row;
+    for (const char* p = chunk->begin; p < chunk->end; p = next_line(p, chunk->end)) {
+        if (blank_line(p, chunk->end)) {
+            continue;
+        }
+        const char* q = parse_uint64(p, chunk->end, &table->stream_ids[row]);
+        float* features = table->features + row * table->num_features;
+        for (int f = 0; q != NULL && f < table->num_features; f++) {
+            q = (q < chunk->end && *q == ',') ? parse_float(q + 1, chunk->end, &features[f]) : NULL;
+        }
+        if (q == NULL) {
+            fprintf(stderr, "Malformed CSV row %llu\n", (unsigned long long)row + 1);
+            chunk->status = MATH_INVALID_RANGE;
+            return NULL;
+        }
+        row++;
+    }
+    return NULL;
+}
+
+// Run fn over every chunk, one thread each, and inline for the chunks no thread could be started for
+static void run_csv_chunks(CsvChunk* chunks, pthread_t* tids, int threads, void* (*fn)(void*)) {
+    int started = 0;
+    while (tids != NULL && started < threads && pthread_create(&tids[started], NULL, fn, &chunks[started]) == 0) {
+        started++;
+    }
+    for (int t = started; t < threads; t++) {
+        fn(&chunks[t]);
+    }
+    for (int t = 0; t < started; t++) {
+        pthread_join(tids[t], NULL);
+    }
+}
+
+static MathStatus parse_csv(FeatureTable* table, MappedCheckpoint* map, int threads) {
+    const char* begin = (const char*)map->base;
+    const char* end = begin + map->size;
+    if (begin < end && !(*begin >= '0' && *begin <= '9')) {
+        begin = next_line(begin, end); // header line
+    }
+    // line-aligned chunks, counted in parallel, then parsed in parallel into their row ranges
+    CsvChunk* chunks = (CsvChunk*)calloc(threads, sizeof(CsvChunk));
+    pthread_t* tids = (pthread_t*)malloc(threads * sizeof(pthread_t));
+    if (chunks == NULL) {
+        free(tids);
+        return MATH_NULL_POINTER;
+    }
+    const char* p = begin;
+    for (int t = 0; t < threads; t++) {
+        chunks[t].table = table;
+        chunks[t].begin = p;
+        p = (t == threads - 1) ? end : begin + (size_t)(end - begin) * (t + 1) / threads;
+        if (p < chunks[t].begin) {
+            p = chunks[t].begin;
+        }
+        if (p > chunks[t].begin && p < end && p[-1] != '\n') {
+            p = next_line(p, end);
+        }
+        chunks[t].end = p;
+    }
+    run_csv_chunks(chunks, tids, threads, count_csv_rows);
+    uint64_t rows = 0;
+    for (int t = 0; t < threads; t++) {
+        chunks[t].first_row = rows;
+        rows += chunks[t].rows;
+    }
+    table->num_rows = rows;
+    table->stream_ids = (uint64_t*)malloc((rows + 1) * sizeof(uint64_t));
+    table->features = (float*)malloc((rows + 1) * table->num_features * sizeof(float));
+    table->owns_data = true;
+    MathStatus status = (table->stream_ids == NULL || table->features == NULL) ? MATH_NULL_POINTER : MATH_SUCCESS;
+    if (status == MATH_SUCCESS) {
+        run_csv_chunks(chunks, tids, threads, parse_csv_rows);
+        for (int t = 0; t < threads; t++) {
+            if (chunks[t].status != MATH_SUCCESS) {
+                status = chunks[t].status;
+            }
+        }
+    }
+    free(chunks);
+    free(tids);
+    return status;
+}
+
+MathStatus open_feature_file(FeatureTable* table, char* path, int num_features, int threads) {
+    if (table == NULL || path == NULL) {
+        return MATH_NULL_POINTER;
+    }
+    if (num_features <= 0 || threads <= 0) {
+        return MATH_INVALID_DIM;
+    }
+    memset(table, 0, sizeof(FeatureTable));
+    table->num_features = num_features;
+    size_t length = strlen(path);
+    bool csv = length >= 4 && strcmp(path + length - 4, ".csv") == 0;
+    // features are read once, front to back
+    MathStatus status = map_checkpoint(&table->map, path, LOAD_SEQUENTIAL | LOAD_WILLNEED);
+    if (status != MATH_SUCCESS) {
+        return status;
+    }
+    if (csv) {
+        status = parse_csv(table, &table->map, threads);
+        unmap_checkpoint(&table->map);
+        if (status != MATH_SUCCESS) {
+            close_feature_file(table);
+        }
+        return status;
+    }
+
+    FeatureFileHeader* header = (FeatureFileHeader*)table->map.base;
+    if (table->map.size < sizeof(FeatureFileHeader) || header->magic != FEATURE_MAGIC || header->version != FEATURE_VERSION) {
+        fprintf(stderr, "%s is not a feature file\n", path);
+        close_feature_file(table);
+        return MATH_INVALID_RANGE;
+    }
+    // bound the row count by the file size first, so the size check below can't overflow
+    uint64_t max_rows = table->map.size / (sizeof(uint64_t) + (size_t)num_features * sizeof(float));
+    if ((int)header->num_features != num_features || header->num_rows > max_rows
+        || table->map.size < features_offset(header->num_rows) + header->num_rows * num_features * sizeof(float)) {
+        fprintf(stderr, "%s holds %u features per row, or is truncated\n", path, header->num_features);
+        close_feature_file(table);
+        return MATH_INVALID_DIM;
+    }
+    table->num_rows = header->num_rows;
+    table->stream_ids = (uint64_t*)(table->map.base + ids_offset());
+    table->features = (float*)(table->map.base + features_offset(header->num_rows));
+    return MATH_SUCCESS;
+}
+
+void close_feature_file(FeatureTable* table) {
+    if (table->owns_data) {
+        free(table->stream_ids);
+        free(table->features);
+    }
+    unmap_checkpoint(&table->map);
+    table->stream_ids = NULL;
+    table->features = NULL;
+    table->num_rows = 0;
+}
+
+// Scoring
+
+typedef struct {
+    uint64_t start;
+    uint64_t length;
+} ScoreSequence;
+
+typedef struct {
+    RNNModel* model;
+    FeatureTable* table;
+    BulkScoreOptions* options;
+    ScoreSequence* sequences;
+    uint64_t num_sequences;
+    atomic_ullong next;      // sequences are handed out one by one, long ones don't stall a static split
+    float* outputs;          // the mapped score rows
+    atomic_int status;       // MATH_SUCCESS, or the first failure of any worker
+} ScoreJob;
+
+static void fail_job(ScoreJob* job, MathStatus status) {
+    int expected = MATH_SUCCESS;
+    atomic_compare_exchange_strong(&job->status, &expected, status);
+}
+
+static void* score_worker(void* arg) {
+    ScoreJob* job = (ScoreJob*)arg;
+    RNNModel* model = job->model;
+    RNNModelConfig* config = &model->config;
+    int num_layers = config->num_layers;
+    int hidden_size = config->hidden_size;
+    int output_size = config->output_size;
+    int num_features = job->table->num_features;
+    int chunk = job->options->chunk;
+    bool lstm = (config->cell_type == RNN_CELL_LSTM);
+
+    // single-row views with this thread's run state, sharing the model weights, zeroed
+    // so the cleanup below is safe whatever failed
+    GRULayer* gru = lstm ? NULL : (GRULayer*)calloc(num_layers, sizeof(GRULayer));
+    LSTMLayer* cells = lstm ? (LSTMLayer*)calloc(num_layers, sizeof(LSTMLayer)) : NULL;
+    float* scaled = (job->options->mean != NULL) ? (float*)malloc((size_t)chunk * num_features * sizeof(float)) : NULL;
+    float* buffers = (float*)malloc(2 * (size_t)chunk * hidden_size * sizeof(float));
+    float* h = (float*)malloc(2 * (size_t)num_layers * hidden_size * sizeof(float));
+    float* c = (h != NULL) ? h + num_layers * hidden_size : NULL;
+    bool ready = (lstm ? cells != NULL : gru != NULL) && (scaled != NULL || job->options->mean == NULL)
+                 && buffers != NULL && h != NULL;
+    for (int l = 0; ready && l < num_layers; l++) {
+        if (lstm) {
+            init_lstm_layer_batch(&cells[l], &model->lstm_layers[l], 1);
+        } else {
+            init_gru_layer_batch(&gru[l], &model->gru_layers[l], 1);
+        }
+    }
+    if (!ready) {
+        fail_job(job, MATH_NULL_POINTER);
+    }
+
+    uint64_t s;
+    while (ready && atomic_load(&job->status) == MATH_SUCCESS && (s = atomic_fetch_add(&job->next, 1)) < job->num_sequences) {
+        ScoreSequence* seq = &job->sequences[s];
+        memset(h, 0, 2 * (size_t)num_layers * hidden_size * sizeof(float));
+        for (uint64_t t0 = 0; t0 < seq->length; t0 += chunk) {
+            int rows = (int)((seq->length - t0 < (uint64_t)chunk) ? seq->length - t0 : (uint64_t)chunk);
+            uint64_t row = seq->start + t0;
+            float* in = job->table->features + row * num_features;
+            if (scaled != NULL) {
+                for (int r = 0; r < rows; r++) {
+                    standard_scaler(scaled + r * num_features, in + r * num_features, num_features,
+                                    job->options->mean, job->options->std);
+                }
+                in = scaled;
+            }
+            // layer by layer over the chunk: one GEMM for the input projections, then the recurrence
+            MathStatus status = MATH_SUCCESS;
+            for (int l = 0; l < num_layers; l++) {
+                float* out = buffers + (l % 2) * (size_t)chunk * hidden_size;
+                float* h_l = h + l * hidden_size;
+                if (lstm) {
+                    float* c_l = c + l * hidden_size;
+                    status = lstm_layer_forward_sequence(&cells[l], in, h_l, c_l, out, rows);
+                    memcpy(c_l, cells[l].state.cell_state_buffer, hidden_size * sizeof(float));
+                } else {
+                    status = gru_layer_forward_sequence(&gru[l], in, h_l, out, rows);
+                }
+                if (status != MATH_SUCCESS) {
+                    fail_job(job, status);
+                    break;
+                }
+                memcpy(h_l, out + (size_t)(rows - 1) * hidden_size, hidden_size * sizeof(float));
+                in = out;
+            }
+            if (status != MATH_SUCCESS) {
+                break; // the job is failed, leave its scores alone
+            }
+            // output layer for the whole chunk, written straight into the score file
+            float* y = job->outputs + row * output_size;
+            LinearLayerWeights* w = &model->output_layer.weights;
+            if (w->packed != NULL) {
+                matmul_packed(y, in, &w->packed->weights, rows);
+            } else {
+                gemm(rows, output_size, hidden_size, 1.0f, in, hidden_size, w->weights, output_size, 0.0f, y, output_size);
+            }
+            float* bias = (w->packed != NULL) ? w->packed->bias : w->bias;
+            for (int r = 0; r < rows; r++) {
+                add(y + r * output_size, y + r * output_size, bias, output_size);
+            }
+        }
+    }
+
+    for (int l = 0; l < num_layers; l++) {
+        if (cells != NULL) {
+            free_lstm_layer_run_state(&cells[l].state);
+        }
+        if (gru != NULL) {
+            free_gru_layer_run_state(&gru[l].state);
+        }
+    }
+    free(gru);
+    free(cells);
+    free(scaled);
+    free(buffers);
+    free(h);
+    return NULL;
+}
+
+static double now_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+MathStatus bulk_score(RNNModel* model, FeatureTable* table, char* out_path, BulkScoreOptions* options, BulkScoreStats* stats) {
+    if (model == NULL || table == NULL || out_path == NULL || options == NULL) {
+        return MATH_NULL_POINTER;
+    }
+    RNNModelConfig* config = &model->config;
+    if (config->input_dim != 1 || config->input_size != table->num_features || options->threads <= 0 || options->chunk <= 0) {
+        return MATH_INVALID_DIM;
+    }
+    double start = now_s();
+
+    // a sequence is a run of rows with one stream id
+    uint64_t num_rows = table->num_rows;
+    uint64_t count = 0;
+    for (uint64_t r = 0; r < num_rows; r++) {
+        count += (r == 0 || table->stream_ids[r] != table->stream_ids[r - 1]);
+    }
+    ScoreSequence* sequences = (ScoreSequence*)malloc((count + 1) * sizeof(ScoreSequence));
+    if (sequences == NULL) {
+        return MATH_NULL_POINTER;
+    }
+    uint64_t n = 0;
+    for (uint64_t r = 0; r < num_rows; r++) {
+        if (r == 0 || table->stream_ids[r] != table->stream_ids[r - 1]) {
+            sequences[n++] = (ScoreSequence){r, 0};
+        }
+        sequences[n - 1].length++;
+    }
+
+    // the score file is mapped and every worker writes its rows in place
+    int fd = open(out_path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) {
+        fprintf(stderr, "Couldn't open file %s\n", out_path);
+        free(sequences);
+        return MATH_NULL_POINTER;
+    }
+    size_t out_bytes = FEATURE_ALIGN + num_rows * config->output_size * sizeof(float);
+    void* out = (ftruncate(fd, (off_t)out_bytes) == 0)
+        ? mmap(NULL, out_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (out == MAP_FAILED) {
+        fprintf(stderr, "Couldn't map %s\n", out_path);
+        free(sequences);
+        return MATH_NULL_POINTER;
+    }
+    FeatureFileHeader header = {SCORE_MAGIC, FEATURE_VERSION, (uint32_t)config->output_size, 0, num_rows};
+    memcpy(out, &header, sizeof(header));
+
+    ScoreJob job;
+    job.model = model;
+    job.table = table;
+    job.options = options;
+    job.sequences = sequences;
+    job.num_sequences = count;
+    job.outputs = (float*)((uint8_t*)out + FEATURE_ALIGN);
+    atomic_init(&job.next, 0);
+    atomic_init(&job.status, MATH_SUCCESS);
+    pthread_t* threads = (pthread_t*)malloc(options->threads * sizeof(pthread_t));
+    int started = 0;
+    while (threads != NULL && started < options->threads
+           && pthread_create(&threads[started], NULL, score_worker, &job) == 0) {
+        started++;
+    }
+    if (started == 0) {
+        score_worker(&job); // no threads to be had, score on this one
+    }
+    for (int t = 0; t < started; t++) {
+        pthread_join(threads[t], NULL);
+    }
+    free(threads);
+    munmap(out, out_bytes); // dirty pages are written back by the kernel
+    free(sequences);
+    MathStatus status = (MathStatus)atomic_load(&job.status);
+    if (status != MATH_SUCCESS) {
+        fprintf(stderr, "Scoring into %s failed, its rows are incomplete\n", out_path);
+        return status;
+    }
+
+    if (stats != NULL) {
+        stats->rows = num_rows;
+        stats->sequences = count;
+        stats->score_s = now_s() - start;
+    }
+    return MATH_SUCCESS;
+}
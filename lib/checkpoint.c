@@ -0,0 +1,155 @@
+#define _DEFAULT_SOURCE // MAP_POPULATE, MAP_ANONYMOUS, MAP_HUGETLB, madvise
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "checkpoint.h"
+#if defined _WIN32
+    #include "win.h"
+#else
+    #include <sys/mman.h>
+#endif
+
+#define HUGE_PAGE_SIZE (2u << 20)
+
+static size_t round_up(size_t bytes, size_t align) {
+    return (bytes + align - 1) / align * align;
+}
+
+// Anonymous copy of the file: explicit huge pages when the pool has them,
+// otherwise a 2 MB aligned region so THP can back it with whole huge pages
+static MathStatus map_anonymous(MappedCheckpoint* ckpt, int fd) {
+#if defined(MAP_HUGETLB)
+    size_t huge_size = round_up(ckpt->size, HUGE_PAGE_SIZE);
+    void* data = mmap(NULL, huge_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (data != MAP_FAILED) {
+        ckpt->map = (uint8_t*)data;
+        ckpt->map_size = huge_size;
+        ckpt->base = ckpt->map;
+        ckpt->huge_tlb = true;
+    }
+#endif
+    if (ckpt->map == NULL) {
+        size_t size = round_up(ckpt->size, HUGE_PAGE_SIZE) + HUGE_PAGE_SIZE;
+        void* data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (data == MAP_FAILED) {
+            fprintf(stderr, "mmap failed!\n");
+            return MATH_NULL_POINTER;
+        }
+        ckpt->map = (uint8_t*)data;
+        ckpt->map_size = size;
+        ckpt->base = (uint8_t*)round_up((uintptr_t)data, HUGE_PAGE_SIZE);
+#if defined(MADV_HUGEPAGE)
+        madvise(ckpt->base, round_up(ckpt->size, HUGE_PAGE_SIZE), MADV_HUGEPAGE);
+#endif
+    }
+
+    size_t done = 0;
+    while (done < ckpt->size) {
+        ssize_t got = read(fd, ckpt->base + done, ckpt->size - done);
+        if (got <= 0) {
+            fprintf(stderr, "Short read of the checkpoint\n");
+            munmap(ckpt->map, ckpt->map_size);
+            ckpt->map = NULL;
+            return MATH_INVALID_DIM;
+        }
+        done += (size_t)got;
+    }
+    mprotect(ckpt->base, round_up(ckpt->size, (size_t)sysconf(_SC_PAGESIZE)), PROT_READ);
+    ckpt->applied |= LOAD_ANON | LOAD_POPULATE | (ckpt->huge_tlb ? 0 : (ckpt->flags & LOAD_HUGEPAGE));
+    return MATH_SUCCESS;
+}
+
+MathStatus map_checkpoint(MappedCheckpoint* ckpt, char* path, unsigned flags) {
+    if (ckpt == NULL || path == NULL) {
+        return MATH_NULL_POINTER;
+    }
+    memset(ckpt, 0, sizeof(MappedCheckpoint));
+    ckpt->flags = flags;
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        fprintf(stderr, "Couldn't open file %s\n", path);
+        return MATH_NULL_POINTER;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return MATH_INVALID_DIM;
+    }
+    ckpt->size = (size_t)st.st_size;
+
+    if (flags & LOAD_ANON) {
+        MathStatus status = map_anonymous(ckpt, fd);
+        close(fd);
+        if (status != MATH_SUCCESS) {
+            return status;
+        }
+    } else {
+        int map_flags = MAP_PRIVATE;
+#if defined(MAP_POPULATE)
+        if (flags & LOAD_POPULATE) {
+            map_flags |= MAP_POPULATE;
+            ckpt->applied |= LOAD_POPULATE;
+        }
+#endif
+        void* data = mmap(NULL, ckpt->size, PROT_READ, map_flags, fd, 0);
+        close(fd);
+        if (data == MAP_FAILED) {
+            fprintf(stderr, "mmap failed!\n");
+            return MATH_NULL_POINTER;
+        }
+        ckpt->map = (uint8_t*)data;
+        ckpt->map_size = ckpt->size;
+        ckpt->base = ckpt->map;
+
+        // readahead hints, file-backed huge pages need a filesystem with large folio support
+        int advice[3] = {MADV_WILLNEED, MADV_SEQUENTIAL, -1};
+        unsigned advice_flag[3] = {LOAD_WILLNEED, LOAD_SEQUENTIAL, LOAD_HUGEPAGE};
+#if defined(MADV_HUGEPAGE)
+        advice[2] = MADV_HUGEPAGE;
+#endif
+        for (int i = 0; i < 3; i++) {
+            if ((flags & advice_flag[i]) && advice[i] >= 0 && madvise(ckpt->map, ckpt->map_size, advice[i]) == 0) {
+                ckpt->applied |= advice_flag[i];
+            }
+        }
+    }
+
+    if (flags & LOAD_MLOCK) {
+        if (mlock(ckpt->base, ckpt->size) == 0) {
+            ckpt->applied |= LOAD_MLOCK;
+        } else {
+            fprintf(stderr, "mlock of %zu checkpoint bytes failed, check RLIMIT_MEMLOCK\n", ckpt->size);
+        }
+    }
+    return MATH_SUCCESS;
+}
+
+void unmap_checkpoint(MappedCheckpoint* ckpt) {
+    if (ckpt->map != NULL) {
+        munmap(ckpt->map, ckpt->map_size); // also drops any mlock
+    }
+    memset(ckpt, 0, sizeof(MappedCheckpoint));
+}
+
+void print_checkpoint_load(MappedCheckpoint* ckpt) {
+    static const char* names[6] = {"populate", "willneed", "sequential", "hugepage", "mlock", "anon"};
+    printf("Checkpoint of %zu bytes loaded:", ckpt->size);
+    if (ckpt->applied == LOAD_LAZY) {
+        printf(" lazy");
+    }
+    for (int i = 0; i < 6; i++) {
+        if (ckpt->applied & (1u << i)) {
+            printf(" %s", names[i]);
+        }
+    }
+    if (ckpt->huge_tlb) {
+        printf(" (hugetlb)");
+    }
+    if (ckpt->flags & ~ckpt->applied) {
+        printf(", not applied: 0x%x", ckpt->flags & ~ckpt->applied);
+    }
+    printf("\n");
+}
@@ -0,0 +1,273 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include "conv1d.h"
+
+void init_conv1d_layer(Conv1DLayer* layer, int in_channels, int out_channels, int kernel_size, int dilation) {
+    layer->config.in_channels = in_channels;
+    layer->config.out_channels = out_channels;
+    layer->config.kernel_size = kernel_size;
+    layer->config.dilation = dilation;
+    layer->weights.weights = (float*)calloc((size_t)kernel_size * in_channels * out_channels, sizeof(float));
+    layer->weights.bias = (float*)calloc(out_channels, sizeof(float));
+}
+
+void free_conv1d_layer(Conv1DLayer* layer, bool free_weights) {
+    if (free_weights) {
+        free(layer->weights.weights);
+        free(layer->weights.bias);
+    }
+    layer->weights.weights = NULL;
+    layer->weights.bias = NULL;
+}
+
+int conv1d_receptive_field(Conv1DLayerConfig* config) {
+    return (config->kernel_size - 1) * config->dilation + 1;
+}
+
+size_t conv1d_layer_floats(Conv1DLayerConfig* config) {
+    return ((size_t)config->kernel_size * config->in_channels + 1) * config->out_channels;
+}
+
+size_t memory_map_conv1d_layer(Conv1DLayer* layer, float* data_ptr) {
+    Conv1DLayerConfig* config = &layer->config;
+    layer->weights.weights = data_ptr;
+    layer->weights.bias = data_ptr + (size_t)config->kernel_size * config->in_channels * config->out_channels;
+    return conv1d_layer_floats(config);
+}
+
+MathStatus init_conv1d_stream(Conv1DStream* stream, Conv1DLayer* layer) {
+    stream->frames = conv1d_receptive_field(&layer->config);
+    stream->channels = layer->config.in_channels;
+    stream->head = stream->frames - 1;
+    stream->ring = (float*)calloc((size_t)stream->frames * stream->channels, sizeof(float));
+    return (stream->ring == NULL) ? MATH_NULL_POINTER : MATH_SUCCESS;
+}
+
+void free_conv1d_stream(Conv1DStream* stream) {
+    free(stream->ring);
+    stream->ring = NULL;
+}
+
+void reset_conv1d_stream(Conv1DStream* stream) {
+    memset(stream->ring, 0, (size_t)stream->frames * stream->channels * sizeof(float));
+    stream->head = stream->frames - 1;
+}
+
+// The frame lag steps before the newest one in the ring
+static float* conv1d_stream_frame(Conv1DStream* stream, int lag) {
+    int slot = (stream->head - lag) % stream->frames;
+    if (slot < 0) {
+        slot += stream->frames;
+    }
+    return stream->ring + (size_t)slot * stream->channels;
+}
+
+static void conv1d_stream_push(Conv1DStream* stream, float* frame) {
+    stream->head = (stream->head + 1) % stream->frames;
+    memcpy(stream->ring + (size_t)stream->head * stream->channels, frame, stream->channels * sizeof(float));
+}
+
+void conv1d_layer_step(Conv1DLayer* layer, Conv1DStream* stream, float* input, float* output) {
+    Conv1DLayerConfig* config = &layer->config;
+    int in = config->in_channels;
+    int out = config->out_channels;
+    conv1d_stream_push(stream, input);
+    memcpy(output, layer->weights.bias, out * sizeof(float));
+    // every tap reads its frame straight from the ring, no gather
+    for (int k = 0; k < config->kernel_size; k++) {
+        int lag = (config->kernel_size - 1 - k) * config->dilation;
+        accumulate_rows(output, conv1d_stream_frame(stream, lag), layer->weights.weights + (size_t)k * in * out, in, out);
+    }
+}
+
+MathStatus conv1d_layer_forward_sequence(Conv1DLayer* layer, Conv1DStream* stream, float* inputs, float* outputs, int seq_len) {
+    if (layer == NULL || inputs == NULL || outputs == NULL) {
+        return MATH_NULL_POINTER;
+    }
+    if (seq_len <= 0) {
+        return MATH_INVALID_DIM;
+    }
+    Conv1DLayerConfig* config = &layer->config;
+    int in = config->in_channels;
+    int out = config->out_channels;
+    int width = config->kernel_size * in;
+    float* columns = (float*)malloc((size_t)seq_len * width * sizeof(float));
+    if (columns == NULL) {
+        return MATH_NULL_POINTER;
+    }
+
+    // im2col: row t holds the kernel_size frames tap k of step t reads
+    for (int t = 0; t < seq_len; t++) {
+        for (int k = 0; k < config->kernel_size; k++) {
+            int src = t - (config->kernel_size - 1 - k) * config->dilation;
+            float* dst = columns + (size_t)t * width + k * in;
+            if (src >= 0) {
+                memcpy(dst, inputs + (size_t)src * in, in * sizeof(float));
+            } else if (stream != NULL) {
+                memcpy(dst, conv1d_stream_frame(stream, -src - 1), in * sizeof(float));
+            } else {
+                memset(dst, 0, in * sizeof(float));
+            }
+        }
+    }
+    for (int t = 0; t < seq_len; t++) {
+        memcpy(outputs + (size_t)t * out, layer->weights.bias, out * sizeof(float));
+    }
+    gemm(seq_len, out, width, 1.0f, columns, width, layer->weights.weights, out, 1.0f, outputs, out);
+    free(columns);
+
+    if (stream != NULL) {
+        int first = (seq_len > stream->frames) ? seq_len - stream->frames : 0;
+        for (int t = first; t < seq_len; t++) {
+            conv1d_stream_push(stream, inputs + (size_t)t * in);
+        }
+    }
+    return MATH_SUCCESS;
+}
+
+// TCN block
+
+static void relu_inplace(float* x, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+        x[i] = (x[i] > 0.0f) ? x[i] : 0.0f;
+    }
+}
+
+MathStatus init_tcn_block(TCNBlock* block, int in_channels, int channels, int kernel_size, int dilation) {
+    if (block == NULL) {
+        return MATH_NULL_POINTER;
+    }
+    if (in_channels <= 0 || channels <= 0 || kernel_size <= 0 || dilation <= 0) {
+        return MATH_INVALID_DIM;
+    }
+    init_conv1d_layer(&block->conv1, in_channels, channels, kernel_size, dilation);
+    init_conv1d_layer(&block->conv2, channels, channels, kernel_size, dilation);
+    block->downsample = NULL;
+    if (in_channels != channels) {
+        block->downsample = (Conv1DLayer*)malloc(sizeof(Conv1DLayer));
+        if (block->downsample != NULL) {
+            init_conv1d_layer(block->downsample, in_channels, channels, 1, 1);
+        }
+    }
+    block->buffer = (float*)malloc(3 * (size_t)channels * sizeof(float));
+    if (block->buffer == NULL || (in_channels != channels && block->downsample == NULL)) {
+        free_tcn_block(block, true);
+        return MATH_NULL_POINTER;
+    }
+    return MATH_SUCCESS;
+}
+
+void free_tcn_block(TCNBlock* block, bool free_weights) {
+    free_conv1d_layer(&block->conv1, free_weights);
+    free_conv1d_layer(&block->conv2, free_weights);
+    if (block->downsample != NULL) {
+        free_conv1d_layer(block->downsample, free_weights);
+        free(block->downsample);
+        block->downsample = NULL;
+    }
+    free(block->buffer);
+    block->buffer = NULL;
+}
+
+size_t tcn_block_floats(TCNBlock* block) {
+    size_t floats = conv1d_layer_floats(&block->conv1.config) + conv1d_layer_floats(&block->conv2.config);
+    if (block->downsample != NULL) {
+        floats += conv1d_layer_floats(&block->downsample->config);
+    }
+    return floats;
+}
+
+size_t memory_map_tcn_block(TCNBlock* block, float* data_ptr) {
+    size_t ptr_offset = memory_map_conv1d_layer(&block->conv1, data_ptr);
+    ptr_offset += memory_map_conv1d_layer(&block->conv2, data_ptr + ptr_offset);
+    if (block->downsample != NULL) {
+        ptr_offset += memory_map_conv1d_layer(block->downsample, data_ptr + ptr_offset);
+    }
+    return ptr_offset;
+}
+
+MathStatus init_tcn_block_stream(TCNBlockStream* stream, TCNBlock* block) {
+    memset(stream, 0, sizeof(TCNBlockStream));
+    MathStatus status = init_conv1d_stream(&stream->conv1, &block->conv1);
+    if (status == MATH_SUCCESS) {
+        status = init_conv1d_stream(&stream->conv2, &block->conv2);
+    }
+    if (status == MATH_SUCCESS && block->downsample != NULL) {
+        status = init_conv1d_stream(&stream->downsample, block->downsample);
+    }
+    if (status != MATH_SUCCESS) {
+        free_tcn_block_stream(stream);
+    }
+    return status;
+}
+
+void free_tcn_block_stream(TCNBlockStream* stream) {
+    free_conv1d_stream(&stream->conv1);
+    free_conv1d_stream(&stream->conv2);
+    free_conv1d_stream(&stream->downsample);
+}
+
+void reset_tcn_block_stream(TCNBlockStream* stream) {
+    reset_conv1d_stream(&stream->conv1);
+    reset_conv1d_stream(&stream->conv2);
+    if (stream->downsample.ring != NULL) {
+        reset_conv1d_stream(&stream->downsample);
+    }
+}
+
+void tcn_block_step(TCNBlock* block, TCNBlockStream* stream, float* input, float* output) {
+    int channels = block->conv2.config.out_channels;
+    float* h1 = block->buffer;
+    float* h2 = h1 + channels;
+    float* residual = input;
+    conv1d_layer_step(&block->conv1, &stream->conv1, input, h1);
+    relu_inplace(h1, channels);
+    conv1d_layer_step(&block->conv2, &stream->conv2, h1, h2);
+    relu_inplace(h2, channels);
+    if (block->downsample != NULL) {
+        residual = h2 + channels;
+        conv1d_layer_step(block->downsample, &stream->downsample, input, residual);
+    }
+    for (int c = 0; c < channels; c++) {
+        float y = h2[c] + residual[c];
+        output[c] = (y > 0.0f) ? y : 0.0f;
+    }
+}
+
+MathStatus tcn_block_forward_sequence(TCNBlock* block, TCNBlockStream* stream, float* inputs, float* outputs, int seq_len) {
+    if (block == NULL || inputs == NULL || outputs == NULL) {
+        return MATH_NULL_POINTER;
+    }
+    if (seq_len <= 0) {
+        return MATH_INVALID_DIM;
+    }
+    int channels = block->conv2.config.out_channels;
+    size_t block_size = (size_t)seq_len * channels;
+    float* h1 = (float*)malloc((block->downsample != NULL ? 2 : 1) * block_size * sizeof(float));
+    if (h1 == NULL) {
+        return MATH_NULL_POINTER;
+    }
+    float* residual = inputs;
+    MathStatus status = conv1d_layer_forward_sequence(&block->conv1, stream ? &stream->conv1 : NULL, inputs, h1, seq_len);
+    if (status == MATH_SUCCESS) {
+        relu_inplace(h1, block_size);
+        status = conv1d_layer_forward_sequence(&block->conv2, stream ? &stream->conv2 : NULL, h1, outputs, seq_len);
+    }
+    if (status == MATH_SUCCESS && block->downsample != NULL) {
+        residual = h1 + block_size;
+        status = conv1d_layer_forward_sequence(block->downsample, stream ? &stream->downsample : NULL, inputs, residual, seq_len);
+    }
+    if (status != MATH_SUCCESS) {
+        free(h1);
+        return status;
+    }
+    relu_inplace(outputs, block_size);
+    for (size_t i = 0; i < block_size; i++) {
+        float y = outputs[i] + residual[i];
+        outputs[i] = (y > 0.0f) ? y : 0.0f;
+    }
+    free(h1);
+    return MATH_SUCCESS;
+}
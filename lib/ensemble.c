@@ -0,0 +1,192 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include "ensemble.h"
+#include "math_nn.h"
+#include "util.h"
+
+static int member_gates(RNNModel* model) {
+    return (model->config.cell_type == RNN_CELL_GRU) ? 3 : 4;
+}
+
+MathStatus init_model_ensemble(ModelEnsemble* ensemble, RNNModel** models, int num_models, EnsembleReduce reduce) {
+    if (ensemble == NULL || models == NULL) {
+        return MATH_NULL_POINTER;
+    }
+    if (num_models <= 0) {
+        return MATH_INVALID_DIM;
+    }
+    memset(ensemble, 0, sizeof(ModelEnsemble));
+    ensemble->num_models = num_models;
+    ensemble->models = models;
+    ensemble->reduce = reduce;
+    ensemble->input_size = models[0]->config.input_size;
+    ensemble->output_size = models[0]->config.output_size;
+    for (int m = 0; m < num_models; m++) {
+        RNNModelConfig* config = &models[m]->config;
+        if (config->input_dim != 1 || config->input_size != ensemble->input_size || config->output_size != ensemble->output_size) {
+            return MATH_INVALID_DIM;
+        }
+        // the first-layer input weights are stacked from their float32 copies
+        bool quantized = (config->cell_type == RNN_CELL_GRU)
+            ? (models[m]->gru_layers[0].weights.packed != NULL || models[m]->gru_layers[0].weights.palette != NULL)
+            : (models[m]->lstm_layers[0].weights.packed != NULL || models[m]->lstm_layers[0].weights.palette != NULL);
+        if (quantized) {
+            return MATH_INVALID_RANGE;
+        }
+    }
+
+    ensemble->columns = (int*)malloc(num_models * sizeof(int));
+    ensemble->states = (int*)malloc(num_models * sizeof(int));
+    if (ensemble->columns == NULL || ensemble->states == NULL) {
+        free_model_ensemble(ensemble);
+        return MATH_NULL_POINTER;
+    }
+    for (int m = 0; m < num_models; m++) {
+        ensemble->columns[m] = ensemble->width;
+        ensemble->states[m] = ensemble->state_size;
+        ensemble->width += member_gates(models[m]) * models[m]->config.hidden_size;
+        ensemble->state_size += rnn_model_state_size(&models[m]->config);
+    }
+    ensemble->input_weights = (float*)malloc((size_t)ensemble->input_size * ensemble->width * sizeof(float));
+    ensemble->scaled = (float*)malloc(ensemble->input_size * sizeof(float));
+    ensemble->x_proj = (float*)malloc(ensemble->width * sizeof(float));
+    ensemble->member_outputs = (float*)malloc((size_t)num_models * ensemble->output_size * sizeof(float));
+    if (ensemble->input_weights == NULL || ensemble->scaled == NULL || ensemble->x_proj == NULL || ensemble->member_outputs == NULL) {
+        free_model_ensemble(ensemble);
+        return MATH_NULL_POINTER;
+    }
+    refresh_model_ensemble(ensemble);
+    return MATH_SUCCESS;
+}
+
+void free_model_ensemble(ModelEnsemble* ensemble) {
+    free(ensemble->columns);
+    free(ensemble->states);
+    free(ensemble->input_weights);
+    free(ensemble->scaled);
+    free(ensemble->x_proj);
+    free(ensemble->member_outputs);
+    ensemble->columns = NULL;
+    ensemble->states = NULL;
+    ensemble->input_weights = NULL;
+    ensemble->scaled = NULL;
+    ensemble->x_proj = NULL;
+    ensemble->member_outputs = NULL;
+}
+
+void refresh_model_ensemble(ModelEnsemble* ensemble) {
+    int input_size = ensemble->input_size;
+    int width = ensemble->width;
+    for (int m = 0; m < ensemble->num_models; m++) {
+        RNNModel* model = ensemble->models[m];
+        int hidden_size = model->config.hidden_size;
+        float* W[4];
+        if (model->config.cell_type == RNN_CELL_GRU) {
+            GRULayerWeights* w = &model->gru_layers[0].weights;
+            W[0] = w->W_ir;
+            W[1] = w->W_iz;
+            W[2] = w->W_in;
+        } else {
+            LSTMLayerWeights* w = &model->lstm_layers[0].weights;
+            W[0] = w->W_ii;
+            W[1] = w->W_if;
+            W[2] = w->W_ig;
+            W[3] = w->W_io;
+        }
+        for (int g = 0; g < member_gates(model); g++) {
+            for (int i = 0; i < input_size; i++) {
+                memcpy(ensemble->input_weights + (size_t)i * width + ensemble->columns[m] + g * hidden_size,
+                       W[g] + (size_t)i * hidden_size, hidden_size * sizeof(float));
+            }
+        }
+    }
+}
+
+float* model_ensemble_member_state(ModelEnsemble* ensemble, float* state, int member) {
+    return state + ensemble->states[member];
+}
+
+// Every member's step from its slice of the stacked projections, then the reduction
+static void ensemble_step(ModelEnsemble* ensemble, float* x_proj, float* state, float* output) {
+    int output_size = ensemble->output_size;
+    for (int m = 0; m < ensemble->num_models; m++) {
+        RNNModel* model = ensemble->models[m];
+        float* member_state = state + ensemble->states[m];
+        float* x = x_proj + ensemble->columns[m];
+        int h = model->config.hidden_size;
+        float* hidden = rnn_model_hidden_state(model, member_state, 0);
+        if (model->config.cell_type == RNN_CELL_GRU) {
+            gru_layer_step(&model->gru_layers[0], x, x + h, x + 2 * h, hidden, hidden);
+            rnn_numerics_scan_layer(model, 0, hidden, NULL, 1);
+        } else {
+            float* cell = rnn_model_cell_state(model, member_state, 0);
+            lstm_layer_step(&model->lstm_layers[0], x, x + h, x + 2 * h, x + 3 * h, hidden, cell, hidden, cell);
+            rnn_numerics_scan_layer(model, 0, hidden, cell, 1);
+        }
+        for (int l = 1; l < model->config.num_layers; l++) {
+            rnn_model_layer_step(model, l, hidden, member_state);
+            hidden = rnn_model_hidden_state(model, member_state, l);
+        }
+        linear_layer_forward(&model->output_layer, hidden, ensemble->member_outputs + m * output_size);
+        rnn_numerics_scan_output(model, ensemble->member_outputs + m * output_size, 1, model->config.num_layers);
+    }
+
+    memset(output, 0, output_size * sizeof(float));
+    float share = 1.0f / ensemble->num_models;
+    for (int m = 0; m < ensemble->num_models; m++) {
+        float* y = ensemble->member_outputs + m * output_size;
+        if (ensemble->reduce == ENSEMBLE_MEAN) {
+            axpy(output, share, y, output_size);
+        } else {
+            int best = 0;
+            for (int k = 1; k < output_size; k++) {
+                best = (y[k] > y[best]) ? k : best;
+            }
+            output[best] += share;
+        }
+    }
+}
+
+void model_ensemble_step(ModelEnsemble* ensemble, float* input, float* state, float* output) {
+    int width = ensemble->width;
+    if (ensemble->mean != NULL) {
+        standard_scaler(ensemble->scaled, input, ensemble->input_size, ensemble->mean, ensemble->std);
+        input = ensemble->scaled;
+    }
+    memset(ensemble->x_proj, 0, width * sizeof(float));
+    for (int i = 0; i < ensemble->input_size; i++) {
+        axpy(ensemble->x_proj, input[i], ensemble->input_weights + (size_t)i * width, width);
+    }
+    ensemble_step(ensemble, ensemble->x_proj, state, output);
+}
+
+MathStatus model_ensemble_forward_sequence(ModelEnsemble* ensemble, float* inputs, float* state, float* outputs, int seq_len) {
+    if (ensemble == NULL || inputs == NULL || state == NULL || outputs == NULL) {
+        return MATH_NULL_POINTER;
+    }
+    if (seq_len <= 0) {
+        return MATH_INVALID_DIM;
+    }
+    int input_size = ensemble->input_size;
+    int width = ensemble->width;
+    size_t scaled_floats = (ensemble->mean != NULL) ? (size_t)seq_len * input_size : 0;
+    float* x_proj = (float*)malloc(((size_t)seq_len * width + scaled_floats) * sizeof(float));
+    if (x_proj == NULL) {
+        return MATH_NULL_POINTER;
+    }
+    if (ensemble->mean != NULL) {
+        float* scaled = x_proj + (size_t)seq_len * width;
+        for (int t = 0; t < seq_len; t++) {
+            standard_scaler(scaled + (size_t)t * input_size, inputs + (size_t)t * input_size, input_size, ensemble->mean, ensemble->std);
+        }
+        inputs = scaled;
+    }
+    gemm(seq_len, width, input_size, 1.0f, inputs, input_size, ensemble->input_weights, width, 0.0f, x_proj, width);
+    for (int t = 0; t < seq_len; t++) {
+        ensemble_step(ensemble, x_proj + (size_t)t * width, state, outputs + (size_t)t * ensemble->output_size);
+    }
+    free(x_proj);
+    return MATH_SUCCESS;
+}
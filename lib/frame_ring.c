@@ -0,0 +1,70 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "frame_ring.h"
+
+MathStatus init_frame_ring(FrameRing* ring, int frame_size, size_t capacity) {
+    if (ring == NULL) {
+        return MATH_NULL_POINTER;
+    }
+    if (frame_size <= 0 || capacity == 0) {
+        return MATH_INVALID_DIM;
+    }
+    memset(ring, 0, sizeof(FrameRing));
+    size_t slots = 1;
+    while (slots < capacity) {
+        slots <<= 1;
+    }
+    size_t per_line = FRAME_RING_LINE / sizeof(float);
+    ring->stride = ((size_t)frame_size + per_line - 1) / per_line * per_line;
+    ring->capacity = slots;
+    ring->mask = slots - 1;
+    ring->frame_size = frame_size;
+    // slots never share a cache line, so the producer and consumer never false share a frame
+    ring->frames = (float*)aligned_alloc(FRAME_RING_LINE, slots * ring->stride * sizeof(float));
+    if (ring->frames == NULL) {
+        fprintf(stderr, "Couldn't allocate a frame ring of %zu slots\n", slots);
+        return MATH_NULL_POINTER;
+    }
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    return MATH_SUCCESS;
+}
+
+void free_frame_ring(FrameRing* ring) {
+    free(ring->frames);
+    ring->frames = NULL;
+}
+
+float* frame_ring_acquire_write(FrameRing* ring) {
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    if (head - ring->cached_tail == ring->capacity) {
+        // looks full, refresh the consumer's index before giving up
+        ring->cached_tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+        if (head - ring->cached_tail == ring->capacity) {
+            return NULL;
+        }
+    }
+    return ring->frames + (head & ring->mask) * ring->stride;
+}
+
+void frame_ring_publish(FrameRing* ring) {
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+float* frame_ring_acquire_read(FrameRing* ring) {
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    if (tail == ring->cached_head) {
+        ring->cached_head = atomic_load_explicit(&ring->head, memory_order_acquire);
+        if (tail == ring->cached_head) {
+            return NULL;
+        }
+    }
+    return ring->frames + (tail & ring->mask) * ring->stride;
+}
+
+void frame_ring_release(FrameRing* ring) {
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+}
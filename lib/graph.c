@@ -0,0 +1,415 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include "graph.h"
+#include "math_nn.h"
+#include "util.h"
+
+static const char* graph_layer_name(GraphLayerType type) {
+    switch (type) {
+    case GRAPH_GRU: return "GRU";
+    case GRAPH_LSTM: return "LSTM";
+    case GRAPH_LINEAR: return "Linear";
+    case GRAPH_RMS_NORM: return "RMSNorm";
+    case GRAPH_SOFTMAX: return "Softmax";
+    case GRAPH_SCALER: return "Scaler";
+    case GRAPH_LSTMP: return "LSTMP";
+    }
+    return "?";
+}
+
+static bool graph_node_recurrent(GraphNode* node) {
+    return node->type == GRAPH_GRU || node->type == GRAPH_LSTM || node->type == GRAPH_LSTMP;
+}
+
+// Op kernels, one per layer type so a step never branches on the type
+
+static void run_gru(GraphNode* node, float* in, float* out, float* cell) {
+    (void)cell;
+    gru_layer_forward_inplace(&node->gru, in, out);
+}
+
+static void run_lstm(GraphNode* node, float* in, float* out, float* cell) {
+    lstm_layer_forward_inplace(&node->lstm, in, out, cell);
+}
+
+static void run_lstmp(GraphNode* node, float* in, float* out, float* cell) {
+    lstmp_layer_forward_inplace(&node->lstmp, in, out, cell);
+}
+
+static void run_linear(GraphNode* node, float* in, float* out, float* cell) {
+    (void)cell;
+    linear_layer_forward(&node->linear, in, out);
+}
+
+static void run_rms_norm(GraphNode* node, float* in, float* out, float* cell) {
+    (void)cell;
+    rms_norm(out, in, node->output_size);
+    mul(out, out, node->gain, node->output_size);
+}
+
+static void run_softmax(GraphNode* node, float* in, float* out, float* cell) {
+    (void)cell;
+    softmax(out, in, node->output_size);
+}
+
+static void run_scaler(GraphNode* node, float* in, float* out, float* cell) {
+    (void)cell;
+    standard_scaler(out, in, node->output_size, node->mean, node->std);
+}
+
+// Hands a recurrent layer's hidden state to the caller when it is the last layer
+static void run_copy(GraphNode* node, float* in, float* out, float* cell) {
+    (void)cell;
+    memcpy(out, in, node->output_size * sizeof(float));
+}
+
+static MathStatus init_graph_node(GraphNode* node, GraphLayerSpec* spec, int input_size) {
+    memset(node, 0, sizeof(GraphNode));
+    node->type = spec->type;
+    node->input_size = input_size;
+    node->output_size = input_size;
+    node->state_offset = -1;
+    node->cell_offset = -1;
+
+    switch (spec->type) {
+    case GRAPH_GRU:
+    case GRAPH_LSTM:
+    case GRAPH_LINEAR:
+        if (spec->size <= 0) {
+            return MATH_INVALID_DIM;
+        }
+        node->output_size = spec->size;
+        break;
+    case GRAPH_LSTMP:
+        if (spec->size <= 0 || spec->proj_size <= 0) {
+            return MATH_INVALID_DIM;
+        }
+        node->output_size = spec->proj_size;
+        break;
+    case GRAPH_RMS_NORM:
+    case GRAPH_SOFTMAX:
+    case GRAPH_SCALER:
+        if (input_size > MAX_DIM) {
+            return MATH_EXCEEDS_MAX_DIM; // the elementwise kernels work on bounded vectors
+        }
+        break;
+    default:
+        return MATH_INVALID_DIM;
+    }
+
+    switch (spec->type) {
+    case GRAPH_GRU:
+        init_gru_layer(&node->gru, 1, input_size, node->output_size);
+        break;
+    case GRAPH_LSTM:
+        init_lstm_layer(&node->lstm, 1, input_size, node->output_size);
+        break;
+    case GRAPH_LSTMP:
+        init_lstmp_layer(&node->lstmp, input_size, spec->size, spec->proj_size);
+        break;
+    case GRAPH_LINEAR:
+        init_linear_layer(&node->linear, input_size, node->output_size);
+        break;
+    case GRAPH_RMS_NORM:
+        node->gain = (float*)malloc(input_size * sizeof(float));
+        if (node->gain == NULL) {
+            return MATH_NULL_POINTER;
+        }
+        for (int i = 0; i < input_size; i++) {
+            node->gain[i] = 1.0f;
+        }
+        break;
+    case GRAPH_SCALER:
+        node->mean = (float*)calloc(input_size, sizeof(float));
+        node->std = (float*)malloc(input_size * sizeof(float));
+        if (node->mean == NULL || node->std == NULL) {
+            return MATH_NULL_POINTER;
+        }
+        for (int i = 0; i < input_size; i++) {
+            node->std[i] = 1.0f;
+        }
+        break;
+    case GRAPH_SOFTMAX:
+        break;
+    }
+    return MATH_SUCCESS;
+}
+
+static void free_graph_node_weights(GraphNode* node) {
+    switch (node->type) {
+    case GRAPH_GRU:
+        free_gru_layer_weights(&node->gru.weights);
+        break;
+    case GRAPH_LSTM:
+        free_lstm_layer_weights(&node->lstm.weights);
+        break;
+    case GRAPH_LSTMP:
+        free_lstmp_layer_weights(&node->lstmp.weights);
+        break;
+    case GRAPH_LINEAR:
+        free_linear_layer_weights(&node->linear.weights);
+        break;
+    default:
+        free(node->gain);
+        free(node->mean);
+        free(node->std);
+        break;
+    }
+    node->gain = NULL;
+    node->mean = NULL;
+    node->std = NULL;
+}
+
+static void free_graph_node(GraphNode* node, bool free_weights) {
+    switch (node->type) {
+    case GRAPH_GRU:
+        free_gru_layer(&node->gru, free_weights);
+        break;
+    case GRAPH_LSTM:
+        free_lstm_layer(&node->lstm, free_weights);
+        break;
+    case GRAPH_LSTMP:
+        free_lstmp_layer(&node->lstmp, free_weights);
+        break;
+    case GRAPH_LINEAR:
+        if (free_weights) {
+            free_linear_layer(&node->linear);
+        } else {
+            free_linear_layer_packed(&node->linear);
+        }
+        break;
+    default:
+        if (free_weights) {
+            free_graph_node_weights(node);
+        }
+        break;
+    }
+}
+
+static void add_graph_op(LayerGraph* graph, void (*run)(GraphNode*, float*, float*, float*), GraphNode* node,
+                         GraphSlot in, GraphSlot out, GraphSlot cell) {
+    GraphOp* op = &graph->ops[graph->num_ops++];
+    op->run = run;
+    op->node = node;
+    op->in = in;
+    op->out = out;
+    op->cell = cell;
+}
+
+// Resolve every activation to a slot. Recurrent layers write their hidden state in
+// place, so the layer above reads it from the state. Linear layers need a distinct
+// output and flip between the two arena halves; the elementwise layers run in place
+// once their input is in the arena, and copy into it when it is the caller's input or
+// a hidden state, which they must not overwrite.
+static void plan_layer_graph(LayerGraph* graph, int width) {
+    static void (*const kernels[])(GraphNode*, float*, float*, float*) = {
+        [GRAPH_GRU] = run_gru,
+        [GRAPH_LSTM] = run_lstm,
+        [GRAPH_LINEAR] = run_linear,
+        [GRAPH_RMS_NORM] = run_rms_norm,
+        [GRAPH_SOFTMAX] = run_softmax,
+        [GRAPH_SCALER] = run_scaler,
+        [GRAPH_LSTMP] = run_lstmp,
+    };
+    GraphSlot cur = {GRAPH_BUF_INPUT, 0};
+    GraphSlot none = {GRAPH_BUF_STATE, 0};
+    int last = graph->num_nodes - 1;
+
+    for (int i = 0; i <= last; i++) {
+        GraphNode* node = &graph->nodes[i];
+        GraphSlot out;
+        GraphSlot cell = none;
+        if (graph_node_recurrent(node)) {
+            out = (GraphSlot){GRAPH_BUF_STATE, node->state_offset};
+            if (node->cell_offset >= 0) {
+                cell = (GraphSlot){GRAPH_BUF_STATE, node->cell_offset};
+            }
+        } else if (i == last) {
+            out = (GraphSlot){GRAPH_BUF_OUTPUT, 0};
+        } else if (node->type != GRAPH_LINEAR && cur.buffer == GRAPH_BUF_ARENA) {
+            out = cur;
+        } else {
+            bool first_half = (cur.buffer == GRAPH_BUF_ARENA && cur.offset == 0);
+            out = (GraphSlot){GRAPH_BUF_ARENA, first_half ? width : 0};
+        }
+        add_graph_op(graph, kernels[node->type], node, cur, out, cell);
+        if (graph_node_recurrent(node)) {
+            graph->stateful_ops = graph->num_ops;
+        }
+        cur = out;
+    }
+    if (graph_node_recurrent(&graph->nodes[last])) {
+        add_graph_op(graph, run_copy, &graph->nodes[last], cur, (GraphSlot){GRAPH_BUF_OUTPUT, 0}, none);
+    }
+}
+
+MathStatus init_layer_graph(LayerGraph* graph, int input_size, GraphLayerSpec* specs, int num_layers) {
+    if (graph == NULL || specs == NULL) {
+        return MATH_NULL_POINTER;
+    }
+    if (input_size <= 0 || num_layers <= 0) {
+        return MATH_INVALID_DIM;
+    }
+    memset(graph, 0, sizeof(LayerGraph));
+    graph->input_size = input_size;
+    graph->nodes = (GraphNode*)calloc(num_layers, sizeof(GraphNode));
+    graph->ops = (GraphOp*)calloc(num_layers + 1, sizeof(GraphOp));
+    if (graph->nodes == NULL || graph->ops == NULL) {
+        free(graph->nodes);
+        free(graph->ops);
+        return MATH_NULL_POINTER;
+    }
+
+    int width = input_size;
+    int arena_width = 0;
+    int hidden = 0;
+    for (int i = 0; i < num_layers; i++) {
+        GraphNode* node = &graph->nodes[i];
+        MathStatus status = init_graph_node(node, &specs[i], width);
+        graph->num_nodes = i + 1;
+        if (status != MATH_SUCCESS) {
+            fprintf(stderr, "Invalid %s layer %d\n", graph_layer_name(specs[i].type), i);
+            free_layer_graph(graph, true);
+            return status;
+        }
+        if (graph_node_recurrent(node)) {
+            node->state_offset = hidden;
+            hidden += node->output_size;
+        } else if (node->output_size > arena_width) {
+            arena_width = node->output_size;
+        }
+        width = node->output_size;
+    }
+    // cell states follow all the hidden states, as in an RNNModel state
+    graph->state_size = hidden;
+    for (int i = 0; i < num_layers; i++) {
+        GraphNode* node = &graph->nodes[i];
+        if (node->type == GRAPH_LSTM || node->type == GRAPH_LSTMP) {
+            node->cell_offset = graph->state_size;
+            graph->state_size += (node->type == GRAPH_LSTMP) ? node->lstmp.config.hidden_size : node->output_size;
+        }
+    }
+    graph->output_size = width;
+
+    graph->arena_size = 2 * arena_width;
+    if (graph->arena_size > 0) {
+        graph->arena = (float*)calloc(graph->arena_size, sizeof(float));
+        if (graph->arena == NULL) {
+            free_layer_graph(graph, true);
+            return MATH_NULL_POINTER;
+        }
+    }
+    plan_layer_graph(graph, arena_width);
+    printf("Layer graph planned: %d layers, %d ops, %d state floats, %d arena floats\n",
+           graph->num_nodes, graph->num_ops, graph->state_size, graph->arena_size);
+    return MATH_SUCCESS;
+}
+
+void free_layer_graph(LayerGraph* graph, bool free_weights) {
+    for (int i = 0; i < graph->num_nodes; i++) {
+        free_graph_node(&graph->nodes[i], free_weights);
+    }
+    free(graph->nodes);
+    free(graph->ops);
+    free(graph->arena);
+    graph->nodes = NULL;
+    graph->ops = NULL;
+    graph->arena = NULL;
+    graph->num_nodes = 0;
+    graph->num_ops = 0;
+}
+
+static size_t graph_node_floats(GraphNode* node) {
+    size_t in = node->input_size;
+    size_t out = node->output_size;
+    switch (node->type) {
+    case GRAPH_GRU:
+        return 3 * (in * out + out * out + 2 * out);
+    case GRAPH_LSTM:
+        return 4 * (in * out + out * out + 2 * out);
+    case GRAPH_LSTMP:
+        return lstmp_layer_floats(&node->lstmp.config);
+    case GRAPH_LINEAR:
+        return in * out + out;
+    case GRAPH_RMS_NORM:
+        return out;
+    case GRAPH_SCALER:
+        return 2 * out;
+    case GRAPH_SOFTMAX:
+        return 0;
+    }
+    return 0;
+}
+
+size_t layer_graph_checkpoint_floats(LayerGraph* graph) {
+    size_t floats = 0;
+    for (int i = 0; i < graph->num_nodes; i++) {
+        floats += graph_node_floats(&graph->nodes[i]);
+    }
+    return floats;
+}
+
+size_t memory_map_layer_graph(LayerGraph* graph, float* data_ptr) {
+    size_t ptr_offset = 0;
+    for (int i = 0; i < graph->num_nodes; i++) {
+        GraphNode* node = &graph->nodes[i];
+        float* data = data_ptr + ptr_offset;
+        switch (node->type) {
+        case GRAPH_GRU:
+            memory_map_gru_layer(&node->gru, data);
+            break;
+        case GRAPH_LSTM:
+            memory_map_lstm_layer(&node->lstm, data);
+            break;
+        case GRAPH_LSTMP:
+            memory_map_lstmp_layer(&node->lstmp, data);
+            break;
+        case GRAPH_LINEAR:
+            memory_map_linear_layer(&node->linear, data);
+            break;
+        case GRAPH_RMS_NORM:
+            node->gain = data;
+            break;
+        case GRAPH_SCALER:
+            node->mean = data;
+            node->std = data + node->output_size;
+            break;
+        case GRAPH_SOFTMAX:
+            break;
+        }
+        ptr_offset += graph_node_floats(node);
+    }
+    return ptr_offset;
+}
+
+MathStatus attach_layer_graph_checkpoint(LayerGraph* graph, MappedCheckpoint* ckpt) {
+    size_t bytes = layer_graph_checkpoint_floats(graph) * sizeof(float);
+    if (ckpt->base == NULL || ckpt->size < bytes) {
+        fprintf(stderr, "Checkpoint holds %zu bytes, the graph needs %zu\n", ckpt->size, bytes);
+        return MATH_INVALID_DIM;
+    }
+    for (int i = 0; i < graph->num_nodes; i++) {
+        free_graph_node_weights(&graph->nodes[i]);
+    }
+    memory_map_layer_graph(graph, (float*)ckpt->base);
+    return MATH_SUCCESS;
+}
+
+float* layer_graph_hidden_state(LayerGraph* graph, float* state, int node) {
+    if (node < 0 || node >= graph->num_nodes || graph->nodes[node].state_offset < 0) {
+        return NULL;
+    }
+    return state + graph->nodes[node].state_offset;
+}
+
+void layer_graph_step(LayerGraph* graph, float* input, float* state, float* output) {
+    float* bases[4] = {input, state, output, graph->arena};
+    int num_ops = (output != NULL) ? graph->num_ops : graph->stateful_ops;
+    for (int i = 0; i < num_ops; i++) {
+        GraphOp* op = &graph->ops[i];
+        op->run(op->node, bases[op->in.buffer] + op->in.offset, bases[op->out.buffer] + op->out.offset,
+                bases[op->cell.buffer] + op->cell.offset);
+    }
+}
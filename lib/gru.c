@@ -13,7 +13,6 @@ void init_gru_layer_config(GRULayerConfig* config, int input_dim, int input_size
 }
 
 void init_gru_layer_weights(GRULayerWeights* weights, GRULayerConfig* config) {
-    int input_dim = config->input_dim;
     int input_size = config->input_size;
     int hidden_size = config->hidden_size;
 
@@ -23,24 +22,28 @@ void init_gru_layer_weights(GRULayerWeights* weights, GRULayerConfig* config) {
     weights->W_hr = (float*)calloc(hidden_size * hidden_size, sizeof(float));
     weights->W_hz = (float*)calloc(hidden_size * hidden_size, sizeof(float));
     weights->W_hn = (float*)calloc(hidden_size * hidden_size, sizeof(float));
-    weights->b_ir = (float*)calloc(input_dim * hidden_size, sizeof(float));
-    weights->b_iz = (float*)calloc(input_dim * hidden_size, sizeof(float));
-    weights->b_in = (float*)calloc(input_dim * hidden_size, sizeof(float));
-    weights->b_hr = (float*)calloc(input_dim * hidden_size, sizeof(float));
-    weights->b_hz = (float*)calloc(input_dim * hidden_size, sizeof(float));
-    weights->b_hn = (float*)calloc(input_dim * hidden_size, sizeof(float));
+    // one bias per unit, shared by every row of the batch
+    weights->b_ir = (float*)calloc(hidden_size, sizeof(float));
+    weights->b_iz = (float*)calloc(hidden_size, sizeof(float));
+    weights->b_in = (float*)calloc(hidden_size, sizeof(float));
+    weights->b_hr = (float*)calloc(hidden_size, sizeof(float));
+    weights->b_hz = (float*)calloc(hidden_size, sizeof(float));
+    weights->b_hn = (float*)calloc(hidden_size, sizeof(float));
+    weights->palette = NULL;
+    weights->packed = NULL;
 }
 
 void init_gru_layer_run_state(GRULayerRunState* state, GRULayerConfig* config) {
     int input_dim = config->input_dim;
     int hidden_size = config->hidden_size;
-    int input_size = config->input_size;
 
     state->hidden_state_buffer = (float*)calloc(input_dim * hidden_size, sizeof(float));
-    state->input_buffer = (float*)calloc(input_dim * input_size, sizeof(float));
     state->reset_gate_buffer = (float*)calloc(input_dim * hidden_size, sizeof(float));
     state->update_gate_buffer = (float*)calloc(input_dim * hidden_size, sizeof(float));
     state->candidate_hidden_state_buffer = (float*)calloc(input_dim * hidden_size, sizeof(float));
+    state->projection_buffer = (float*)calloc(input_dim * hidden_size, sizeof(float));
+    state->reset_hidden_buffer = (float*)calloc(input_dim * hidden_size, sizeof(float));
+    state->delta = NULL;
     // Removed allocation of hidden_cell_temp
 }
 
@@ -50,6 +53,12 @@ void init_gru_layer(GRULayer* layer, int input_dim, int input_size, int hidden_s
     init_gru_layer_run_state(&layer->state, &layer->config);
 }
 
+void init_gru_layer_batch(GRULayer* batch, GRULayer* layer, int rows) {
+    init_gru_layer_config(&batch->config, rows, layer->config.input_size, layer->config.hidden_size);
+    batch->weights = layer->weights;
+    init_gru_layer_run_state(&batch->state, &batch->config);
+}
+
 void free_gru_layer_weights(GRULayerWeights* weights) {
     free(weights->W_ir);
     free(weights->W_iz);
@@ -67,44 +76,93 @@ void free_gru_layer_weights(GRULayerWeights* weights) {
 
 void free_gru_layer_run_state(GRULayerRunState* state) {
     free(state->hidden_state_buffer);
-    free(state->input_buffer);
     free(state->reset_gate_buffer);
     free(state->update_gate_buffer);
     free(state->candidate_hidden_state_buffer);
+    free(state->projection_buffer);
+    free(state->reset_hidden_buffer);
+    if (state->delta != NULL) {
+        free(state->delta->x_ref);
+        free(state->delta->idx);
+        free(state->delta->dx);
+        free(state->delta);
+        state->delta = NULL;
+    }
     // Removed freeing of hidden_cell_temp
 }
 
 void free_gru_layer(GRULayer* layer, bool free_weights) {
     printf("Freeing GRU layer...\n");
     free_gru_layer_run_state(&layer->state);
+    free_gru_layer_palette(layer);
+    free_gru_layer_packed(layer);
 
     if (free_weights) {
         free_gru_layer_weights(&layer->weights);
     }
 }
 
-// Forward function
-void gru_layer_forward(GRULayer* layer, float* input, float* h_prev) {
+size_t memory_map_gru_layer(GRULayer* layer, float* data_ptr) {
+    size_t input_size = layer->config.input_size;
+    size_t hidden_size = layer->config.hidden_size;
+    GRULayerWeights* w = &layer->weights;
+    float** tensors[12] = {&w->W_ir, &w->W_iz, &w->W_in, &w->W_hr, &w->W_hz, &w->W_hn,
+                           &w->b_ir, &w->b_iz, &w->b_in, &w->b_hr, &w->b_hz, &w->b_hn};
+    size_t ptr_offset = 0;
+    for (int i = 0; i < 12; i++) {
+        *tensors[i] = data_ptr + ptr_offset;
+        ptr_offset += (i < 3) ? input_size * hidden_size : (i < 6) ? hidden_size * hidden_size : hidden_size;
+    }
+    return ptr_offset;
+}
+
+// out[m, p] = a[m, n] * W[n, p], using the packed panels or the palette of W when attached,
+// and the blocked GEMM for float weights once there are enough rows to amortise packing
+static void gru_project(float* out, float* a, float* W, PaletteMatrix* P, PackedMatrix* K, int m, int n, int p) {
+    if (K != NULL) {
+        matmul_packed(out, a, K, m);
+    } else if (P != NULL) {
+        matmul_palette(out, a, P, m);
+    } else if (m >= GEMM_MIN_ROWS) {
+        gemm(m, p, n, 1.0f, a, n, W, p, 0.0f, out, p);
+    } else {
+        matmul(out, a, W, m, n, p);
+    }
+}
+
+// out[r] = act(x[r] + proj[r] + b_i + b_h) for each of the rows, the biases are shared by all rows
+static void gru_gate(float* out, float* x, float* proj, float* b_i, float* b_h, int rows, int hidden_size, bool candidate) {
+    for (int r = 0; r < rows; r++) {
+        float* g = out + r * hidden_size;
+        add(g, x + r * hidden_size, b_i, hidden_size);
+        add(g, g, proj + r * hidden_size, hidden_size);
+        add(g, g, b_h, hidden_size);
+        if (candidate) {
+            tanh_act_vec(g, g, hidden_size);
+        } else {
+            sigmoid_act_vec(g, g, hidden_size);
+        }
+    }
+}
+
+// Recurrent half of a step. x_r, x_z and x_n hold the input projections of the
+// step without biases and may alias the gate buffers of the run state.
+// h_prev is fully consumed before h_out is written, so the two may alias.
+void gru_layer_step(GRULayer* layer, float* x_r, float* x_z, float* x_n, float* h_prev, float* h_out) {
     GRULayerConfig* config = &layer->config;
     GRULayerWeights* weights = &layer->weights;
     GRULayerRunState* state = &layer->state;
 
     int input_dim = config->input_dim;
-    int input_size = config->input_size;
     int hidden_size = config->hidden_size;
 
-    float* input_buffer = state->input_buffer;
-    float* hidden_state_buffer = state->hidden_state_buffer;
     float* reset_gate_buffer = state->reset_gate_buffer;
     float* update_gate_buffer = state->update_gate_buffer;
     float* candidate_hidden_state_buffer = state->candidate_hidden_state_buffer;
-    // Removed declaration of hidden_cell_temp
-
-    memcpy(input_buffer, input, input_dim * input_size * sizeof(float));
+    // projection of the previous hidden state, added on top of the input projection
+    float* h_proj = state->projection_buffer;
+    float* r_h_prev = state->reset_hidden_buffer;
 
-    float* W_ir = weights->W_ir;
-    float* W_iz = weights->W_iz;
-    float* W_in = weights->W_in;
     float* W_hr = weights->W_hr;
     float* W_hz = weights->W_hz;
     float* W_hn = weights->W_hn;
@@ -114,37 +172,354 @@ void gru_layer_forward(GRULayer* layer, float* input, float* h_prev) {
     float* b_hr = weights->b_hr;
     float* b_hz = weights->b_hz;
     float* b_hn = weights->b_hn;
-    
-
-    matmul(reset_gate_buffer, input_buffer, W_ir, input_dim, input_size, hidden_size);
-    add(reset_gate_buffer, reset_gate_buffer, b_ir, input_dim * hidden_size);
-    matmul(reset_gate_buffer, h_prev, W_hr, input_dim, hidden_size, hidden_size);
-    add(reset_gate_buffer, reset_gate_buffer, b_hr, input_dim * hidden_size);
-    sigmoid_act_vec(reset_gate_buffer, reset_gate_buffer, input_dim * hidden_size);
-
-    matmul(update_gate_buffer, input_buffer, W_iz, input_dim, input_size, hidden_size);
-    add(update_gate_buffer, update_gate_buffer, b_iz, input_dim * hidden_size);
-    matmul(update_gate_buffer, h_prev, W_hz, input_dim, hidden_size, hidden_size);
-    add(update_gate_buffer, update_gate_buffer, b_hz, input_dim * hidden_size);
-    sigmoid_act_vec(update_gate_buffer, update_gate_buffer, input_dim * hidden_size);
+    GRULayerPalette* palette = weights->palette;
+    GRULayerPacked* packed = weights->packed;
+    if (packed != NULL) {
+        b_ir = packed->b_ir;
+        b_iz = packed->b_iz;
+        b_in = packed->b_in;
+        b_hr = packed->b_hr;
+        b_hz = packed->b_hz;
+        b_hn = packed->b_hn;
+    }
 
-    matmul(candidate_hidden_state_buffer, input_buffer, W_in, input_dim, input_size, hidden_size);
-    add(candidate_hidden_state_buffer, candidate_hidden_state_buffer, b_in, input_dim * hidden_size);
+    gru_project(h_proj, h_prev, W_hr, palette ? &palette->W_hr : NULL, packed ? &packed->W_hr : NULL, input_dim, hidden_size, hidden_size);
+    gru_gate(reset_gate_buffer, x_r, h_proj, b_ir, b_hr, input_dim, hidden_size, false);
 
-    float r_h_prev[input_dim * hidden_size];
-    // for (int i = 0; i < input_dim * hidden_size; i++) {
-    //     r_h_prev[i] = reset_gate_buffer[i] * h_prev[i];
-    // }
-    mul(r_h_prev, reset_gate_buffer, h_prev, input_dim * hidden_size);
+    gru_project(h_proj, h_prev, W_hz, palette ? &palette->W_hz : NULL, packed ? &packed->W_hz : NULL, input_dim, hidden_size, hidden_size);
+    gru_gate(update_gate_buffer, x_z, h_proj, b_iz, b_hz, input_dim, hidden_size, false);
 
-    matmul(candidate_hidden_state_buffer, r_h_prev, W_hn, input_dim, hidden_size, hidden_size);
-    add(candidate_hidden_state_buffer, candidate_hidden_state_buffer, b_hn, input_dim * hidden_size);
-    tanh_act_vec(candidate_hidden_state_buffer, candidate_hidden_state_buffer, input_dim * hidden_size);
+    for (int i = 0; i < input_dim * hidden_size; i++) {
+        r_h_prev[i] = reset_gate_buffer[i] * h_prev[i];
+    }
+    gru_project(h_proj, r_h_prev, W_hn, palette ? &palette->W_hn : NULL, packed ? &packed->W_hn : NULL, input_dim, hidden_size, hidden_size);
+    gru_gate(candidate_hidden_state_buffer, x_n, h_proj, b_in, b_hn, input_dim, hidden_size, true);
 
     for (int i = 0; i < input_dim * hidden_size; i++) {
-        hidden_state_buffer[i] = update_gate_buffer[i] * h_prev[i] + (1 - update_gate_buffer[i]) * candidate_hidden_state_buffer[i];
+        h_out[i] = update_gate_buffer[i] * h_prev[i] + (1 - update_gate_buffer[i]) * candidate_hidden_state_buffer[i];
     }
 
     //below is removed for memory efficiency 
     //memcpy(hidden_state_buffer, hidden_cell_temp, input_dim * hidden_size * sizeof(float));
-}
\ No newline at end of file
+}
+
+void gru_layer_project_inputs(GRULayer* layer, float* inputs, int rows, float* x_r, float* x_z, float* x_n) {
+    GRULayerWeights* weights = &layer->weights;
+    GRULayerPalette* palette = weights->palette;
+    GRULayerPacked* packed = weights->packed;
+    int input_size = layer->config.input_size;
+    int hidden_size = layer->config.hidden_size;
+
+    gru_project(x_r, inputs, weights->W_ir, palette ? &palette->W_ir : NULL, packed ? &packed->W_ir : NULL, rows, input_size, hidden_size);
+    gru_project(x_z, inputs, weights->W_iz, palette ? &palette->W_iz : NULL, packed ? &packed->W_iz : NULL, rows, input_size, hidden_size);
+    gru_project(x_n, inputs, weights->W_in, palette ? &palette->W_in : NULL, packed ? &packed->W_in : NULL, rows, input_size, hidden_size);
+}
+
+// Delta-network step
+// The pre-activations are kept from the previous step and only corrected by the
+// weight rows of inputs, hidden units and r * h entries that changed. h_prev and
+// h_out may alias.
+static void gru_layer_delta_step(GRULayer* layer, float* input, float* h_prev, float* h_out) {
+    GRULayerWeights* weights = &layer->weights;
+    GRULayerRunState* state = &layer->state;
+    GRULayerDelta* delta = state->delta;
+    int input_size = layer->config.input_size;
+    int hidden_size = layer->config.hidden_size;
+    float* r = state->reset_gate_buffer;
+    float* z = state->update_gate_buffer;
+    float* n = state->candidate_hidden_state_buffer;
+    float* r_h_prev = state->reset_hidden_buffer;
+
+    int count = delta_encode(delta->idx, delta->dx, input, delta->x_ref, input_size, delta->threshold);
+    delta_accumulate(delta->m_r, weights->W_ir, hidden_size, delta->idx, delta->dx, count);
+    delta_accumulate(delta->m_z, weights->W_iz, hidden_size, delta->idx, delta->dx, count);
+    delta_accumulate(delta->m_xn, weights->W_in, hidden_size, delta->idx, delta->dx, count);
+    delta->skipped += input_size - count;
+
+    count = delta_encode(delta->idx, delta->dx, h_prev, delta->h_ref, hidden_size, delta->threshold);
+    delta_accumulate(delta->m_r, weights->W_hr, hidden_size, delta->idx, delta->dx, count);
+    delta_accumulate(delta->m_z, weights->W_hz, hidden_size, delta->idx, delta->dx, count);
+    delta->skipped += hidden_size - count;
+
+    sigmoid_act_vec(r, delta->m_r, hidden_size);
+    sigmoid_act_vec(z, delta->m_z, hidden_size);
+    mul(r_h_prev, r, h_prev, hidden_size);
+
+    count = delta_encode(delta->idx, delta->dx, r_h_prev, delta->rh_ref, hidden_size, delta->threshold);
+    delta_accumulate(delta->m_hn, weights->W_hn, hidden_size, delta->idx, delta->dx, count);
+    delta->skipped += hidden_size - count;
+    delta->columns += input_size + 2 * hidden_size;
+
+    add(n, delta->m_xn, delta->m_hn, hidden_size);
+    tanh_act_vec(n, n, hidden_size);
+    for (int i = 0; i < hidden_size; i++) {
+        h_out[i] = z[i] * h_prev[i] + (1 - z[i]) * n[i];
+    }
+}
+
+// Forward function
+void gru_layer_forward(GRULayer* layer, float* input, float* h_prev) {
+    GRULayerConfig* config = &layer->config;
+    GRULayerRunState* state = &layer->state;
+
+    if (state->delta != NULL) {
+        gru_layer_delta_step(layer, input, h_prev, state->hidden_state_buffer);
+        return;
+    }
+    gru_layer_project_inputs(layer, input, config->input_dim,
+                             state->reset_gate_buffer, state->update_gate_buffer, state->candidate_hidden_state_buffer);
+    gru_layer_step(layer, state->reset_gate_buffer, state->update_gate_buffer, state->candidate_hidden_state_buffer, h_prev, state->hidden_state_buffer);
+}
+
+// Forward function updating h in place, for callers that own the recurrent state
+void gru_layer_forward_inplace(GRULayer* layer, float* input, float* h) {
+    GRULayerRunState* state = &layer->state;
+    if (state->delta != NULL) {
+        gru_layer_delta_step(layer, input, h, h);
+        return;
+    }
+
+    gru_layer_project_inputs(layer, input, layer->config.input_dim,
+                             state->reset_gate_buffer, state->update_gate_buffer, state->candidate_hidden_state_buffer);
+    gru_layer_step(layer, state->reset_gate_buffer, state->update_gate_buffer, state->candidate_hidden_state_buffer, h, h);
+}
+
+// Sequence forward function
+// The input projections of all seq_len steps are hoisted into three
+// [seq_len * input_dim x hidden_size] GEMMs, only the recurrent half runs per step.
+MathStatus gru_layer_forward_sequence(GRULayer* layer, float* inputs, float* h0, float* outputs, int seq_len) {
+    int input_dim = layer->config.input_dim;
+    int hidden_size = layer->config.hidden_size;
+    int rows = seq_len * input_dim;
+    int step = input_dim * hidden_size;
+
+    float* x_proj = (float*)malloc(3 * (size_t)rows * hidden_size * sizeof(float));
+    if (x_proj == NULL) {
+        fprintf(stderr, "gru_layer_forward_sequence: out of memory\n");
+        return MATH_NULL_POINTER;
+    }
+    float* x_r = x_proj;
+    float* x_z = x_r + (size_t)rows * hidden_size;
+    float* x_n = x_z + (size_t)rows * hidden_size;
+    gru_layer_project_inputs(layer, inputs, rows, x_r, x_z, x_n);
+
+    float* h_prev = h0;
+    for (int t = 0; t < seq_len; t++) {
+        gru_layer_step(layer, x_r + t * step, x_z + t * step, x_n + t * step, h_prev, outputs + t * step);
+        h_prev = outputs + t * step;
+    }
+    free(x_proj);
+    return MATH_SUCCESS;
+}
+
+// Delta-network mode
+MathStatus enable_gru_layer_delta(GRULayer* layer, float threshold) {
+    GRULayerWeights* weights = &layer->weights;
+    if (weights->W_ir == NULL || weights->W_hr == NULL || weights->b_ir == NULL) {
+        return MATH_NULL_POINTER; // runs on the float32 weights, not on packed or palettized copies
+    }
+    if (layer->config.input_dim != 1 || threshold < 0.0f) {
+        return MATH_INVALID_DIM;
+    }
+    disable_gru_layer_delta(layer);
+    int input_size = layer->config.input_size;
+    int hidden_size = layer->config.hidden_size;
+    int widest = (input_size > hidden_size) ? input_size : hidden_size;
+    GRULayerDelta* delta = (GRULayerDelta*)calloc(1, sizeof(GRULayerDelta));
+    if (delta == NULL) {
+        return MATH_NULL_POINTER;
+    }
+    // one block for the references and the pre-activations
+    delta->x_ref = (float*)malloc((input_size + 6 * hidden_size) * sizeof(float));
+    delta->idx = (int*)malloc(widest * sizeof(int));
+    delta->dx = (float*)malloc(widest * sizeof(float));
+    if (delta->x_ref == NULL || delta->idx == NULL || delta->dx == NULL) {
+        free(delta->x_ref);
+        free(delta->idx);
+        free(delta->dx);
+        free(delta);
+        return MATH_NULL_POINTER;
+    }
+    delta->h_ref = delta->x_ref + input_size;
+    delta->rh_ref = delta->h_ref + hidden_size;
+    delta->m_r = delta->rh_ref + hidden_size;
+    delta->m_z = delta->m_r + hidden_size;
+    delta->m_xn = delta->m_z + hidden_size;
+    delta->m_hn = delta->m_xn + hidden_size;
+    delta->threshold = threshold;
+    layer->state.delta = delta;
+    reset_gru_layer_delta(layer);
+    return MATH_SUCCESS;
+}
+
+void reset_gru_layer_delta(GRULayer* layer) {
+    GRULayerDelta* delta = layer->state.delta;
+    if (delta == NULL) {
+        return;
+    }
+    GRULayerWeights* weights = &layer->weights;
+    int hidden_size = layer->config.hidden_size;
+    // with all references at zero the pre-activations are just the biases
+    memset(delta->x_ref, 0, (layer->config.input_size + 2 * hidden_size) * sizeof(float));
+    add(delta->m_r, weights->b_ir, weights->b_hr, hidden_size);
+    add(delta->m_z, weights->b_iz, weights->b_hz, hidden_size);
+    memcpy(delta->m_xn, weights->b_in, hidden_size * sizeof(float));
+    memcpy(delta->m_hn, weights->b_hn, hidden_size * sizeof(float));
+    delta->columns = 0;
+    delta->skipped = 0;
+}
+
+void disable_gru_layer_delta(GRULayer* layer) {
+    GRULayerDelta* delta = layer->state.delta;
+    if (delta == NULL) {
+        return;
+    }
+    free(delta->x_ref);
+    free(delta->idx);
+    free(delta->dx);
+    free(delta);
+    layer->state.delta = NULL;
+}
+
+float gru_layer_delta_skip_ratio(GRULayer* layer) {
+    GRULayerDelta* delta = layer->state.delta;
+    if (delta == NULL || delta->columns == 0) {
+        return 0.0f;
+    }
+    return (float)delta->skipped / (float)delta->columns;
+}
+
+// Palettized weights
+// The six matrices are handled in checkpoint order: W_ir, W_iz, W_in, W_hr, W_hz, W_hn
+static void gru_palette_slots(GRULayer* layer, GRULayerPalette* palette, float** dense, PaletteMatrix** packed, int* rows) {
+    GRULayerWeights* weights = &layer->weights;
+    float* all_dense[6] = {weights->W_ir, weights->W_iz, weights->W_in, weights->W_hr, weights->W_hz, weights->W_hn};
+    PaletteMatrix* all_packed[6] = {&palette->W_ir, &palette->W_iz, &palette->W_in, &palette->W_hr, &palette->W_hz, &palette->W_hn};
+    for (int i = 0; i < 6; i++) {
+        dense[i] = all_dense[i];
+        packed[i] = all_packed[i];
+        rows[i] = (i < 3) ? layer->config.input_size : layer->config.hidden_size;
+    }
+}
+
+MathStatus palettize_gru_layer(GRULayer* layer, bool per_row, int iterations) {
+    free_gru_layer_palette(layer);
+    GRULayerPalette* palette = (GRULayerPalette*)calloc(1, sizeof(GRULayerPalette));
+    if (palette == NULL) {
+        return MATH_NULL_POINTER;
+    }
+
+    float* dense[6];
+    PaletteMatrix* packed[6];
+    int rows[6];
+    gru_palette_slots(layer, palette, dense, packed, rows);
+    for (int i = 0; i < 6; i++) {
+        MathStatus status = palettize_matrix(packed[i], dense[i], rows[i], layer->config.hidden_size, per_row, iterations);
+        if (status != MATH_SUCCESS) {
+            layer->weights.palette = palette;
+            free_gru_layer_palette(layer);
+            return status;
+        }
+    }
+    layer->weights.palette = palette;
+    return MATH_SUCCESS;
+}
+
+size_t map_gru_layer_palette(GRULayer* layer, void* data, bool per_row) {
+    free_gru_layer_palette(layer);
+    GRULayerPalette* palette = (GRULayerPalette*)calloc(1, sizeof(GRULayerPalette));
+    if (palette == NULL) {
+        return 0;
+    }
+
+    float* dense[6];
+    PaletteMatrix* packed[6];
+    int rows[6];
+    gru_palette_slots(layer, palette, dense, packed, rows);
+    size_t offset = 0;
+    for (int i = 0; i < 6; i++) {
+        offset += map_palette_matrix(packed[i], (uint8_t*)data + offset, rows[i], layer->config.hidden_size, per_row ? rows[i] : 1);
+    }
+    layer->weights.palette = palette;
+    return offset;
+}
+
+size_t write_gru_layer_palette(FILE* file, GRULayer* layer) {
+    GRULayerPalette* palette = layer->weights.palette;
+    if (palette == NULL) {
+        return 0;
+    }
+    float* dense[6];
+    PaletteMatrix* packed[6];
+    int rows[6];
+    gru_palette_slots(layer, palette, dense, packed, rows);
+    size_t written = 0;
+    for (int i = 0; i < 6; i++) {
+        written += write_palette_matrix(file, packed[i]);
+    }
+    return written;
+}
+
+void free_gru_layer_palette(GRULayer* layer) {
+    GRULayerPalette* palette = layer->weights.palette;
+    if (palette == NULL) {
+        return;
+    }
+    free_palette_matrix(&palette->W_ir);
+    free_palette_matrix(&palette->W_iz);
+    free_palette_matrix(&palette->W_in);
+    free_palette_matrix(&palette->W_hr);
+    free_palette_matrix(&palette->W_hz);
+    free_palette_matrix(&palette->W_hn);
+    free(palette);
+    layer->weights.palette = NULL;
+}
+
+// Panel-packed weights
+size_t gru_layer_packed_bytes(GRULayerConfig* config) {
+    int input_size = config->input_size;
+    int hidden_size = config->hidden_size;
+    return 3 * packed_matrix_bytes(input_size, hidden_size)
+         + 3 * packed_matrix_bytes(hidden_size, hidden_size)
+         + 6 * packed_vector_bytes(hidden_size);
+}
+
+MathStatus pack_gru_layer(GRULayer* layer, PackArena* arena) {
+    free_gru_layer_packed(layer);
+    GRULayerPacked* packed = (GRULayerPacked*)calloc(1, sizeof(GRULayerPacked));
+    if (packed == NULL) {
+        return MATH_NULL_POINTER;
+    }
+    GRULayerWeights* weights = &layer->weights;
+    int input_size = layer->config.input_size;
+    int hidden_size = layer->config.hidden_size;
+    int bias_size = hidden_size;
+
+    MathStatus status = MATH_SUCCESS;
+    float* dense[6] = {weights->W_ir, weights->W_iz, weights->W_in, weights->W_hr, weights->W_hz, weights->W_hn};
+    PackedMatrix* panels[6] = {&packed->W_ir, &packed->W_iz, &packed->W_in, &packed->W_hr, &packed->W_hz, &packed->W_hn};
+    for (int i = 0; i < 6 && status == MATH_SUCCESS; i++) {
+        status = pack_matrix(panels[i], arena, dense[i], (i < 3) ? input_size : hidden_size, hidden_size);
+    }
+    packed->b_ir = pack_vector(arena, weights->b_ir, bias_size);
+    packed->b_iz = pack_vector(arena, weights->b_iz, bias_size);
+    packed->b_in = pack_vector(arena, weights->b_in, bias_size);
+    packed->b_hr = pack_vector(arena, weights->b_hr, bias_size);
+    packed->b_hz = pack_vector(arena, weights->b_hz, bias_size);
+    packed->b_hn = pack_vector(arena, weights->b_hn, bias_size);
+    if (status == MATH_SUCCESS && packed->b_hn == NULL) {
+        status = MATH_EXCEEDS_MAX_DIM;
+    }
+    if (status != MATH_SUCCESS) {
+        free(packed);
+        return status;
+    }
+    weights->packed = packed;
+    return MATH_SUCCESS;
+}
+
+void free_gru_layer_packed(GRULayer* layer) {
+    // the panels belong to the arena, only the descriptor is owned by the layer
+    free(layer->weights.packed);
+    layer->weights.packed = NULL;
+}
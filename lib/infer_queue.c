@@ -0,0 +1,272 @@
+#define _POSIX_C_SOURCE 200809L // sem_timedwait, clock_gettime
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <sched.h>
+#include <time.h>
+#include "infer_queue.h"
+#include "math_nn.h"
+
+static double now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+// Intrusive MPSC queue with a stub node (Vyukov): producers only swap the tail,
+// the single consumer walks from the head.
+static void queue_push(InferQueue* queue, InferRequest* request) {
+    atomic_store_explicit(&request->next, NULL, memory_order_relaxed);
+    InferRequest* prev = atomic_exchange_explicit(&queue->tail, request, memory_order_acq_rel);
+    atomic_store_explicit(&prev->next, request, memory_order_release);
+}
+
+// NULL when empty, or when a producer has swapped the tail but not linked yet
+static InferRequest* queue_pop(InferQueue* queue) {
+    InferRequest* head = queue->head;
+    InferRequest* next = atomic_load_explicit(&head->next, memory_order_acquire);
+    if (head == &queue->stub) {
+        if (next == NULL) {
+            return NULL;
+        }
+        queue->head = next;
+        head = next;
+        next = atomic_load_explicit(&head->next, memory_order_acquire);
+    }
+    if (next != NULL) {
+        queue->head = next;
+        return head;
+    }
+    if (head != atomic_load_explicit(&queue->tail, memory_order_acquire)) {
+        return NULL;
+    }
+    // head is the last real node, put the stub behind it so it can be handed out
+    queue_push(queue, &queue->stub);
+    next = atomic_load_explicit(&head->next, memory_order_acquire);
+    if (next != NULL) {
+        queue->head = next;
+        return head;
+    }
+    return NULL;
+}
+
+// Take one counted request, NULL once the queue is drained after a stop
+static InferRequest* take_request(InferQueue* queue) {
+    InferRequest* request;
+    while ((request = queue_pop(queue)) == NULL) {
+        if (!atomic_load(&queue->running)) {
+            return NULL; // the count was the stop token
+        }
+        sched_yield(); // a producer is between its swap and its link
+    }
+    return request;
+}
+
+static void complete_request(InferQueue* queue, InferRequest* request, MathStatus status) {
+    request->status = status;
+    request->complete_us = now_us();
+    if (request->callback != NULL) {
+        request->callback(request, request->ctx);
+    }
+    atomic_store(&request->done, true);
+    pthread_mutex_lock(&queue->done_lock);
+    pthread_cond_broadcast(&queue->done_cond);
+    pthread_mutex_unlock(&queue->done_lock);
+}
+
+static bool batch_has_stream(InferRequest** batch, int count, uint64_t stream_id) {
+    for (int i = 0; i < count; i++) {
+        if (batch[i]->stream_id == stream_id) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void run_batch(InferQueue* queue, InferRequest** batch, int count) {
+    RNNModelConfig* config = &queue->sessions->model->config;
+    uint64_t stream_ids[count];
+    int rows = 0;
+    for (int i = 0; i < count; i++) {
+        if (session_state(queue->sessions, batch[i]->stream_id) == NULL) {
+            complete_request(queue, batch[i], MATH_INVALID_RANGE);
+            continue;
+        }
+        batch[rows] = batch[i];
+        stream_ids[rows] = batch[i]->stream_id;
+        memcpy(queue->inputs + rows * config->input_size, batch[i]->input, config->input_size * sizeof(float));
+        rows++;
+    }
+    if (rows == 0) {
+        return;
+    }
+    MathStatus status = session_step_batch(queue->sessions, &queue->batch, rows, stream_ids, queue->inputs, queue->outputs);
+    if (status == MATH_SUCCESS) {
+        queue->batches++;
+        queue->requests += rows;
+    }
+    for (int i = 0; i < rows; i++) {
+        // a failed step leaves the outputs undefined, callers only get the status
+        if (status == MATH_SUCCESS && batch[i]->output != NULL) {
+            memcpy(batch[i]->output, queue->outputs + i * config->output_size, config->output_size * sizeof(float));
+        }
+        complete_request(queue, batch[i], status);
+    }
+}
+
+static void* batcher_main(void* arg) {
+    InferQueue* queue = (InferQueue*)arg;
+    InferRequest* batch[queue->max_batch];
+    bool stopping = false;
+
+    while (true) {
+        int count = 0;
+        // requests deferred from the last batch go first, keeping per-stream order
+        InferRequest** link = &queue->carry;
+        while (*link != NULL && count < queue->max_batch) {
+            InferRequest* request = *link;
+            if (batch_has_stream(batch, count, request->stream_id)) {
+                link = &request->defer_next;
+                continue;
+            }
+            *link = request->defer_next;
+            batch[count++] = request;
+        }
+        InferRequest** carry_tail = &queue->carry;
+        while (*carry_tail != NULL) {
+            carry_tail = &(*carry_tail)->defer_next;
+        }
+
+        if (count == 0) {
+            if (stopping) {
+                break;
+            }
+            if (atomic_load(&queue->running)) {
+                sem_wait(&queue->pending);
+            } else if (sem_trywait(&queue->pending) != 0) {
+                break;
+            }
+            InferRequest* request = take_request(queue);
+            if (request == NULL) {
+                stopping = true;
+                continue;
+            }
+            batch[count++] = request;
+        }
+
+        // gather more until the batch is full or the oldest request hits its deadline
+        double deadline = batch[0]->submit_us + queue->max_delay_us;
+        while (count < queue->max_batch && !stopping) {
+            double remaining = deadline - now_us();
+            int got;
+            if (remaining <= 0.0 || !atomic_load(&queue->running)) {
+                got = sem_trywait(&queue->pending);
+            } else {
+                struct timespec ts;
+                clock_gettime(CLOCK_REALTIME, &ts);
+                long long ns = ts.tv_nsec + (long long)(remaining * 1e3);
+                ts.tv_sec += ns / 1000000000LL;
+                ts.tv_nsec = ns % 1000000000LL;
+                while ((got = sem_timedwait(&queue->pending, &ts)) != 0 && errno == EINTR) {
+                }
+            }
+            if (got != 0) {
+                break;
+            }
+            InferRequest* request = take_request(queue);
+            if (request == NULL) {
+                stopping = true;
+                break;
+            }
+            if (batch_has_stream(batch, count, request->stream_id)) {
+                // a second step of a stream waits for the next batch
+                request->defer_next = NULL;
+                *carry_tail = request;
+                carry_tail = &request->defer_next;
+                continue;
+            }
+            batch[count++] = request;
+        }
+        run_batch(queue, batch, count);
+    }
+    return NULL;
+}
+
+MathStatus start_infer_queue(InferQueue* queue, SessionManager* sessions, int max_batch, int max_delay_us) {
+    if (queue == NULL || sessions == NULL) {
+        return MATH_NULL_POINTER;
+    }
+    if (max_batch <= 0 || max_delay_us < 0) {
+        return MATH_INVALID_DIM;
+    }
+    memset(queue, 0, sizeof(InferQueue));
+    queue->sessions = sessions;
+    queue->max_batch = max_batch;
+    queue->max_delay_us = max_delay_us;
+    MathStatus status = init_rnn_batch(&queue->batch, sessions->model, max_batch);
+    if (status != MATH_SUCCESS) {
+        return status;
+    }
+    RNNModelConfig* config = &sessions->model->config;
+    queue->inputs = (float*)malloc((size_t)max_batch * config->input_size * sizeof(float));
+    queue->outputs = (float*)malloc((size_t)max_batch * config->output_size * sizeof(float));
+    if (queue->inputs == NULL || queue->outputs == NULL) {
+        free(queue->inputs);
+        free(queue->outputs);
+        free_rnn_batch(&queue->batch);
+        return MATH_NULL_POINTER;
+    }
+
+    atomic_store(&queue->stub.next, NULL);
+    atomic_store(&queue->tail, &queue->stub);
+    queue->head = &queue->stub;
+    sem_init(&queue->pending, 0, 0);
+    pthread_mutex_init(&queue->done_lock, NULL);
+    pthread_cond_init(&queue->done_cond, NULL);
+    atomic_store(&queue->running, true);
+    if (pthread_create(&queue->thread, NULL, batcher_main, queue) != 0) {
+        fprintf(stderr, "Couldn't start the batcher thread\n");
+        atomic_store(&queue->running, false);
+        sem_destroy(&queue->pending);
+        pthread_mutex_destroy(&queue->done_lock);
+        pthread_cond_destroy(&queue->done_cond);
+        free(queue->inputs);
+        free(queue->outputs);
+        free_rnn_batch(&queue->batch);
+        return MATH_NULL_POINTER;
+    }
+    return MATH_SUCCESS;
+}
+
+void stop_infer_queue(InferQueue* queue) {
+    atomic_store(&queue->running, false);
+    sem_post(&queue->pending); // stop token, wakes an idle batcher
+    pthread_join(queue->thread, NULL);
+    sem_destroy(&queue->pending);
+    pthread_mutex_destroy(&queue->done_lock);
+    pthread_cond_destroy(&queue->done_cond);
+    free(queue->inputs);
+    free(queue->outputs);
+    free_rnn_batch(&queue->batch);
+    queue->inputs = NULL;
+    queue->outputs = NULL;
+}
+
+void infer_submit(InferQueue* queue, InferRequest* request) {
+    atomic_store(&request->done, false);
+    request->status = MATH_SUCCESS;
+    request->submit_us = now_us();
+    queue_push(queue, request);
+    sem_post(&queue->pending);
+}
+
+MathStatus infer_wait(InferQueue* queue, InferRequest* request) {
+    pthread_mutex_lock(&queue->done_lock);
+    while (!atomic_load(&request->done)) {
+        pthread_cond_wait(&queue->done_cond, &queue->done_lock);
+    }
+    pthread_mutex_unlock(&queue->done_lock);
+    return request->status;
+}
@@ -0,0 +1,255 @@
+#define _POSIX_C_SOURCE 200809L // pread, posix_fadvise, clock_gettime
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/stat.h>
+#include "layer_stream.h"
+
+#define STREAM_ALIGN 64
+
+static double now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static MathStatus read_range(int fd, void* dst, size_t bytes, size_t offset) {
+    size_t done = 0;
+    while (done < bytes) {
+        ssize_t got = pread(fd, (char*)dst + done, bytes - done, (off_t)(offset + done));
+        if (got <= 0) {
+            return MATH_INVALID_RANGE;
+        }
+        done += (size_t)got;
+    }
+    return MATH_SUCCESS;
+}
+
+static size_t layer_bytes(LayerStream* stream, int layer) {
+    return rnn_model_layer_floats(&stream->model->config, layer) * sizeof(float);
+}
+
+// Leave a layer without weights between steps, its slot is recycled by the loader
+static void unmap_stream_layer(RNNModel* model, int layer) {
+    if (model->config.cell_type == RNN_CELL_GRU) {
+        memset(&model->gru_layers[layer].weights, 0, sizeof(GRULayerWeights));
+    } else {
+        memset(&model->lstm_layers[layer].weights, 0, sizeof(LSTMLayerWeights));
+    }
+}
+
+static void* loader_main(void* arg) {
+    LayerStream* stream = (LayerStream*)arg;
+    int num_layers = stream->model->config.num_layers;
+
+    pthread_mutex_lock(&stream->lock);
+    while (true) {
+        while (stream->running && stream->loaded - stream->released >= stream->depth) {
+            pthread_cond_wait(&stream->cond, &stream->lock);
+        }
+        if (!stream->running) {
+            break;
+        }
+        long k = stream->loaded;
+        pthread_mutex_unlock(&stream->lock);
+
+        int layer = (int)(k % num_layers);
+        int slot = (int)(k % stream->depth);
+        MathStatus status = MATH_SUCCESS;
+        size_t bytes = 0;
+        // with one slot per layer every layer stays where it was loaded
+        if (stream->slot_layer[slot] != layer) {
+            bytes = layer_bytes(stream, layer);
+            status = read_range(stream->fd, stream->slots + slot * stream->slot_floats, bytes, stream->offsets[layer]);
+            // drop the file pages, the slot is the only resident copy
+            posix_fadvise(stream->fd, (off_t)stream->offsets[layer], (off_t)bytes, POSIX_FADV_DONTNEED);
+            // and let the disk start on the layer after this one
+            int next = (layer + 1) % num_layers;
+            posix_fadvise(stream->fd, (off_t)stream->offsets[next], (off_t)layer_bytes(stream, next), POSIX_FADV_WILLNEED);
+        }
+
+        pthread_mutex_lock(&stream->lock);
+        if (status != MATH_SUCCESS) {
+            fprintf(stderr, "Couldn't read layer %d of the streamed checkpoint\n", layer);
+            stream->error = status;
+            pthread_cond_broadcast(&stream->cond);
+            break;
+        }
+        if (bytes > 0) {
+            stream->reads++;
+            stream->bytes_read += bytes;
+        }
+        stream->slot_layer[slot] = layer;
+        stream->loaded++;
+        pthread_cond_broadcast(&stream->cond);
+    }
+    pthread_mutex_unlock(&stream->lock);
+    return NULL;
+}
+
+MathStatus open_layer_stream(LayerStream* stream, RNNModel* model, char* path, int depth) {
+    if (stream == NULL || model == NULL || path == NULL) {
+        return MATH_NULL_POINTER;
+    }
+    RNNModelConfig* config = &model->config;
+    int num_layers = config->num_layers;
+    if (depth <= 0) {
+        return MATH_INVALID_DIM;
+    }
+    for (int l = 0; l < num_layers; l++) {
+        bool quantized = (config->cell_type == RNN_CELL_GRU)
+            ? (model->gru_layers[l].weights.packed != NULL || model->gru_layers[l].weights.palette != NULL)
+            : (model->lstm_layers[l].weights.packed != NULL || model->lstm_layers[l].weights.palette != NULL);
+        if (quantized) {
+            return MATH_INVALID_RANGE; // streamed weights are float32 in checkpoint layout
+        }
+    }
+    memset(stream, 0, sizeof(LayerStream));
+    stream->model = model;
+    stream->depth = depth < num_layers ? depth : num_layers;
+
+    stream->fd = open(path, O_RDONLY);
+    if (stream->fd == -1) {
+        fprintf(stderr, "Couldn't open file %s\n", path);
+        return MATH_NULL_POINTER;
+    }
+    stream->offsets = (size_t*)malloc((num_layers + 1) * sizeof(size_t));
+    stream->slot_layer = (int*)malloc(stream->depth * sizeof(int));
+    if (stream->offsets == NULL || stream->slot_layer == NULL) {
+        close_layer_stream(stream);
+        return MATH_NULL_POINTER;
+    }
+    size_t offset = 0;
+    for (int l = 0; l <= num_layers; l++) {
+        stream->offsets[l] = offset;
+        offset += layer_bytes(stream, l);
+        if (l < num_layers && rnn_model_layer_floats(config, l) > stream->slot_floats) {
+            stream->slot_floats = rnn_model_layer_floats(config, l);
+        }
+    }
+    struct stat st;
+    if (fstat(stream->fd, &st) != 0) {
+        st.st_size = 0;
+    }
+    if ((size_t)st.st_size < offset) {
+        fprintf(stderr, "%s holds %lld bytes, the model needs %zu\n", path, (long long)st.st_size, offset);
+        close(stream->fd);
+        free(stream->offsets);
+        free(stream->slot_layer);
+        return MATH_INVALID_DIM;
+    }
+    // keep every slot on a cache line boundary
+    stream->slot_floats = (stream->slot_floats + STREAM_ALIGN / sizeof(float) - 1) / (STREAM_ALIGN / sizeof(float))
+                          * (STREAM_ALIGN / sizeof(float));
+    stream->slots = (float*)aligned_alloc(STREAM_ALIGN, stream->depth * stream->slot_floats * sizeof(float));
+    stream->output_weights = (float*)malloc(layer_bytes(stream, num_layers));
+    if (stream->slots == NULL || stream->output_weights == NULL
+        || read_range(stream->fd, stream->output_weights, layer_bytes(stream, num_layers), stream->offsets[num_layers]) != MATH_SUCCESS) {
+        close_layer_stream(stream);
+        return MATH_NULL_POINTER;
+    }
+    for (int s = 0; s < stream->depth; s++) {
+        stream->slot_layer[s] = -1;
+    }
+    posix_fadvise(stream->fd, 0, (off_t)offset, POSIX_FADV_SEQUENTIAL);
+
+    pthread_mutex_init(&stream->lock, NULL);
+    pthread_cond_init(&stream->cond, NULL);
+    stream->running = true;
+    if (pthread_create(&stream->thread, NULL, loader_main, stream) != 0) {
+        fprintf(stderr, "Couldn't start the layer loader thread\n");
+        stream->running = false;
+        pthread_mutex_destroy(&stream->lock);
+        pthread_cond_destroy(&stream->cond);
+        close_layer_stream(stream);
+        return MATH_NULL_POINTER;
+    }
+
+    // the stream holds the only copy of the weights from here on, as in attach_rnn_checkpoint
+    for (int l = 0; l < num_layers; l++) {
+        if (config->cell_type == RNN_CELL_GRU) {
+            free_gru_layer_weights(&model->gru_layers[l].weights);
+        } else {
+            free_lstm_layer_weights(&model->lstm_layers[l].weights);
+        }
+        unmap_stream_layer(model, l);
+    }
+    free_linear_layer_weights(&model->output_layer.weights);
+    memory_map_rnn_layer(model, num_layers, stream->output_weights);
+    return MATH_SUCCESS;
+}
+
+void close_layer_stream(LayerStream* stream) {
+    if (stream->running) {
+        pthread_mutex_lock(&stream->lock);
+        stream->running = false;
+        pthread_cond_broadcast(&stream->cond);
+        pthread_mutex_unlock(&stream->lock);
+        pthread_join(stream->thread, NULL);
+        pthread_mutex_destroy(&stream->lock);
+        pthread_cond_destroy(&stream->cond);
+    }
+    if (stream->fd >= 0) {
+        close(stream->fd);
+    }
+    free(stream->offsets);
+    free(stream->slot_layer);
+    free(stream->slots);
+    if (stream->model != NULL && stream->model->output_layer.weights.weights == stream->output_weights) {
+        stream->model->output_layer.weights.weights = NULL;
+        stream->model->output_layer.weights.bias = NULL;
+    }
+    free(stream->output_weights);
+    stream->offsets = NULL;
+    stream->slot_layer = NULL;
+    stream->slots = NULL;
+    stream->output_weights = NULL;
+    stream->fd = -1;
+}
+
+MathStatus layer_stream_step(LayerStream* stream, float* input, float* state, float* output) {
+    RNNModel* model = stream->model;
+    int num_layers = model->config.num_layers;
+    float* inter_input = input;
+
+    for (int l = 0; l < num_layers; l++) {
+        long k = stream->released; // every step consumes loads l = k % num_layers in order
+        pthread_mutex_lock(&stream->lock);
+        if (stream->loaded <= k && stream->error == MATH_SUCCESS) {
+            double start = now_us();
+            while (stream->loaded <= k && stream->error == MATH_SUCCESS) {
+                pthread_cond_wait(&stream->cond, &stream->lock);
+            }
+            stream->stalls++;
+            stream->stall_us += now_us() - start;
+        }
+        MathStatus error = stream->error;
+        pthread_mutex_unlock(&stream->lock);
+        if (error != MATH_SUCCESS) {
+            return error;
+        }
+
+        memory_map_rnn_layer(model, l, stream->slots + (k % stream->depth) * stream->slot_floats);
+        rnn_model_layer_step(model, l, inter_input, state);
+        unmap_stream_layer(model, l);
+        inter_input = rnn_model_hidden_state(model, state, l);
+
+        pthread_mutex_lock(&stream->lock);
+        stream->released++;
+        pthread_cond_broadcast(&stream->cond);
+        pthread_mutex_unlock(&stream->lock);
+    }
+    if (output != NULL) {
+        linear_layer_forward(&model->output_layer, inter_input, output);
+    }
+    rnn_numerics_scan_output(model, output, model->config.input_dim, model->config.num_layers);
+    return MATH_SUCCESS;
+}
+
+size_t layer_stream_resident_bytes(LayerStream* stream) {
+    return stream->depth * stream->slot_floats * sizeof(float) + layer_bytes(stream, stream->model->config.num_layers);
+}
@@ -17,6 +17,7 @@ void init_linear_layer_weights(LinearLayerWeights* weights, LinearLayerConfig* c
 
     weights->weights = (float*)calloc(input_size * output_size, sizeof(float));
     weights->bias = (float*)calloc(output_size, sizeof(float));
+    weights->packed = NULL;
 }
 
 void init_linear_layer(LinearLayer* layer, int input_size, int output_size) {
@@ -30,9 +31,17 @@ void free_linear_layer_weights(LinearLayerWeights* weights) {
 }
 
 void free_linear_layer(LinearLayer* layer) {
+    free_linear_layer_packed(layer);
     free_linear_layer_weights(&layer->weights);
 }
 
+size_t memory_map_linear_layer(LinearLayer* layer, float* data_ptr) {
+    size_t weights = (size_t)layer->config.input_size * layer->config.output_size;
+    layer->weights.weights = data_ptr;
+    layer->weights.bias = data_ptr + weights;
+    return weights + layer->config.output_size;
+}
+
 // Forward function
 void linear_layer_forward(LinearLayer* layer, float* input, float* output) {
     LinearLayerConfig* config = &layer->config;
@@ -41,6 +50,42 @@ void linear_layer_forward(LinearLayer* layer, float* input, float* output) {
     int input_size = config->input_size;
     int output_size = config->output_size;
 
+    if (weights->packed != NULL) {
+        matmul_packed(output, input, &weights->packed->weights, 1);
+        add(output, output, weights->packed->bias, output_size);
+        return;
+    }
     matmul(output, input, weights->weights, 1, input_size, output_size);
     add(output, output, weights->bias, output_size);
+}
+
+// Panel-packed weights
+size_t linear_layer_packed_bytes(LinearLayerConfig* config) {
+    return packed_matrix_bytes(config->input_size, config->output_size)
+         + packed_vector_bytes(config->output_size);
+}
+
+MathStatus pack_linear_layer(LinearLayer* layer, PackArena* arena) {
+    free_linear_layer_packed(layer);
+    LinearLayerPacked* packed = (LinearLayerPacked*)calloc(1, sizeof(LinearLayerPacked));
+    if (packed == NULL) {
+        return MATH_NULL_POINTER;
+    }
+    MathStatus status = pack_matrix(&packed->weights, arena, layer->weights.weights,
+                                    layer->config.input_size, layer->config.output_size);
+    packed->bias = pack_vector(arena, layer->weights.bias, layer->config.output_size);
+    if (status == MATH_SUCCESS && packed->bias == NULL) {
+        status = MATH_EXCEEDS_MAX_DIM;
+    }
+    if (status != MATH_SUCCESS) {
+        free(packed);
+        return status;
+    }
+    layer->weights.packed = packed;
+    return MATH_SUCCESS;
+}
+
+void free_linear_layer_packed(LinearLayer* layer) {
+    free(layer->weights.packed);
+    layer->weights.packed = NULL;
 }
\ No newline at end of file
@@ -12,7 +12,6 @@ void init_lstm_layer_config(LSTMLayerConfig* config, int input_dim, int input_si
 }
 
 void init_lstm_layer_weights(LSTMLayerWeights* weights, LSTMLayerConfig* config) {
-    int input_dim = config->input_dim;
     int input_size = config->input_size;
     int hidden_size = config->hidden_size; 
 
@@ -24,29 +23,31 @@ void init_lstm_layer_weights(LSTMLayerWeights* weights, LSTMLayerConfig* config)
     weights->W_hf = (float*)calloc(hidden_size * hidden_size, sizeof(float));
     weights->W_hg = (float*)calloc(hidden_size * hidden_size, sizeof(float));
     weights->W_ho = (float*)calloc(hidden_size * hidden_size, sizeof(float));
-    weights->b_ii = (float*)calloc(input_dim * hidden_size, sizeof(float));
-    weights->b_if = (float*)calloc(input_dim * hidden_size, sizeof(float));
-    weights->b_ig = (float*)calloc(input_dim * hidden_size, sizeof(float));
-    weights->b_io = (float*)calloc(input_dim * hidden_size, sizeof(float));
-    weights->b_hi = (float*)calloc(input_dim * hidden_size, sizeof(float));
-    weights->b_hf = (float*)calloc(input_dim * hidden_size, sizeof(float));
-    weights->b_hg = (float*)calloc(input_dim * hidden_size, sizeof(float));
-    weights->b_ho = (float*)calloc(input_dim * hidden_size, sizeof(float));
+    // one bias per unit, shared by every row of the batch
+    weights->b_ii = (float*)calloc(hidden_size, sizeof(float));
+    weights->b_if = (float*)calloc(hidden_size, sizeof(float));
+    weights->b_ig = (float*)calloc(hidden_size, sizeof(float));
+    weights->b_io = (float*)calloc(hidden_size, sizeof(float));
+    weights->b_hi = (float*)calloc(hidden_size, sizeof(float));
+    weights->b_hf = (float*)calloc(hidden_size, sizeof(float));
+    weights->b_hg = (float*)calloc(hidden_size, sizeof(float));
+    weights->b_ho = (float*)calloc(hidden_size, sizeof(float));
+    weights->palette = NULL;
+    weights->packed = NULL;
 }
 
 void init_lstm_layer_run_state(LSTMLayerRunState* state, LSTMLayerConfig* config) {
     int input_dim = config->input_dim;
     int hidden_size = config->hidden_size;
-    int input_size = config->input_size;
 
-    state->input_buffer = (float*)calloc(input_dim * input_size, sizeof(float));
     state->input_gate_buffer = (float*)calloc(input_dim * hidden_size, sizeof(float));
     state->hidden_state_buffer = (float*)calloc(input_dim * hidden_size, sizeof(float));
     state->forget_gate_buffer = (float*)calloc(input_dim * hidden_size, sizeof(float));
     state->input_node_buffer = (float*)calloc(input_dim * hidden_size, sizeof(float));
     state->output_gate_buffer = (float*)calloc(input_dim * hidden_size, sizeof(float));
     state->cell_state_buffer = (float*)calloc(input_dim * hidden_size, sizeof(float));
-
+    state->projection_buffer = (float*)calloc(input_dim * hidden_size, sizeof(float));
+    state->delta = NULL;
 }
 
 void init_lstm_layer(LSTMLayer* layer, int input_dim, int input_size, int hidden_size) {
@@ -55,6 +56,12 @@ void init_lstm_layer(LSTMLayer* layer, int input_dim, int input_size, int hidden
     init_lstm_layer_run_state(&layer->state, &layer->config);
 }
 
+void init_lstm_layer_batch(LSTMLayer* batch, LSTMLayer* layer, int rows) {
+    init_lstm_layer_config(&batch->config, rows, layer->config.input_size, layer->config.hidden_size);
+    batch->weights = layer->weights;
+    init_lstm_layer_run_state(&batch->state, &batch->config);
+}
+
 void free_lstm_layer_weights(LSTMLayerWeights* weights) {
     free(weights->W_ii);
     free(weights->W_if);
@@ -75,50 +82,97 @@ void free_lstm_layer_weights(LSTMLayerWeights* weights) {
 }
 
 void free_lstm_layer_run_state(LSTMLayerRunState* state) {
-    free(state->input_buffer);
     free(state->forget_gate_buffer);
     free(state->input_gate_buffer);
     free(state->output_gate_buffer);
     free(state->input_node_buffer); // Free new buffer
     free(state->cell_state_buffer);
     free(state->hidden_state_buffer);
+    free(state->projection_buffer);
+    if (state->delta != NULL) {
+        free(state->delta->x_ref);
+        free(state->delta->idx);
+        free(state->delta->dx);
+        free(state->delta);
+        state->delta = NULL;
+    }
 }
 
 void free_lstm_layer(LSTMLayer* layer, bool free_weights) {
     free_lstm_layer_run_state(&layer->state);
+    free_lstm_layer_palette(layer);
+    free_lstm_layer_packed(layer);
     if (free_weights) {
         free_lstm_layer_weights(&layer->weights);
     }
 
 }
 
-void lstm_layer_forward(LSTMLayer* layer, float* input, float* h_prev, float* c_prev) {
+size_t memory_map_lstm_layer(LSTMLayer* layer, float* data_ptr) {
+    size_t input_size = layer->config.input_size;
+    size_t hidden_size = layer->config.hidden_size;
+    LSTMLayerWeights* w = &layer->weights;
+    float** tensors[16] = {&w->W_ii, &w->W_if, &w->W_ig, &w->W_io, &w->W_hi, &w->W_hf, &w->W_hg, &w->W_ho,
+                           &w->b_ii, &w->b_if, &w->b_ig, &w->b_io, &w->b_hi, &w->b_hf, &w->b_hg, &w->b_ho};
+    size_t ptr_offset = 0;
+    for (int i = 0; i < 16; i++) {
+        *tensors[i] = data_ptr + ptr_offset;
+        ptr_offset += (i < 4) ? input_size * hidden_size : (i < 8) ? hidden_size * hidden_size : hidden_size;
+    }
+    return ptr_offset;
+}
+
+// out[m, p] = a[m, n] * W[n, p], using the packed panels or the palette of W when attached,
+// and the blocked GEMM for float weights once there are enough rows to amortise packing
+static void lstm_project(float* out, float* a, float* W, PaletteMatrix* P, PackedMatrix* K, int m, int n, int p) {
+    if (K != NULL) {
+        matmul_packed(out, a, K, m);
+    } else if (P != NULL) {
+        matmul_palette(out, a, P, m);
+    } else if (m >= GEMM_MIN_ROWS) {
+        gemm(m, p, n, 1.0f, a, n, W, p, 0.0f, out, p);
+    } else {
+        matmul(out, a, W, m, n, p);
+    }
+}
+
+// out[r] = act(x[r] + proj[r] + b_i + b_h) for each of the rows, the biases are shared by all rows
+static void lstm_gate(float* out, float* x, float* proj, float* b_i, float* b_h, int rows, int hidden_size, bool input_node) {
+    for (int r = 0; r < rows; r++) {
+        float* g = out + r * hidden_size;
+        add(g, x + r * hidden_size, proj + r * hidden_size, hidden_size);
+        add(g, g, b_i, hidden_size);
+        add(g, g, b_h, hidden_size);
+        if (input_node) {
+            tanh_act_vec(g, g, hidden_size);
+        } else {
+            sigmoid_act_vec(g, g, hidden_size);
+        }
+    }
+}
+
+// Recurrent half of a step. x_i, x_f, x_g and x_o hold the input projections of
+// the step without biases and may alias the gate buffers of the run state.
+// h_prev/c_prev are fully consumed before h_out/c_out are written, so they may alias.
+void lstm_layer_step(LSTMLayer* layer, float* x_i, float* x_f, float* x_g, float* x_o,
+                     float* h_prev, float* c_prev, float* h_out, float* c_out) {
     // get the config, weights and state
     LSTMLayerConfig* config = &layer->config;
     LSTMLayerWeights* weights = &layer->weights;
     LSTMLayerRunState* state = &layer->state;
 
-    // get the input and hidden size
     int input_dim = config->input_dim;
-    int input_size = config->input_size;
     int hidden_size = config->hidden_size;
 
     // get the run state buffers
-    float* input_buffer = state->input_buffer;
     float* forget_gate_buffer = state->forget_gate_buffer;
     float* input_gate_buffer = state->input_gate_buffer;
     float* output_gate_buffer = state->output_gate_buffer;
     float* input_node_buffer = state->input_node_buffer; // New buffer
-    float* cell_state_buffer = state->cell_state_buffer;
-    float* hidden_state_buffer = state->hidden_state_buffer;
+    // projection of the previous hidden state, added on top of the input projection
+    float* h_proj = state->projection_buffer;
 
-    // map input into input buffer
-    memcpy(input_buffer, input, input_size * sizeof(float));
     // get the weights and the bias 
-    float* W_ii = weights->W_ii;
-    float* W_if = weights->W_if;
-    float* W_ig = weights->W_ig;
-    float* W_io = weights->W_io;
     float* W_hi = weights->W_hi;
     float* W_hf = weights->W_hf;
     float* W_hg = weights->W_hg;
@@ -131,47 +185,380 @@ void lstm_layer_forward(LSTMLayer* layer, float* input, float* h_prev, float* c_
     float* b_hf = weights->b_hf;
     float* b_hg = weights->b_hg;
     float* b_ho = weights->b_ho;
-
+    LSTMLayerPalette* palette = weights->palette;
+    LSTMLayerPacked* packed = weights->packed;
+    if (packed != NULL) {
+        b_ii = packed->b_ii;
+        b_if = packed->b_if;
+        b_ig = packed->b_ig;
+        b_io = packed->b_io;
+        b_hi = packed->b_hi;
+        b_hf = packed->b_hf;
+        b_hg = packed->b_hg;
+        b_ho = packed->b_ho;
+    }
 
     // Compute input gate: i_t = sigmoid(W_ii * x_t + W_hi * h_prev + b_ii + b_hi)
-    matmul(input_gate_buffer, input_buffer, W_ii, input_dim, input_size, hidden_size);
-    matmul(hidden_state_buffer, W_hi, h_prev, input_dim, hidden_size, hidden_size);
-    add(input_gate_buffer, input_gate_buffer, hidden_state_buffer, input_dim * hidden_size);
-    add(input_gate_buffer, input_gate_buffer, b_ii, input_dim * hidden_size);
-    add(input_gate_buffer, input_gate_buffer, b_hi, input_dim * hidden_size);
-    sigmoid_act_vec(input_gate_buffer, input_gate_buffer, input_dim * hidden_size);
+    lstm_project(h_proj, h_prev, W_hi, palette ? &palette->W_hi : NULL, packed ? &packed->W_hi : NULL, input_dim, hidden_size, hidden_size);
+    lstm_gate(input_gate_buffer, x_i, h_proj, b_ii, b_hi, input_dim, hidden_size, false);
 
     // Compute forget gate: f_t = sigmoid(W_if * x_t + W_hf * h_prev + b_if + b_hf)
-    matmul(forget_gate_buffer, input_buffer, W_if, input_dim, input_size, hidden_size);
-    matmul(hidden_state_buffer, h_prev, W_hf, input_dim, hidden_size, hidden_size);
-    add(forget_gate_buffer, forget_gate_buffer, hidden_state_buffer, hidden_size);
-    add(forget_gate_buffer, forget_gate_buffer, b_if, input_dim * hidden_size);
-    add(forget_gate_buffer, forget_gate_buffer, b_hf, input_dim * hidden_size);
-    sigmoid_act_vec(forget_gate_buffer, forget_gate_buffer, input_dim * hidden_size);
+    lstm_project(h_proj, h_prev, W_hf, palette ? &palette->W_hf : NULL, packed ? &packed->W_hf : NULL, input_dim, hidden_size, hidden_size);
+    lstm_gate(forget_gate_buffer, x_f, h_proj, b_if, b_hf, input_dim, hidden_size, false);
 
     // Compute input node: g_t = tanh(W_ig * x_t + W_hg * h_prev + b_ig + b_hg)
-    matmul(input_node_buffer, input_buffer, W_ig, input_dim, input_size, hidden_size);
-    matmul(hidden_state_buffer, h_prev, W_hg, input_dim, hidden_size, hidden_size);
-    add(input_node_buffer, input_node_buffer, hidden_state_buffer, input_dim * hidden_size);
-    add(input_node_buffer, input_node_buffer, b_ig, input_dim * hidden_size);
-    add(input_node_buffer, input_node_buffer, b_hg, input_dim * hidden_size);
-    tanh_act_vec(input_node_buffer, input_node_buffer, input_dim * hidden_size);
+    lstm_project(h_proj, h_prev, W_hg, palette ? &palette->W_hg : NULL, packed ? &packed->W_hg : NULL, input_dim, hidden_size, hidden_size);
+    lstm_gate(input_node_buffer, x_g, h_proj, b_ig, b_hg, input_dim, hidden_size, true);
 
     // Compute output gate: o_t = sigmoid(W_io * x_t + W_ho * h_prev + b_io + b_ho)
-    matmul(output_gate_buffer, input_buffer, W_io, input_dim, input_size, hidden_size);
-    matmul(hidden_state_buffer, h_prev, W_ho, input_dim, hidden_size, hidden_size);
-    add(output_gate_buffer, output_gate_buffer, hidden_state_buffer, input_dim * hidden_size);
-    add(output_gate_buffer, output_gate_buffer, b_io, input_dim * hidden_size);
-    add(output_gate_buffer, output_gate_buffer, b_ho, input_dim * hidden_size);
-    sigmoid_act_vec(output_gate_buffer, output_gate_buffer, input_dim * hidden_size);
-
-
-    // Update cell state: c_t = f_t * c_prev + i_t * g_t
-    mul(cell_state_buffer, forget_gate_buffer, c_prev, input_dim * hidden_size);
-    mul(input_node_buffer, input_gate_buffer, input_node_buffer, input_dim * hidden_size);
-    add(cell_state_buffer, cell_state_buffer, input_node_buffer, input_dim *hidden_size);
-
-    // Update hidden state: h_t = o_t * tanh(c_t)
-    tanh_act_vec(cell_state_buffer, cell_state_buffer, input_dim * hidden_size);
-    mul(hidden_state_buffer, output_gate_buffer, cell_state_buffer, input_dim * hidden_size);
+    lstm_project(h_proj, h_prev, W_ho, palette ? &palette->W_ho : NULL, packed ? &packed->W_ho : NULL, input_dim, hidden_size, hidden_size);
+    lstm_gate(output_gate_buffer, x_o, h_proj, b_io, b_ho, input_dim, hidden_size, false);
+
+    for (int r = 0; r < input_dim; r++) {
+        int o = r * hidden_size;
+        // Update cell state: c_t = f_t * c_prev + i_t * g_t
+        mul(c_out + o, forget_gate_buffer + o, c_prev + o, hidden_size);
+        mul(input_node_buffer + o, input_gate_buffer + o, input_node_buffer + o, hidden_size);
+        add(c_out + o, c_out + o, input_node_buffer + o, hidden_size);
+
+        // Update hidden state: h_t = o_t * tanh(c_t), keeping c_t intact for the next step
+        tanh_act_vec(input_node_buffer + o, c_out + o, hidden_size);
+        mul(h_out + o, output_gate_buffer + o, input_node_buffer + o, hidden_size);
+    }
+}
+
+void lstm_layer_project_inputs(LSTMLayer* layer, float* inputs, int rows, float* x_i, float* x_f, float* x_g, float* x_o) {
+    LSTMLayerWeights* weights = &layer->weights;
+    LSTMLayerPalette* palette = weights->palette;
+    LSTMLayerPacked* packed = weights->packed;
+    int input_size = layer->config.input_size;
+    int hidden_size = layer->config.hidden_size;
+
+    lstm_project(x_i, inputs, weights->W_ii, palette ? &palette->W_ii : NULL, packed ? &packed->W_ii : NULL, rows, input_size, hidden_size);
+    lstm_project(x_f, inputs, weights->W_if, palette ? &palette->W_if : NULL, packed ? &packed->W_if : NULL, rows, input_size, hidden_size);
+    lstm_project(x_g, inputs, weights->W_ig, palette ? &palette->W_ig : NULL, packed ? &packed->W_ig : NULL, rows, input_size, hidden_size);
+    lstm_project(x_o, inputs, weights->W_io, palette ? &palette->W_io : NULL, packed ? &packed->W_io : NULL, rows, input_size, hidden_size);
+}
+
+// Delta-network step
+// The pre-activations are kept from the previous step and only corrected by the
+// weight rows of inputs and hidden units that changed. h/c in and out may alias.
+static void lstm_layer_delta_step(LSTMLayer* layer, float* input, float* h_prev, float* c_prev, float* h_out, float* c_out) {
+    LSTMLayerWeights* weights = &layer->weights;
+    LSTMLayerRunState* state = &layer->state;
+    LSTMLayerDelta* delta = state->delta;
+    int input_size = layer->config.input_size;
+    int hidden_size = layer->config.hidden_size;
+
+    int count = delta_encode(delta->idx, delta->dx, input, delta->x_ref, input_size, delta->threshold);
+    delta_accumulate(delta->m_i, weights->W_ii, hidden_size, delta->idx, delta->dx, count);
+    delta_accumulate(delta->m_f, weights->W_if, hidden_size, delta->idx, delta->dx, count);
+    delta_accumulate(delta->m_g, weights->W_ig, hidden_size, delta->idx, delta->dx, count);
+    delta_accumulate(delta->m_o, weights->W_io, hidden_size, delta->idx, delta->dx, count);
+    delta->skipped += input_size - count;
+
+    count = delta_encode(delta->idx, delta->dx, h_prev, delta->h_ref, hidden_size, delta->threshold);
+    delta_accumulate(delta->m_i, weights->W_hi, hidden_size, delta->idx, delta->dx, count);
+    delta_accumulate(delta->m_f, weights->W_hf, hidden_size, delta->idx, delta->dx, count);
+    delta_accumulate(delta->m_g, weights->W_hg, hidden_size, delta->idx, delta->dx, count);
+    delta_accumulate(delta->m_o, weights->W_ho, hidden_size, delta->idx, delta->dx, count);
+    delta->skipped += hidden_size - count;
+    delta->columns += input_size + hidden_size;
+
+    float* i_t = state->input_gate_buffer;
+    float* f_t = state->forget_gate_buffer;
+    float* g_t = state->input_node_buffer;
+    float* o_t = state->output_gate_buffer;
+    sigmoid_act_vec(i_t, delta->m_i, hidden_size);
+    sigmoid_act_vec(f_t, delta->m_f, hidden_size);
+    tanh_act_vec(g_t, delta->m_g, hidden_size);
+    sigmoid_act_vec(o_t, delta->m_o, hidden_size);
+    for (int k = 0; k < hidden_size; k++) {
+        c_out[k] = f_t[k] * c_prev[k] + i_t[k] * g_t[k];
+    }
+    tanh_act_vec(g_t, c_out, hidden_size);
+    mul(h_out, o_t, g_t, hidden_size);
+}
+
+void lstm_layer_forward(LSTMLayer* layer, float* input, float* h_prev, float* c_prev) {
+    LSTMLayerConfig* config = &layer->config;
+    LSTMLayerRunState* state = &layer->state;
+
+    if (state->delta != NULL) {
+        lstm_layer_delta_step(layer, input, h_prev, c_prev, state->hidden_state_buffer, state->cell_state_buffer);
+        return;
+    }
+
+    // input projections go straight into the gate buffers
+    lstm_layer_project_inputs(layer, input, config->input_dim, state->input_gate_buffer,
+                              state->forget_gate_buffer, state->input_node_buffer, state->output_gate_buffer);
+    lstm_layer_step(layer, state->input_gate_buffer, state->forget_gate_buffer, state->input_node_buffer,
+                    state->output_gate_buffer, h_prev, c_prev, state->hidden_state_buffer, state->cell_state_buffer);
+}
+
+// Forward function updating h and c in place, for callers that own the recurrent state
+void lstm_layer_forward_inplace(LSTMLayer* layer, float* input, float* h, float* c) {
+    LSTMLayerRunState* state = &layer->state;
+    if (state->delta != NULL) {
+        lstm_layer_delta_step(layer, input, h, c, h, c);
+        return;
+    }
+
+    lstm_layer_project_inputs(layer, input, layer->config.input_dim, state->input_gate_buffer,
+                              state->forget_gate_buffer, state->input_node_buffer, state->output_gate_buffer);
+    lstm_layer_step(layer, state->input_gate_buffer, state->forget_gate_buffer, state->input_node_buffer,
+                    state->output_gate_buffer, h, c, h, c);
+}
+
+// Sequence forward function
+// The input projections of all seq_len steps are hoisted into four
+// [seq_len * input_dim x hidden_size] GEMMs, only the recurrent half runs per step.
+// The final cell state is left in the run state.
+MathStatus lstm_layer_forward_sequence(LSTMLayer* layer, float* inputs, float* h0, float* c0, float* outputs, int seq_len) {
+    int input_dim = layer->config.input_dim;
+    int hidden_size = layer->config.hidden_size;
+    int rows = seq_len * input_dim;
+    int step = input_dim * hidden_size;
+    size_t block = (size_t)rows * hidden_size;
+
+    float* x_proj = (float*)malloc(4 * block * sizeof(float));
+    if (x_proj == NULL) {
+        fprintf(stderr, "lstm_layer_forward_sequence: out of memory\n");
+        return MATH_NULL_POINTER;
+    }
+    float* x_i = x_proj;
+    float* x_f = x_i + block;
+    float* x_g = x_f + block;
+    float* x_o = x_g + block;
+    lstm_layer_project_inputs(layer, inputs, rows, x_i, x_f, x_g, x_o);
+
+    float* h_prev = h0;
+    float* c_prev = c0;
+    for (int t = 0; t < seq_len; t++) {
+        lstm_layer_step(layer, x_i + t * step, x_f + t * step, x_g + t * step, x_o + t * step,
+                        h_prev, c_prev, outputs + t * step, layer->state.cell_state_buffer);
+        h_prev = outputs + t * step;
+        c_prev = layer->state.cell_state_buffer; // c_t is updated in place from here on
+    }
+    free(x_proj);
+    return MATH_SUCCESS;
+}
+
+// Delta-network mode
+MathStatus enable_lstm_layer_delta(LSTMLayer* layer, float threshold) {
+    LSTMLayerWeights* weights = &layer->weights;
+    if (weights->W_ii == NULL || weights->W_hi == NULL || weights->b_ii == NULL) {
+        return MATH_NULL_POINTER; // runs on the float32 weights, not on packed or palettized copies
+    }
+    if (layer->config.input_dim != 1 || threshold < 0.0f) {
+        return MATH_INVALID_DIM;
+    }
+    disable_lstm_layer_delta(layer);
+    int input_size = layer->config.input_size;
+    int hidden_size = layer->config.hidden_size;
+    int widest = (input_size > hidden_size) ? input_size : hidden_size;
+    LSTMLayerDelta* delta = (LSTMLayerDelta*)calloc(1, sizeof(LSTMLayerDelta));
+    if (delta == NULL) {
+        return MATH_NULL_POINTER;
+    }
+    // one block for the references and the pre-activations
+    delta->x_ref = (float*)malloc((input_size + 5 * hidden_size) * sizeof(float));
+    delta->idx = (int*)malloc(widest * sizeof(int));
+    delta->dx = (float*)malloc(widest * sizeof(float));
+    if (delta->x_ref == NULL || delta->idx == NULL || delta->dx == NULL) {
+        free(delta->x_ref);
+        free(delta->idx);
+        free(delta->dx);
+        free(delta);
+        return MATH_NULL_POINTER;
+    }
+    delta->h_ref = delta->x_ref + input_size;
+    delta->m_i = delta->h_ref + hidden_size;
+    delta->m_f = delta->m_i + hidden_size;
+    delta->m_g = delta->m_f + hidden_size;
+    delta->m_o = delta->m_g + hidden_size;
+    delta->threshold = threshold;
+    layer->state.delta = delta;
+    reset_lstm_layer_delta(layer);
+    return MATH_SUCCESS;
+}
+
+void reset_lstm_layer_delta(LSTMLayer* layer) {
+    LSTMLayerDelta* delta = layer->state.delta;
+    if (delta == NULL) {
+        return;
+    }
+    LSTMLayerWeights* weights = &layer->weights;
+    int hidden_size = layer->config.hidden_size;
+    // with all references at zero the pre-activations are just the biases
+    memset(delta->x_ref, 0, (layer->config.input_size + hidden_size) * sizeof(float));
+    add(delta->m_i, weights->b_ii, weights->b_hi, hidden_size);
+    add(delta->m_f, weights->b_if, weights->b_hf, hidden_size);
+    add(delta->m_g, weights->b_ig, weights->b_hg, hidden_size);
+    add(delta->m_o, weights->b_io, weights->b_ho, hidden_size);
+    delta->columns = 0;
+    delta->skipped = 0;
+}
+
+void disable_lstm_layer_delta(LSTMLayer* layer) {
+    LSTMLayerDelta* delta = layer->state.delta;
+    if (delta == NULL) {
+        return;
+    }
+    free(delta->x_ref);
+    free(delta->idx);
+    free(delta->dx);
+    free(delta);
+    layer->state.delta = NULL;
+}
+
+float lstm_layer_delta_skip_ratio(LSTMLayer* layer) {
+    LSTMLayerDelta* delta = layer->state.delta;
+    if (delta == NULL || delta->columns == 0) {
+        return 0.0f;
+    }
+    return (float)delta->skipped / (float)delta->columns;
+}
+
+// Palettized weights
+// The eight matrices are handled in checkpoint order: W_ii, W_if, W_ig, W_io, W_hi, W_hf, W_hg, W_ho
+static void lstm_palette_slots(LSTMLayer* layer, LSTMLayerPalette* palette, float** dense, PaletteMatrix** packed, int* rows) {
+    LSTMLayerWeights* weights = &layer->weights;
+    float* all_dense[8] = {weights->W_ii, weights->W_if, weights->W_ig, weights->W_io,
+                           weights->W_hi, weights->W_hf, weights->W_hg, weights->W_ho};
+    PaletteMatrix* all_packed[8] = {&palette->W_ii, &palette->W_if, &palette->W_ig, &palette->W_io,
+                                    &palette->W_hi, &palette->W_hf, &palette->W_hg, &palette->W_ho};
+    for (int i = 0; i < 8; i++) {
+        dense[i] = all_dense[i];
+        packed[i] = all_packed[i];
+        rows[i] = (i < 4) ? layer->config.input_size : layer->config.hidden_size;
+    }
+}
+
+MathStatus palettize_lstm_layer(LSTMLayer* layer, bool per_row, int iterations) {
+    free_lstm_layer_palette(layer);
+    LSTMLayerPalette* palette = (LSTMLayerPalette*)calloc(1, sizeof(LSTMLayerPalette));
+    if (palette == NULL) {
+        return MATH_NULL_POINTER;
+    }
+
+    float* dense[8];
+    PaletteMatrix* packed[8];
+    int rows[8];
+    lstm_palette_slots(layer, palette, dense, packed, rows);
+    for (int i = 0; i < 8; i++) {
+        MathStatus status = palettize_matrix(packed[i], dense[i], rows[i], layer->config.hidden_size, per_row, iterations);
+        if (status != MATH_SUCCESS) {
+            layer->weights.palette = palette;
+            free_lstm_layer_palette(layer);
+            return status;
+        }
+    }
+    layer->weights.palette = palette;
+    return MATH_SUCCESS;
+}
+
+size_t map_lstm_layer_palette(LSTMLayer* layer, void* data, bool per_row) {
+    free_lstm_layer_palette(layer);
+    LSTMLayerPalette* palette = (LSTMLayerPalette*)calloc(1, sizeof(LSTMLayerPalette));
+    if (palette == NULL) {
+        return 0;
+    }
+
+    float* dense[8];
+    PaletteMatrix* packed[8];
+    int rows[8];
+    lstm_palette_slots(layer, palette, dense, packed, rows);
+    size_t offset = 0;
+    for (int i = 0; i < 8; i++) {
+        offset += map_palette_matrix(packed[i], (uint8_t*)data + offset, rows[i], layer->config.hidden_size, per_row ? rows[i] : 1);
+    }
+    layer->weights.palette = palette;
+    return offset;
+}
+
+size_t write_lstm_layer_palette(FILE* file, LSTMLayer* layer) {
+    LSTMLayerPalette* palette = layer->weights.palette;
+    if (palette == NULL) {
+        return 0;
+    }
+    float* dense[8];
+    PaletteMatrix* packed[8];
+    int rows[8];
+    lstm_palette_slots(layer, palette, dense, packed, rows);
+    size_t written = 0;
+    for (int i = 0; i < 8; i++) {
+        written += write_palette_matrix(file, packed[i]);
+    }
+    return written;
+}
+
+void free_lstm_layer_palette(LSTMLayer* layer) {
+    LSTMLayerPalette* palette = layer->weights.palette;
+    if (palette == NULL) {
+        return;
+    }
+    free_palette_matrix(&palette->W_ii);
+    free_palette_matrix(&palette->W_if);
+    free_palette_matrix(&palette->W_ig);
+    free_palette_matrix(&palette->W_io);
+    free_palette_matrix(&palette->W_hi);
+    free_palette_matrix(&palette->W_hf);
+    free_palette_matrix(&palette->W_hg);
+    free_palette_matrix(&palette->W_ho);
+    free(palette);
+    layer->weights.palette = NULL;
+}
+
+// Panel-packed weights
+size_t lstm_layer_packed_bytes(LSTMLayerConfig* config) {
+    int input_size = config->input_size;
+    int hidden_size = config->hidden_size;
+    return 4 * packed_matrix_bytes(input_size, hidden_size)
+         + 4 * packed_matrix_bytes(hidden_size, hidden_size)
+         + 8 * packed_vector_bytes(hidden_size);
+}
+
+MathStatus pack_lstm_layer(LSTMLayer* layer, PackArena* arena) {
+    free_lstm_layer_packed(layer);
+    LSTMLayerPacked* packed = (LSTMLayerPacked*)calloc(1, sizeof(LSTMLayerPacked));
+    if (packed == NULL) {
+        return MATH_NULL_POINTER;
+    }
+    LSTMLayerWeights* weights = &layer->weights;
+    int input_size = layer->config.input_size;
+    int hidden_size = layer->config.hidden_size;
+    int bias_size = hidden_size;
+
+    MathStatus status = MATH_SUCCESS;
+    float* dense[8] = {weights->W_ii, weights->W_if, weights->W_ig, weights->W_io,
+                       weights->W_hi, weights->W_hf, weights->W_hg, weights->W_ho};
+    PackedMatrix* panels[8] = {&packed->W_ii, &packed->W_if, &packed->W_ig, &packed->W_io,
+                               &packed->W_hi, &packed->W_hf, &packed->W_hg, &packed->W_ho};
+    for (int i = 0; i < 8 && status == MATH_SUCCESS; i++) {
+        status = pack_matrix(panels[i], arena, dense[i], (i < 4) ? input_size : hidden_size, hidden_size);
+    }
+    packed->b_ii = pack_vector(arena, weights->b_ii, bias_size);
+    packed->b_if = pack_vector(arena, weights->b_if, bias_size);
+    packed->b_ig = pack_vector(arena, weights->b_ig, bias_size);
+    packed->b_io = pack_vector(arena, weights->b_io, bias_size);
+    packed->b_hi = pack_vector(arena, weights->b_hi, bias_size);
+    packed->b_hf = pack_vector(arena, weights->b_hf, bias_size);
+    packed->b_hg = pack_vector(arena, weights->b_hg, bias_size);
+    packed->b_ho = pack_vector(arena, weights->b_ho, bias_size);
+    if (status == MATH_SUCCESS && packed->b_ho == NULL) {
+        status = MATH_EXCEEDS_MAX_DIM;
+    }
+    if (status != MATH_SUCCESS) {
+        free(packed);
+        return status;
+    }
+    weights->packed = packed;
+    return MATH_SUCCESS;
+}
+
+void free_lstm_layer_packed(LSTMLayer* layer) {
+    // the panels belong to the arena, only the descriptor is owned by the layer
+    free(layer->weights.packed);
+    layer->weights.packed = NULL;
 }
@@ -0,0 +1,126 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include "lstmp.h"
+
+void init_lstmp_layer(LSTMPLayer* layer, int input_size, int hidden_size, int proj_size) {
+    layer->config.input_size = input_size;
+    layer->config.hidden_size = hidden_size;
+    layer->config.proj_size = proj_size;
+
+    size_t gates = 4 * (size_t)hidden_size;
+    LSTMPLayerWeights* w = &layer->weights;
+    w->W_x = (float*)calloc(input_size * gates, sizeof(float));
+    w->W_h = (float*)calloc(proj_size * gates, sizeof(float));
+    w->b_x = (float*)calloc(gates, sizeof(float));
+    w->b_h = (float*)calloc(gates, sizeof(float));
+    w->W_p = (float*)calloc((size_t)hidden_size * proj_size, sizeof(float));
+
+    layer->state.gate_buffer = (float*)calloc(gates, sizeof(float));
+    layer->state.cell_out_buffer = (float*)calloc(hidden_size, sizeof(float));
+    layer->state.cell_state_buffer = (float*)calloc(hidden_size, sizeof(float));
+}
+
+void free_lstmp_layer_weights(LSTMPLayerWeights* weights) {
+    free(weights->W_x);
+    free(weights->W_h);
+    free(weights->b_x);
+    free(weights->b_h);
+    free(weights->W_p);
+}
+
+void free_lstmp_layer(LSTMPLayer* layer, bool free_weights) {
+    free(layer->state.gate_buffer);
+    free(layer->state.cell_out_buffer);
+    free(layer->state.cell_state_buffer);
+    if (free_weights) {
+        free_lstmp_layer_weights(&layer->weights);
+    }
+}
+
+size_t lstmp_layer_floats(LSTMPLayerConfig* config) {
+    size_t gates = 4 * (size_t)config->hidden_size;
+    return (config->input_size + config->proj_size) * gates + 2 * gates + (size_t)config->hidden_size * config->proj_size;
+}
+
+size_t memory_map_lstmp_layer(LSTMPLayer* layer, float* data_ptr) {
+    LSTMPLayerConfig* config = &layer->config;
+    size_t gates = 4 * (size_t)config->hidden_size;
+    LSTMPLayerWeights* w = &layer->weights;
+    w->W_x = data_ptr;
+    w->W_h = w->W_x + config->input_size * gates;
+    w->b_x = w->W_h + config->proj_size * gates;
+    w->b_h = w->b_x + gates;
+    w->W_p = w->b_h + gates;
+    return lstmp_layer_floats(config);
+}
+
+void lstmp_layer_project_inputs(LSTMPLayer* layer, float* inputs, int rows, float* x) {
+    int input_size = layer->config.input_size;
+    int gates = 4 * layer->config.hidden_size;
+    if (rows >= GEMM_MIN_ROWS) {
+        gemm(rows, gates, input_size, 1.0f, inputs, input_size, layer->weights.W_x, gates, 0.0f, x, gates);
+        return;
+    }
+    for (int r = 0; r < rows; r++) {
+        memset(x + (size_t)r * gates, 0, gates * sizeof(float));
+        accumulate_rows(x + (size_t)r * gates, inputs + (size_t)r * input_size, layer->weights.W_x, input_size, gates);
+    }
+}
+
+// One fused pass per stage: a single [proj x 4 hidden] GEMV for all four gates, one loop
+// for the activations and the cell update, and the [hidden x proj] projection
+void lstmp_layer_step(LSTMPLayer* layer, float* x, float* h_prev, float* c_prev, float* h_out, float* c_out) {
+    LSTMPLayerWeights* w = &layer->weights;
+    int hidden_size = layer->config.hidden_size;
+    int proj_size = layer->config.proj_size;
+    int gates = 4 * hidden_size;
+    float* g = layer->state.gate_buffer;
+    float* m = layer->state.cell_out_buffer;
+
+    for (int j = 0; j < gates; j++) {
+        g[j] = x[j] + w->b_x[j] + w->b_h[j]; // x may be the gate buffer itself
+    }
+    accumulate_rows(g, h_prev, w->W_h, proj_size, gates);
+
+    float* g_i = g;
+    float* g_f = g + hidden_size;
+    float* g_g = g + 2 * hidden_size;
+    float* g_o = g + 3 * hidden_size;
+    for (int j = 0; j < hidden_size; j++) {
+        float c = sigmoid_act(g_f[j]) * c_prev[j] + sigmoid_act(g_i[j]) * tanh_act(g_g[j]);
+        c_out[j] = c;
+        m[j] = sigmoid_act(g_o[j]) * tanh_act(c);
+    }
+
+    memset(h_out, 0, proj_size * sizeof(float));
+    accumulate_rows(h_out, m, w->W_p, hidden_size, proj_size);
+}
+
+void lstmp_layer_forward_inplace(LSTMPLayer* layer, float* input, float* h, float* c) {
+    float* x = layer->state.gate_buffer;
+    lstmp_layer_project_inputs(layer, input, 1, x);
+    lstmp_layer_step(layer, x, h, c, h, c);
+}
+
+MathStatus lstmp_layer_forward_sequence(LSTMPLayer* layer, float* inputs, float* h0, float* c0, float* outputs, int seq_len) {
+    int proj_size = layer->config.proj_size;
+    int gates = 4 * layer->config.hidden_size;
+    float* x = (float*)malloc((size_t)seq_len * gates * sizeof(float));
+    if (x == NULL) {
+        fprintf(stderr, "lstmp_layer_forward_sequence: out of memory\n");
+        return MATH_NULL_POINTER;
+    }
+    lstmp_layer_project_inputs(layer, inputs, seq_len, x);
+
+    float* h_prev = h0;
+    float* c_prev = c0;
+    for (int t = 0; t < seq_len; t++) {
+        lstmp_layer_step(layer, x + (size_t)t * gates, h_prev, c_prev, outputs + (size_t)t * proj_size, layer->state.cell_state_buffer);
+        h_prev = outputs + (size_t)t * proj_size;
+        c_prev = layer->state.cell_state_buffer; // c_t is updated in place from here on
+    }
+    free(x);
+    return MATH_SUCCESS;
+}
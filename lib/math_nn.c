@@ -2,7 +2,14 @@
 #include <stddef.h> // for NULL
 #include <float.h>  // for FLT_MAX
 #include <limits.h> // for FLT_MAX
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
 #include "math_nn.h"
+#if defined(__AVX2__)
+    #include <immintrin.h>
+#endif
 
 
 // implement the sigmoid activation function
@@ -21,6 +28,16 @@ float tanh_act(float x) {
 // out[m, p] = a[m, n] * b[n, p]
 // out[batch, out_dim] = a[batch, in_dim] * b[in_dim, out_dim]
 MathStatus matmul(float* out, float* a, float* b, int m, int n, int p) {
+#ifdef MATH_UNCHECKED
+    // release mode: each row of out is built from whole rows of b, no per-element branches
+    for (int i = 0; i < m; i++) {
+        float* out_row = out + (size_t)i * p;
+        memset(out_row, 0, p * sizeof(float));
+        for (int k = 0; k < n; k++) {
+            axpy(out_row, a[i * n + k], b + (size_t)k * p, p);
+        }
+    }
+#else
     //check for null pointers
     if (out == NULL || a == NULL || b == NULL) {
         return MATH_NULL_POINTER;
@@ -45,16 +62,366 @@ MathStatus matmul(float* out, float* a, float* b, int m, int n, int p) {
             }
         }
     }
+#endif
+    return MATH_SUCCESS;
+}
+
+
+// Pack an mc x kc block of A into MR-row panels, each stored k-major and scaled by alpha
+static void gemm_pack_a(float* packed, float* A, int lda, int mc, int kc, float alpha) {
+    for (int ir = 0; ir < mc; ir += GEMM_MR) {
+        int mr = (mc - ir < GEMM_MR) ? mc - ir : GEMM_MR;
+        for (int k = 0; k < kc; k++) {
+            for (int r = 0; r < GEMM_MR; r++) {
+                *packed++ = (r < mr) ? alpha * A[(size_t)(ir + r) * lda + k] : 0.0f;
+            }
+        }
+    }
+}
+
+// Pack a kc x nc block of B into NR-column panels, each stored k-major
+static void gemm_pack_b(float* packed, float* B, int ldb, int kc, int nc) {
+    for (int jr = 0; jr < nc; jr += GEMM_NR) {
+        int nr = (nc - jr < GEMM_NR) ? nc - jr : GEMM_NR;
+        for (int k = 0; k < kc; k++) {
+            float* row = B + (size_t)k * ldb + jr;
+            for (int c = 0; c < GEMM_NR; c++) {
+                *packed++ = (c < nr) ? row[c] : 0.0f;
+            }
+        }
+    }
+}
+
+// C[mr, nr] = A_panel * B_panel + beta * C, accumulating the full MR x NR tile in registers
+static void gemm_micro_kernel(int kc, float* a, float* b, float* C, int ldc, float beta, int mr, int nr) {
+    float tile[GEMM_MR * GEMM_NR];
+#if defined(__AVX2__) && defined(__FMA__)
+    // 12 accumulators spelled out so they stay in ymm registers at -O2 (GEMM_MR == 6)
+    __m256 c00 = _mm256_setzero_ps(), c01 = _mm256_setzero_ps();
+    __m256 c10 = _mm256_setzero_ps(), c11 = _mm256_setzero_ps();
+    __m256 c20 = _mm256_setzero_ps(), c21 = _mm256_setzero_ps();
+    __m256 c30 = _mm256_setzero_ps(), c31 = _mm256_setzero_ps();
+    __m256 c40 = _mm256_setzero_ps(), c41 = _mm256_setzero_ps();
+    __m256 c50 = _mm256_setzero_ps(), c51 = _mm256_setzero_ps();
+    for (int k = 0; k < kc; k++) {
+        __m256 b0 = _mm256_load_ps(b + k * GEMM_NR);
+        __m256 b1 = _mm256_load_ps(b + k * GEMM_NR + 8);
+        float* ak = a + k * GEMM_MR;
+        __m256 ar = _mm256_broadcast_ss(ak);
+        c00 = _mm256_fmadd_ps(ar, b0, c00);
+        c01 = _mm256_fmadd_ps(ar, b1, c01);
+        ar = _mm256_broadcast_ss(ak + 1);
+        c10 = _mm256_fmadd_ps(ar, b0, c10);
+        c11 = _mm256_fmadd_ps(ar, b1, c11);
+        ar = _mm256_broadcast_ss(ak + 2);
+        c20 = _mm256_fmadd_ps(ar, b0, c20);
+        c21 = _mm256_fmadd_ps(ar, b1, c21);
+        ar = _mm256_broadcast_ss(ak + 3);
+        c30 = _mm256_fmadd_ps(ar, b0, c30);
+        c31 = _mm256_fmadd_ps(ar, b1, c31);
+        ar = _mm256_broadcast_ss(ak + 4);
+        c40 = _mm256_fmadd_ps(ar, b0, c40);
+        c41 = _mm256_fmadd_ps(ar, b1, c41);
+        ar = _mm256_broadcast_ss(ak + 5);
+        c50 = _mm256_fmadd_ps(ar, b0, c50);
+        c51 = _mm256_fmadd_ps(ar, b1, c51);
+    }
+    _mm256_storeu_ps(tile + 0 * GEMM_NR, c00);
+    _mm256_storeu_ps(tile + 0 * GEMM_NR + 8, c01);
+    _mm256_storeu_ps(tile + 1 * GEMM_NR, c10);
+    _mm256_storeu_ps(tile + 1 * GEMM_NR + 8, c11);
+    _mm256_storeu_ps(tile + 2 * GEMM_NR, c20);
+    _mm256_storeu_ps(tile + 2 * GEMM_NR + 8, c21);
+    _mm256_storeu_ps(tile + 3 * GEMM_NR, c30);
+    _mm256_storeu_ps(tile + 3 * GEMM_NR + 8, c31);
+    _mm256_storeu_ps(tile + 4 * GEMM_NR, c40);
+    _mm256_storeu_ps(tile + 4 * GEMM_NR + 8, c41);
+    _mm256_storeu_ps(tile + 5 * GEMM_NR, c50);
+    _mm256_storeu_ps(tile + 5 * GEMM_NR + 8, c51);
+#else
+    for (int i = 0; i < GEMM_MR * GEMM_NR; i++) {
+        tile[i] = 0.0f;
+    }
+    for (int k = 0; k < kc; k++) {
+        for (int r = 0; r < GEMM_MR; r++) {
+            float ar = a[k * GEMM_MR + r];
+            for (int c = 0; c < GEMM_NR; c++) {
+                tile[r * GEMM_NR + c] += ar * b[k * GEMM_NR + c];
+            }
+        }
+    }
+#endif
+    for (int r = 0; r < mr; r++) {
+        float* c_row = C + r * ldc;
+        if (beta == 0.0f) {
+            memcpy(c_row, tile + r * GEMM_NR, nr * sizeof(float)); // never read C, it may be uninitialised
+        } else {
+            for (int c = 0; c < nr; c++) {
+                c_row[c] = tile[r * GEMM_NR + c] + beta * c_row[c];
+            }
+        }
+    }
+}
+
+// MC in the high half and KC in the low half, one atomic so a gemm never sees half an update
+static _Atomic uint64_t gemm_blocking = ((uint64_t)GEMM_MC << 32) | GEMM_KC;
+
+MathStatus gemm_set_blocking(int mc, int kc) {
+    if (mc <= 0 || kc <= 0) {
+        return MATH_INVALID_DIM;
+    }
+    atomic_store_explicit(&gemm_blocking, ((uint64_t)mc << 32) | (uint32_t)kc, memory_order_relaxed);
     return MATH_SUCCESS;
 }
 
+void gemm_get_blocking(int* mc, int* kc) {
+    uint64_t blocking = atomic_load_explicit(&gemm_blocking, memory_order_relaxed);
+    *mc = (int)(blocking >> 32);
+    *kc = (int)(uint32_t)blocking;
+}
+
+// Implement the blocked matrix multiplication
+// C[M, N] = alpha * A[M, K] * B[K, N] + beta * C[M, N]
+// Loop order follows BLIS: NC columns of B, KC deep slices packed once per slice,
+// MC rows of A packed per block, then MR x NR register tiles.
+MathStatus gemm(int M, int N, int K, float alpha, float* A, int lda, float* B, int ldb,
+                float beta, float* C, int ldc) {
+    int mc_block, kc_block;
+    gemm_get_blocking(&mc_block, &kc_block);
+    return gemm_with_blocking(mc_block, kc_block, M, N, K, alpha, A, lda, B, ldb, beta, C, ldc);
+}
+
+MathStatus gemm_with_blocking(int mc_block, int kc_block, int M, int N, int K, float alpha, float* A, int lda,
+                              float* B, int ldb, float beta, float* C, int ldc) {
+    if (C == NULL || (K > 0 && (A == NULL || B == NULL))) {
+        return MATH_NULL_POINTER;
+    }
+    if (M < 0 || N < 0 || K < 0 || lda < K || ldb < N || ldc < N || mc_block <= 0 || kc_block <= 0) {
+        return MATH_INVALID_DIM;
+    }
+    if (M == 0 || N == 0) {
+        return MATH_SUCCESS;
+    }
+    if (K == 0 || alpha == 0.0f) {
+        for (int i = 0; i < M; i++) {
+            for (int j = 0; j < N; j++) {
+                C[(size_t)i * ldc + j] = (beta == 0.0f) ? 0.0f : beta * C[(size_t)i * ldc + j];
+            }
+        }
+        return MATH_SUCCESS;
+    }
+
+    int nc_max = (N < GEMM_NC) ? N : GEMM_NC;
+    int kc_max = (K < kc_block) ? K : kc_block;
+    int mc_max = (M < mc_block) ? M : mc_block;
+    size_t b_bytes = (size_t)((nc_max + GEMM_NR - 1) / GEMM_NR) * GEMM_NR * kc_max * sizeof(float);
+    size_t a_bytes = (size_t)((mc_max + GEMM_MR - 1) / GEMM_MR) * GEMM_MR * kc_max * sizeof(float);
+    float* packed_b = (float*)aligned_alloc(64, (b_bytes + 63) & ~(size_t)63);
+    float* packed_a = (float*)aligned_alloc(64, (a_bytes + 63) & ~(size_t)63);
+    if (packed_a == NULL || packed_b == NULL) {
+        free(packed_a);
+        free(packed_b);
+        return MATH_NULL_POINTER;
+    }
+
+    for (int jc = 0; jc < N; jc += GEMM_NC) {
+        int nc = (N - jc < GEMM_NC) ? N - jc : GEMM_NC;
+        for (int pc = 0; pc < K; pc += kc_block) {
+            int kc = (K - pc < kc_block) ? K - pc : kc_block;
+            float beta_pc = (pc == 0) ? beta : 1.0f; // later slices accumulate onto the first
+            gemm_pack_b(packed_b, B + (size_t)pc * ldb + jc, ldb, kc, nc);
+
+            for (int ic = 0; ic < M; ic += mc_block) {
+                int mc = (M - ic < mc_block) ? M - ic : mc_block;
+                gemm_pack_a(packed_a, A + (size_t)ic * lda + pc, lda, mc, kc, alpha);
+
+                for (int jr = 0; jr < nc; jr += GEMM_NR) {
+                    int nr = (nc - jr < GEMM_NR) ? nc - jr : GEMM_NR;
+                    for (int ir = 0; ir < mc; ir += GEMM_MR) {
+                        int mr = (mc - ir < GEMM_MR) ? mc - ir : GEMM_MR;
+                        gemm_micro_kernel(kc, packed_a + ir * kc, packed_b + jr * kc,
+                                          C + (size_t)(ic + ir) * ldc + jc + jr, ldc, beta_pc, mr, nr);
+                    }
+                }
+            }
+        }
+    }
+
+    free(packed_a);
+    free(packed_b);
+    return MATH_SUCCESS;
+}
+
+
+// Delta encoding against the last propagated values. Entries below the threshold
+// keep their old reference, so small changes accumulate until they are propagated.
+int delta_encode(int* idx, float* dx, float* x, float* ref, int size, float threshold) {
+    int count = 0;
+    for (int i = 0; i < size; i++) {
+        float d = x[i] - ref[i];
+        if (d > threshold || d < -threshold) {
+            idx[count] = i;
+            dx[count] = d;
+            ref[i] = x[i];
+            count++;
+        }
+    }
+    return count;
+}
+
+// out[cols] += a * w[cols], the row update shared by the GEMV-style kernels below
+static void axpy_row(float* out, float a, float* w, int cols) {
+    for (int j = 0; j < cols; j++) {
+        out[j] += a * w[j];
+    }
+}
+
+// Only the rows of W for changed entries are read, the cost scales with count
+void delta_accumulate(float* m, float* W, int cols, int* idx, float* dx, int count) {
+    for (int k = 0; k < count; k++) {
+        axpy_row(m, dx[k], W + (size_t)idx[k] * cols, cols);
+    }
+}
+
+// One contiguous row of W at a time
+void accumulate_rows(float* out, float* a, float* W, int rows, int cols) {
+    for (int k = 0; k < rows; k++) {
+        axpy_row(out, a[k], W + (size_t)k * cols, cols);
+    }
+}
+
+#if defined(__AVX2__) && defined(__FMA__)
+static float hsum256(__m256 v) {
+    __m128 s = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+    s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+    return _mm_cvtss_f32(s);
+}
+
+// exp(x) as 2^n * p(r) with x = n ln2 + r, |r| <= ln2 / 2 (Cephes expf polynomial)
+static __m256 exp256(__m256 x) {
+    // min/max return their second operand on NaN, so a NaN lane stays NaN as with expf
+    x = _mm256_max_ps(_mm256_set1_ps(-87.0f), _mm256_min_ps(_mm256_set1_ps(88.0f), x));
+    __m256 n = _mm256_round_ps(_mm256_mul_ps(x, _mm256_set1_ps(1.44269504f)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+    __m256 r = _mm256_fnmadd_ps(n, _mm256_set1_ps(0.693359375f), x);
+    r = _mm256_fnmadd_ps(n, _mm256_set1_ps(-2.12194440e-4f), r);
+    __m256 p = _mm256_set1_ps(1.9875691500e-4f);
+    p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(1.3981999507e-3f));
+    p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(8.3334519073e-3f));
+    p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(4.1665795894e-2f));
+    p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(1.6666665459e-1f));
+    p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(5.0000001201e-1f));
+    p = _mm256_fmadd_ps(p, _mm256_mul_ps(r, r), _mm256_add_ps(r, _mm256_set1_ps(1.0f)));
+    __m256i e = _mm256_slli_epi32(_mm256_add_epi32(_mm256_cvtps_epi32(n), _mm256_set1_epi32(127)), 23);
+    return _mm256_mul_ps(p, _mm256_castsi256_ps(e));
+}
+#endif
+
+float dot_product(float* a, float* b, int size) {
+    int i = 0;
+    float sum = 0.0f;
+#if defined(__AVX2__) && defined(__FMA__)
+    __m256 acc0 = _mm256_setzero_ps();
+    __m256 acc1 = _mm256_setzero_ps();
+    for (; i + 16 <= size; i += 16) {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc0);
+        acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8), acc1);
+    }
+    for (; i + 8 <= size; i += 8) {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc0);
+    }
+    sum = hsum256(_mm256_add_ps(acc0, acc1));
+#endif
+    for (; i < size; i++) {
+        sum += a[i] * b[i];
+    }
+    return sum;
+}
+
+void axpy(float* y, float alpha, float* x, int size) {
+    int i = 0;
+#if defined(__AVX2__) && defined(__FMA__)
+    __m256 a = _mm256_set1_ps(alpha);
+    for (; i + 8 <= size; i += 8) {
+        _mm256_storeu_ps(y + i, _mm256_fmadd_ps(a, _mm256_loadu_ps(x + i), _mm256_loadu_ps(y + i)));
+    }
+#endif
+    for (; i < size; i++) {
+        y[i] += alpha * x[i];
+    }
+}
+
+void softmax_inplace(float* x, int size) {
+    if (size <= 0) {
+        return;
+    }
+    float max_val = x[0];
+    for (int i = 1; i < size; i++) {
+        max_val = (x[i] > max_val) ? x[i] : max_val;
+    }
+    int i = 0;
+    float sum = 0.0f;
+#if defined(__AVX2__) && defined(__FMA__)
+    __m256 m = _mm256_set1_ps(max_val);
+    __m256 acc = _mm256_setzero_ps();
+    for (; i + 8 <= size; i += 8) {
+        __m256 e = exp256(_mm256_sub_ps(_mm256_loadu_ps(x + i), m));
+        _mm256_storeu_ps(x + i, e);
+        acc = _mm256_add_ps(acc, e);
+    }
+    sum = hsum256(acc);
+#endif
+    for (; i < size; i++) {
+        x[i] = expf(x[i] - max_val);
+        sum += x[i];
+    }
+    float inv = 1.0f / sum;
+    for (i = 0; i < size; i++) {
+        x[i] *= inv;
+    }
+}
+
+MathStatus numerics_scan(float* x, int size, float limit, NumericsCounts* counts) {
+    long nan = 0;
+    long inf = 0;
+    long saturated = 0;
+    int i = 0;
+#if defined(__AVX2__) // compares and movemask only, no FMA needed
+    __m256 abs_mask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+    __m256 infinity = _mm256_set1_ps(INFINITY);
+    __m256 bound = _mm256_set1_ps(limit);
+    for (; i + 8 <= size; i += 8) {
+        __m256 v = _mm256_loadu_ps(x + i);
+        __m256 a = _mm256_and_ps(v, abs_mask);
+        nan += __builtin_popcount(_mm256_movemask_ps(_mm256_cmp_ps(v, v, _CMP_UNORD_Q)));
+        inf += __builtin_popcount(_mm256_movemask_ps(_mm256_cmp_ps(a, infinity, _CMP_EQ_OQ)));
+        __m256 high = _mm256_and_ps(_mm256_cmp_ps(a, bound, _CMP_GE_OQ), _mm256_cmp_ps(a, infinity, _CMP_LT_OQ));
+        saturated += __builtin_popcount(_mm256_movemask_ps(high));
+    }
+#endif
+    for (; i < size; i++) {
+        float a = fabsf(x[i]);
+        nan += (x[i] != x[i]);
+        inf += (a == INFINITY);
+        saturated += (a >= limit && a < INFINITY);
+    }
+    counts->nan += nan;
+    counts->inf += inf;
+    counts->saturated += saturated;
+    if (nan > 0 || inf > 0) {
+        return MATH_OVERFLOW_RISK;
+    }
+    return (saturated > 0) ? MATH_INVALID_RANGE : MATH_SUCCESS;
+}
 
 // implement add function at vector level 
 // out[size] = a[size] + b[size]
 MathStatus add(float* out, float* a, float* b, int size) {
+#ifndef MATH_UNCHECKED
     if (size > MAX_DIM) {
         return MATH_INVALID_DIM; // Exceeds maximum iteration limit
     }
+#endif
     for (int i = 0; i < size; i++) {
         out[i] = a[i] + b[i];
     }
@@ -66,9 +433,11 @@ MathStatus add(float* out, float* a, float* b, int size) {
 //out[size] = a[size] * b[size]
 //          =[a1*b1 a2*b2 a3*b3 ...]
 MathStatus mul(float* out, float* a, float* b, int size) {
+#ifndef MATH_UNCHECKED
     if (size > MAX_DIM) {
         return MATH_INVALID_DIM; // Exceeds maximum iteration limit
     }
+#endif
     for (int i = 0; i < size; i++) {
         out[i] = a[i] * b[i];
     }
@@ -78,9 +447,11 @@ MathStatus mul(float* out, float* a, float* b, int size) {
 
 // implement the sigmoid activation function at vector level 
 MathStatus sigmoid_act_vec(float* out, float* x, int size) {
+#ifndef MATH_UNCHECKED
     if (size > MAX_DIM) {
         return MATH_INVALID_DIM; // Exceeds maximum iteration limit
     }
+#endif
     for (int i = 0; i < size; i++) {
         out[i] = sigmoid_act(x[i]);
     }
@@ -89,9 +460,11 @@ MathStatus sigmoid_act_vec(float* out, float* x, int size) {
 
 // implement the tanh activation function at vector level
 MathStatus tanh_act_vec(float* out, float* x, int size) {
+#ifndef MATH_UNCHECKED
     if (size > MAX_DIM) {
         return MATH_INVALID_DIM; // Exceeds maximum iteration limit
     }
+#endif
     for (int i = 0; i < size; i++) {
         out[i] = tanh_act(x[i]);
     }
@@ -100,12 +473,14 @@ MathStatus tanh_act_vec(float* out, float* x, int size) {
 
 // Function to perform RMS normalization
 MathStatus rms_norm(float* out, float* x, int size) {
+#ifndef MATH_UNCHECKED
     if (out == NULL || x == NULL) {
         return MATH_NULL_POINTER; // Check for null pointers
     }
     if (size <= 0 || size > MAX_DIM) {
         return MATH_INVALID_DIM; // Check for valid dimensions
     }
+#endif
 
     // Calculate sum of squares
     float ss = 0.0f;
@@ -126,12 +501,14 @@ MathStatus rms_norm(float* out, float* x, int size) {
 
 // Function to perform softmax
 MathStatus softmax(float* out, float* x, int size) {
+#ifndef MATH_UNCHECKED
     if (out == NULL || x == NULL) {
         return MATH_NULL_POINTER; // Check for null pointers
     }
     if (size <= 0 || size > MAX_DIM) {
         return MATH_INVALID_DIM; // Check for valid dimensions
     }
+#endif
 
     // Find max value (for numerical stability)
     float max_val = x[0];
@@ -0,0 +1,205 @@
+#define _POSIX_C_SOURCE 200809L // stat st_mtim
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <sched.h>
+#include <sys/stat.h>
+#include "model_registry.h"
+
+MathStatus init_model_registry(ModelRegistry* registry, int capacity) {
+    if (registry == NULL) {
+        return MATH_NULL_POINTER;
+    }
+    if (capacity <= 0) {
+        return MATH_INVALID_DIM;
+    }
+    memset(registry, 0, sizeof(ModelRegistry));
+    registry->entries = (RegistryEntry*)calloc(capacity, sizeof(RegistryEntry));
+    if (registry->entries == NULL) {
+        return MATH_NULL_POINTER;
+    }
+    registry->capacity = capacity;
+    for (int i = 0; i < capacity; i++) {
+        atomic_init(&registry->entries[i].current, NULL);
+    }
+    atomic_init(&registry->epoch, 0);
+    atomic_init(&registry->readers[0], 0);
+    atomic_init(&registry->readers[1], 0);
+    pthread_mutex_init(&registry->lock, NULL);
+    return MATH_SUCCESS;
+}
+
+// Reuse the mapping of the same file, or map it. Called with the lock held.
+static SharedMapping* get_mapping(ModelRegistry* registry, const char* path, unsigned load_flags) {
+    struct stat st;
+    if (stat(path, &st) != 0) {
+        fprintf(stderr, "Couldn't stat %s\n", path);
+        return NULL;
+    }
+    for (SharedMapping* m = registry->mappings; m != NULL; m = m->next) {
+        if (m->dev == (uint64_t)st.st_dev && m->ino == (uint64_t)st.st_ino && m->mtime_sec == (int64_t)st.st_mtim.tv_sec
+            && m->mtime_nsec == (int64_t)st.st_mtim.tv_nsec && m->ckpt.size == (size_t)st.st_size) {
+            m->users++;
+            return m;
+        }
+    }
+    SharedMapping* m = (SharedMapping*)calloc(1, sizeof(SharedMapping));
+    if (m == NULL) {
+        return NULL;
+    }
+    if (map_checkpoint(&m->ckpt, (char*)path, load_flags) != MATH_SUCCESS) {
+        free(m);
+        return NULL;
+    }
+    snprintf(m->path, REGISTRY_PATH_LEN, "%s", path);
+    m->dev = (uint64_t)st.st_dev;
+    m->ino = (uint64_t)st.st_ino;
+    m->mtime_sec = (int64_t)st.st_mtim.tv_sec;
+    m->mtime_nsec = (int64_t)st.st_mtim.tv_nsec;
+    m->users = 1;
+    m->next = registry->mappings;
+    registry->mappings = m;
+    return m;
+}
+
+// Called with the lock held
+static void put_mapping(ModelRegistry* registry, SharedMapping* mapping) {
+    if (--mapping->users > 0) {
+        return;
+    }
+    SharedMapping** link = &registry->mappings;
+    while (*link != mapping) {
+        link = &(*link)->next;
+    }
+    *link = mapping->next;
+    unmap_checkpoint(&mapping->ckpt);
+    free(mapping);
+}
+
+// Called with the lock held
+static void free_model_version(ModelRegistry* registry, ModelVersion* version) {
+    printf("Unloading version %d...\n", version->version);
+    free_rnn_model(&version->model, false); // the weights belong to the mapping
+    put_mapping(registry, version->mapping);
+    free(version);
+}
+
+static ModelVersion* new_model_version(ModelRegistry* registry, const char* path, RNNModelConfig config, unsigned load_flags) {
+    SharedMapping* mapping = get_mapping(registry, path, load_flags);
+    if (mapping == NULL) {
+        return NULL;
+    }
+    ModelVersion* version = (ModelVersion*)calloc(1, sizeof(ModelVersion));
+    if (version == NULL) {
+        put_mapping(registry, mapping);
+        return NULL;
+    }
+    init_rnn_model(&version->model, config);
+    if (attach_rnn_checkpoint(&version->model, &mapping->ckpt) != MATH_SUCCESS) {
+        free_rnn_model(&version->model, true);
+        free(version);
+        put_mapping(registry, mapping);
+        return NULL;
+    }
+    version->mapping = mapping;
+    atomic_init(&version->refs, 1);
+    return version;
+}
+
+// Called with the lock held
+static RegistryEntry* find_entry(ModelRegistry* registry, const char* name) {
+    for (int i = 0; i < registry->count; i++) {
+        if (strcmp(registry->entries[i].name, name) == 0) {
+            return &registry->entries[i];
+        }
+    }
+    return NULL;
+}
+
+RegistryEntry* model_registry_find(ModelRegistry* registry, const char* name) {
+    pthread_mutex_lock(&registry->lock);
+    RegistryEntry* entry = find_entry(registry, name);
+    pthread_mutex_unlock(&registry->lock);
+    return entry;
+}
+
+MathStatus model_registry_load(ModelRegistry* registry, const char* name, const char* path,
+                               RNNModelConfig config, unsigned load_flags) {
+    if (registry == NULL || name == NULL || path == NULL) {
+        return MATH_NULL_POINTER;
+    }
+    pthread_mutex_lock(&registry->lock);
+    RegistryEntry* entry = find_entry(registry, name);
+    if (entry == NULL && registry->count == registry->capacity) {
+        pthread_mutex_unlock(&registry->lock);
+        return MATH_INVALID_DIM;
+    }
+    ModelVersion* version = new_model_version(registry, path, config, load_flags);
+    if (version == NULL) {
+        pthread_mutex_unlock(&registry->lock);
+        return MATH_INVALID_RANGE;
+    }
+    if (entry == NULL) {
+        entry = &registry->entries[registry->count];
+        snprintf(entry->name, REGISTRY_NAME_LEN, "%s", name);
+        version->version = 1;
+        atomic_store(&entry->current, version);
+        registry->count++;
+        pthread_mutex_unlock(&registry->lock);
+        return MATH_SUCCESS;
+    }
+
+    ModelVersion* old = atomic_load(&entry->current);
+    version->version = old->version + 1;
+    atomic_store(&entry->current, version);
+    // grace period: readers that started before the swap may still be about to
+    // pin the old version, later ones land in the other slot and see the new one.
+    // One flip is not enough: a reader may have read the epoch before the previous
+    // reload's flip and counted itself into the slot that reload already drained,
+    // so flip twice and drain both slots in turn.
+    for (int flip = 0; flip < 2; flip++) {
+        int epoch = atomic_fetch_add(&registry->epoch, 1) & 1;
+        while (atomic_load(&registry->readers[epoch]) != 0) {
+            sched_yield();
+        }
+    }
+    registry->reloads++;
+    pthread_mutex_unlock(&registry->lock);
+    printf("Swapped in version %d of %s.\n", version->version, name);
+    model_registry_release(registry, old); // the registry's reference
+    return MATH_SUCCESS;
+}
+
+ModelVersion* model_registry_acquire(ModelRegistry* registry, RegistryEntry* entry) {
+    int epoch = atomic_load(&registry->epoch) & 1;
+    atomic_fetch_add(&registry->readers[epoch], 1);
+    ModelVersion* version = atomic_load(&entry->current);
+    atomic_fetch_add(&version->refs, 1);
+    atomic_fetch_sub(&registry->readers[epoch], 1);
+    return version;
+}
+
+void model_registry_release(ModelRegistry* registry, ModelVersion* version) {
+    if (atomic_fetch_sub(&version->refs, 1) == 1) {
+        // the last step on a retired version, only happens once per reload
+        pthread_mutex_lock(&registry->lock);
+        free_model_version(registry, version);
+        pthread_mutex_unlock(&registry->lock);
+    }
+}
+
+void free_model_registry(ModelRegistry* registry) {
+    for (int i = 0; i < registry->count; i++) {
+        ModelVersion* version = atomic_load(&registry->entries[i].current);
+        atomic_store(&registry->entries[i].current, NULL);
+        model_registry_release(registry, version);
+    }
+    if (registry->mappings != NULL) {
+        fprintf(stderr, "Model registry freed with versions still acquired\n");
+    }
+    pthread_mutex_destroy(&registry->lock);
+    free(registry->entries);
+    registry->entries = NULL;
+    registry->count = 0;
+}
@@ -0,0 +1,259 @@
+#define _POSIX_C_SOURCE 200809L // stat st_mtim
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/stat.h>
+#include "pack.h"
+#include "math_nn.h"
+#if defined(__AVX__)
+    #include <immintrin.h>
+#endif
+
+static size_t align_up(size_t bytes) {
+    return (bytes + PACK_ALIGN - 1) & ~(size_t)(PACK_ALIGN - 1);
+}
+
+size_t packed_matrix_bytes(int rows, int cols) {
+    size_t panels = (cols + PACK_PANEL - 1) / PACK_PANEL;
+    return align_up(panels * rows * PACK_PANEL * sizeof(float));
+}
+
+size_t packed_vector_bytes(int size) {
+    return align_up(size * sizeof(float));
+}
+
+MathStatus init_pack_arena(PackArena* arena, size_t size) {
+    if (arena == NULL) {
+        return MATH_NULL_POINTER;
+    }
+    size = align_up(size);
+    arena->base = (uint8_t*)aligned_alloc(PACK_ALIGN, size);
+    if (arena->base == NULL) {
+        return MATH_NULL_POINTER;
+    }
+    memset(arena->base, 0, size);
+    arena->size = size;
+    arena->used = 0;
+    arena->prepacked = false;
+    arena->owns_data = true;
+    memset(&arena->mapping, 0, sizeof(MappedCheckpoint));
+    return MATH_SUCCESS;
+}
+
+void attach_pack_arena(PackArena* arena, void* data, size_t size) {
+    arena->base = (uint8_t*)data;
+    arena->size = size;
+    arena->used = 0;
+    arena->prepacked = true;
+    arena->owns_data = false;
+    memset(&arena->mapping, 0, sizeof(MappedCheckpoint));
+}
+
+void free_pack_arena(PackArena* arena) {
+    if (arena->owns_data) {
+        free(arena->base);
+    }
+    arena->base = NULL;
+    arena->size = 0;
+    arena->used = 0;
+}
+
+static void* arena_take(PackArena* arena, size_t bytes) {
+    if (arena->base == NULL || arena->used + bytes > arena->size) {
+        return NULL;
+    }
+    void* ptr = arena->base + arena->used;
+    arena->used += bytes;
+    return ptr;
+}
+
+MathStatus pack_matrix(PackedMatrix* out, PackArena* arena, float* w, int rows, int cols) {
+    if (out == NULL || arena == NULL) {
+        return MATH_NULL_POINTER;
+    }
+    if (rows <= 0 || cols <= 0) {
+        return MATH_INVALID_DIM;
+    }
+    float* dst = (float*)arena_take(arena, packed_matrix_bytes(rows, cols));
+    if (dst == NULL) {
+        return MATH_EXCEEDS_MAX_DIM; // arena too small
+    }
+    out->rows = rows;
+    out->cols = cols;
+    out->data = dst;
+    if (arena->prepacked) {
+        return MATH_SUCCESS;
+    }
+    if (w == NULL) {
+        return MATH_NULL_POINTER;
+    }
+
+    int panels = (cols + PACK_PANEL - 1) / PACK_PANEL;
+    for (int pn = 0; pn < panels; pn++) {
+        float* panel = dst + (size_t)pn * rows * PACK_PANEL;
+        for (int k = 0; k < rows; k++) {
+            for (int c = 0; c < PACK_PANEL; c++) {
+                int j = pn * PACK_PANEL + c;
+                panel[k * PACK_PANEL + c] = (j < cols) ? w[k * cols + j] : 0.0f;
+            }
+        }
+    }
+    return MATH_SUCCESS;
+}
+
+float* pack_vector(PackArena* arena, float* v, int size) {
+    float* dst = (float*)arena_take(arena, packed_vector_bytes(size));
+    if (dst != NULL && !arena->prepacked) {
+        memcpy(dst, v, size * sizeof(float));
+    }
+    return dst;
+}
+
+// Stamp the header with the size and mtime of the float checkpoint, nothing when source is NULL
+static MathStatus stamp_source(PackedCheckpointHeader* header, char* source) {
+    header->source_size = 0;
+    header->source_mtime_sec = 0;
+    header->source_mtime_nsec = 0;
+    if (source == NULL) {
+        return MATH_SUCCESS;
+    }
+    struct stat st;
+    if (stat(source, &st) != 0) {
+        fprintf(stderr, "Couldn't stat %s\n", source);
+        return MATH_NULL_POINTER;
+    }
+    header->source_size = (uint64_t)st.st_size;
+    header->source_mtime_sec = (int64_t)st.st_mtim.tv_sec;
+    header->source_mtime_nsec = (int64_t)st.st_mtim.tv_nsec;
+    return MATH_SUCCESS;
+}
+
+MathStatus save_packed_checkpoint(char* path, PackArena* arena, char* source) {
+    uint8_t header_block[PACK_ALIGN] = {0};
+    PackedCheckpointHeader header = {PACK_MAGIC, PACK_VERSION, arena->used, 0, 0, 0};
+    MathStatus status = stamp_source(&header, source);
+    if (status != MATH_SUCCESS) {
+        return status;
+    }
+    FILE* file = fopen(path, "wb");
+    if (!file) {
+        fprintf(stderr, "Couldn't open file %s\n", path);
+        return MATH_NULL_POINTER;
+    }
+    memcpy(header_block, &header, sizeof(header));
+
+    size_t written = fwrite(header_block, 1, PACK_ALIGN, file);
+    written += fwrite(arena->base, 1, arena->used, file);
+    fclose(file);
+    if (written != PACK_ALIGN + arena->used) {
+        fprintf(stderr, "Short write to %s\n", path);
+        return MATH_INVALID_DIM;
+    }
+    return MATH_SUCCESS;
+}
+
+MathStatus open_packed_checkpoint(char* path, PackArena* arena, size_t expected_size, char* source, unsigned load_flags) {
+    FILE* file = fopen(path, "rb");
+    if (!file) {
+        return MATH_NULL_POINTER;
+    }
+    PackedCheckpointHeader header;
+    size_t got = fread(&header, sizeof(header), 1, file);
+    fclose(file);
+    if (got != 1 || header.magic != PACK_MAGIC || header.version != PACK_VERSION) {
+        fprintf(stderr, "%s is not a pre-packed checkpoint\n", path);
+        return MATH_INVALID_RANGE;
+    }
+    if (expected_size != 0 && header.size != expected_size) {
+        fprintf(stderr, "%s was packed for a different model\n", path);
+        return MATH_INVALID_DIM;
+    }
+    // a float checkpoint replaced since packing leaves the panels stale
+    PackedCheckpointHeader current;
+    if (source != NULL && (stamp_source(&current, source) != MATH_SUCCESS
+                           || current.source_size != header.source_size
+                           || current.source_mtime_sec != header.source_mtime_sec
+                           || current.source_mtime_nsec != header.source_mtime_nsec)) {
+        fprintf(stderr, "%s was packed from an older %s\n", path, source);
+        return MATH_INVALID_RANGE;
+    }
+
+    // the panels are only ever read, so a lazy mapping stays shared with the page cache
+    MappedCheckpoint mapping;
+    MathStatus status = map_checkpoint(&mapping, path, load_flags);
+    if (status != MATH_SUCCESS) {
+        return status;
+    }
+    if (mapping.size < PACK_ALIGN + header.size) {
+        fprintf(stderr, "%s is truncated\n", path);
+        unmap_checkpoint(&mapping);
+        return MATH_INVALID_DIM;
+    }
+    attach_pack_arena(arena, mapping.base + PACK_ALIGN, header.size);
+    arena->mapping = mapping;
+    return MATH_SUCCESS;
+}
+
+void close_packed_checkpoint(PackArena* arena) {
+    unmap_checkpoint(&arena->mapping);
+    arena->base = NULL;
+    arena->size = 0;
+    arena->used = 0;
+}
+
+// out[m, p] = a[m, n] * b[n, p]
+// Each panel keeps 16 outputs in registers while streaming its rows once.
+MathStatus matmul_packed(float* out, float* a, PackedMatrix* b, int m) {
+    if (out == NULL || a == NULL || b == NULL || b->data == NULL) {
+        return MATH_NULL_POINTER;
+    }
+    int n = b->rows;
+    int p = b->cols;
+    if (m <= 0 || n <= 0 || p <= 0 || n > MAX_DIM || p > MAX_DIM) { // any number of rows
+        return MATH_INVALID_DIM;
+    }
+
+    int panels = (p + PACK_PANEL - 1) / PACK_PANEL;
+    for (int i = 0; i < m; i++) {
+        float* x = a + i * n;
+        for (int pn = 0; pn < panels; pn++) {
+            float* panel = b->data + (size_t)pn * n * PACK_PANEL;
+            float acc[PACK_PANEL];
+#if defined(__AVX__)
+            __m256 acc0 = _mm256_setzero_ps();
+            __m256 acc1 = _mm256_setzero_ps();
+            for (int k = 0; k < n; k++) {
+                __m256 xk = _mm256_set1_ps(x[k]);
+    #if defined(__FMA__)
+                acc0 = _mm256_fmadd_ps(xk, _mm256_load_ps(panel + k * PACK_PANEL), acc0);
+                acc1 = _mm256_fmadd_ps(xk, _mm256_load_ps(panel + k * PACK_PANEL + 8), acc1);
+    #else
+                acc0 = _mm256_add_ps(acc0, _mm256_mul_ps(xk, _mm256_load_ps(panel + k * PACK_PANEL)));
+                acc1 = _mm256_add_ps(acc1, _mm256_mul_ps(xk, _mm256_load_ps(panel + k * PACK_PANEL + 8)));
+    #endif
+            }
+            _mm256_storeu_ps(acc, acc0);
+            _mm256_storeu_ps(acc + 8, acc1);
+#else
+            for (int c = 0; c < PACK_PANEL; c++) {
+                acc[c] = 0.0f;
+            }
+            for (int k = 0; k < n; k++) {
+                float xk = x[k];
+                float* w = panel + k * PACK_PANEL;
+                for (int c = 0; c < PACK_PANEL; c++) {
+                    acc[c] += xk * w[c];
+                }
+            }
+#endif
+            int width = p - pn * PACK_PANEL;
+            if (width > PACK_PANEL) {
+                width = PACK_PANEL;
+            }
+            memcpy(out + i * p + pn * PACK_PANEL, acc, width * sizeof(float));
+        }
+    }
+    return MATH_SUCCESS;
+}
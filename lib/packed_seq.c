@@ -0,0 +1,166 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include "packed_seq.h"
+
+MathStatus init_packed_sequences(PackedSequences* packed, int* lengths, int count) {
+    if (packed == NULL || lengths == NULL) {
+        return MATH_NULL_POINTER;
+    }
+    if (count <= 0) {
+        return MATH_INVALID_DIM;
+    }
+    memset(packed, 0, sizeof(PackedSequences));
+    int max_len = 0;
+    for (int i = 0; i < count; i++) {
+        if (lengths[i] <= 0) {
+            return MATH_INVALID_DIM;
+        }
+        max_len = (lengths[i] > max_len) ? lengths[i] : max_len;
+    }
+    packed->count = count;
+    packed->max_len = max_len;
+    packed->order = (int*)malloc(count * sizeof(int));
+    packed->lengths = (int*)malloc(count * sizeof(int));
+    packed->batch_sizes = (int*)calloc(max_len + 1, sizeof(int));
+    packed->offsets = (long*)malloc(max_len * sizeof(long));
+    if (packed->order == NULL || packed->lengths == NULL || packed->batch_sizes == NULL || packed->offsets == NULL) {
+        free_packed_sequences(packed);
+        return MATH_NULL_POINTER;
+    }
+
+    // counting sort, longest first: batch_sizes[len] first holds the sequences of each length
+    int* histogram = packed->batch_sizes;
+    for (int i = 0; i < count; i++) {
+        histogram[lengths[i]]++;
+    }
+    int slot = 0;
+    for (int len = max_len; len > 0; len--) {
+        int start = slot;
+        slot += histogram[len];
+        histogram[len] = start;
+    }
+    for (int i = 0; i < count; i++) {
+        int s = histogram[lengths[i]]++;
+        packed->order[s] = i;
+        packed->lengths[s] = lengths[i];
+    }
+
+    // step t runs the slots whose length is past t, a prefix since lengths are sorted
+    int live = count;
+    long offset = 0;
+    for (int t = 0; t < max_len; t++) {
+        while (packed->lengths[live - 1] <= t) {
+            live--;
+        }
+        packed->batch_sizes[t] = live;
+        packed->offsets[t] = offset;
+        offset += live;
+    }
+    packed->batch_sizes[max_len] = 0;
+    packed->total = offset;
+    return MATH_SUCCESS;
+}
+
+void free_packed_sequences(PackedSequences* packed) {
+    free(packed->order);
+    free(packed->lengths);
+    free(packed->batch_sizes);
+    free(packed->offsets);
+    packed->order = NULL;
+    packed->lengths = NULL;
+    packed->batch_sizes = NULL;
+    packed->offsets = NULL;
+}
+
+void pack_sequences(PackedSequences* packed, float** sequences, int width, float* data) {
+    size_t bytes = width * sizeof(float);
+    for (int t = 0; t < packed->max_len; t++) {
+        for (int s = 0; s < packed->batch_sizes[t]; s++) {
+            memcpy(data + (packed->offsets[t] + s) * width, sequences[packed->order[s]] + (size_t)t * width, bytes);
+        }
+    }
+}
+
+void unpack_sequences(PackedSequences* packed, float* data, int width, float** sequences) {
+    size_t bytes = width * sizeof(float);
+    for (int t = 0; t < packed->max_len; t++) {
+        for (int s = 0; s < packed->batch_sizes[t]; s++) {
+            memcpy(sequences[packed->order[s]] + (size_t)t * width, data + (packed->offsets[t] + s) * width, bytes);
+        }
+    }
+}
+
+MathStatus rnn_batch_forward_packed(RNNBatch* batch, PackedSequences* packed, float* inputs, float** states, float* outputs) {
+    if (batch == NULL || packed == NULL || inputs == NULL || states == NULL) {
+        return MATH_NULL_POINTER;
+    }
+    if (packed->count > batch->max_rows) {
+        return MATH_INVALID_DIM;
+    }
+    RNNModel* model = batch->model;
+    int num_layers = model->config.num_layers;
+    int hidden_size = model->config.hidden_size;
+    int output_size = model->config.output_size;
+    bool lstm = (model->config.cell_type == RNN_CELL_LSTM);
+    int gates = lstm ? 4 : 3;
+    size_t block = (size_t)packed->total * hidden_size;
+    size_t bytes = hidden_size * sizeof(float);
+
+    float* x_proj = (float*)malloc((gates + 2) * block * sizeof(float));
+    if (x_proj == NULL) {
+        return MATH_NULL_POINTER;
+    }
+    float* layer_outputs[2] = {x_proj + gates * block, x_proj + (gates + 1) * block};
+
+    for (int l = 0; l < num_layers; l++) {
+        float* layer_input = (l == 0) ? inputs : layer_outputs[(l - 1) % 2];
+        float* out = layer_outputs[l % 2];
+        float* h0 = batch->hidden + (size_t)l * batch->max_rows * hidden_size;
+        float* c = lstm ? batch->cell + (size_t)l * batch->max_rows * hidden_size : NULL;
+        for (int s = 0; s < packed->count; s++) {
+            memcpy(h0 + s * hidden_size, rnn_model_hidden_state(model, states[packed->order[s]], l), bytes);
+            if (c != NULL) {
+                memcpy(c + s * hidden_size, rnn_model_cell_state(model, states[packed->order[s]], l), bytes);
+            }
+        }
+        if (lstm) {
+            lstm_layer_project_inputs(&batch->lstm_layers[l], layer_input, (int)packed->total,
+                                      x_proj, x_proj + block, x_proj + 2 * block, x_proj + 3 * block);
+        } else {
+            gru_layer_project_inputs(&batch->gru_layers[l], layer_input, (int)packed->total,
+                                     x_proj, x_proj + block, x_proj + 2 * block);
+        }
+
+        for (int t = 0; t < packed->max_len; t++) {
+            int rows = packed->batch_sizes[t];
+            size_t at = (size_t)packed->offsets[t] * hidden_size;
+            // the live slots of step t are a prefix of those of step t - 1
+            float* h_prev = (t == 0) ? h0 : out + (size_t)packed->offsets[t - 1] * hidden_size;
+            if (lstm) {
+                batch->lstm_layers[l].config.input_dim = rows;
+                lstm_layer_step(&batch->lstm_layers[l], x_proj + at, x_proj + block + at, x_proj + 2 * block + at,
+                                x_proj + 3 * block + at, h_prev, c, out + at, c);
+            } else {
+                batch->gru_layers[l].config.input_dim = rows;
+                gru_layer_step(&batch->gru_layers[l], x_proj + at, x_proj + block + at, x_proj + 2 * block + at, h_prev, out + at);
+            }
+
+            // slots that end here write their state out now and drop from the next steps
+            for (int s = packed->batch_sizes[t + 1]; s < rows; s++) {
+                float* h = out + at + (size_t)s * hidden_size;
+                float* state = states[packed->order[s]];
+                memcpy(rnn_model_hidden_state(model, state, l), h, bytes);
+                if (c != NULL) {
+                    memcpy(rnn_model_cell_state(model, state, l), c + s * hidden_size, bytes);
+                }
+                if (outputs != NULL && l == num_layers - 1) {
+                    linear_layer_forward(&model->output_layer, h, outputs + (size_t)packed->order[s] * output_size);
+                }
+            }
+        }
+    }
+    free(x_proj);
+    return MATH_SUCCESS;
+}
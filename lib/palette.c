@@ -0,0 +1,262 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "palette.h"
+#include "math_nn.h"
+#if defined(__AVX2__)
+    #include <immintrin.h>
+#endif
+
+int palette_row_stride(int cols) {
+    return (cols + 1) / 2;
+}
+
+size_t palette_matrix_bytes(int rows, int cols, int num_codebooks) {
+    size_t bytes = (size_t)num_codebooks * PALETTE_SIZE * sizeof(float);
+    bytes += (size_t)rows * palette_row_stride(cols);
+    return (bytes + 3) & ~(size_t)3; // keep the next float tensor aligned
+}
+
+static int compare_float(const void* a, const void* b) {
+    float fa = *(const float*)a;
+    float fb = *(const float*)b;
+    return (fa > fb) - (fa < fb);
+}
+
+static int nearest_centroid(float* centroids, float x) {
+    int best = 0;
+    float best_dist = (x - centroids[0]) * (x - centroids[0]);
+    for (int t = 1; t < PALETTE_SIZE; t++) {
+        float dist = (x - centroids[t]) * (x - centroids[t]);
+        if (dist < best_dist) {
+            best_dist = dist;
+            best = t;
+        }
+    }
+    return best;
+}
+
+// 1-D k-means (Lloyd), centroids start at the quantile midpoints of the values,
+// or at the values themselves when there are no more than 16 distinct ones
+static MathStatus kmeans_1d(float* centroids, float* values, int count, int iterations) {
+    float* sorted = (float*)malloc(count * sizeof(float));
+    if (sorted == NULL) {
+        return MATH_NULL_POINTER;
+    }
+    memcpy(sorted, values, count * sizeof(float));
+    qsort(sorted, count, sizeof(float), compare_float);
+    int distinct = 1;
+    for (int i = 1; i < count && distinct <= PALETTE_SIZE; i++) {
+        if (sorted[i] != sorted[i - 1]) {
+            distinct++;
+        }
+    }
+    if (distinct <= PALETTE_SIZE) {
+        int t = 0;
+        centroids[t++] = sorted[0];
+        for (int i = 1; i < count; i++) {
+            if (sorted[i] != sorted[i - 1]) {
+                centroids[t++] = sorted[i];
+            }
+        }
+        for (; t < PALETTE_SIZE; t++) {
+            centroids[t] = sorted[count - 1];
+        }
+        free(sorted);
+        return MATH_SUCCESS;
+    }
+    for (int t = 0; t < PALETTE_SIZE; t++) {
+        centroids[t] = sorted[((2 * t + 1) * count) / (2 * PALETTE_SIZE)];
+    }
+    free(sorted);
+
+    for (int it = 0; it < iterations; it++) {
+        float sums[PALETTE_SIZE] = {0};
+        int counts[PALETTE_SIZE] = {0};
+        for (int i = 0; i < count; i++) {
+            int t = nearest_centroid(centroids, values[i]);
+            sums[t] += values[i];
+            counts[t]++;
+        }
+        bool moved = false;
+        for (int t = 0; t < PALETTE_SIZE; t++) {
+            if (counts[t] == 0) {
+                continue; // keep empty clusters where they are
+            }
+            float c = sums[t] / counts[t];
+            if (c != centroids[t]) {
+                centroids[t] = c;
+                moved = true;
+            }
+        }
+        if (!moved) {
+            break;
+        }
+    }
+    return MATH_SUCCESS;
+}
+
+MathStatus palettize_matrix(PaletteMatrix* out, float* w, int rows, int cols, bool per_row, int iterations) {
+    if (out == NULL || w == NULL) {
+        return MATH_NULL_POINTER;
+    }
+    if (rows <= 0 || cols <= 0) {
+        return MATH_INVALID_DIM;
+    }
+
+    // a NaN or Inf would poison its cluster's centroid and every weight mapped to it
+    for (size_t i = 0; i < (size_t)rows * cols; i++) {
+        if (!isfinite(w[i])) {
+            return MATH_INVALID_RANGE;
+        }
+    }
+
+    int stride = palette_row_stride(cols);
+    out->rows = rows;
+    out->cols = cols;
+    out->num_codebooks = per_row ? rows : 1;
+    out->codebook = (float*)calloc(out->num_codebooks * PALETTE_SIZE, sizeof(float));
+    out->indices = (uint8_t*)calloc(rows * stride, sizeof(uint8_t));
+    out->owns_data = true;
+    if (out->codebook == NULL || out->indices == NULL) {
+        free_palette_matrix(out);
+        return MATH_NULL_POINTER;
+    }
+
+    MathStatus status = per_row ? MATH_SUCCESS : kmeans_1d(out->codebook, w, rows * cols, iterations);
+    for (int k = 0; k < rows && status == MATH_SUCCESS; k++) {
+        float* centroids = out->codebook + (per_row ? k * PALETTE_SIZE : 0);
+        if (per_row && (status = kmeans_1d(centroids, w + k * cols, cols, iterations)) != MATH_SUCCESS) {
+            break;
+        }
+        uint8_t* row = out->indices + k * stride;
+        for (int j = 0; j < cols; j++) {
+            uint8_t t = (uint8_t)nearest_centroid(centroids, w[k * cols + j]);
+            row[j >> 1] |= (j & 1) ? (uint8_t)(t << 4) : t;
+        }
+    }
+    if (status != MATH_SUCCESS) {
+        free_palette_matrix(out);
+    }
+    return status;
+}
+
+MathStatus depalettize_matrix(float* w, PaletteMatrix* m) {
+    if (w == NULL || m == NULL || m->codebook == NULL || m->indices == NULL) {
+        return MATH_NULL_POINTER;
+    }
+    int stride = palette_row_stride(m->cols);
+    for (int k = 0; k < m->rows; k++) {
+        float* centroids = m->codebook + (m->num_codebooks == 1 ? 0 : k * PALETTE_SIZE);
+        uint8_t* row = m->indices + k * stride;
+        for (int j = 0; j < m->cols; j++) {
+            int t = (j & 1) ? row[j >> 1] >> 4 : row[j >> 1] & 0x0F;
+            w[k * m->cols + j] = centroids[t];
+        }
+    }
+    return MATH_SUCCESS;
+}
+
+size_t map_palette_matrix(PaletteMatrix* m, void* data, int rows, int cols, int num_codebooks) {
+    m->rows = rows;
+    m->cols = cols;
+    m->num_codebooks = num_codebooks;
+    m->codebook = (float*)data;
+    m->indices = (uint8_t*)data + (size_t)num_codebooks * PALETTE_SIZE * sizeof(float);
+    m->owns_data = false;
+    return palette_matrix_bytes(rows, cols, num_codebooks);
+}
+
+size_t write_palette_matrix(FILE* file, PaletteMatrix* m) {
+    size_t codebook_bytes = (size_t)m->num_codebooks * PALETTE_SIZE * sizeof(float);
+    size_t index_bytes = (size_t)m->rows * palette_row_stride(m->cols);
+    size_t total = palette_matrix_bytes(m->rows, m->cols, m->num_codebooks);
+    static const uint8_t padding[4] = {0};
+
+    size_t written = fwrite(m->codebook, 1, codebook_bytes, file);
+    written += fwrite(m->indices, 1, index_bytes, file);
+    written += fwrite(padding, 1, total - codebook_bytes - index_bytes, file);
+    return written;
+}
+
+void free_palette_matrix(PaletteMatrix* m) {
+    if (m->owns_data) {
+        free(m->codebook);
+        free(m->indices);
+    }
+    m->codebook = NULL;
+    m->indices = NULL;
+}
+
+// out[j] += lut[idx[j]] for one row of packed 4-bit indices
+static void palette_axpy_row(float* out, float* lut, uint8_t* idx, int p) {
+    int j = 0;
+#if defined(__AVX2__)
+    // The 16-entry table lives in two ymm registers; each index selects a lane
+    // with permutevar8x32 and bit 3 picks the low or high half.
+    __m256 lut_lo = _mm256_loadu_ps(lut);
+    __m256 lut_hi = _mm256_loadu_ps(lut + 8);
+    __m128i low_nibble = _mm_set1_epi8(0x0F);
+    for (; j + 16 <= p; j += 16) {
+        __m128i bytes = _mm_loadl_epi64((const __m128i*)(idx + (j >> 1)));
+        __m128i lo = _mm_and_si128(bytes, low_nibble);
+        __m128i hi = _mm_and_si128(_mm_srli_epi16(bytes, 4), low_nibble);
+        __m128i nibbles = _mm_unpacklo_epi8(lo, hi);
+
+        __m256i i0 = _mm256_cvtepu8_epi32(nibbles);
+        __m256i i1 = _mm256_cvtepu8_epi32(_mm_srli_si128(nibbles, 8));
+        __m256 w0 = _mm256_blendv_ps(_mm256_permutevar8x32_ps(lut_lo, i0),
+                                     _mm256_permutevar8x32_ps(lut_hi, i0),
+                                     _mm256_castsi256_ps(_mm256_slli_epi32(i0, 28)));
+        __m256 w1 = _mm256_blendv_ps(_mm256_permutevar8x32_ps(lut_lo, i1),
+                                     _mm256_permutevar8x32_ps(lut_hi, i1),
+                                     _mm256_castsi256_ps(_mm256_slli_epi32(i1, 28)));
+        _mm256_storeu_ps(out + j, _mm256_add_ps(_mm256_loadu_ps(out + j), w0));
+        _mm256_storeu_ps(out + j + 8, _mm256_add_ps(_mm256_loadu_ps(out + j + 8), w1));
+    }
+#endif
+    for (; j + 2 <= p; j += 2) {
+        uint8_t byte = idx[j >> 1];
+        out[j] += lut[byte & 0x0F];
+        out[j + 1] += lut[byte >> 4];
+    }
+    if (j < p) {
+        out[j] += lut[idx[j >> 1] & 0x0F];
+    }
+}
+
+// out[m, p] = a[m, n] * b[n, p]
+// Each input element scales the 16-entry codebook once, then the row of the
+// weight matrix is accumulated by table lookup instead of multiply-add.
+MathStatus matmul_palette(float* out, float* a, PaletteMatrix* b, int m) {
+    if (out == NULL || a == NULL || b == NULL || b->codebook == NULL || b->indices == NULL) {
+        return MATH_NULL_POINTER;
+    }
+    int n = b->rows;
+    int p = b->cols;
+    if (m <= 0 || n <= 0 || p <= 0 || n > MAX_DIM || p > MAX_DIM) { // any number of rows
+        return MATH_INVALID_DIM;
+    }
+
+    int stride = palette_row_stride(p);
+    float lut[PALETTE_SIZE];
+    for (int i = 0; i < m; i++) {
+        float* out_row = out + i * p;
+        memset(out_row, 0, p * sizeof(float));
+        for (int k = 0; k < n; k++) {
+            float x = a[i * n + k];
+            if (x == 0.0f) {
+                continue;
+            }
+            float* centroids = b->codebook + (b->num_codebooks == 1 ? 0 : k * PALETTE_SIZE);
+            for (int t = 0; t < PALETTE_SIZE; t++) {
+                lut[t] = x * centroids[t];
+            }
+            palette_axpy_row(out_row, lut, b->indices + k * stride, p);
+        }
+    }
+    return MATH_SUCCESS;
+}
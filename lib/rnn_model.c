@@ -0,0 +1,499 @@
+#include <stdio.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include "rnn_model.h"
+#include "math_nn.h"
+
+void init_rnn_model(RNNModel* model, RNNModelConfig config) {
+    model->config = config;
+    model->gru_layers = NULL;
+    model->lstm_layers = NULL;
+    model->early_exit = NULL;
+    model->guard = NULL;
+    printf("Initializing %s model...\n", config.cell_type == RNN_CELL_GRU ? "GRU" : "LSTM");
+
+    int input_dim = config.input_dim;
+    int input_size = config.input_size;
+    if (config.cell_type == RNN_CELL_GRU) {
+        model->gru_layers = (GRULayer*)malloc(config.num_layers * sizeof(GRULayer));
+    } else {
+        model->lstm_layers = (LSTMLayer*)malloc(config.num_layers * sizeof(LSTMLayer));
+    }
+    for (int i = 0; i < config.num_layers; i++) {
+        if (config.cell_type == RNN_CELL_GRU) {
+            init_gru_layer(&model->gru_layers[i], input_dim, input_size, config.hidden_size);
+        } else {
+            init_lstm_layer(&model->lstm_layers[i], input_dim, input_size, config.hidden_size);
+        }
+        input_size = config.hidden_size; // Next layer's input size is current layer's hidden size
+    }
+    init_linear_layer(&model->output_layer, input_dim * config.hidden_size, config.output_size); // the linear layer requires a flattening beforehand
+    printf("Model initialized.\n");
+}
+
+void free_rnn_model(RNNModel* model, bool free_weights) {
+    printf("Freeing model...\n");
+    for (int i = 0; i < model->config.num_layers; i++) {
+        if (model->config.cell_type == RNN_CELL_GRU) {
+            free_gru_layer(&model->gru_layers[i], free_weights);
+        } else {
+            free_lstm_layer(&model->lstm_layers[i], free_weights);
+        }
+    }
+    free(model->gru_layers);
+    free(model->lstm_layers);
+    free_rnn_early_exit(model);
+    free_rnn_numerics_guard(model);
+    if (free_weights) {
+        free_linear_layer(&model->output_layer);
+    } else {
+        free_linear_layer_packed(&model->output_layer);
+    }
+    printf("Model freed.\n");
+}
+
+// Checkpoint layout per layer: input weights, hidden weights, input biases, hidden biases,
+// in gate order (r, z, n for GRU and i, f, g, o for LSTM), then the output layer
+size_t rnn_model_layer_floats(RNNModelConfig* config, int layer) {
+    size_t hidden_size = config->hidden_size;
+    if (layer == config->num_layers) {
+        return config->output_size * (hidden_size + 1);
+    }
+    size_t cell_size = (layer == 0) ? (size_t)config->input_size : hidden_size;
+    size_t gates = (config->cell_type == RNN_CELL_GRU) ? 3 : 4;
+    return gates * (cell_size * hidden_size + hidden_size * hidden_size + 2 * hidden_size);
+}
+
+size_t memory_map_rnn_layer(RNNModel* model, int layer, float* data_ptr) {
+    if (layer == model->config.num_layers) {
+        memory_map_linear_layer(&model->output_layer, data_ptr);
+    } else if (model->config.cell_type == RNN_CELL_GRU) {
+        memory_map_gru_layer(&model->gru_layers[layer], data_ptr);
+    } else {
+        memory_map_lstm_layer(&model->lstm_layers[layer], data_ptr);
+    }
+    return rnn_model_layer_floats(&model->config, layer);
+}
+
+size_t memory_map_rnn_weights(RNNModel* model, float* data_ptr) {
+    printf("Mapping weights...\n");
+    size_t ptr_offset = 0;
+    for (int l = 0; l <= model->config.num_layers; l++) {
+        ptr_offset += memory_map_rnn_layer(model, l, data_ptr + ptr_offset);
+    }
+    printf("Weights mapped.\n");
+    return ptr_offset;
+}
+
+MathStatus attach_rnn_checkpoint(RNNModel* model, MappedCheckpoint* ckpt) {
+    RNNModelConfig* config = &model->config;
+    size_t bytes = 0;
+    for (int l = 0; l <= config->num_layers; l++) {
+        bytes += rnn_model_layer_floats(config, l) * sizeof(float);
+    }
+    if (ckpt->base == NULL || ckpt->size < bytes) {
+        fprintf(stderr, "Checkpoint holds %zu bytes, the model needs %zu\n", ckpt->size, bytes);
+        return MATH_INVALID_DIM;
+    }
+    for (int l = 0; l < config->num_layers; l++) {
+        if (config->cell_type == RNN_CELL_GRU) {
+            free_gru_layer_weights(&model->gru_layers[l].weights);
+        } else {
+            free_lstm_layer_weights(&model->lstm_layers[l].weights);
+        }
+    }
+    free_linear_layer_weights(&model->output_layer.weights);
+    memory_map_rnn_weights(model, (float*)ckpt->base);
+    return MATH_SUCCESS;
+}
+
+size_t rnn_model_packed_bytes(RNNModel* model) {
+    size_t bytes = 0;
+    for (int l = 0; l < model->config.num_layers; l++) {
+        if (model->config.cell_type == RNN_CELL_GRU) {
+            bytes += gru_layer_packed_bytes(&model->gru_layers[l].config);
+        } else {
+            bytes += lstm_layer_packed_bytes(&model->lstm_layers[l].config);
+        }
+    }
+    return bytes + linear_layer_packed_bytes(&model->output_layer.config);
+}
+
+// Repack all weights into the arena, or adopt them when the arena is a pre-packed image
+MathStatus pack_rnn_model(RNNModel* model, PackArena* arena) {
+    for (int l = 0; l < model->config.num_layers; l++) {
+        MathStatus status = (model->config.cell_type == RNN_CELL_GRU)
+            ? pack_gru_layer(&model->gru_layers[l], arena)
+            : pack_lstm_layer(&model->lstm_layers[l], arena);
+        if (status != MATH_SUCCESS) {
+            return status;
+        }
+    }
+    return pack_linear_layer(&model->output_layer, arena);
+}
+
+void free_rnn_model_packed(RNNModel* model) {
+    for (int l = 0; l < model->config.num_layers; l++) {
+        if (model->config.cell_type == RNN_CELL_GRU) {
+            free_gru_layer_packed(&model->gru_layers[l]);
+        } else {
+            free_lstm_layer_packed(&model->lstm_layers[l]);
+        }
+    }
+    free_linear_layer_packed(&model->output_layer);
+}
+
+int rnn_model_state_size(RNNModelConfig* config) {
+    int hidden = config->num_layers * config->input_dim * config->hidden_size;
+    return (config->cell_type == RNN_CELL_LSTM) ? 2 * hidden : hidden;
+}
+
+float* rnn_model_hidden_state(RNNModel* model, float* state, int layer) {
+    return state + layer * model->config.input_dim * model->config.hidden_size;
+}
+
+float* rnn_model_cell_state(RNNModel* model, float* state, int layer) {
+    if (model->config.cell_type != RNN_CELL_LSTM) {
+        return NULL;
+    }
+    int hidden = model->config.num_layers * model->config.input_dim * model->config.hidden_size;
+    return state + hidden + layer * model->config.input_dim * model->config.hidden_size;
+}
+
+// Worse of two scan results, NaN/Inf over saturation over success
+static MathStatus worse_status(MathStatus a, MathStatus b) {
+    if (a == MATH_OVERFLOW_RISK || b == MATH_OVERFLOW_RISK) {
+        return MATH_OVERFLOW_RISK;
+    }
+    return (a != MATH_SUCCESS) ? a : b;
+}
+
+void rnn_numerics_scan_layer(RNNModel* model, int layer, float* h, float* c, int rows) {
+    RNNNumericsGuard* guard = model->guard;
+    if (guard == NULL) {
+        return;
+    }
+    int size = rows * model->config.hidden_size;
+    guard->status[layer] = numerics_scan(h, size, guard->limit, &guard->counts[layer]);
+    if (c != NULL) {
+        guard->status[layer] = worse_status(guard->status[layer], numerics_scan(c, size, guard->limit, &guard->counts[layer]));
+    }
+}
+
+void rnn_numerics_scan_output(RNNModel* model, float* output, int rows, int layers_run) {
+    RNNNumericsGuard* guard = model->guard;
+    if (guard == NULL) {
+        return;
+    }
+    int num_layers = model->config.num_layers;
+    // layers an early exit skipped have nothing to report for this step
+    for (int l = layers_run; l < num_layers; l++) {
+        guard->status[l] = MATH_SUCCESS;
+    }
+    guard->status[num_layers] = (output != NULL)
+        ? numerics_scan(output, rows * model->config.output_size, INFINITY, &guard->counts[num_layers]) : MATH_SUCCESS;
+    guard->steps += rows;
+}
+
+void rnn_model_layer_step(RNNModel* model, int layer, float* input, float* state) {
+    float* h = rnn_model_hidden_state(model, state, layer);
+    float* c = NULL;
+    if (model->config.cell_type == RNN_CELL_GRU) {
+        gru_layer_forward_inplace(&model->gru_layers[layer], input, h);
+    } else {
+        c = rnn_model_cell_state(model, state, layer);
+        lstm_layer_forward_inplace(&model->lstm_layers[layer], input, h, c);
+    }
+    rnn_numerics_scan_layer(model, layer, h, c, model->config.input_dim);
+}
+
+void rnn_model_step(RNNModel* model, float* input, float* state, float* output) {
+    if (model->early_exit != NULL) {
+        rnn_model_step_early_exit(model, input, state, output);
+        return;
+    }
+    float* inter_input = input;
+    for (int l = 0; l < model->config.num_layers; l++) {
+        rnn_model_layer_step(model, l, inter_input, state);
+        inter_input = rnn_model_hidden_state(model, state, l); // the next layer reads this layer's new hidden state directly
+    }
+    if (output != NULL) {
+        linear_layer_forward(&model->output_layer, inter_input, output);
+    }
+    rnn_numerics_scan_output(model, output, model->config.input_dim, model->config.num_layers);
+}
+
+// Batched steps
+MathStatus init_rnn_batch(RNNBatch* batch, RNNModel* model, int max_rows) {
+    if (batch == NULL || model == NULL) {
+        return MATH_NULL_POINTER;
+    }
+    if (max_rows <= 0 || model->config.input_dim != 1) {
+        return MATH_INVALID_DIM;
+    }
+    memset(batch, 0, sizeof(RNNBatch));
+    batch->model = model;
+    batch->max_rows = max_rows;
+    int num_layers = model->config.num_layers;
+    size_t block = (size_t)max_rows * model->config.hidden_size;
+    bool lstm = (model->config.cell_type == RNN_CELL_LSTM);
+
+    batch->hidden = (float*)calloc(num_layers * block, sizeof(float));
+    if (lstm) {
+        batch->cell = (float*)calloc(num_layers * block, sizeof(float));
+        batch->lstm_layers = (LSTMLayer*)malloc(num_layers * sizeof(LSTMLayer));
+    } else {
+        batch->gru_layers = (GRULayer*)malloc(num_layers * sizeof(GRULayer));
+    }
+    if (batch->hidden == NULL || (lstm && (batch->cell == NULL || batch->lstm_layers == NULL)) || (!lstm && batch->gru_layers == NULL)) {
+        free(batch->hidden);
+        free(batch->cell);
+        free(batch->lstm_layers);
+        free(batch->gru_layers);
+        return MATH_NULL_POINTER;
+    }
+    for (int l = 0; l < num_layers; l++) {
+        if (lstm) {
+            init_lstm_layer_batch(&batch->lstm_layers[l], &model->lstm_layers[l], max_rows);
+        } else {
+            init_gru_layer_batch(&batch->gru_layers[l], &model->gru_layers[l], max_rows);
+        }
+    }
+    return MATH_SUCCESS;
+}
+
+void free_rnn_batch(RNNBatch* batch) {
+    for (int l = 0; l < batch->model->config.num_layers; l++) {
+        if (batch->gru_layers != NULL) {
+            free_gru_layer_run_state(&batch->gru_layers[l].state);
+        }
+        if (batch->lstm_layers != NULL) {
+            free_lstm_layer_run_state(&batch->lstm_layers[l].state);
+        }
+    }
+    free(batch->gru_layers);
+    free(batch->lstm_layers);
+    free(batch->hidden);
+    free(batch->cell);
+    batch->gru_layers = NULL;
+    batch->lstm_layers = NULL;
+    batch->hidden = NULL;
+    batch->cell = NULL;
+}
+
+MathStatus rnn_batch_step(RNNBatch* batch, int rows, float* inputs, float** states, float* outputs) {
+    if (batch == NULL || inputs == NULL || states == NULL) {
+        return MATH_NULL_POINTER;
+    }
+    if (rows <= 0 || rows > batch->max_rows) {
+        return MATH_INVALID_DIM;
+    }
+    RNNModel* model = batch->model;
+    int num_layers = model->config.num_layers;
+    int hidden_size = model->config.hidden_size;
+    size_t block = (size_t)batch->max_rows * hidden_size;
+    size_t bytes = hidden_size * sizeof(float);
+
+    for (int l = 0; l < num_layers; l++) {
+        float* h = batch->hidden + l * block;
+        float* c = (batch->cell != NULL) ? batch->cell + l * block : NULL;
+        for (int r = 0; r < rows; r++) {
+            memcpy(h + r * hidden_size, rnn_model_hidden_state(model, states[r], l), bytes);
+            if (c != NULL) {
+                memcpy(c + r * hidden_size, rnn_model_cell_state(model, states[r], l), bytes);
+            }
+        }
+        // the views are sized for max_rows, each batch runs on its first rows
+        float* layer_input = (l == 0) ? inputs : batch->hidden + (l - 1) * block;
+        if (c != NULL) {
+            batch->lstm_layers[l].config.input_dim = rows;
+            lstm_layer_forward_inplace(&batch->lstm_layers[l], layer_input, h, c);
+        } else {
+            batch->gru_layers[l].config.input_dim = rows;
+            gru_layer_forward_inplace(&batch->gru_layers[l], layer_input, h);
+        }
+        rnn_numerics_scan_layer(model, l, h, c, rows);
+        for (int r = 0; r < rows; r++) {
+            memcpy(rnn_model_hidden_state(model, states[r], l), h + r * hidden_size, bytes);
+            if (c != NULL) {
+                memcpy(rnn_model_cell_state(model, states[r], l), c + r * hidden_size, bytes);
+            }
+        }
+    }
+    if (outputs != NULL) {
+        float* top = batch->hidden + (num_layers - 1) * block;
+        for (int r = 0; r < rows; r++) {
+            linear_layer_forward(&model->output_layer, top + r * hidden_size, outputs + r * model->config.output_size);
+        }
+    }
+    rnn_numerics_scan_output(model, outputs, rows, num_layers);
+    return MATH_SUCCESS;
+}
+
+// Early exit
+MathStatus init_rnn_early_exit(RNNModel* model, ExitCriterion criterion, float threshold) {
+    free_rnn_early_exit(model);
+    int num_layers = model->config.num_layers;
+    int output_size = model->config.output_size;
+    RNNEarlyExit* early_exit = (RNNEarlyExit*)calloc(1, sizeof(RNNEarlyExit));
+    if (early_exit == NULL) {
+        return MATH_NULL_POINTER;
+    }
+    early_exit->criterion = criterion;
+    early_exit->threshold = threshold;
+    early_exit->heads = (LinearLayer*)calloc(num_layers, sizeof(LinearLayer));
+    early_exit->has_head = (bool*)calloc(num_layers, sizeof(bool));
+    early_exit->logits = (float*)calloc(output_size, sizeof(float));
+    early_exit->probs = (float*)calloc(output_size, sizeof(float));
+    early_exit->exits = (long*)calloc(num_layers, sizeof(long));
+    model->early_exit = early_exit;
+    if (!early_exit->heads || !early_exit->has_head || !early_exit->logits || !early_exit->probs || !early_exit->exits) {
+        free_rnn_early_exit(model);
+        return MATH_NULL_POINTER;
+    }
+    return MATH_SUCCESS;
+}
+
+void free_rnn_early_exit(RNNModel* model) {
+    RNNEarlyExit* early_exit = model->early_exit;
+    if (early_exit == NULL) {
+        return;
+    }
+    for (int l = 0; l < model->config.num_layers && early_exit->has_head != NULL; l++) {
+        if (early_exit->has_head[l]) {
+            free_linear_layer(&early_exit->heads[l]);
+        }
+    }
+    free(early_exit->heads);
+    free(early_exit->has_head);
+    free(early_exit->logits);
+    free(early_exit->probs);
+    free(early_exit->exits);
+    free(early_exit);
+    model->early_exit = NULL;
+}
+
+LinearLayer* add_rnn_exit_head(RNNModel* model, int layer) {
+    RNNEarlyExit* early_exit = model->early_exit;
+    if (early_exit == NULL || layer < 0 || layer >= model->config.num_layers - 1) {
+        return NULL; // the last layer always uses the output layer
+    }
+    if (!early_exit->has_head[layer]) {
+        init_linear_layer(&early_exit->heads[layer], model->config.input_dim * model->config.hidden_size, model->config.output_size);
+        early_exit->has_head[layer] = true;
+    }
+    return &early_exit->heads[layer];
+}
+
+static bool exit_confident(RNNEarlyExit* early_exit, float* logits, int size) {
+    if (softmax(early_exit->probs, logits, size) != MATH_SUCCESS) {
+        return false;
+    }
+    float top = 0.0f;
+    float second = 0.0f;
+    for (int i = 0; i < size; i++) {
+        float p = early_exit->probs[i];
+        if (p > top) {
+            second = top;
+            top = p;
+        } else if (p > second) {
+            second = p;
+        }
+    }
+    float confidence = (early_exit->criterion == EXIT_MARGIN) ? top - second : top;
+    return confidence >= early_exit->threshold;
+}
+
+int rnn_model_step_early_exit(RNNModel* model, float* input, float* state, float* output) {
+    RNNEarlyExit* early_exit = model->early_exit;
+    int num_layers = model->config.num_layers;
+    int output_size = model->config.output_size;
+    float* logits = (output != NULL) ? output : early_exit->logits;
+    early_exit->steps++;
+
+    float* inter_input = input;
+    for (int l = 0; l < num_layers - 1; l++) {
+        rnn_model_layer_step(model, l, inter_input, state);
+        inter_input = rnn_model_hidden_state(model, state, l);
+        if (early_exit->has_head[l]) {
+            linear_layer_forward(&early_exit->heads[l], inter_input, logits);
+            if (exit_confident(early_exit, logits, output_size)) {
+                early_exit->exits[l]++;
+                rnn_numerics_scan_output(model, logits, model->config.input_dim, l + 1);
+                return l;
+            }
+        }
+    }
+    rnn_model_layer_step(model, num_layers - 1, inter_input, state);
+    linear_layer_forward(&model->output_layer, rnn_model_hidden_state(model, state, num_layers - 1), logits);
+    rnn_numerics_scan_output(model, logits, model->config.input_dim, num_layers);
+    early_exit->exits[num_layers - 1]++;
+    return num_layers - 1;
+}
+
+void print_rnn_exit_stats(RNNModel* model) {
+    RNNEarlyExit* early_exit = model->early_exit;
+    if (early_exit == NULL || early_exit->steps == 0) {
+        return;
+    }
+    double layers_run = 0.0;
+    printf("Exit distribution over %ld steps:", early_exit->steps);
+    for (int l = 0; l < model->config.num_layers; l++) {
+        double share = (double)early_exit->exits[l] / early_exit->steps;
+        layers_run += share * (l + 1);
+        printf(" L%d %.1f%%", l, 100.0 * share);
+    }
+    printf("\nMean layers run: %.2f of %d\n", layers_run, model->config.num_layers);
+}
+
+MathStatus enable_rnn_numerics_guard(RNNModel* model, float limit) {
+    free_rnn_numerics_guard(model);
+    int entries = model->config.num_layers + 1;
+    RNNNumericsGuard* guard = (RNNNumericsGuard*)calloc(1, sizeof(RNNNumericsGuard));
+    if (guard == NULL) {
+        return MATH_NULL_POINTER;
+    }
+    guard->limit = limit;
+    guard->status = (MathStatus*)calloc(entries, sizeof(MathStatus));
+    guard->counts = (NumericsCounts*)calloc(entries, sizeof(NumericsCounts));
+    model->guard = guard;
+    if (guard->status == NULL || guard->counts == NULL) {
+        free_rnn_numerics_guard(model);
+        return MATH_NULL_POINTER;
+    }
+    return MATH_SUCCESS;
+}
+
+void free_rnn_numerics_guard(RNNModel* model) {
+    RNNNumericsGuard* guard = model->guard;
+    if (guard == NULL) {
+        return;
+    }
+    free(guard->status);
+    free(guard->counts);
+    free(guard);
+    model->guard = NULL;
+}
+
+MathStatus rnn_numerics_status(RNNModel* model) {
+    MathStatus status = MATH_SUCCESS;
+    for (int l = 0; model->guard != NULL && l <= model->config.num_layers; l++) {
+        status = worse_status(status, model->guard->status[l]);
+    }
+    return status;
+}
+
+void print_rnn_numerics_stats(RNNModel* model) {
+    RNNNumericsGuard* guard = model->guard;
+    if (guard == NULL) {
+        return;
+    }
+    printf("Numerics over %ld steps:\n", guard->steps);
+    for (int l = 0; l <= model->config.num_layers; l++) {
+        NumericsCounts* counts = &guard->counts[l];
+        printf("  %s %d: %ld NaN, %ld Inf, %ld saturated\n", (l < model->config.num_layers) ? "layer" : "output",
+               l, counts->nan, counts->inf, counts->saturated);
+    }
+}
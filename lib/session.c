@@ -0,0 +1,251 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "session.h"
+#include "state_store.h"
+#include "math_nn.h"
+
+static uint64_t hash_stream_id(uint64_t x) {
+    // splitmix64 finaliser, spreads sequential ids over the table
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return x;
+}
+
+MathStatus init_session_manager(SessionManager* manager, RNNModel* model, size_t memory_cap) {
+    if (manager == NULL || model == NULL) {
+        return MATH_NULL_POINTER;
+    }
+    memset(manager, 0, sizeof(SessionManager));
+    manager->model = model;
+    manager->state_size = rnn_model_state_size(&model->config);
+    size_t slot_bytes = manager->state_size * sizeof(float);
+    size_t max_slots = memory_cap / slot_bytes;
+    if (max_slots == 0 || max_slots > INT32_MAX / 4) {
+        return MATH_INVALID_DIM;
+    }
+    manager->max_slots = (int)max_slots;
+
+    int table_size = 1;
+    while (table_size < 2 * manager->max_slots) {
+        table_size <<= 1; // at most half full
+    }
+    int num_slabs = (manager->max_slots + SESSION_SLAB_SLOTS - 1) / SESSION_SLAB_SLOTS;
+    manager->slabs = (float**)calloc(num_slabs, sizeof(float*));
+    manager->slots = (SessionSlot*)calloc(manager->max_slots, sizeof(SessionSlot));
+    manager->free_slots = (int*)malloc(manager->max_slots * sizeof(int));
+    manager->table = (int*)malloc(table_size * sizeof(int));
+    if (!manager->slabs || !manager->slots || !manager->free_slots || !manager->table) {
+        free_session_manager(manager);
+        return MATH_NULL_POINTER;
+    }
+    for (int i = 0; i < table_size; i++) {
+        manager->table[i] = -1;
+    }
+    manager->table_mask = table_size - 1;
+    manager->lru_head = -1;
+    manager->lru_tail = -1;
+    return MATH_SUCCESS;
+}
+
+void free_session_manager(SessionManager* manager) {
+    if (manager->slabs != NULL) {
+        int num_slabs = (manager->max_slots + SESSION_SLAB_SLOTS - 1) / SESSION_SLAB_SLOTS;
+        for (int i = 0; i < num_slabs; i++) {
+            free(manager->slabs[i]);
+        }
+    }
+    free(manager->slabs);
+    free(manager->slots);
+    free(manager->free_slots);
+    free(manager->table);
+    manager->slabs = NULL;
+    manager->slots = NULL;
+    manager->free_slots = NULL;
+    manager->table = NULL;
+}
+
+static float* slot_state(SessionManager* manager, int slot) {
+    return manager->slabs[slot / SESSION_SLAB_SLOTS] + (size_t)(slot % SESSION_SLAB_SLOTS) * manager->state_size;
+}
+
+// Table position holding stream_id, or the empty position where it would go
+static int table_find(SessionManager* manager, uint64_t stream_id) {
+    int pos = (int)(hash_stream_id(stream_id) & manager->table_mask);
+    while (manager->table[pos] != -1 && manager->slots[manager->table[pos]].stream_id != stream_id) {
+        pos = (pos + 1) & manager->table_mask;
+    }
+    return pos;
+}
+
+// Backward-shift deletion keeps probe chains intact without tombstones
+static void table_remove(SessionManager* manager, int pos) {
+    int mask = manager->table_mask;
+    int hole = pos;
+    int next = (pos + 1) & mask;
+    while (manager->table[next] != -1) {
+        int home = (int)(hash_stream_id(manager->slots[manager->table[next]].stream_id) & mask);
+        // move the entry back if its home is not cyclically within (hole, next]
+        if (((next - home) & mask) >= ((next - hole) & mask)) {
+            manager->table[hole] = manager->table[next];
+            hole = next;
+        }
+        next = (next + 1) & mask;
+    }
+    manager->table[hole] = -1;
+}
+
+static void lru_unlink(SessionManager* manager, int slot) {
+    SessionSlot* s = &manager->slots[slot];
+    if (s->prev != -1) {
+        manager->slots[s->prev].next = s->next;
+    } else {
+        manager->lru_head = s->next;
+    }
+    if (s->next != -1) {
+        manager->slots[s->next].prev = s->prev;
+    } else {
+        manager->lru_tail = s->prev;
+    }
+}
+
+static void lru_push_front(SessionManager* manager, int slot) {
+    SessionSlot* s = &manager->slots[slot];
+    s->prev = -1;
+    s->next = manager->lru_head;
+    if (manager->lru_head != -1) {
+        manager->slots[manager->lru_head].prev = slot;
+    } else {
+        manager->lru_tail = slot;
+    }
+    manager->lru_head = slot;
+}
+
+static void release_slot(SessionManager* manager, int slot) {
+    if (manager->store != NULL) {
+        // a stream that ended must not come back at the next restore
+        state_store_remove(manager->store, manager->slots[slot].stream_id);
+    }
+    table_remove(manager, table_find(manager, manager->slots[slot].stream_id));
+    lru_unlink(manager, slot);
+    manager->slots[slot].in_use = false;
+    manager->free_slots[manager->num_free++] = slot;
+    manager->active--;
+}
+
+static int acquire_slot(SessionManager* manager) {
+    if (manager->num_free > 0) {
+        return manager->free_slots[--manager->num_free];
+    }
+    if (manager->num_slots < manager->max_slots) {
+        int slot = manager->num_slots;
+        int slab = slot / SESSION_SLAB_SLOTS;
+        if (manager->slabs[slab] == NULL) {
+            manager->slabs[slab] = (float*)malloc((size_t)SESSION_SLAB_SLOTS * manager->state_size * sizeof(float));
+            if (manager->slabs[slab] == NULL) {
+                return -1;
+            }
+        }
+        manager->num_slots++;
+        return slot;
+    }
+    // pool is full, evict the least recently used stream
+    release_slot(manager, manager->lru_tail);
+    manager->evictions++;
+    return manager->free_slots[--manager->num_free];
+}
+
+MathStatus session_create(SessionManager* manager, uint64_t stream_id) {
+    int pos = table_find(manager, stream_id);
+    int slot = manager->table[pos];
+    if (slot == -1) {
+        slot = acquire_slot(manager);
+        if (slot == -1) {
+            return MATH_NULL_POINTER;
+        }
+        pos = table_find(manager, stream_id); // eviction may have shifted the table
+        manager->table[pos] = slot;
+        manager->slots[slot].stream_id = stream_id;
+        manager->slots[slot].in_use = true;
+        manager->active++;
+    } else {
+        lru_unlink(manager, slot);
+    }
+    manager->slots[slot].last_step = manager->clock;
+    lru_push_front(manager, slot);
+    memset(slot_state(manager, slot), 0, manager->state_size * sizeof(float));
+    return MATH_SUCCESS;
+}
+
+MathStatus session_step(SessionManager* manager, uint64_t stream_id, float* input, float* output) {
+    if (input == NULL) {
+        return MATH_NULL_POINTER;
+    }
+    int slot = manager->table[table_find(manager, stream_id)];
+    if (slot == -1) {
+        return MATH_INVALID_RANGE;
+    }
+    if (manager->lru_head != slot) {
+        lru_unlink(manager, slot);
+        lru_push_front(manager, slot);
+    }
+    manager->slots[slot].last_step = ++manager->clock;
+    rnn_model_step(manager->model, input, slot_state(manager, slot), output);
+    return MATH_SUCCESS;
+}
+
+MathStatus session_step_batch(SessionManager* manager, RNNBatch* batch, int count, uint64_t* stream_ids, float* inputs, float* outputs) {
+    if (inputs == NULL || batch == NULL) {
+        return MATH_NULL_POINTER;
+    }
+    if (count <= 0 || count > batch->max_rows) {
+        return MATH_INVALID_DIM;
+    }
+    int slots[count];
+    float* states[count];
+    for (int i = 0; i < count; i++) {
+        slots[i] = manager->table[table_find(manager, stream_ids[i])];
+        if (slots[i] == -1) {
+            return MATH_INVALID_RANGE;
+        }
+        states[i] = slot_state(manager, slots[i]);
+    }
+    manager->clock++;
+    for (int i = 0; i < count; i++) {
+        if (manager->lru_head != slots[i]) {
+            lru_unlink(manager, slots[i]);
+            lru_push_front(manager, slots[i]);
+        }
+        manager->slots[slots[i]].last_step = manager->clock;
+    }
+    return rnn_batch_step(batch, count, inputs, states, outputs);
+}
+
+float* session_state(SessionManager* manager, uint64_t stream_id) {
+    int slot = manager->table[table_find(manager, stream_id)];
+    return (slot == -1) ? NULL : slot_state(manager, slot);
+}
+
+MathStatus session_close(SessionManager* manager, uint64_t stream_id) {
+    int slot = manager->table[table_find(manager, stream_id)];
+    if (slot == -1) {
+        return MATH_INVALID_RANGE;
+    }
+    release_slot(manager, slot);
+    return MATH_SUCCESS;
+}
+
+int session_evict_idle(SessionManager* manager, uint64_t max_idle_steps) {
+    int evicted = 0;
+    while (manager->lru_tail != -1 && manager->clock - manager->slots[manager->lru_tail].last_step > max_idle_steps) {
+        release_slot(manager, manager->lru_tail);
+        evicted++;
+    }
+    manager->evictions += evicted;
+    return evicted;
+}
@@ -0,0 +1,225 @@
+#define _DEFAULT_SOURCE // shm_open, SCM_RIGHTS, sem_timedwait
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include "shm_ring.h"
+
+static size_t slot_stride(size_t input_size, size_t output_size) {
+    size_t bytes = sizeof(ShmSlot) + (input_size + output_size) * sizeof(float);
+    return (bytes + SHM_RING_LINE - 1) / SHM_RING_LINE * SHM_RING_LINE;
+}
+
+static size_t header_bytes(void) {
+    return (sizeof(ShmRingHeader) + SHM_RING_LINE - 1) / SHM_RING_LINE * SHM_RING_LINE;
+}
+
+static ShmSlot* ring_slot(ShmRing* ring, uint64_t seq) {
+    return (ShmSlot*)(ring->slots + (seq & (ring->capacity - 1)) * ring->slot_bytes);
+}
+
+static MathStatus map_ring(ShmRing* ring, int fd, size_t size) {
+    void* base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED) {
+        fprintf(stderr, "mmap failed!\n");
+        return MATH_NULL_POINTER;
+    }
+    ring->fd = fd;
+    ring->base = (uint8_t*)base;
+    ring->size = size;
+    ring->header = (ShmRingHeader*)base;
+    ring->slots = ring->base + header_bytes();
+    ring->consumed = 0;
+    return MATH_SUCCESS;
+}
+
+MathStatus create_shm_ring(ShmRing* ring, int capacity, int input_size, int output_size) {
+    if (ring == NULL) {
+        return MATH_NULL_POINTER;
+    }
+    if (capacity <= 0 || input_size <= 0 || output_size <= 0) {
+        return MATH_INVALID_DIM;
+    }
+    uint32_t slots = 1;
+    while (slots < (uint32_t)capacity) {
+        slots <<= 1;
+    }
+    // a private name, unlinked right away: the descriptor is the only handle
+    static atomic_uint counter;
+    char name[64];
+    snprintf(name, sizeof(name), "/embedded_nn.%d.%u", (int)getpid(), atomic_fetch_add(&counter, 1));
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd == -1) {
+        fprintf(stderr, "shm_open of %s failed\n", name);
+        return MATH_NULL_POINTER;
+    }
+    shm_unlink(name);
+    size_t stride = slot_stride(input_size, output_size);
+    size_t size = header_bytes() + slots * stride;
+    if (ftruncate(fd, (off_t)size) != 0 || map_ring(ring, fd, size) != MATH_SUCCESS) {
+        close(fd);
+        return MATH_NULL_POINTER;
+    }
+    ring->capacity = slots;
+    ring->input_size = (uint32_t)input_size;
+    ring->output_size = (uint32_t)output_size;
+    ring->slot_bytes = stride;
+    ShmRingHeader* header = ring->header;
+    header->capacity = slots;
+    header->input_size = (uint32_t)input_size;
+    header->output_size = (uint32_t)output_size;
+    header->slot_bytes = stride;
+    sem_init(&header->submitted, 1, 0);
+    sem_init(&header->completed, 1, 0);
+    atomic_init(&header->head, 0);
+    atomic_init(&header->tail, 0);
+    header->magic = SHM_RING_MAGIC;
+    return MATH_SUCCESS;
+}
+
+MathStatus attach_shm_ring(ShmRing* ring, int fd) {
+    struct stat st;
+    if (ring == NULL) {
+        return MATH_NULL_POINTER;
+    }
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < header_bytes()) {
+        return MATH_INVALID_DIM;
+    }
+    MathStatus status = map_ring(ring, fd, (size_t)st.st_size);
+    if (status != MATH_SUCCESS) {
+        return status;
+    }
+    // read each field once, then check the copies
+    ShmRingHeader* header = ring->header;
+    volatile ShmRingHeader* shared = header;
+    ring->capacity = shared->capacity;
+    ring->input_size = shared->input_size;
+    ring->output_size = shared->output_size;
+    ring->slot_bytes = shared->slot_bytes;
+    bool valid = shared->magic == SHM_RING_MAGIC && ring->capacity > 0 && (ring->capacity & (ring->capacity - 1)) == 0
+                 && ring->input_size > 0 && ring->output_size > 0
+                 && ring->input_size <= ring->size / sizeof(float) && ring->output_size <= ring->size / sizeof(float)
+                 && ring->slot_bytes >= slot_stride(ring->input_size, ring->output_size)
+                 && ring->capacity <= (ring->size - header_bytes()) / ring->slot_bytes;
+    if (!valid) {
+        fprintf(stderr, "Not an inference ring\n");
+        close_shm_ring(ring);
+        return MATH_INVALID_RANGE;
+    }
+    return MATH_SUCCESS;
+}
+
+void close_shm_ring(ShmRing* ring) {
+    if (ring->base != NULL) {
+        munmap(ring->base, ring->size);
+    }
+    if (ring->fd >= 0) {
+        close(ring->fd);
+    }
+    ring->base = NULL;
+    ring->header = NULL;
+    ring->slots = NULL;
+    ring->fd = -1;
+}
+
+MathStatus send_shm_ring(int sock, ShmRing* ring) {
+    char byte = 'R';
+    struct iovec iov = {&byte, 1};
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(sizeof(int))];
+    } control;
+    memset(&control, 0, sizeof(control));
+    struct msghdr msg = {0};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &ring->fd, sizeof(int));
+    return sendmsg(sock, &msg, 0) == 1 ? MATH_SUCCESS : MATH_INVALID_RANGE;
+}
+
+MathStatus receive_shm_ring(int sock, ShmRing* ring) {
+    char byte;
+    struct iovec iov = {&byte, 1};
+    union {
+        struct cmsghdr align;
+        char buf[CMSG_SPACE(sizeof(int))];
+    } control;
+    struct msghdr msg = {0};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+    if (recvmsg(sock, &msg, 0) != 1) {
+        return MATH_INVALID_RANGE;
+    }
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    if (cmsg == NULL || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) {
+        return MATH_INVALID_RANGE;
+    }
+    int fd;
+    memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+    return attach_shm_ring(ring, fd);
+}
+
+ShmSlot* shm_ring_acquire(ShmRing* ring) {
+    uint64_t head = atomic_load_explicit(&ring->header->head, memory_order_relaxed);
+    if (head - ring->consumed >= ring->capacity) {
+        return NULL;
+    }
+    return ring_slot(ring, head);
+}
+
+void shm_ring_submit(ShmRing* ring) {
+    uint64_t head = atomic_load_explicit(&ring->header->head, memory_order_relaxed);
+    atomic_store_explicit(&ring->header->head, head + 1, memory_order_release);
+    sem_post(&ring->header->submitted);
+}
+
+ShmSlot* shm_ring_complete(ShmRing* ring) {
+    if (ring->consumed == atomic_load_explicit(&ring->header->head, memory_order_relaxed)) {
+        return NULL; // nothing in flight
+    }
+    while (sem_wait(&ring->header->completed) != 0 && errno == EINTR) {
+    }
+    atomic_load_explicit(&ring->header->tail, memory_order_acquire); // pairs with the worker's release
+    return ring_slot(ring, ring->consumed);
+}
+
+void shm_ring_release(ShmRing* ring) {
+    ring->consumed++;
+}
+
+ShmSlot* shm_ring_next(ShmRing* ring, int timeout_ms) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    long long ns = ts.tv_nsec + (long long)timeout_ms * 1000000LL;
+    ts.tv_sec += ns / 1000000000LL;
+    ts.tv_nsec = ns % 1000000000LL;
+    while (sem_timedwait(&ring->header->submitted, &ts) != 0) {
+        if (errno != EINTR) {
+            return NULL;
+        }
+    }
+    uint64_t tail = atomic_load_explicit(&ring->header->tail, memory_order_relaxed);
+    atomic_load_explicit(&ring->header->head, memory_order_acquire); // the slot contents are visible
+    return ring_slot(ring, tail);
+}
+
+void shm_ring_done(ShmRing* ring) {
+    uint64_t tail = atomic_load_explicit(&ring->header->tail, memory_order_relaxed);
+    atomic_store_explicit(&ring->header->tail, tail + 1, memory_order_release);
+    sem_post(&ring->header->completed);
+}
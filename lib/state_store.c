@@ -0,0 +1,363 @@
+#define _POSIX_C_SOURCE 200809L // pread, ftruncate, msync
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "state_store.h"
+#include "math_nn.h"
+#if defined _WIN32
+    #include "win.h"
+#else
+    #include <sys/mman.h>
+#endif
+#if defined(__F16C__)
+    #include <immintrin.h>
+#endif
+
+static uint16_t float_to_half_1(float f) {
+    uint32_t x;
+    memcpy(&x, &f, sizeof(x));
+    uint32_t sign = (x >> 16) & 0x8000;
+    uint32_t mant = x & 0x7fffff;
+    int exp = (int)((x >> 23) & 0xff);
+    if (exp == 0xff) {
+        return sign | 0x7c00 | (mant ? 0x200 : 0); // inf, or a quiet nan
+    }
+    exp = exp - 127 + 15;
+    if (exp >= 0x1f) {
+        return sign | 0x7c00;
+    }
+    uint32_t half;
+    uint32_t rem;
+    uint32_t mid;
+    if (exp <= 0) {
+        if (exp < -10) {
+            return sign;
+        }
+        mant |= 0x800000; // subnormal half, keep the implicit bit
+        int shift = 14 - exp;
+        half = mant >> shift;
+        rem = mant & ((1u << shift) - 1);
+        mid = 1u << (shift - 1);
+    } else {
+        half = ((uint32_t)exp << 10) | (mant >> 13);
+        rem = mant & 0x1fff;
+        mid = 0x1000;
+    }
+    if (rem > mid || (rem == mid && (half & 1))) {
+        half++; // round to nearest even, a carry correctly bumps the exponent
+    }
+    return sign | half;
+}
+
+static float half_to_float_1(uint16_t h) {
+    uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+    uint32_t exp = (h >> 10) & 0x1f;
+    uint32_t mant = h & 0x3ff;
+    uint32_t x;
+    if (exp == 0) {
+        if (mant == 0) {
+            x = sign;
+        } else {
+            uint32_t e = 113;
+            while (!(mant & 0x400)) {
+                mant <<= 1;
+                e--;
+            }
+            x = sign | (e << 23) | ((mant & 0x3ff) << 13);
+        }
+    } else if (exp == 0x1f) {
+        x = sign | 0x7f800000 | (mant << 13);
+    } else {
+        x = sign | ((exp + 112) << 23) | (mant << 13);
+    }
+    float f;
+    memcpy(&f, &x, sizeof(f));
+    return f;
+}
+
+void float_to_half(uint16_t* out, float* in, int size) {
+    int i = 0;
+#if defined(__F16C__)
+    for (; i + 8 <= size; i += 8) {
+        _mm_storeu_si128((__m128i*)(out + i), _mm256_cvtps_ph(_mm256_loadu_ps(in + i), _MM_FROUND_TO_NEAREST_INT));
+    }
+#endif
+    for (; i < size; i++) {
+        out[i] = float_to_half_1(in[i]);
+    }
+}
+
+void half_to_float(float* out, uint16_t* in, int size) {
+    int i = 0;
+#if defined(__F16C__)
+    for (; i + 8 <= size; i += 8) {
+        _mm256_storeu_ps(out + i, _mm256_cvtph_ps(_mm_loadu_si128((__m128i*)(in + i))));
+    }
+#endif
+    for (; i < size; i++) {
+        out[i] = half_to_float_1(in[i]);
+    }
+}
+
+static uint64_t hash_stream_id(uint64_t x) {
+    // splitmix64 finaliser, the same spread as the session table
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return x;
+}
+
+static size_t round_to_page(size_t bytes, size_t page_size) {
+    return (bytes + page_size - 1) / page_size * page_size;
+}
+
+static void mark_dirty(StateStore* store, void* ptr, size_t bytes) {
+    size_t first = ((uint8_t*)ptr - store->base) / store->page_size;
+    size_t last = ((uint8_t*)ptr - store->base + bytes - 1) / store->page_size;
+    for (size_t p = first; p <= last; p++) {
+        store->dirty[p / 8] |= (uint8_t)(1u << (p % 8));
+    }
+}
+
+MathStatus open_state_store(StateStore* store, char* path, int state_size, int capacity, StatePrecision precision) {
+    if (store == NULL || path == NULL) {
+        return MATH_NULL_POINTER;
+    }
+    if (state_size <= 0 || capacity <= 0 || capacity > (1 << 28)) {
+        return MATH_INVALID_DIM;
+    }
+    memset(store, 0, sizeof(StateStore));
+    store->page_size = (size_t)sysconf(_SC_PAGESIZE);
+
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd == -1) {
+        fprintf(stderr, "Couldn't open file %s\n", path);
+        return MATH_NULL_POINTER;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        close(fd);
+        return MATH_NULL_POINTER;
+    }
+    bool created = (st.st_size == 0);
+    StateStoreHeader header;
+    if (created) {
+        int table_size = 1;
+        while (table_size < capacity + capacity / 3) {
+            table_size <<= 1; // keep the directory at most 3/4 full
+        }
+        header.magic = STATE_STORE_MAGIC;
+        header.version = STATE_STORE_VERSION;
+        header.precision = precision;
+        header.state_size = state_size;
+        header.capacity = table_size;
+        header.count = 0;
+    } else if (pread(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header)
+               || header.magic != STATE_STORE_MAGIC || header.version != STATE_STORE_VERSION) {
+        fprintf(stderr, "%s is not a state store\n", path);
+        close(fd);
+        return MATH_INVALID_RANGE;
+    } else if (header.state_size != state_size || header.precision != (uint32_t)precision) {
+        fprintf(stderr, "%s holds states of a different model\n", path);
+        close(fd);
+        return MATH_INVALID_DIM;
+    } else if (header.capacity <= 0 || header.capacity > (1 << 29) || (header.capacity & (header.capacity - 1)) != 0
+               || header.count < 0 || header.count > header.capacity / 4 * 3) {
+        // probing masks with capacity - 1, anything but a power of two walks off the directory
+        fprintf(stderr, "%s has a corrupt directory\n", path);
+        close(fd);
+        return MATH_INVALID_RANGE;
+    }
+
+    store->slot_bytes = (size_t)state_size * (precision == STATE_FP16 ? sizeof(uint16_t) : sizeof(float));
+    size_t directory_bytes = round_to_page((size_t)header.capacity * sizeof(StateStoreEntry), store->page_size);
+    size_t states_bytes = round_to_page((size_t)header.capacity * store->slot_bytes, store->page_size);
+    store->size = store->page_size + directory_bytes + states_bytes;
+    // unused slots are never written, so the file stays sparse on disk
+    if (created && ftruncate(fd, (off_t)store->size) == -1) {
+        close(fd);
+        return MATH_NULL_POINTER;
+    }
+    if (!created && (size_t)st.st_size < store->size) {
+        fprintf(stderr, "%s is truncated\n", path);
+        close(fd);
+        return MATH_INVALID_DIM;
+    }
+    void* data = mmap(NULL, store->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        fprintf(stderr, "mmap failed!\n");
+        return MATH_NULL_POINTER;
+    }
+    store->base = (uint8_t*)data;
+    store->header = (StateStoreHeader*)store->base;
+    store->entries = (StateStoreEntry*)(store->base + store->page_size);
+    store->states = store->base + store->page_size + directory_bytes;
+    store->num_pages = store->size / store->page_size;
+    store->dirty = (uint8_t*)calloc((store->num_pages + 7) / 8, 1);
+    if (store->dirty == NULL) {
+        munmap(data, store->size);
+        return MATH_NULL_POINTER;
+    }
+    if (created) {
+        memcpy(store->header, &header, sizeof(header));
+        mark_dirty(store, store->header, sizeof(header));
+    }
+    return MATH_SUCCESS;
+}
+
+void close_state_store(StateStore* store) {
+    if (store->base != NULL) {
+        state_store_sync(store, true);
+        munmap(store->base, store->size);
+    }
+    free(store->dirty);
+    store->base = NULL;
+    store->dirty = NULL;
+}
+
+// Directory position holding stream_id, or the empty position where it would go
+static int store_find(StateStore* store, uint64_t stream_id) {
+    int mask = store->header->capacity - 1;
+    int pos = (int)(hash_stream_id(stream_id) & mask);
+    while (store->entries[pos].used && store->entries[pos].stream_id != stream_id) {
+        pos = (pos + 1) & mask;
+    }
+    return pos;
+}
+
+static uint8_t* store_slot(StateStore* store, int pos) {
+    return store->states + (size_t)pos * store->slot_bytes;
+}
+
+MathStatus state_store_put(StateStore* store, uint64_t stream_id, float* state) {
+    if (store->base == NULL || state == NULL) {
+        return MATH_NULL_POINTER;
+    }
+    int pos = store_find(store, stream_id);
+    StateStoreEntry* entry = &store->entries[pos];
+    if (!entry->used) {
+        if (store->header->count + 1 > store->header->capacity / 4 * 3) {
+            return MATH_EXCEEDS_MAX_DIM;
+        }
+        entry->stream_id = stream_id;
+        entry->used = 1;
+        store->header->count++;
+        mark_dirty(store, entry, sizeof(StateStoreEntry));
+        mark_dirty(store, store->header, sizeof(StateStoreHeader));
+    }
+    uint8_t* slot = store_slot(store, pos);
+    if (store->header->precision == STATE_FP16) {
+        float_to_half((uint16_t*)slot, state, store->header->state_size);
+    } else {
+        memcpy(slot, state, store->slot_bytes);
+    }
+    mark_dirty(store, slot, store->slot_bytes);
+    return MATH_SUCCESS;
+}
+
+MathStatus state_store_get(StateStore* store, uint64_t stream_id, float* state) {
+    if (store->base == NULL || state == NULL) {
+        return MATH_NULL_POINTER;
+    }
+    int pos = store_find(store, stream_id);
+    if (!store->entries[pos].used) {
+        return MATH_INVALID_RANGE;
+    }
+    uint8_t* slot = store_slot(store, pos);
+    if (store->header->precision == STATE_FP16) {
+        half_to_float(state, (uint16_t*)slot, store->header->state_size);
+    } else {
+        memcpy(state, slot, store->slot_bytes);
+    }
+    return MATH_SUCCESS;
+}
+
+// Backward-shift deletion as in the session table, moving states along with their entries
+MathStatus state_store_remove(StateStore* store, uint64_t stream_id) {
+    if (store->base == NULL) {
+        return MATH_NULL_POINTER;
+    }
+    int mask = store->header->capacity - 1;
+    int hole = store_find(store, stream_id);
+    if (!store->entries[hole].used) {
+        return MATH_INVALID_RANGE;
+    }
+    int next = (hole + 1) & mask;
+    while (store->entries[next].used) {
+        int home = (int)(hash_stream_id(store->entries[next].stream_id) & mask);
+        if (((next - home) & mask) >= ((next - hole) & mask)) {
+            store->entries[hole] = store->entries[next];
+            memcpy(store_slot(store, hole), store_slot(store, next), store->slot_bytes);
+            mark_dirty(store, &store->entries[hole], sizeof(StateStoreEntry));
+            mark_dirty(store, store_slot(store, hole), store->slot_bytes);
+            hole = next;
+        }
+        next = (next + 1) & mask;
+    }
+    store->entries[hole].used = 0;
+    store->header->count--;
+    mark_dirty(store, &store->entries[hole], sizeof(StateStoreEntry));
+    mark_dirty(store, store->header, sizeof(StateStoreHeader));
+    return MATH_SUCCESS;
+}
+
+int state_store_sync(StateStore* store, bool wait) {
+    int synced = 0;
+    size_t p = 0;
+    while (p < store->num_pages) {
+        if (!(store->dirty[p / 8] & (1u << (p % 8)))) {
+            p++;
+            continue;
+        }
+        size_t run = p;
+        while (run < store->num_pages && (store->dirty[run / 8] & (1u << (run % 8)))) {
+            store->dirty[run / 8] &= (uint8_t)~(1u << (run % 8));
+            run++;
+        }
+        // one msync per run of adjacent dirty pages
+        msync(store->base + p * store->page_size, (run - p) * store->page_size, wait ? MS_SYNC : MS_ASYNC);
+        synced += (int)(run - p);
+        p = run;
+    }
+    return synced;
+}
+
+MathStatus snapshot_sessions(SessionManager* manager, StateStore* store) {
+    for (int slot = manager->lru_head; slot != -1; slot = manager->slots[slot].next) {
+        uint64_t stream_id = manager->slots[slot].stream_id;
+        MathStatus status = state_store_put(store, stream_id, session_state(manager, stream_id));
+        if (status != MATH_SUCCESS) {
+            return status;
+        }
+    }
+    return MATH_SUCCESS;
+}
+
+int restore_sessions(SessionManager* manager, StateStore* store) {
+    int restored = 0;
+    for (int pos = 0; pos < store->header->capacity; pos++) {
+        StateStoreEntry* entry = &store->entries[pos];
+        if (!entry->used) {
+            continue;
+        }
+        // stop when the pool is full rather than evict streams restored a moment ago
+        bool present = (session_state(manager, entry->stream_id) != NULL);
+        if (!present && manager->active >= manager->max_slots) {
+            break;
+        }
+        if (session_create(manager, entry->stream_id) != MATH_SUCCESS) {
+            continue;
+        }
+        state_store_get(store, entry->stream_id, session_state(manager, entry->stream_id));
+        restored++;
+    }
+    return restored;
+}
@@ -0,0 +1,198 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include "stepper.h"
+#include "math_nn.h"
+
+MathStatus init_rnn_stepper(RNNStepper* stepper, RNNModel* model, int slice_units) {
+    if (stepper == NULL || model == NULL) {
+        return MATH_NULL_POINTER;
+    }
+    if (model->config.input_dim != 1 || slice_units < 0) {
+        return MATH_INVALID_DIM;
+    }
+    memset(stepper, 0, sizeof(RNNStepper));
+    stepper->model = model;
+    stepper->slice_units = slice_units;
+    stepper->done = true;
+    size_t hidden_size = model->config.hidden_size;
+    stepper->reset = (float*)malloc(8 * hidden_size * sizeof(float));
+    if (stepper->reset == NULL) {
+        return MATH_NULL_POINTER;
+    }
+    stepper->reset_hidden = stepper->reset + hidden_size;
+    stepper->hidden = stepper->reset_hidden + hidden_size;
+    stepper->cell = stepper->hidden + hidden_size;
+    stepper->gates = stepper->cell + hidden_size;
+    return MATH_SUCCESS;
+}
+
+void free_rnn_stepper(RNNStepper* stepper) {
+    free(stepper->reset);
+    stepper->reset = NULL;
+    stepper->reset_hidden = NULL;
+    stepper->hidden = NULL;
+    stepper->cell = NULL;
+    stepper->gates = NULL;
+}
+
+void rnn_stepper_begin(RNNStepper* stepper, float* input, float* state, float* output) {
+    stepper->input = input;
+    stepper->state = state;
+    stepper->output = output;
+    stepper->layer = 0;
+    stepper->phase = 0;
+    stepper->unit = 0;
+    stepper->done = false;
+}
+
+// g[0..count) = b_i + b_h + x W_i[:, first..] + h W_h[:, first..] over the units of one slice,
+// both weights [rows x hidden_size] read one contiguous row segment at a time
+static void gate_units(float* g, float* x, float* W_i, float* b_i, int input_size, float* h, float* W_h, float* b_h,
+                       int hidden_size, int first, int count) {
+    add(g, b_i + first, b_h + first, count);
+    for (int k = 0; k < input_size; k++) {
+        axpy(g, x[k], W_i + (size_t)k * hidden_size + first, count);
+    }
+    for (int k = 0; k < hidden_size; k++) {
+        axpy(g, h[k], W_h + (size_t)k * hidden_size + first, count);
+    }
+}
+
+static void gru_slice(RNNStepper* stepper, GRULayer* layer, float* x, float* h, int first, int count) {
+    GRULayerWeights* w = &layer->weights;
+    int in = layer->config.input_size;
+    int hidden_size = layer->config.hidden_size;
+    if (stepper->phase == 0) {
+        float* r = stepper->reset + first;
+        gate_units(r, x, w->W_ir, w->b_ir, in, h, w->W_hr, w->b_hr, hidden_size, first, count);
+        sigmoid_act_vec(r, r, count);
+        mul(stepper->reset_hidden + first, r, h + first, count);
+        return;
+    }
+    // the candidate reads r * h_prev of every unit, so it waits for the whole reset pass
+    float* z = stepper->gates;
+    float* n = z + count;
+    gate_units(z, x, w->W_iz, w->b_iz, in, h, w->W_hz, w->b_hz, hidden_size, first, count);
+    sigmoid_act_vec(z, z, count);
+    gate_units(n, x, w->W_in, w->b_in, in, stepper->reset_hidden, w->W_hn, w->b_hn, hidden_size, first, count);
+    tanh_act_vec(n, n, count);
+    for (int j = 0; j < count; j++) {
+        stepper->hidden[first + j] = z[j] * h[first + j] + (1 - z[j]) * n[j];
+    }
+}
+
+static void lstm_slice(RNNStepper* stepper, LSTMLayer* layer, float* x, float* h, float* c, int first, int count) {
+    LSTMLayerWeights* w = &layer->weights;
+    int in = layer->config.input_size;
+    int hidden_size = layer->config.hidden_size;
+    float* i_g = stepper->gates;
+    float* f_g = i_g + count;
+    float* g_g = f_g + count;
+    float* o_g = g_g + count;
+    gate_units(i_g, x, w->W_ii, w->b_ii, in, h, w->W_hi, w->b_hi, hidden_size, first, count);
+    gate_units(f_g, x, w->W_if, w->b_if, in, h, w->W_hf, w->b_hf, hidden_size, first, count);
+    gate_units(g_g, x, w->W_ig, w->b_ig, in, h, w->W_hg, w->b_hg, hidden_size, first, count);
+    gate_units(o_g, x, w->W_io, w->b_io, in, h, w->W_ho, w->b_ho, hidden_size, first, count);
+    sigmoid_act_vec(i_g, i_g, count);
+    sigmoid_act_vec(f_g, f_g, count);
+    tanh_act_vec(g_g, g_g, count);
+    sigmoid_act_vec(o_g, o_g, count);
+    float* c_new = stepper->cell + first;
+    for (int j = 0; j < count; j++) {
+        c_new[j] = f_g[j] * c[first + j] + i_g[j] * g_g[j];
+    }
+    tanh_act_vec(stepper->hidden + first, c_new, count);
+    mul(stepper->hidden + first, o_g, stepper->hidden + first, count);
+}
+
+// Whether a layer can be cut into unit slices: float32 weights, dense steps
+static bool layer_sliceable(RNNModel* model, int layer) {
+    if (model->config.cell_type == RNN_CELL_GRU) {
+        GRULayer* gru = &model->gru_layers[layer];
+        return gru->weights.packed == NULL && gru->weights.palette == NULL && gru->state.delta == NULL;
+    }
+    LSTMLayer* lstm = &model->lstm_layers[layer];
+    return lstm->weights.packed == NULL && lstm->weights.palette == NULL && lstm->state.delta == NULL;
+}
+
+static StepperStatus finish_slice(RNNStepper* stepper) {
+    if (stepper->layer == stepper->model->config.num_layers && stepper->output == NULL) {
+        stepper->done = true; // no output wanted
+        rnn_numerics_scan_output(stepper->model, NULL, 1, stepper->layer);
+    }
+    return stepper->done ? STEPPER_DONE : STEPPER_PENDING;
+}
+
+StepperStatus rnn_stepper_resume(RNNStepper* stepper) {
+    if (stepper->done) {
+        return STEPPER_DONE;
+    }
+    RNNModel* model = stepper->model;
+    int num_layers = model->config.num_layers;
+    int l = stepper->layer;
+
+    if (l == num_layers) {
+        LinearLayer* head = &model->output_layer;
+        float* h = rnn_model_hidden_state(model, stepper->state, num_layers - 1);
+        int output_size = head->config.output_size;
+        if (stepper->slice_units == 0 || head->weights.packed != NULL) {
+            linear_layer_forward(head, h, stepper->output);
+            rnn_numerics_scan_output(model, stepper->output, 1, num_layers);
+            stepper->done = true;
+            return STEPPER_DONE;
+        }
+        int first = stepper->unit;
+        int count = (output_size - first < stepper->slice_units) ? output_size - first : stepper->slice_units;
+        float* y = stepper->output + first;
+        memcpy(y, head->weights.bias + first, count * sizeof(float));
+        for (int k = 0; k < head->config.input_size; k++) {
+            axpy(y, h[k], head->weights.weights + (size_t)k * output_size + first, count);
+        }
+        stepper->unit += count;
+        stepper->done = (stepper->unit == output_size);
+        if (stepper->done) {
+            rnn_numerics_scan_output(model, stepper->output, 1, num_layers);
+        }
+        return stepper->done ? STEPPER_DONE : STEPPER_PENDING;
+    }
+
+    float* x = (l == 0) ? stepper->input : rnn_model_hidden_state(model, stepper->state, l - 1);
+    if (stepper->slice_units == 0 || !layer_sliceable(model, l)) {
+        rnn_model_layer_step(model, l, x, stepper->state);
+        stepper->layer++;
+        return finish_slice(stepper);
+    }
+
+    int hidden_size = model->config.hidden_size;
+    int first = stepper->unit;
+    int count = (hidden_size - first < stepper->slice_units) ? hidden_size - first : stepper->slice_units;
+    float* h = rnn_model_hidden_state(model, stepper->state, l);
+    bool gru = (model->config.cell_type == RNN_CELL_GRU);
+    if (gru) {
+        gru_slice(stepper, &model->gru_layers[l], x, h, first, count);
+    } else {
+        lstm_slice(stepper, &model->lstm_layers[l], x, h, rnn_model_cell_state(model, stepper->state, l), first, count);
+    }
+    stepper->unit += count;
+    if (stepper->unit < hidden_size) {
+        return STEPPER_PENDING;
+    }
+    stepper->unit = 0;
+    if (gru && stepper->phase == 0) {
+        stepper->phase = 1;
+        return STEPPER_PENDING;
+    }
+    // the layer's last slice publishes its new states
+    memcpy(h, stepper->hidden, hidden_size * sizeof(float));
+    float* c = NULL;
+    if (!gru) {
+        c = rnn_model_cell_state(model, stepper->state, l);
+        memcpy(c, stepper->cell, hidden_size * sizeof(float));
+    }
+    rnn_numerics_scan_layer(model, l, h, c, 1);
+    stepper->phase = 0;
+    stepper->layer++;
+    return finish_slice(stepper);
+}
@@ -0,0 +1,307 @@
+#define _POSIX_C_SOURCE 200809L // clock_gettime, mkstemp
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+#include <unistd.h>
+#include "tune.h"
+#include "bulk_score.h"
+#include "math_nn.h"
+
+#define TUNE_MIN_S 0.02      // each candidate is timed for at least this long
+#define TUNE_GEMM_ROWS 256
+#define TUNE_SCORE_FLOPS 5e8 // synthetic scoring work per candidate, a fraction of a second
+
+static const int tune_mc[] = {24, 48, 72, 120, 240};
+static const int tune_kc[] = {64, 128, 256, 512};
+static const int tune_chunk[] = {128, 512, 1024};
+
+static double now_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void fill_tune_data(float* x, size_t size) {
+    for (size_t i = 0; i < size; i++) {
+        x[i] = 0.01f * (float)((i * 37) % 101) - 0.5f;
+    }
+}
+
+void tune_key(RNNModelConfig* config, char* key, size_t size) {
+    char cpu[160] = "unknown cpu";
+    FILE* file = fopen("/proc/cpuinfo", "r");
+    if (file != NULL) {
+        char line[256];
+        while (fgets(line, sizeof(line), file) != NULL) {
+            char* colon = strchr(line, ':');
+            if (strncmp(line, "model name", 10) == 0 && colon != NULL) {
+                snprintf(cpu, sizeof(cpu), "%s", colon + 2);
+                cpu[strcspn(cpu, "\n")] = '\0';
+                break;
+            }
+        }
+        fclose(file);
+    }
+#if defined(__AVX2__) && defined(__FMA__)
+    const char* simd = "avx2";
+#else
+    const char* simd = "scalar";
+#endif
+    snprintf(key, size, "%s|%s|%s %dx%dx%dx%dx%d", cpu, simd, (config->cell_type == RNN_CELL_GRU) ? "gru" : "lstm",
+             config->input_dim, config->input_size, config->hidden_size, config->output_size, config->num_layers);
+}
+
+// Mean seconds per model step from a zero state
+static double time_model_steps(RNNModel* model, float* input, float* state, float* output) {
+    memset(state, 0, rnn_model_state_size(&model->config) * sizeof(float));
+    long steps = 0;
+    double start = now_s();
+    double elapsed;
+    do {
+        rnn_model_step(model, input, state, output);
+        steps++;
+    } while ((elapsed = now_s() - start) < TUNE_MIN_S);
+    return elapsed / steps;
+}
+
+static MathStatus tune_packing(RNNModel* model, TuneResult* result) {
+    RNNModelConfig* config = &model->config;
+    float* input = (float*)malloc(config->input_dim * config->input_size * sizeof(float));
+    float* state = (float*)malloc(rnn_model_state_size(config) * sizeof(float));
+    float* output = (float*)malloc(config->input_dim * config->output_size * sizeof(float));
+    PackArena arena;
+    MathStatus status = (input == NULL || state == NULL || output == NULL) ? MATH_NULL_POINTER
+        : init_pack_arena(&arena, rnn_model_packed_bytes(model));
+    if (status == MATH_SUCCESS) {
+        fill_tune_data(input, config->input_dim * config->input_size);
+        double float_s = time_model_steps(model, input, state, output);
+        status = pack_rnn_model(model, &arena);
+        if (status == MATH_SUCCESS) {
+            result->packed = time_model_steps(model, input, state, output) < float_s;
+        }
+        free_rnn_model_packed(model);
+        free_pack_arena(&arena);
+    }
+    free(input);
+    free(state);
+    free(output);
+    return status;
+}
+
+// The input projection GEMM of a sequence chunk, on the model's widest shapes
+static MathStatus tune_blocking(RNNModel* model, TuneResult* result) {
+    RNNModelConfig* config = &model->config;
+    int M = TUNE_GEMM_ROWS;
+    int N = ((config->cell_type == RNN_CELL_GRU) ? 3 : 4) * config->hidden_size;
+    int K = (config->input_size > config->hidden_size) ? config->input_size : config->hidden_size;
+    float* A = (float*)malloc((size_t)M * K * sizeof(float));
+    float* B = (float*)malloc((size_t)K * N * sizeof(float));
+    float* C = (float*)malloc((size_t)M * N * sizeof(float));
+    if (A == NULL || B == NULL || C == NULL) {
+        free(A);
+        free(B);
+        free(C);
+        return MATH_NULL_POINTER;
+    }
+    fill_tune_data(A, (size_t)M * K);
+    fill_tune_data(B, (size_t)K * N);
+
+    double best_s = 0.0;
+    int last_kc = 0;
+    for (size_t k = 0; k < sizeof(tune_kc) / sizeof(tune_kc[0]); k++) {
+        if (last_kc >= K) {
+            break; // deeper slices than K all run the same single slice
+        }
+        last_kc = tune_kc[k];
+        int last_mc = 0;
+        for (size_t m = 0; m < sizeof(tune_mc) / sizeof(tune_mc[0]) && last_mc < M; m++) {
+            last_mc = tune_mc[m];
+            long calls = 0;
+            double start = now_s();
+            double elapsed;
+            do {
+                gemm_with_blocking(tune_mc[m], tune_kc[k], M, N, K, 1.0f, A, K, B, N, 0.0f, C, N);
+                calls++;
+            } while ((elapsed = now_s() - start) < TUNE_MIN_S);
+            if (best_s == 0.0 || elapsed / calls < best_s) {
+                best_s = elapsed / calls;
+                result->gemm_mc = tune_mc[m];
+                result->gemm_kc = tune_kc[k];
+            }
+        }
+    }
+    free(A);
+    free(B);
+    free(C);
+    return MATH_SUCCESS;
+}
+
+// Chunk size and thread count of bulk scoring on a synthetic feature table
+static MathStatus tune_bulk_score(RNNModel* model, TuneResult* result) {
+    RNNModelConfig* config = &model->config;
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int max_threads = (cpus > 1) ? (int)cpus : 1;
+    uint64_t streams = 2 * (uint64_t)max_threads;
+    // rows per stream from the multiply-adds of a row, so wide models don't take minutes
+    double row_flops = 2.0 * config->num_layers * ((config->cell_type == RNN_CELL_GRU) ? 3 : 4)
+                       * config->hidden_size * (config->input_size + config->hidden_size);
+    uint64_t stream_rows = (uint64_t)(TUNE_SCORE_FLOPS / row_flops / 2);
+    stream_rows = (stream_rows < 64) ? 64 : (stream_rows > 1024) ? 1024 : stream_rows;
+    FeatureTable table;
+    memset(&table, 0, sizeof(FeatureTable));
+    table.num_rows = streams * stream_rows;
+    table.num_features = config->input_size;
+    table.stream_ids = (uint64_t*)malloc(table.num_rows * sizeof(uint64_t));
+    table.features = (float*)malloc(table.num_rows * config->input_size * sizeof(float));
+    char out_path[] = "/tmp/embedded_nn_tune_XXXXXX";
+    int fd = mkstemp(out_path);
+    if (fd != -1) {
+        close(fd);
+    }
+    if (table.stream_ids == NULL || table.features == NULL || fd == -1) {
+        free(table.stream_ids);
+        free(table.features);
+        remove(out_path);
+        return MATH_NULL_POINTER;
+    }
+    for (uint64_t r = 0; r < table.num_rows; r++) {
+        table.stream_ids[r] = r / stream_rows;
+    }
+    fill_tune_data(table.features, table.num_rows * config->input_size);
+
+    double best_s = 0.0;
+    MathStatus status = MATH_SUCCESS;
+    // powers of two, then the core count itself when it is not one
+    for (int threads = 1; threads <= max_threads && status == MATH_SUCCESS;
+         threads = (threads < max_threads && threads * 2 > max_threads) ? max_threads : threads * 2) {
+        int last_chunk = 0;
+        for (size_t c = 0; c < sizeof(tune_chunk) / sizeof(tune_chunk[0]) && (uint64_t)last_chunk < stream_rows; c++) {
+            last_chunk = tune_chunk[c];
+            BulkScoreOptions options = {threads, tune_chunk[c], NULL, NULL};
+            BulkScoreStats stats;
+            status = bulk_score(model, &table, out_path, &options, &stats);
+            if (status != MATH_SUCCESS) {
+                break;
+            }
+            if (best_s == 0.0 || stats.score_s < best_s) {
+                best_s = stats.score_s;
+                result->chunk = tune_chunk[c];
+                result->threads = threads;
+            }
+        }
+    }
+    remove(out_path);
+    free(table.stream_ids);
+    free(table.features);
+    return status;
+}
+
+MathStatus tune_rnn_model(RNNModel* model, TuneResult* result) {
+    if (model == NULL || result == NULL) {
+        return MATH_NULL_POINTER;
+    }
+    result->packed = false;
+    gemm_get_blocking(&result->gemm_mc, &result->gemm_kc);
+    result->chunk = tune_chunk[sizeof(tune_chunk) / sizeof(tune_chunk[0]) - 1];
+    result->threads = 1;
+
+    MathStatus status = tune_packing(model, result);
+    if (status == MATH_SUCCESS) {
+        status = tune_blocking(model, result);
+    }
+    if (status == MATH_SUCCESS && model->config.input_dim == 1) {
+        // scored on float32 weights with the process-wide blocking, which tuning never changes
+        status = tune_bulk_score(model, result);
+    }
+    return status;
+}
+
+bool load_tune_cache(char* path, char* key, TuneResult* result) {
+    FILE* file = fopen(path, "r");
+    if (file == NULL) {
+        return false;
+    }
+    char line[512];
+    size_t key_length = strlen(key);
+    bool found = false;
+    while (!found && fgets(line, sizeof(line), file) != NULL) {
+        if (strncmp(line, key, key_length) != 0 || line[key_length] != '\t') {
+            continue;
+        }
+        int packed;
+        TuneResult cached;
+        if (sscanf(line + key_length + 1, "%d %d %d %d %d", &packed, &cached.gemm_mc, &cached.gemm_kc,
+                   &cached.chunk, &cached.threads) == 5 && cached.gemm_mc > 0 && cached.gemm_kc > 0
+            && cached.chunk > 0 && cached.threads > 0) {
+            cached.packed = (packed != 0);
+            *result = cached;
+            found = true;
+        }
+    }
+    fclose(file);
+    return found;
+}
+
+MathStatus save_tune_cache(char* path, char* key, TuneResult* result) {
+    char tmp_path[512];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    FILE* out = fopen(tmp_path, "w");
+    if (out == NULL) {
+        fprintf(stderr, "Couldn't open file %s\n", tmp_path);
+        return MATH_NULL_POINTER;
+    }
+    // keep the other keys, the file is rewritten and renamed over the old one
+    FILE* in = fopen(path, "r");
+    if (in != NULL) {
+        char line[512];
+        size_t key_length = strlen(key);
+        while (fgets(line, sizeof(line), in) != NULL) {
+            if (strncmp(line, key, key_length) != 0 || line[key_length] != '\t') {
+                fputs(line, out);
+            }
+        }
+        fclose(in);
+    }
+    fprintf(out, "%s\t%d %d %d %d %d\n", key, result->packed ? 1 : 0, result->gemm_mc, result->gemm_kc,
+            result->chunk, result->threads);
+    if (fclose(out) != 0 || rename(tmp_path, path) != 0) {
+        fprintf(stderr, "Couldn't write %s\n", path);
+        remove(tmp_path);
+        return MATH_NULL_POINTER;
+    }
+    return MATH_SUCCESS;
+}
+
+MathStatus apply_tuning(RNNModel* model, PackArena* arena, TuneResult* result) {
+    if (model == NULL || arena == NULL || result == NULL) {
+        return MATH_NULL_POINTER;
+    }
+    memset(arena, 0, sizeof(PackArena));
+    MathStatus status = gemm_set_blocking(result->gemm_mc, result->gemm_kc);
+    if (status == MATH_SUCCESS && result->packed) {
+        status = init_pack_arena(arena, rnn_model_packed_bytes(model));
+        if (status == MATH_SUCCESS) {
+            status = pack_rnn_model(model, arena);
+        }
+    }
+    return status;
+}
+
+MathStatus autotune_rnn_model(char* path, RNNModel* model, PackArena* arena, TuneResult* result) {
+    if (path == NULL || model == NULL || arena == NULL || result == NULL) {
+        return MATH_NULL_POINTER;
+    }
+    char key[TUNE_KEY_SIZE];
+    tune_key(&model->config, key, sizeof(key));
+    if (!load_tune_cache(path, key, result)) {
+        printf("Tuning %s...\n", key);
+        MathStatus status = tune_rnn_model(model, result);
+        if (status != MATH_SUCCESS) {
+            return status;
+        }
+        save_tune_cache(path, key, result); // a read-only cache only costs the next start a retune
+    }
+    return apply_tuning(model, arena, result);
+}
@@ -1,9 +1,11 @@
 #include <stdio.h>
 #include "math_nn.h"
+#include "util.h"
 
-MathStatus standard_scaler(float* out, float* in, int size, float mean, float std) {
+// Per-feature (in[i] - mean[i]) / std[i], out and in may alias
+MathStatus standard_scaler(float* out, float* in, int size, float* mean, float* std) {
     // Validate input pointers
-    if (out == NULL || in == NULL) {
+    if (out == NULL || in == NULL || mean == NULL || std == NULL) {
         return MATH_NULL_POINTER;
     }
     // Validate size
@@ -14,11 +16,13 @@ MathStatus standard_scaler(float* out, float* in, int size, float mean, float st
         return MATH_EXCEEDS_MAX_DIM;
     }
     // Prevent division by zero
-    if (std == 0.0f) {
-        return MATH_OVERFLOW_RISK;
+    for (int i = 0; i < size; i++) {
+        if (std[i] == 0.0f) {
+            return MATH_OVERFLOW_RISK;
+        }
     }
     for (int i = 0; i < size; i++) {
-        out[i] = (in[i] - mean) / std;
+        out[i] = (in[i] - mean[i]) / std[i];
     }
     return MATH_SUCCESS;
 }
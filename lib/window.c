@@ -0,0 +1,171 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include "window.h"
+#include "math_nn.h"
+
+MathStatus init_sliding_window(SlidingWindow* sw, RNNModel* model, int window, WindowMode mode) {
+    if (sw == NULL || model == NULL) {
+        return MATH_NULL_POINTER;
+    }
+    if (window <= 0 || model->config.input_dim != 1) {
+        return MATH_INVALID_DIM; // one stream per window, the batch rows are the windows
+    }
+    memset(sw, 0, sizeof(SlidingWindow));
+    sw->model = model;
+    sw->mode = mode;
+    sw->window = window;
+
+    RNNModelConfig* config = &model->config;
+    int hidden_size = config->hidden_size;
+    int num_layers = config->num_layers;
+    bool lstm = (config->cell_type == RNN_CELL_LSTM);
+    int gates = lstm ? 4 : 3;
+
+    sw->inputs = (float*)calloc((size_t)window * config->input_size, sizeof(float));
+    if (mode == WINDOW_STATEFUL) {
+        sw->states = (float*)calloc(rnn_model_state_size(config), sizeof(float));
+        if (sw->inputs == NULL || sw->states == NULL) {
+            free_sliding_window(sw);
+            return MATH_NULL_POINTER;
+        }
+        return MATH_SUCCESS;
+    }
+
+    size_t block = (size_t)window * hidden_size;
+    sw->states = (float*)calloc((lstm ? 2 : 1) * num_layers * block, sizeof(float));
+    sw->projections = (float*)malloc(gates * hidden_size * sizeof(float));
+    sw->gate_inputs = (float*)malloc(gates * block * sizeof(float));
+    // zeroed so free_sliding_window can run before the batch views are initialized
+    if (lstm) {
+        sw->lstm_batch = (LSTMLayer*)calloc(num_layers, sizeof(LSTMLayer));
+    } else {
+        sw->gru_batch = (GRULayer*)calloc(num_layers, sizeof(GRULayer));
+    }
+    if (sw->inputs == NULL || sw->states == NULL || sw->projections == NULL || sw->gate_inputs == NULL
+        || (sw->lstm_batch == NULL && sw->gru_batch == NULL)) {
+        free_sliding_window(sw);
+        return MATH_NULL_POINTER;
+    }
+    for (int l = 0; l < num_layers; l++) {
+        if (lstm) {
+            init_lstm_layer_batch(&sw->lstm_batch[l], &model->lstm_layers[l], window);
+        } else {
+            init_gru_layer_batch(&sw->gru_batch[l], &model->gru_layers[l], window);
+        }
+    }
+    return MATH_SUCCESS;
+}
+
+void free_sliding_window(SlidingWindow* sw) {
+    for (int l = 0; l < sw->model->config.num_layers; l++) {
+        if (sw->gru_batch != NULL) {
+            free_gru_layer_run_state(&sw->gru_batch[l].state);
+        }
+        if (sw->lstm_batch != NULL) {
+            free_lstm_layer_run_state(&sw->lstm_batch[l].state);
+        }
+    }
+    free(sw->gru_batch);
+    free(sw->lstm_batch);
+    free(sw->states);
+    free(sw->projections);
+    free(sw->gate_inputs);
+    free(sw->inputs);
+    sw->gru_batch = NULL;
+    sw->lstm_batch = NULL;
+    sw->states = NULL;
+    sw->projections = NULL;
+    sw->gate_inputs = NULL;
+    sw->inputs = NULL;
+}
+
+bool sliding_window_push(SlidingWindow* sw, float* input, float* output) {
+    RNNModel* model = sw->model;
+    int window = sw->window;
+    int input_size = model->config.input_size;
+    long t = sw->steps++;
+    bool full = (t >= window - 1);
+    memcpy(sw->inputs + (t % window) * input_size, input, input_size * sizeof(float));
+
+    if (sw->mode == WINDOW_STATEFUL) {
+        rnn_model_step(model, input, sw->states, full ? output : NULL);
+        return full;
+    }
+
+    int hidden_size = model->config.hidden_size;
+    int num_layers = model->config.num_layers;
+    bool lstm = (model->config.cell_type == RNN_CELL_LSTM);
+    int gates = lstm ? 4 : 3;
+    size_t block = (size_t)window * hidden_size;
+    float* hidden = sw->states;
+    float* cell = sw->states + num_layers * block;
+    float* x[4];
+    for (int g = 0; g < gates; g++) {
+        x[g] = sw->gate_inputs + g * block;
+    }
+
+    // the row whose window ended a step ago starts a fresh window at this input
+    int row = (int)(t % window);
+    for (int l = 0; l < num_layers; l++) {
+        memset(hidden + l * block + row * hidden_size, 0, hidden_size * sizeof(float));
+        if (lstm) {
+            memset(cell + l * block + row * hidden_size, 0, hidden_size * sizeof(float));
+        }
+    }
+
+    for (int l = 0; l < num_layers; l++) {
+        float* h = hidden + l * block;
+        if (l == 0) {
+            // every window sees the same newest input, so project it once and share it
+            float* p = sw->projections;
+            if (lstm) {
+                lstm_layer_project_inputs(&sw->lstm_batch[0], input, 1, p, p + hidden_size, p + 2 * hidden_size, p + 3 * hidden_size);
+            } else {
+                gru_layer_project_inputs(&sw->gru_batch[0], input, 1, p, p + hidden_size, p + 2 * hidden_size);
+            }
+            for (int g = 0; g < gates; g++) {
+                for (int r = 0; r < window; r++) {
+                    memcpy(x[g] + r * hidden_size, p + g * hidden_size, hidden_size * sizeof(float));
+                }
+            }
+        } else if (lstm) {
+            lstm_layer_project_inputs(&sw->lstm_batch[l], hidden + (l - 1) * block, window, x[0], x[1], x[2], x[3]);
+        } else {
+            gru_layer_project_inputs(&sw->gru_batch[l], hidden + (l - 1) * block, window, x[0], x[1], x[2]);
+        }
+
+        if (lstm) {
+            float* c = cell + l * block;
+            lstm_layer_step(&sw->lstm_batch[l], x[0], x[1], x[2], x[3], h, c, h, c);
+        } else {
+            gru_layer_step(&sw->gru_batch[l], x[0], x[1], x[2], h, h);
+        }
+    }
+
+    if (full && output != NULL) {
+        // the oldest row has now seen exactly window inputs
+        int done = (int)((t + 1) % window);
+        linear_layer_forward(&model->output_layer, hidden + (num_layers - 1) * block + done * hidden_size, output);
+    }
+    return full;
+}
+
+MathStatus sliding_window_recompute(SlidingWindow* sw, float* output) {
+    int window = sw->window;
+    if (sw->steps < window) {
+        return MATH_INVALID_RANGE;
+    }
+    RNNModel* model = sw->model;
+    float* state = (float*)calloc(rnn_model_state_size(&model->config), sizeof(float));
+    if (state == NULL) {
+        return MATH_NULL_POINTER;
+    }
+    for (int k = 0; k < window; k++) {
+        long t = sw->steps - window + k;
+        rnn_model_step(model, sw->inputs + (t % window) * model->config.input_size, state, (k == window - 1) ? output : NULL);
+    }
+    free(state);
+    return MATH_SUCCESS;
+}
@@ -0,0 +1,159 @@
+#define _DEFAULT_SOURCE // clock_gettime, struct sockaddr_un
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <math.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "shm_ring.h"
+
+// Local load generator for server.c. Every client thread opens its own
+// connection, keeps up to depth requests in flight over its ring and spreads
+// them across its streams.
+//
+//   ./loadgen socket clients requests [depth streams]
+
+typedef struct {
+    char* socket_path;
+    int requests;
+    int depth;
+    int streams;
+    int id;
+    float* latency_us;   // per request
+    int completed;       // requests with a latency_us entry
+    int failed;
+} LoadClient;
+
+static double now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static void* client_main(void* arg) {
+    LoadClient* client = (LoadClient*)arg;
+    int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    struct sockaddr_un addr = {0};
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", client->socket_path);
+    ShmRing ring;
+    if (sock < 0 || connect(sock, (struct sockaddr*)&addr, sizeof(addr)) != 0 || receive_shm_ring(sock, &ring) != MATH_SUCCESS) {
+        fprintf(stderr, "Client %d couldn't connect to %s\n", client->id, client->socket_path);
+        client->failed = client->requests;
+        if (sock >= 0) {
+            close(sock);
+        }
+        return NULL;
+    }
+    int input_size = (int)ring.input_size;
+    double* submit_us = (double*)malloc(client->requests * sizeof(double));
+    if (submit_us == NULL) {
+        fprintf(stderr, "Client %d is out of memory\n", client->id);
+        client->failed = client->requests;
+        close_shm_ring(&ring);
+        close(sock);
+        return NULL;
+    }
+
+    int sent = 0;
+    int done = 0;
+    while (done < client->requests) {
+        // keep the pipeline full, then take the oldest completion
+        while (sent < client->requests && sent - done < client->depth) {
+            ShmSlot* slot = shm_ring_acquire(&ring);
+            if (slot == NULL) {
+                break;
+            }
+            slot->stream_id = (uint64_t)(sent % client->streams);
+            slot->op = (sent < client->streams) ? SHM_OP_RESET : SHM_OP_STEP;
+            float* input = shm_slot_input(slot);
+            for (int i = 0; i < input_size; i++) {
+                input[i] = sinf(0.01f * (float)sent + (float)i);
+            }
+            submit_us[sent] = now_us();
+            shm_ring_submit(&ring);
+            sent++;
+        }
+        ShmSlot* slot = shm_ring_complete(&ring);
+        client->latency_us[done] = (float)(now_us() - submit_us[done]);
+        if (slot->status != MATH_SUCCESS) {
+            client->failed++;
+        }
+        shm_ring_release(&ring);
+        done++;
+        client->completed = done;
+    }
+    free(submit_us);
+    close_shm_ring(&ring);
+    close(sock);
+    return NULL;
+}
+
+static int compare_float(const void* a, const void* b) {
+    float x = *(const float*)a;
+    float y = *(const float*)b;
+    return (x > y) - (x < y);
+}
+
+int main(int argc, char** argv) {
+    if (argc != 4 && argc != 6) {
+        fprintf(stderr, "usage: %s socket clients requests [depth streams]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    int clients = atoi(argv[2]);
+    int requests = atoi(argv[3]);
+    int depth = (argc == 6) ? atoi(argv[4]) : 8;
+    int streams = (argc == 6) ? atoi(argv[5]) : 4;
+    if (clients <= 0 || requests <= 0 || depth <= 0 || streams <= 0) {
+        fprintf(stderr, "Invalid load parameters\n");
+        return EXIT_FAILURE;
+    }
+
+    pthread_t* threads = (pthread_t*)malloc(clients * sizeof(pthread_t));
+    LoadClient* args = (LoadClient*)calloc(clients, sizeof(LoadClient));
+    float* latency = (float*)malloc((size_t)clients * requests * sizeof(float));
+    if (threads == NULL || args == NULL || latency == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        free(threads);
+        free(args);
+        free(latency);
+        return EXIT_FAILURE;
+    }
+    double start = now_us();
+    int started = 0;
+    for (; started < clients; started++) {
+        args[started] = (LoadClient){argv[1], requests, depth, streams, started, latency + (size_t)started * requests, 0, 0};
+        if (pthread_create(&threads[started], NULL, client_main, &args[started]) != 0) {
+            fprintf(stderr, "Couldn't start client %d\n", started);
+            break;
+        }
+    }
+    int failed = (clients - started) * requests;
+    size_t total = 0;
+    for (int c = 0; c < started; c++) {
+        pthread_join(threads[c], NULL);
+        failed += args[c].failed;
+        // only completed requests have a latency, pack them at the front
+        memmove(latency + total, args[c].latency_us, (size_t)args[c].completed * sizeof(float));
+        total += (size_t)args[c].completed;
+    }
+    double elapsed = now_us() - start;
+
+    if (total == 0) {
+        printf("%d clients x %d requests, depth %d: no request completed  failed %d\n", clients, requests, depth, failed);
+    } else {
+        qsort(latency, total, sizeof(float), compare_float);
+        printf("%d clients x %d requests, depth %d: %.0f req/s  p50 %.0f us  p99 %.0f us  max %.0f us  failed %d\n",
+               clients, requests, depth, total / elapsed * 1e6, latency[total / 2], latency[total * 99 / 100],
+               latency[total - 1], failed);
+    }
+    free(latency);
+    free(args);
+    free(threads);
+    return failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
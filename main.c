@@ -1,156 +1,28 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <fcntl.h>
 #include <stdbool.h>
 
-#include "gru.h"
-#include "linear.h"
+#include "rnn_model.h"
+#include "session.h"
+#include "state_store.h"
 #include "util.h"
-#if defined _WIN32
-    #include "win.h"
-#else
-    #include <sys/mman.h>
-#endif
-
-typedef struct {
-    int input_dim;
-    int input_size;
-    int hidden_size;
-    int output_size;
-    int num_layers;
-} GRUModelConfig;
-
-typedef struct {
-    GRUModelConfig config;
-    GRULayer* gru_layers;
-    LinearLayer output_layer;
-} GRUModel;
-
-void init_gru_model(GRUModel* model, GRUModelConfig config) {
-    model->config = config;    printf("Initializing GRU model...\n");
-    //allocate memory for GRU layers
-    model->gru_layers = (GRULayer*)malloc(model->config.num_layers * sizeof(GRULayer));
-    int input_dim = model->config.input_dim;
-    int input_size = model->config.input_size;
-    for (int i = 0; i < model->config.num_layers; i++) {
-        init_gru_layer(&model->gru_layers[i], input_dim, input_size, model->config.hidden_size);
-        input_size = model->config.hidden_size;
-    }
-    init_linear_layer(&model->output_layer, input_dim * model->config.hidden_size, model->config.output_size); // the linear layer requires a flattening beforehand
-    printf("GRU model initialized.\n");
-}
-
-void free_gru_model(GRUModel* model, bool free_weights) {
-    printf("Freeing GRU model...\n");
-    for (int i = 0; i < model->config.num_layers; i++) {
-        free_gru_layer(&model->gru_layers[i], free_weights); // Pass false to not free weights
-    }
-    free(model->gru_layers); // Free the array of GRU layers
-    printf("GRU model freed.\n");
-}
-
-void memory_map_weights(GRUModel* model, float *data_ptr) {
-    printf("Mapping weights...\n");
-    int input_size = model->config.input_size;
-    int hidden_size = model->config.hidden_size;
-    int num_layers = model->config.num_layers;
-    int output_size = model->config.output_size;
-
-    // Map weights and biases from the pointer
-    int ptr_offset = 0;
-    
-    for (int l = 0; l < num_layers; l++) {
-        int cell_size = (l == 0) ? input_size : hidden_size;
-
-        //map the weights and biases for the current layer
-        model->gru_layers[l].weights.W_ir = data_ptr + ptr_offset;
-        ptr_offset += cell_size * hidden_size;
-
-        model->gru_layers[l].weights.W_iz = data_ptr + ptr_offset;
-        ptr_offset += cell_size * hidden_size;
-
-        model->gru_layers[l].weights.W_in = data_ptr + ptr_offset;
-        ptr_offset += cell_size * hidden_size;
-
-        model->gru_layers[l].weights.W_hr = data_ptr + ptr_offset;
-        ptr_offset += hidden_size * hidden_size;
-
-        model->gru_layers[l].weights.W_hz = data_ptr + ptr_offset;
-        ptr_offset += hidden_size * hidden_size;
-
-        model->gru_layers[l].weights.W_hn = data_ptr + ptr_offset;
-        ptr_offset += hidden_size * hidden_size;
-
-        model->gru_layers[l].weights.b_ir = data_ptr + ptr_offset;
-        ptr_offset += hidden_size;
-
-        model->gru_layers[l].weights.b_iz = data_ptr + ptr_offset;
-        ptr_offset += hidden_size;
-
-        model->gru_layers[l].weights.b_in = data_ptr + ptr_offset;
-        ptr_offset += hidden_size;
-
-        model->gru_layers[l].weights.b_hr = data_ptr + ptr_offset;
-        ptr_offset += hidden_size;
-        
-        model->gru_layers[l].weights.b_hz = data_ptr + ptr_offset;
-        ptr_offset += hidden_size;
-
-        model->gru_layers[l].weights.b_hn = data_ptr + ptr_offset;
-        ptr_offset += hidden_size;
-    }
-
-    // Output Layer Weights and Biases
-    model->output_layer.weights.weights = data_ptr + ptr_offset;
-    ptr_offset += output_size * hidden_size;
-
-    model->output_layer.weights.bias = data_ptr + ptr_offset;
-
-    //print out the output layer weights and biases
-    printf("first Layer Weights: ");
-    for (int i = 0; i < 10; i++) {
-        printf("%f ", model->gru_layers[0].weights.W_ir[i]);
-    }
-    printf("\n");
+#include "pack.h"
+#include "checkpoint.h"
 
-    printf("Output Layer Biases: ");
-    for (int i = 0; i < output_size; i++) {
-        printf("%f ", model->output_layer.weights.bias[i]);
-    }
-
-    printf("Weights mapped.\n");
-}
-
-void read_checkpoint(char *checkpoint, float **data, size_t *file_size, GRUModel* model) {
+void read_checkpoint(char *checkpoint, MappedCheckpoint* ckpt, unsigned load_flags, RNNModel* model) {
     printf("Reading checkpoint from %s...\n", checkpoint);
-    FILE *file = fopen(checkpoint, "rb");
-    if (!file) { 
-        fprintf(stderr, "Couldn't open file %s\n", checkpoint); 
-        exit(EXIT_FAILURE); 
-    }
-
-    // Figure out the file size
-    fseek(file, 0, SEEK_END); // Move file pointer to end of file
-    *file_size = ftell(file); // Get the file size in bytes
-    fclose(file);
-    printf("File size: %ld bytes\n", *file_size);
-
-    // Memory map the GRU weights into the data pointer
-    int fd = open(checkpoint, O_RDONLY); // Open in read-only mode
-    if (fd == -1) { 
-        fprintf(stderr, "open failed!\n"); 
-        exit(EXIT_FAILURE); 
+    if (map_checkpoint(ckpt, checkpoint, load_flags) != MATH_SUCCESS) {
+        fprintf(stderr, "Couldn't map %s\n", checkpoint);
+        exit(EXIT_FAILURE);
     }
+    print_checkpoint_load(ckpt);
 
-    *data = mmap(NULL, *file_size, PROT_READ, MAP_PRIVATE, fd, 0);
-    
-    if (*data == MAP_FAILED) { 
-        fprintf(stderr, "mmap failed!\n"); 
-        exit(EXIT_FAILURE); 
+    size_t floats = memory_map_rnn_weights(model, (float*)ckpt->base);
+    if (floats * sizeof(float) > ckpt->size) {
+        fprintf(stderr, "%s holds %zu bytes, the model needs %zu\n", checkpoint, ckpt->size, floats * sizeof(float));
+        exit(EXIT_FAILURE);
     }
-
-    memory_map_weights(model, *data);
     printf("Checkpoint read and weights mapped.\n");
 }
 
@@ -164,16 +36,64 @@ int main() {
     int num_layers = 5;
 
 
-    GRUModelConfig model_config = {input_dim, input_size, hidden_size, output_size, num_layers};
-    GRUModel* model = (GRUModel*)malloc(sizeof(GRUModel));
-    init_gru_model(model, model_config);
+    RNNModelConfig model_config = {RNN_CELL_GRU, input_dim, input_size, hidden_size, output_size, num_layers};
+    RNNModel* model = (RNNModel*)malloc(sizeof(RNNModel));
+    init_rnn_model(model, model_config);
 
     
-    // map the weights from the binary file
-    float* data;
-    size_t file_size;
-    read_checkpoint("GRUModel_5_64_1_para.bin", &data, &file_size, model);
+    // map the pre-packed weights when they exist, otherwise map the binary file,
+    // repack it and persist the panels so the next start is zero-copy
+    // the weights are prefaulted at load so the first request doesn't take a page fault per weight page
+    unsigned load_flags = LOAD_POPULATE | LOAD_HUGEPAGE;
+    // the packed image is stamped with the source's size and mtime and repacked once it changes,
+    // and any packing failure leaves the model on the float weights
+    char* source = "GRUModel_5_64_1_para.bin";
+    char* packed_path = "GRUModel_5_64_1_para.packed.bin";
+    MappedCheckpoint checkpoint = {0};
+    PackArena arena = {0};
+    size_t packed_size = rnn_model_packed_bytes(model);
+    bool prepacked = false;
+    if (open_packed_checkpoint(packed_path, &arena, packed_size, source, load_flags) == MATH_SUCCESS) {
+        prepacked = (pack_rnn_model(model, &arena) == MATH_SUCCESS);
+        if (prepacked) {
+            printf("Using pre-packed checkpoint.\n");
+        } else {
+            free_rnn_model_packed(model);
+            close_packed_checkpoint(&arena);
+        }
+    }
+    if (!prepacked) {
+        read_checkpoint(source, &checkpoint, load_flags, model);
+        if (init_pack_arena(&arena, packed_size) != MATH_SUCCESS || pack_rnn_model(model, &arena) != MATH_SUCCESS) {
+            fprintf(stderr, "Couldn't pack the weights, running on float32.\n");
+            free_rnn_model_packed(model);
+            free_pack_arena(&arena);
+        } else if (save_packed_checkpoint(packed_path, &arena, source) != MATH_SUCCESS) {
+            fprintf(stderr, "Couldn't save %s, the next start repacks.\n", packed_path);
+        }
+    }
 
+    // the session manager owns the recurrent state of every stream, capped at 1 MB here
+    SessionManager sessions;
+    init_session_manager(&sessions, model, 1 << 20);
+    uint64_t stream_id = 1;
+
+    // reattach to the states saved by the previous run instead of replaying history
+    StateStore states;
+    bool persist = (open_state_store(&states, "GRUModel_5_64_1_para.states.bin", sessions.state_size, 1024, STATE_FP32) == MATH_SUCCESS);
+    if (persist) {
+        printf("Restored %d streams.\n", restore_sessions(&sessions, &states));
+        sessions.store = &states;
+    } else {
+        printf("Running without a state store.\n");
+    }
+    if (session_state(&sessions, stream_id) == NULL) {
+        session_create(&sessions, stream_id);
+        float* h_prev = session_state(&sessions, stream_id);
+        for (int i = 0; i < rnn_model_state_size(&model_config); i++) {
+            h_prev[i] = 0.5f;
+        }
+    }
 
 
     // Example input
@@ -181,10 +101,6 @@ int main() {
     for (int i = 0; i < input_dim * input_size; i++) {
         input[i] = 0.3f; // Initialize to 1
     }
-    float* h_prev = (float*)malloc( num_layers * input_dim * hidden_size * sizeof(float)); // Allocate 3 * 64 floats
-    for (int i = 0; i < num_layers * input_dim * hidden_size; i++) {
-        h_prev[i] = 0.5f; // Initialize to 1
-    }
     float* output = (float*)calloc(input_dim * output_size, sizeof(float)); // Adjust the size according to output_size
     float* inter_input = NULL; // Initialize inter_input to NULL
 
@@ -198,40 +114,41 @@ int main() {
                                 3.23f, 4.32f, 3.85f, 14.11f, 27.65f}; 
     standard_scaler(inter_input, input, input_size, in_mean, in_std);
 
-    printf("Running forward pass through GRU layers...\n");
-    for (int i = 0; i < num_layers; i++) {
-        if (i == 0) {
-            inter_input = input;
-        }
-        //print out the input 
-        printf("Input: ");
-        for (int j = 0; j < input_dim * input_size; j++) {
-            printf("%f ", inter_input[j]);
-        }
-        printf("\n");
-        gru_layer_forward(&model->gru_layers[i], inter_input, h_prev + i * hidden_size);
-        memcpy(h_prev + i * hidden_size, model->gru_layers[i].state.hidden_state_buffer, model->gru_layers->config.hidden_size * sizeof(float));
-        inter_input = model->gru_layers[i].state.hidden_state_buffer; // inter_input points to hidden_state_buffer
+    printf("Input: ");
+    for (int j = 0; j < input_dim * input_size; j++) {
+        printf("%f ", input[j]);
     }
+    printf("\n");
 
-    printf("Running forward pass through the output layer...\n");
-    linear_layer_forward(&model->output_layer, model->gru_layers[2].state.hidden_state_buffer, output);
+    printf("Running forward pass through GRU layers and the output layer...\n");
+    session_step(&sessions, stream_id, input, output);
 
     // Print the output
     printf("Output: ");
-    for (int i = 0; i < 4; i++) {
+    for (int i = 0; i < output_size; i++) {
         printf("%f ", output[i]);
     }
     printf("\n");
 
+    // persist the updated states, only the pages that changed are written back
+    if (persist) {
+        snapshot_sessions(&sessions, &states);
+        close_state_store(&states);
+    }
+
     // Free resources
-    //free(input);
-    free(h_prev);
+    free(input);
     free(output);
-    free_gru_model(model, false); // Free the model and its internal memory
+    free_session_manager(&sessions);
+    free_rnn_model(model, false); // Free the model and its internal memory
     free(model); // Free the model itself
 
-    munmap(data, file_size);
+    if (prepacked) {
+        close_packed_checkpoint(&arena);
+    } else {
+        unmap_checkpoint(&checkpoint);
+        free_pack_arena(&arena);
+    }
 
     printf("Main finished.\n");
     return 0;
@@ -0,0 +1,91 @@
+#define _POSIX_C_SOURCE 200809L // clock_gettime
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+
+#include "rnn_model.h"
+#include "checkpoint.h"
+#include "bulk_score.h"
+#include "tune.h"
+
+// Offline bulk scoring: every stream of a feature file is run from a zero state
+// and its per-row outputs land in a score file, row for row.
+//
+//   ./score checkpoint features.{bin,csv} scores.bin threads [gru|lstm input hidden output layers]
+//
+// threads "auto" takes the thread count, chunk size, GEMM blocking and weight packing
+// from the tuning cache, tuning the model on this machine the first time.
+
+#define SCORE_CHUNK 1024 // rows per sequence-forward call
+#define SCORE_TUNE_CACHE "embedded_nn.tune"
+
+static double now_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char** argv) {
+    if (argc != 5 && argc != 10) {
+        fprintf(stderr, "usage: %s checkpoint features.{bin,csv} scores.bin threads [gru|lstm input hidden output layers]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    RNNModelConfig config = {RNN_CELL_GRU, 1, 15, 64, 4, 5}; // the GRU model main.c runs
+    if (argc == 10) {
+        config.cell_type = (strcmp(argv[5], "lstm") == 0) ? RNN_CELL_LSTM : RNN_CELL_GRU;
+        config.input_size = atoi(argv[6]);
+        config.hidden_size = atoi(argv[7]);
+        config.output_size = atoi(argv[8]);
+        config.num_layers = atoi(argv[9]);
+    }
+    bool autotune = (strcmp(argv[4], "auto") == 0);
+    BulkScoreOptions options = {autotune ? 1 : atoi(argv[4]), SCORE_CHUNK, NULL, NULL};
+    if (options.threads <= 0 || config.input_size <= 0 || config.hidden_size <= 0 || config.output_size <= 0 || config.num_layers <= 0) {
+        fprintf(stderr, "Invalid thread count or model dims\n");
+        return EXIT_FAILURE;
+    }
+
+    MappedCheckpoint ckpt;
+    if (map_checkpoint(&ckpt, argv[1], LOAD_POPULATE) != MATH_SUCCESS) {
+        return EXIT_FAILURE;
+    }
+    RNNModel model;
+    init_rnn_model(&model, config);
+    if (attach_rnn_checkpoint(&model, &ckpt) != MATH_SUCCESS) {
+        return EXIT_FAILURE;
+    }
+    PackArena arena = {0};
+    if (autotune) {
+        TuneResult tuning;
+        if (autotune_rnn_model(SCORE_TUNE_CACHE, &model, &arena, &tuning) != MATH_SUCCESS) {
+            fprintf(stderr, "Tuning failed\n");
+            return EXIT_FAILURE;
+        }
+        options.threads = tuning.threads;
+        options.chunk = tuning.chunk;
+    }
+
+    double start = now_s();
+    FeatureTable table;
+    if (open_feature_file(&table, argv[2], config.input_size, options.threads) != MATH_SUCCESS) {
+        return EXIT_FAILURE;
+    }
+    double load_s = now_s() - start;
+
+    BulkScoreStats stats;
+    if (bulk_score(&model, &table, argv[3], &options, &stats) != MATH_SUCCESS) {
+        fprintf(stderr, "Scoring failed\n");
+        return EXIT_FAILURE;
+    }
+    printf("Scored %llu rows in %llu sequences with %d threads: load %.3f s, score %.3f s, %.0f rows/s\n",
+           (unsigned long long)stats.rows, (unsigned long long)stats.sequences, options.threads,
+           load_s, stats.score_s, stats.rows / stats.score_s);
+
+    close_feature_file(&table);
+    free_rnn_model(&model, false);
+    free_pack_arena(&arena);
+    unmap_checkpoint(&ckpt);
+    return EXIT_SUCCESS;
+}
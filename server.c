@@ -0,0 +1,274 @@
+#define _DEFAULT_SOURCE // sigaction, kill
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include "rnn_model.h"
+#include "session.h"
+#include "checkpoint.h"
+#include "shm_ring.h"
+
+// Pre-fork inference server. The parent maps the checkpoint once and forks the
+// workers, which share its read-only weight pages. Every worker accepts clients
+// on a Unix socket. It hands each client a shared-memory ring of request slots,
+// then steps the client's streams straight from the slots. The socket is only
+// reachable by the server's user, and the rings are treated as untrusted input.
+//
+//   ./server checkpoint socket workers [gru|lstm input hidden output layers]
+
+#define SERVER_RING_SLOTS 64
+#define SERVER_STATE_CAP (1 << 20) // stream state bytes per connection
+#define SERVER_CLIENTS 64          // connections served at once by one worker
+#define SERVER_SPIN_SWEEPS 1000    // idle sweeps over several rings before napping
+
+static volatile sig_atomic_t stopping = 0;
+
+static void handle_stop(int sig) {
+    (void)sig;
+    stopping = 1;
+}
+
+// Pages this process wrote itself, i.e. what a worker costs on top of the shared weights
+static long private_dirty_kb(void) {
+    FILE* file = fopen("/proc/self/smaps_rollup", "r");
+    if (!file) {
+        return -1;
+    }
+    char line[256];
+    long kb = -1;
+    while (fgets(line, sizeof(line), file)) {
+        if (sscanf(line, "Private_Dirty: %ld kB", &kb) == 1) {
+            break;
+        }
+    }
+    fclose(file);
+    return kb;
+}
+
+static bool peer_closed(int conn) {
+    char byte;
+    ssize_t got = recv(conn, &byte, 1, MSG_DONTWAIT);
+    return got == 0 || (got < 0 && errno != EAGAIN && errno != EWOULDBLOCK);
+}
+
+// One client: its ring and the streams it owns
+typedef struct {
+    int conn;
+    ShmRing ring;
+    SessionManager sessions;
+    long served;
+} ServerClient;
+
+static bool open_client(ServerClient* client, RNNModel* model, int conn) {
+    RNNModelConfig* config = &model->config;
+    client->conn = conn;
+    client->served = 0;
+    if (create_shm_ring(&client->ring, SERVER_RING_SLOTS, config->input_size, config->output_size) != MATH_SUCCESS) {
+        return false;
+    }
+    // streams belong to their connection, so their ids never clash across clients
+    if (send_shm_ring(conn, &client->ring) != MATH_SUCCESS
+        || init_session_manager(&client->sessions, model, SERVER_STATE_CAP) != MATH_SUCCESS) {
+        close_shm_ring(&client->ring);
+        return false;
+    }
+    return true;
+}
+
+static void close_client(ServerClient* client, int worker) {
+    printf("Worker %d served %ld requests on %d streams, private dirty %ld kB\n",
+           worker, client->served, client->sessions.active, private_dirty_kb());
+    free_session_manager(&client->sessions);
+    close_shm_ring(&client->ring);
+    close(client->conn);
+}
+
+// Step one request. The slot is client memory: stream_id and op are read once and
+// the op is checked before it picks a path.
+static void serve_slot(ServerClient* client, ShmSlot* slot) {
+    volatile ShmSlot* shared = slot;
+    uint64_t stream_id = shared->stream_id;
+    int32_t op = shared->op;
+    SessionManager* sessions = &client->sessions;
+    MathStatus status = MATH_SUCCESS;
+    if (op == SHM_OP_CLOSE) {
+        status = session_close(sessions, stream_id);
+    } else if (op == SHM_OP_STEP || op == SHM_OP_RESET) {
+        if (op == SHM_OP_RESET || session_state(sessions, stream_id) == NULL) {
+            status = session_create(sessions, stream_id);
+        }
+        if (status == MATH_SUCCESS) {
+            status = session_step(sessions, stream_id, shm_slot_input(slot), shm_slot_output(&client->ring, slot));
+        }
+    } else {
+        status = MATH_INVALID_RANGE;
+    }
+    slot->status = status;
+    shm_ring_done(&client->ring);
+    client->served++;
+}
+
+// Every worker serves up to SERVER_CLIENTS connections at once. With one client it
+// blocks on that client's ring; with several it sweeps the rings, yielding while
+// they are idle and then napping, since their semaphores can't be waited on together.
+static void worker_main(RNNModel* model, int listen_fd, int worker) {
+    ServerClient clients[SERVER_CLIENTS];
+    int count = 0;
+    int idle = 0;
+    while (!stopping) {
+        if (count < SERVER_CLIENTS) {
+            struct pollfd pending = {listen_fd, POLLIN, 0};
+            if (poll(&pending, 1, (count == 0) ? 100 : 0) > 0) {
+                int conn = accept(listen_fd, NULL, NULL); // EAGAIN when another worker took it
+                if (conn >= 0) {
+                    if (open_client(&clients[count], model, conn)) {
+                        count++;
+                    } else {
+                        close(conn);
+                    }
+                }
+            }
+        }
+        if (count == 0) {
+            continue;
+        }
+
+        bool busy = false;
+        for (int c = 0; c < count; c++) {
+            // at most a ring's worth per client per sweep, so one client can't starve the rest
+            int timeout_ms = (count == 1 && idle > 0) ? 100 : 0;
+            for (int k = 0; k < SERVER_RING_SLOTS; k++) {
+                ShmSlot* slot = shm_ring_next(&clients[c].ring, timeout_ms);
+                if (slot == NULL) {
+                    break;
+                }
+                serve_slot(&clients[c], slot);
+                busy = true;
+                timeout_ms = 0;
+            }
+        }
+        if (busy) {
+            idle = 0;
+            continue;
+        }
+        idle++;
+        for (int c = 0; c < count; c++) {
+            if (peer_closed(clients[c].conn)) {
+                close_client(&clients[c], worker);
+                clients[c--] = clients[--count];
+            }
+        }
+        if (count > 1) {
+            if (idle < SERVER_SPIN_SWEEPS) {
+                sched_yield();
+            } else {
+                usleep(50);
+            }
+        }
+    }
+    for (int c = 0; c < count; c++) {
+        close_client(&clients[c], worker);
+    }
+}
+
+int main(int argc, char** argv) {
+    if (argc != 4 && argc != 9) {
+        fprintf(stderr, "usage: %s checkpoint socket workers [gru|lstm input hidden output layers]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    char* checkpoint = argv[1];
+    char* socket_path = argv[2];
+    int workers = atoi(argv[3]);
+    RNNModelConfig config = {RNN_CELL_GRU, 1, 15, 64, 4, 5}; // the GRU model main.c runs
+    if (argc == 9) {
+        config.cell_type = (strcmp(argv[4], "lstm") == 0) ? RNN_CELL_LSTM : RNN_CELL_GRU;
+        config.input_size = atoi(argv[5]);
+        config.hidden_size = atoi(argv[6]);
+        config.output_size = atoi(argv[7]);
+        config.num_layers = atoi(argv[8]);
+    }
+    if (workers <= 0 || config.input_size <= 0 || config.hidden_size <= 0 || config.output_size <= 0 || config.num_layers <= 0) {
+        fprintf(stderr, "Invalid worker count or model dims\n");
+        return EXIT_FAILURE;
+    }
+
+    // one prefaulted mapping, inherited by every worker
+    MappedCheckpoint ckpt;
+    if (map_checkpoint(&ckpt, checkpoint, LOAD_POPULATE) != MATH_SUCCESS) {
+        return EXIT_FAILURE;
+    }
+    print_checkpoint_load(&ckpt);
+    RNNModel model;
+    init_rnn_model(&model, config);
+    if (attach_rnn_checkpoint(&model, &ckpt) != MATH_SUCCESS) {
+        return EXIT_FAILURE;
+    }
+
+    int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    struct sockaddr_un addr = {0};
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", socket_path);
+    unlink(socket_path);
+    mode_t umask_before = umask(0177); // the socket file is created 0600
+    bool bound = listen_fd >= 0 && bind(listen_fd, (struct sockaddr*)&addr, sizeof(addr)) == 0;
+    umask(umask_before);
+    // non-blocking, as every worker polls it and only one wins each connection
+    if (!bound || listen(listen_fd, 64) != 0 || fcntl(listen_fd, F_SETFL, O_NONBLOCK) != 0) {
+        fprintf(stderr, "Couldn't listen on %s\n", socket_path);
+        return EXIT_FAILURE;
+    }
+
+    struct sigaction action = {0};
+    action.sa_handler = handle_stop; // no SA_RESTART, so accept and sem waits return
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+
+    pid_t* pids = (pid_t*)malloc(workers * sizeof(pid_t));
+    if (pids == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        return EXIT_FAILURE;
+    }
+    fflush(stdout); // or the children repeat the buffered startup log
+    for (int w = 0; w < workers; w++) {
+        pids[w] = fork();
+        if (pids[w] == 0) {
+            worker_main(&model, listen_fd, w);
+            fflush(stdout);
+            _exit(EXIT_SUCCESS);
+        }
+    }
+    printf("Serving %s on %s with %d workers.\n", checkpoint, socket_path, workers);
+    fflush(stdout);
+
+    while (!stopping) {
+        pause();
+    }
+    for (int w = 0; w < workers; w++) {
+        if (pids[w] > 0) {
+            kill(pids[w], SIGTERM);
+        }
+    }
+    for (int w = 0; w < workers; w++) {
+        if (pids[w] > 0) {
+            waitpid(pids[w], NULL, 0);
+        }
+    }
+    close(listen_fd);
+    unlink(socket_path);
+    free(pids);
+    free_rnn_model(&model, false);
+    unmap_checkpoint(&ckpt);
+    printf("Server stopped.\n");
+    return EXIT_SUCCESS;
+}
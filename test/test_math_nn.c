@@ -1,7 +1,11 @@
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <assert.h>
+#include <math.h>
 #include "math_nn.h"
+#include "palette.h"
+#include "pack.h"
 
 void test_sigmoid_act() {
     float x = 0.0f;
@@ -54,6 +58,239 @@ void test_tanh_act_vec() {
     printf("tanh_act_vec result: %f %f %f\n", out[0], out[1], out[2]);
 }
 
+void test_matmul_palette() {
+    // 8 x 37 weights drawn from 16 levels, so the codebook reproduces them exactly
+    enum { N = 8, P = 37 };
+    float w[N * P];
+    float a[2 * N];
+    for (int i = 0; i < N * P; i++) {
+        w[i] = ((i * 7) % 16) * 0.25f - 2.0f;
+    }
+    for (int i = 0; i < 2 * N; i++) {
+        a[i] = 0.1f * (i - 5);
+    }
+
+    for (int per_row = 0; per_row <= 1; per_row++) {
+        PaletteMatrix pal;
+        assert(palettize_matrix(&pal, w, N, P, per_row, 20) == MATH_SUCCESS);
+        float decoded[N * P];
+        depalettize_matrix(decoded, &pal);
+        for (int i = 0; i < N * P; i++) {
+            assert(decoded[i] == w[i]);
+        }
+
+        float expected[2 * P];
+        float out[2 * P];
+        matmul(expected, a, w, 2, N, P);
+        assert(matmul_palette(out, a, &pal, 2) == MATH_SUCCESS);
+        for (int i = 0; i < 2 * P; i++) {
+            assert(fabsf(out[i] - expected[i]) < 1e-4f);
+        }
+        free_palette_matrix(&pal);
+    }
+
+    // non-finite weights are rejected rather than folded into a centroid
+    for (int per_row = 0; per_row <= 1; per_row++) {
+        PaletteMatrix pal;
+        float saved = w[P + 3];
+        w[P + 3] = per_row ? INFINITY : NAN;
+        assert(palettize_matrix(&pal, w, N, P, per_row, 20) == MATH_INVALID_RANGE);
+        w[P + 3] = saved;
+    }
+    printf("matmul_palette matches matmul\n");
+}
+
+void test_matmul_packed() {
+    enum { N = 5, P = 21 };
+    float w[N * P];
+    float a[3 * N];
+    for (int i = 0; i < N * P; i++) {
+        w[i] = 0.01f * (i % 13) - 0.05f;
+    }
+    for (int i = 0; i < 3 * N; i++) {
+        a[i] = 0.5f - 0.1f * i;
+    }
+
+    PackArena arena;
+    PackedMatrix packed;
+    assert(init_pack_arena(&arena, packed_matrix_bytes(N, P)) == MATH_SUCCESS);
+    assert(pack_matrix(&packed, &arena, w, N, P) == MATH_SUCCESS);
+
+    float expected[3 * P];
+    float out[3 * P];
+    matmul(expected, a, w, 3, N, P);
+    assert(matmul_packed(out, a, &packed, 3) == MATH_SUCCESS);
+    for (int i = 0; i < 3 * P; i++) {
+        assert(fabsf(out[i] - expected[i]) < 1e-5f);
+    }
+
+    // attaching to the packed image hands back the same panels without copying
+    PackArena image;
+    PackedMatrix reattached;
+    attach_pack_arena(&image, arena.base, arena.used);
+    assert(pack_matrix(&reattached, &image, NULL, N, P) == MATH_SUCCESS);
+    assert(reattached.data == packed.data);
+    assert(pack_matrix(&reattached, &image, NULL, N, P) == MATH_EXCEEDS_MAX_DIM);
+
+    free_pack_arena(&arena);
+    printf("matmul_packed matches matmul\n");
+}
+
+void test_gemm() {
+    // odd sizes that cross every block edge, with padded leading dimensions
+    int M = 77, N = 35, K = 300;
+    int lda = K + 3, ldb = N + 5, ldc = N + 2;
+    float* A = (float*)malloc(M * lda * sizeof(float));
+    float* B = (float*)malloc(K * ldb * sizeof(float));
+    float* C = (float*)malloc(M * ldc * sizeof(float));
+    float* expected = (float*)malloc(M * N * sizeof(float));
+    for (int i = 0; i < M * lda; i++) {
+        A[i] = 0.01f * ((i * 37) % 101) - 0.5f;
+    }
+    for (int i = 0; i < K * ldb; i++) {
+        B[i] = 0.01f * ((i * 53) % 97) - 0.45f;
+    }
+    for (int i = 0; i < M * ldc; i++) {
+        C[i] = 1.0f;
+    }
+    for (int i = 0; i < M; i++) {
+        for (int j = 0; j < N; j++) {
+            double acc = 0.0;
+            for (int k = 0; k < K; k++) {
+                acc += (double)A[i * lda + k] * B[k * ldb + j];
+            }
+            expected[i * N + j] = (float)(2.0 * acc + 0.5);
+        }
+    }
+
+    assert(gemm(M, N, K, 2.0f, A, lda, B, ldb, 0.5f, C, ldc) == MATH_SUCCESS);
+    for (int i = 0; i < M; i++) {
+        for (int j = 0; j < N; j++) {
+            assert(fabsf(C[i * ldc + j] - expected[i * N + j]) < 1e-3f);
+        }
+        assert(C[i * ldc + N] == 1.0f); // padding untouched
+    }
+    assert(gemm(M, N, K, 1.0f, A, K - 1, B, ldb, 0.0f, C, ldc) == MATH_INVALID_DIM);
+
+    // blocking that is not a multiple of the register tile gives the same result
+    int mc, kc;
+    gemm_get_blocking(&mc, &kc);
+    assert(gemm_set_blocking(0, kc) == MATH_INVALID_DIM);
+    assert(gemm_set_blocking(25, 70) == MATH_SUCCESS);
+    assert(gemm(M, N, K, 2.0f, A, lda, B, ldb, 0.0f, C, ldc) == MATH_SUCCESS);
+    for (int i = 0; i < M; i++) {
+        for (int j = 0; j < N; j++) {
+            assert(fabsf(C[i * ldc + j] - (expected[i * N + j] - 0.5f)) < 1e-3f);
+        }
+    }
+    gemm_set_blocking(mc, kc);
+    int now_mc, now_kc;
+    gemm_get_blocking(&now_mc, &now_kc);
+    assert(now_mc == mc && now_kc == kc);
+    // an explicit blocking leaves the process-wide one as it was
+    assert(gemm_with_blocking(13, 40, M, N, K, 2.0f, A, lda, B, ldb, 0.0f, C, ldc) == MATH_SUCCESS);
+    for (int i = 0; i < M; i++) {
+        for (int j = 0; j < N; j++) {
+            assert(fabsf(C[i * ldc + j] - (expected[i * N + j] - 0.5f)) < 1e-3f);
+        }
+    }
+    gemm_get_blocking(&now_mc, &now_kc);
+    assert(now_mc == mc && now_kc == kc);
+
+    free(A);
+    free(B);
+    free(C);
+    free(expected);
+    printf("gemm matches reference\n");
+}
+
+// The streaming kernels against plain loops, at lengths that exercise the vector tails
+void test_streaming_kernels() {
+    enum { N = 1500 };
+    float* a = (float*)malloc(N * sizeof(float));
+    float* b = (float*)malloc(N * sizeof(float));
+    for (int i = 0; i < N; i++) {
+        a[i] = 0.01f * ((i * 37) % 101) - 0.5f;
+        b[i] = 0.02f * ((i * 53) % 97) - 1.0f;
+    }
+    int sizes[5] = {1, 7, 16, 37, N};
+    for (int s = 0; s < 5; s++) {
+        int n = sizes[s];
+        double ref = 0.0;
+        for (int i = 0; i < n; i++) {
+            ref += (double)a[i] * b[i];
+        }
+        assert(fabs(dot_product(a, b, n) - ref) < 1e-3);
+
+        // scores spread over [-50, 10], exp of the shifted values spans the denormal range
+        float x[N];
+        float ref_p[N];
+        double max_val = -1e30;
+        for (int i = 0; i < n; i++) {
+            x[i] = 60.0f * a[i] * b[i] - 10.0f * a[i];
+            max_val = (x[i] > max_val) ? x[i] : max_val;
+        }
+        double sum = 0.0;
+        for (int i = 0; i < n; i++) {
+            sum += exp(x[i] - max_val);
+        }
+        for (int i = 0; i < n; i++) {
+            ref_p[i] = (float)(exp(x[i] - max_val) / sum);
+        }
+        softmax_inplace(x, n);
+        for (int i = 0; i < n; i++) {
+            assert(fabsf(x[i] - ref_p[i]) <= 1e-6f + 1e-5f * ref_p[i]);
+        }
+    }
+    // a NaN score poisons the whole distribution on the vector path as on the scalar one
+    float z[16];
+    for (int i = 0; i < 16; i++) {
+        z[i] = 0.1f * i;
+    }
+    z[3] = NAN;
+    softmax_inplace(z, 16);
+    for (int i = 0; i < 16; i++) {
+        assert(isnan(z[i]));
+    }
+    float y[37];
+    for (int i = 0; i < 37; i++) {
+        y[i] = b[i];
+    }
+    axpy(y, 0.5f, a, 37);
+    for (int i = 0; i < 37; i++) {
+        assert(fabsf(y[i] - (b[i] + 0.5f * a[i])) < 1e-6f);
+    }
+    free(a);
+    free(b);
+    printf("dot_product, axpy and softmax_inplace match plain loops\n");
+}
+
+void test_numerics_scan() {
+    // 37 values: the flagged ones land in both the vector body and the tail
+    float x[37];
+    for (int i = 0; i < 37; i++) {
+        x[i] = 0.01f * (i - 18);
+    }
+    NumericsCounts counts = {0, 0, 0};
+    assert(numerics_scan(x, 37, 1.0f, &counts) == MATH_SUCCESS);
+    assert(counts.nan == 0 && counts.inf == 0 && counts.saturated == 0);
+    x[3] = 1.0f;
+    x[35] = -2.5f;
+    assert(numerics_scan(x, 37, 1.0f, &counts) == MATH_INVALID_RANGE);
+    assert(counts.saturated == 2);
+    x[5] = NAN;
+    x[33] = NAN;
+    x[10] = INFINITY;
+    x[36] = -INFINITY;
+    assert(numerics_scan(x, 37, 1.0f, &counts) == MATH_OVERFLOW_RISK);
+    assert(counts.nan == 2 && counts.inf == 2 && counts.saturated == 4);
+    // with no limit only NaN and Inf count
+    NumericsCounts unbounded = {0, 0, 0};
+    assert(numerics_scan(x, 37, INFINITY, &unbounded) == MATH_OVERFLOW_RISK);
+    assert(unbounded.nan == 2 && unbounded.inf == 2 && unbounded.saturated == 0);
+    printf("numerics_scan counts NaN, Inf and saturated values\n");
+}
+
 int main() {
     test_sigmoid_act();
     test_tanh_act();
@@ -62,6 +299,11 @@ int main() {
     test_mul();
     test_sigmoid_act_vec();
     test_tanh_act_vec();
+    test_matmul_palette();
+    test_matmul_packed();
+    test_gemm();
+    test_streaming_kernels();
+    test_numerics_scan();
     printf("All tests passed!\n");
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,2076 @@
+#define _POSIX_C_SOURCE 200809L // utimensat
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdbool.h>
+#include <assert.h>
+#include <math.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include "gru.h"
+#include "lstm.h"
+#include "rnn_model.h"
+#include "session.h"
+#include "state_store.h"
+#include "window.h"
+#include "infer_queue.h"
+#include "frame_ring.h"
+#include "checkpoint.h"
+#include "layer_stream.h"
+#include "model_registry.h"
+#include "shm_ring.h"
+#include "bulk_score.h"
+#include "graph.h"
+#include "bidirectional.h"
+#include "lstmp.h"
+#include "conv1d.h"
+#include "attention.h"
+#include "packed_seq.h"
+#include "ensemble.h"
+#include "tune.h"
+#include "stepper.h"
+#include "util.h"
+
+static void fill_pattern(float* x, int size, int seed) {
+    for (int i = 0; i < size; i++) {
+        x[i] = 0.02f * (((i + seed) * 29) % 41) - 0.4f;
+    }
+}
+
+static void fill_gru_layer(GRULayer* layer) {
+    int in = layer->config.input_size;
+    int h = layer->config.hidden_size;
+    GRULayerWeights* w = &layer->weights;
+    fill_pattern(w->W_ir, in * h, 1);
+    fill_pattern(w->W_iz, in * h, 2);
+    fill_pattern(w->W_in, in * h, 3);
+    fill_pattern(w->W_hr, h * h, 4);
+    fill_pattern(w->W_hz, h * h, 5);
+    fill_pattern(w->W_hn, h * h, 6);
+    fill_pattern(w->b_ir, h, 7);
+    fill_pattern(w->b_iz, h, 8);
+    fill_pattern(w->b_in, h, 9);
+    fill_pattern(w->b_hr, h, 10);
+    fill_pattern(w->b_hz, h, 11);
+    fill_pattern(w->b_hn, h, 12);
+}
+
+static void fill_lstm_layer(LSTMLayer* layer) {
+    int in = layer->config.input_size;
+    int h = layer->config.hidden_size;
+    LSTMLayerWeights* w = &layer->weights;
+    float* input_weights[4] = {w->W_ii, w->W_if, w->W_ig, w->W_io};
+    float* hidden_weights[4] = {w->W_hi, w->W_hf, w->W_hg, w->W_ho};
+    float* biases[8] = {w->b_ii, w->b_if, w->b_ig, w->b_io, w->b_hi, w->b_hf, w->b_hg, w->b_ho};
+    for (int i = 0; i < 4; i++) {
+        fill_pattern(input_weights[i], in * h, i + 1);
+        fill_pattern(hidden_weights[i], h * h, i + 5);
+    }
+    for (int i = 0; i < 8; i++) {
+        fill_pattern(biases[i], h, i + 9);
+    }
+}
+
+static void assert_close(float* a, float* b, int size, float tol) {
+    for (int i = 0; i < size; i++) {
+        assert(fabsf(a[i] - b[i]) < tol);
+    }
+}
+
+void test_gru_forward_sequence() {
+    enum { T = 9, IN = 7, H = 20 };
+    GRULayer layer;
+    init_gru_layer(&layer, 1, IN, H);
+    fill_gru_layer(&layer);
+
+    float inputs[T * IN];
+    float h0[H];
+    float outputs[T * H];
+    float h[H];
+    fill_pattern(inputs, T * IN, 13);
+    fill_pattern(h0, H, 14);
+
+    gru_layer_forward_sequence(&layer, inputs, h0, outputs, T);
+
+    memcpy(h, h0, sizeof(h));
+    for (int t = 0; t < T; t++) {
+        gru_layer_forward(&layer, inputs + t * IN, h);
+        memcpy(h, layer.state.hidden_state_buffer, sizeof(h));
+        assert_close(outputs + t * H, h, H, 1e-5f);
+    }
+    free_gru_layer(&layer, true);
+    printf("gru_layer_forward_sequence matches the step loop\n");
+}
+
+void test_lstm_forward_sequence() {
+    enum { T = 9, IN = 7, H = 20 };
+    LSTMLayer layer;
+    init_lstm_layer(&layer, 1, IN, H);
+    fill_lstm_layer(&layer);
+
+    float inputs[T * IN];
+    float h0[H];
+    float c0[H];
+    float outputs[T * H];
+    float h[H];
+    float c[H];
+    fill_pattern(inputs, T * IN, 15);
+    fill_pattern(h0, H, 16);
+    fill_pattern(c0, H, 17);
+
+    lstm_layer_forward_sequence(&layer, inputs, h0, c0, outputs, T);
+    float c_seq[H];
+    memcpy(c_seq, layer.state.cell_state_buffer, sizeof(c_seq));
+
+    memcpy(h, h0, sizeof(h));
+    memcpy(c, c0, sizeof(c));
+    for (int t = 0; t < T; t++) {
+        lstm_layer_forward(&layer, inputs + t * IN, h, c);
+        memcpy(h, layer.state.hidden_state_buffer, sizeof(h));
+        memcpy(c, layer.state.cell_state_buffer, sizeof(c));
+        assert_close(outputs + t * H, h, H, 1e-5f);
+    }
+    assert_close(c_seq, c, H, 1e-5f);
+    free_lstm_layer(&layer, true);
+    printf("lstm_layer_forward_sequence matches the step loop\n");
+}
+
+void test_session_manager() {
+    enum { IN = 5, H = 12, O = 3, L = 2 };
+    RNNModelConfig config = {RNN_CELL_LSTM, 1, IN, H, O, L};
+    RNNModel model;
+    init_rnn_model(&model, config);
+    for (int l = 0; l < L; l++) {
+        fill_lstm_layer(&model.lstm_layers[l]);
+    }
+    fill_pattern(model.output_layer.weights.weights, H * O, 18);
+    fill_pattern(model.output_layer.weights.bias, O, 19);
+
+    int state_size = rnn_model_state_size(&config);
+    size_t slot_bytes = state_size * sizeof(float);
+    SessionManager manager;
+    assert(init_session_manager(&manager, &model, 2 * slot_bytes) == MATH_SUCCESS);
+    assert(manager.max_slots == 2);
+
+    // two interleaved streams must match two independent step loops
+    float* ref_a = (float*)calloc(state_size, sizeof(float));
+    float* ref_b = (float*)calloc(state_size, sizeof(float));
+    float x[IN];
+    float out[O];
+    float ref_out[O];
+    assert(session_create(&manager, 100) == MATH_SUCCESS);
+    assert(session_create(&manager, 200) == MATH_SUCCESS);
+    for (int t = 0; t < 4; t++) {
+        fill_pattern(x, IN, t);
+        assert(session_step(&manager, 100, x, out) == MATH_SUCCESS);
+        rnn_model_step(&model, x, ref_a, ref_out);
+        assert_close(out, ref_out, O, 1e-5f);
+        fill_pattern(x, IN, t + 20);
+        assert(session_step(&manager, 200, x, NULL) == MATH_SUCCESS);
+        rnn_model_step(&model, x, ref_b, NULL);
+    }
+    assert_close(session_state(&manager, 100), ref_a, state_size, 1e-5f);
+    assert_close(session_state(&manager, 200), ref_b, state_size, 1e-5f);
+
+    // the pool is full, so a third stream evicts the least recently used one
+    assert(session_create(&manager, 300) == MATH_SUCCESS);
+    assert(manager.evictions == 1);
+    assert(session_state(&manager, 100) == NULL);
+    assert(session_step(&manager, 100, x, out) == MATH_INVALID_RANGE);
+    assert_close(session_state(&manager, 200), ref_b, state_size, 1e-5f);
+
+    // stream 300 has never been stepped, so it is idle for longer than 200
+    assert(session_step(&manager, 200, x, out) == MATH_SUCCESS);
+    assert(session_evict_idle(&manager, 0) == 1);
+    assert(session_state(&manager, 300) == NULL);
+    assert(session_close(&manager, 200) == MATH_SUCCESS);
+    assert(manager.active == 0);
+
+    free(ref_a);
+    free(ref_b);
+    free_session_manager(&manager);
+    free_rnn_model(&model, true);
+    printf("session_manager matches independent streams and evicts in LRU order\n");
+}
+
+void test_state_store() {
+    // exact half values, rounding to nearest even, subnormals and overflow
+    float values[10] = {0.0f, 1.0f, -2.5f, 65504.0f, 1.0f + 1.0f / 2048.0f, 1.0f + 3.0f / 2048.0f,
+                        5.9604645e-8f, 6.1035156e-5f, 1e6f, -0.333333f};
+    uint16_t half[10];
+    float back[10];
+    float_to_half(half, values, 10);
+    half_to_float(back, half, 10);
+    assert(half[1] == 0x3c00 && half[2] == 0xc100 && half[3] == 0x7bff);
+    assert(back[4] == 1.0f && back[5] == 1.0f + 4.0f / 2048.0f);
+    assert(half[6] == 0x0001 && half[7] == 0x0400 && half[8] == 0x7c00);
+    assert(fabsf(back[9] - values[9]) < 2e-4f);
+
+    enum { S = 40, N = 50 };
+    char* path = "/tmp/test_rnn_state_store.bin";
+    StatePrecision precisions[2] = {STATE_FP32, STATE_FP16};
+    for (int p = 0; p < 2; p++) {
+        remove(path);
+        StateStore store;
+        float state[S];
+        float got[S];
+        assert(open_state_store(&store, path, S, N, precisions[p]) == MATH_SUCCESS);
+        for (int id = 0; id < N; id++) {
+            fill_pattern(state, S, id);
+            assert(state_store_put(&store, 1000 + id, state) == MATH_SUCCESS);
+        }
+        for (int id = 0; id < N; id += 3) {
+            assert(state_store_remove(&store, 1000 + id) == MATH_SUCCESS);
+        }
+        assert(state_store_sync(&store, true) > 0);
+        assert(state_store_sync(&store, true) == 0); // nothing changed since
+        close_state_store(&store);
+
+        // reattach and check every surviving stream
+        assert(open_state_store(&store, path, S + 1, N, precisions[p]) == MATH_INVALID_DIM);
+        assert(open_state_store(&store, path, S, N, precisions[p]) == MATH_SUCCESS);
+        for (int id = 0; id < N; id++) {
+            MathStatus status = state_store_get(&store, 1000 + id, got);
+            if (id % 3 == 0) {
+                assert(status == MATH_INVALID_RANGE);
+                continue;
+            }
+            assert(status == MATH_SUCCESS);
+            fill_pattern(state, S, id);
+            assert_close(got, state, S, precisions[p] == STATE_FP16 ? 1e-3f : 1e-7f);
+        }
+        close_state_store(&store);
+    }
+
+    // a directory size that isn't a power of two is refused before anything is mapped
+    FILE* file = fopen(path, "r+b");
+    assert(file != NULL);
+    int32_t capacity = 48;
+    assert(fseek(file, offsetof(StateStoreHeader, capacity), SEEK_SET) == 0);
+    assert(fwrite(&capacity, sizeof(capacity), 1, file) == 1);
+    fclose(file);
+    StateStore forged;
+    assert(open_state_store(&forged, path, S, N, STATE_FP16) == MATH_INVALID_RANGE);
+    remove(path);
+
+    // a session manager brought back from a snapshot continues where it stopped
+    RNNModelConfig config = {RNN_CELL_GRU, 1, 5, 12, 3, 2};
+    RNNModel model;
+    init_rnn_model(&model, config);
+    for (int l = 0; l < config.num_layers; l++) {
+        fill_gru_layer(&model.gru_layers[l]);
+    }
+    SessionManager manager;
+    init_session_manager(&manager, &model, 1 << 16);
+    float x[5];
+    float out[3];
+    float ref[3];
+    fill_pattern(x, 5, 3);
+    session_create(&manager, 7);
+    session_create(&manager, 8);
+    session_step(&manager, 7, x, NULL);
+    session_step(&manager, 8, x, NULL);
+    session_step(&manager, 8, x, NULL);
+
+    StateStore store;
+    assert(open_state_store(&store, path, manager.state_size, 16, STATE_FP32) == MATH_SUCCESS);
+    assert(snapshot_sessions(&manager, &store) == MATH_SUCCESS);
+    session_step(&manager, 8, x, ref);
+    free_session_manager(&manager);
+
+    init_session_manager(&manager, &model, 1 << 16);
+    assert(restore_sessions(&manager, &store) == 2);
+    session_step(&manager, 8, x, out);
+    assert_close(out, ref, 3, 1e-6f);
+    free_session_manager(&manager);
+
+    // a pool smaller than the store takes what fits without evicting
+    init_session_manager(&manager, &model, manager.state_size * sizeof(float));
+    assert(restore_sessions(&manager, &store) == 1);
+    assert(manager.active == 1 && manager.evictions == 0);
+    free_session_manager(&manager);
+
+    // with the store attached, closed and evicted streams don't come back at the next restore
+    init_session_manager(&manager, &model, manager.state_size * sizeof(float));
+    manager.store = &store;
+    assert(restore_sessions(&manager, &store) == 1);
+    uint64_t kept = manager.slots[manager.lru_head].stream_id;
+    session_create(&manager, 9); // evicts the restored stream
+    assert(manager.evictions == 1);
+    assert(state_store_get(&store, kept, session_state(&manager, 9)) == MATH_INVALID_RANGE);
+    assert(state_store_put(&store, 9, session_state(&manager, 9)) == MATH_SUCCESS);
+    assert(session_close(&manager, 9) == MATH_SUCCESS);
+    float* closed = (float*)calloc(manager.state_size, sizeof(float));
+    assert(state_store_get(&store, 9, closed) == MATH_INVALID_RANGE);
+    free(closed);
+    assert(store.header->count == 1);
+    close_state_store(&store);
+    remove(path);
+
+    free_session_manager(&manager);
+    free_rnn_model(&model, true);
+    printf("state_store round-trips streams through the mapped file\n");
+}
+
+static void test_sliding_window_cell(RNNCellType cell_type) {
+    enum { IN = 4, H = 10, O = 3, L = 2, W = 8, T = 21 };
+    RNNModelConfig config = {cell_type, 1, IN, H, O, L};
+    RNNModel model;
+    init_rnn_model(&model, config);
+    for (int l = 0; l < L; l++) {
+        if (cell_type == RNN_CELL_GRU) {
+            fill_gru_layer(&model.gru_layers[l]);
+        } else {
+            fill_lstm_layer(&model.lstm_layers[l]);
+        }
+    }
+    fill_pattern(model.output_layer.weights.weights, H * O, 20);
+    fill_pattern(model.output_layer.weights.bias, O, 21);
+
+    SlidingWindow exact;
+    SlidingWindow stateful;
+    assert(init_sliding_window(&exact, &model, W, WINDOW_EXACT) == MATH_SUCCESS);
+    assert(init_sliding_window(&stateful, &model, W, WINDOW_STATEFUL) == MATH_SUCCESS);
+    float* stream_state = (float*)calloc(rnn_model_state_size(&config), sizeof(float));
+    float x[IN];
+    float out[O];
+    float ref[O];
+    float stream_out[O];
+    for (int t = 0; t < T; t++) {
+        fill_pattern(x, IN, 3 * t);
+        bool full = sliding_window_push(&exact, x, out);
+        assert(full == (t >= W - 1));
+        if (full) {
+            // every window matches a from-scratch run over its inputs
+            assert(sliding_window_recompute(&exact, ref) == MATH_SUCCESS);
+            assert_close(out, ref, O, 1e-5f);
+        } else {
+            assert(sliding_window_recompute(&exact, ref) == MATH_INVALID_RANGE);
+        }
+
+        // the stateful mode is the continuous stream, equal to the first window only
+        rnn_model_step(&model, x, stream_state, stream_out);
+        if (sliding_window_push(&stateful, x, out)) {
+            assert_close(out, stream_out, O, 1e-5f);
+            if (t == W - 1) {
+                assert_close(out, ref, O, 1e-5f);
+            }
+        }
+    }
+    free(stream_state);
+    free_sliding_window(&exact);
+    free_sliding_window(&stateful);
+    free_rnn_model(&model, true);
+}
+
+void test_sliding_window() {
+    test_sliding_window_cell(RNN_CELL_GRU);
+    test_sliding_window_cell(RNN_CELL_LSTM);
+    printf("sliding_window matches recomputing every window\n");
+}
+
+void test_delta_forward() {
+    enum { T = 30, IN = 6, H = 16 };
+    GRULayer gru;
+    GRULayer gru_delta;
+    LSTMLayer lstm;
+    LSTMLayer lstm_delta;
+    init_gru_layer(&gru, 1, IN, H);
+    init_gru_layer(&gru_delta, 1, IN, H);
+    init_lstm_layer(&lstm, 1, IN, H);
+    init_lstm_layer(&lstm_delta, 1, IN, H);
+    fill_gru_layer(&gru);
+    fill_gru_layer(&gru_delta);
+    fill_lstm_layer(&lstm);
+    fill_lstm_layer(&lstm_delta);
+
+    float thresholds[2] = {0.0f, 0.02f};
+    for (int k = 0; k < 2; k++) {
+        assert(enable_gru_layer_delta(&gru_delta, thresholds[k]) == MATH_SUCCESS);
+        assert(enable_lstm_layer_delta(&lstm_delta, thresholds[k]) == MATH_SUCCESS);
+        float h[H] = {0};
+        float hd[H] = {0};
+        float c[H] = {0};
+        float cd[H] = {0};
+        float lh[H] = {0};
+        float lhd[H] = {0};
+        float x[IN];
+        float drift = 0.0f;
+        for (int t = 0; t < T; t++) {
+            // slowly varying input with one channel held constant
+            for (int i = 0; i < IN; i++) {
+                x[i] = (i == 0) ? 0.5f : sinf(0.05f * t + i);
+            }
+            gru_layer_forward_inplace(&gru, x, h);
+            gru_layer_forward_inplace(&gru_delta, x, hd);
+            lstm_layer_forward_inplace(&lstm, x, lh, c);
+            lstm_layer_forward_inplace(&lstm_delta, x, lhd, cd);
+            for (int i = 0; i < H; i++) {
+                drift = fmaxf(drift, fabsf(h[i] - hd[i]));
+                drift = fmaxf(drift, fabsf(lh[i] - lhd[i]));
+            }
+        }
+        if (thresholds[k] == 0.0f) {
+            // only the constant channel is skipped after the first step
+            assert(drift < 1e-4f);
+            assert(gru_layer_delta_skip_ratio(&gru_delta) > 0.0f);
+        } else {
+            assert(drift < 0.1f);
+            assert(gru_layer_delta_skip_ratio(&gru_delta) > 0.3f);
+            assert(lstm_layer_delta_skip_ratio(&lstm_delta) > 0.3f);
+        }
+    }
+    disable_gru_layer_delta(&gru_delta);
+    assert(gru_delta.state.delta == NULL);
+
+    free_gru_layer(&gru, true);
+    free_gru_layer(&gru_delta, true);
+    free_lstm_layer(&lstm, true);
+    free_lstm_layer(&lstm_delta, true);
+    printf("delta forward matches the dense step at threshold 0 and skips above it\n");
+}
+
+void test_early_exit() {
+    enum { IN = 5, H = 12, O = 3, L = 3 };
+    RNNModelConfig config = {RNN_CELL_GRU, 1, IN, H, O, L};
+    RNNModel model;
+    init_rnn_model(&model, config);
+    for (int l = 0; l < L; l++) {
+        fill_gru_layer(&model.gru_layers[l]);
+    }
+    fill_pattern(model.output_layer.weights.weights, H * O, 22);
+    int state_size = rnn_model_state_size(&config);
+    float* state = (float*)calloc(state_size, sizeof(float));
+    float* ref = (float*)calloc(state_size, sizeof(float));
+    float x[IN];
+    float out[O];
+    float ref_out[O];
+    fill_pattern(x, IN, 4);
+
+    assert(init_rnn_early_exit(&model, EXIT_MAX_SOFTMAX, 0.9f) == MATH_SUCCESS);
+    assert(add_rnn_exit_head(&model, L - 1) == NULL);
+    LinearLayer* head = add_rnn_exit_head(&model, 0);
+    assert(head != NULL);
+    fill_pattern(head->weights.weights, H * O, 23);
+
+    // an unconfident head runs the full stack, exactly like the plain step
+    RNNEarlyExit* early_exit = model.early_exit;
+    model.early_exit = NULL;
+    rnn_model_step(&model, x, ref, ref_out);
+    model.early_exit = early_exit;
+    assert(rnn_model_step_early_exit(&model, x, state, out) == L - 1);
+    assert_close(out, ref_out, O, 1e-6f);
+    assert_close(state, ref, state_size, 1e-6f);
+
+    // a confident head stops after layer 0 and the upper layers hold their state
+    head->weights.bias[1] = 10.0f;
+    memcpy(ref, state, state_size * sizeof(float));
+    assert(rnn_model_step_early_exit(&model, x, state, out) == 0);
+    assert(out[1] > out[0] && out[1] > out[2]);
+    assert_close(state + H, ref + H, (L - 1) * H, 1e-12f);
+    rnn_model_step(&model, x, state, NULL);
+    assert(model.early_exit->exits[0] == 2 && model.early_exit->exits[L - 1] == 1);
+
+    // the margin test needs the top two probabilities far enough apart
+    model.early_exit->criterion = EXIT_MARGIN;
+    model.early_exit->threshold = 1.0f;
+    assert(rnn_model_step_early_exit(&model, x, state, out) == L - 1);
+    print_rnn_exit_stats(&model);
+
+    free(state);
+    free(ref);
+    free_rnn_model(&model, true);
+    printf("early exit stops at confident heads and holds the skipped layers\n");
+}
+
+typedef struct {
+    InferQueue* queue;
+    uint64_t first_stream;
+    float* outputs;      // [2 streams][steps][output_size]
+} ProducerArgs;
+
+enum { QUEUE_IN = 5, QUEUE_H = 12, QUEUE_O = 3, QUEUE_STEPS = 25, QUEUE_PRODUCERS = 4 };
+
+static void* queue_producer(void* arg) {
+    ProducerArgs* args = (ProducerArgs*)arg;
+    float x[2][QUEUE_IN];
+    InferRequest requests[2];
+    for (int t = 0; t < QUEUE_STEPS; t++) {
+        // two streams in flight at once, each waiting for its previous step
+        for (int s = 0; s < 2; s++) {
+            uint64_t stream_id = args->first_stream + s;
+            fill_pattern(x[s], QUEUE_IN, (int)stream_id * 7 + t);
+            memset(&requests[s], 0, sizeof(InferRequest));
+            requests[s].stream_id = stream_id;
+            requests[s].input = x[s];
+            requests[s].output = args->outputs + (s * QUEUE_STEPS + t) * QUEUE_O;
+            infer_submit(args->queue, &requests[s]);
+        }
+        for (int s = 0; s < 2; s++) {
+            assert(infer_wait(args->queue, &requests[s]) == MATH_SUCCESS);
+        }
+    }
+    return NULL;
+}
+
+static void count_completion(InferRequest* request, void* ctx) {
+    (void)request;
+    (*(int*)ctx)++;
+}
+
+void test_infer_queue() {
+    RNNModelConfig config = {RNN_CELL_LSTM, 1, QUEUE_IN, QUEUE_H, QUEUE_O, 2};
+    RNNModel model;
+    init_rnn_model(&model, config);
+    for (int l = 0; l < config.num_layers; l++) {
+        fill_lstm_layer(&model.lstm_layers[l]);
+    }
+    fill_pattern(model.output_layer.weights.weights, QUEUE_H * QUEUE_O, 24);
+    SessionManager sessions;
+    init_session_manager(&sessions, &model, 1 << 16);
+    for (uint64_t id = 0; id < 2 * QUEUE_PRODUCERS; id++) {
+        session_create(&sessions, id);
+    }
+
+    InferQueue queue;
+    assert(start_infer_queue(&queue, &sessions, 8, 500) == MATH_SUCCESS);
+    pthread_t threads[QUEUE_PRODUCERS];
+    ProducerArgs args[QUEUE_PRODUCERS];
+    for (int p = 0; p < QUEUE_PRODUCERS; p++) {
+        args[p].queue = &queue;
+        args[p].first_stream = 2 * p;
+        args[p].outputs = (float*)malloc(2 * QUEUE_STEPS * QUEUE_O * sizeof(float));
+        pthread_create(&threads[p], NULL, queue_producer, &args[p]);
+    }
+    for (int p = 0; p < QUEUE_PRODUCERS; p++) {
+        pthread_join(threads[p], NULL);
+    }
+
+    // back-to-back steps of one stream are split over batches in order
+    float x[3][QUEUE_IN];
+    float out[3][QUEUE_O];
+    InferRequest requests[4];
+    int completed = 0;
+    memset(requests, 0, sizeof(requests));
+    for (int k = 0; k < 3; k++) {
+        fill_pattern(x[k], QUEUE_IN, 100 + k);
+        requests[k].stream_id = 0;
+        requests[k].input = x[k];
+        requests[k].output = out[k];
+        requests[k].callback = count_completion;
+        requests[k].ctx = &completed;
+        infer_submit(&queue, &requests[k]);
+    }
+    requests[3].stream_id = 999;
+    requests[3].input = x[0];
+    infer_submit(&queue, &requests[3]);
+    for (int k = 0; k < 3; k++) {
+        assert(infer_wait(&queue, &requests[k]) == MATH_SUCCESS);
+    }
+    assert(infer_wait(&queue, &requests[3]) == MATH_INVALID_RANGE);
+    assert(completed == 3);
+    stop_infer_queue(&queue);
+    assert(queue.requests == 2 * QUEUE_PRODUCERS * QUEUE_STEPS + 3);
+    assert(queue.batches < queue.requests);
+
+    // every stream matches its own sequential run
+    float* state = (float*)malloc(rnn_model_state_size(&config) * sizeof(float));
+    float ref[QUEUE_O];
+    float xs[QUEUE_IN];
+    for (int p = 0; p < QUEUE_PRODUCERS; p++) {
+        for (int s = 0; s < 2; s++) {
+            uint64_t stream_id = args[p].first_stream + s;
+            memset(state, 0, rnn_model_state_size(&config) * sizeof(float));
+            for (int t = 0; t < QUEUE_STEPS; t++) {
+                fill_pattern(xs, QUEUE_IN, (int)stream_id * 7 + t);
+                rnn_model_step(&model, xs, state, ref);
+                assert_close(args[p].outputs + (s * QUEUE_STEPS + t) * QUEUE_O, ref, QUEUE_O, 1e-4f);
+            }
+            if (stream_id == 0) {
+                for (int k = 0; k < 3; k++) {
+                    rnn_model_step(&model, x[k], state, ref);
+                    assert_close(out[k], ref, QUEUE_O, 1e-4f);
+                }
+            }
+        }
+        free(args[p].outputs);
+    }
+    printf("infer_queue ran %ld requests in %ld batches\n", queue.requests, queue.batches);
+    free(state);
+    free_session_manager(&sessions);
+    free_rnn_model(&model, true);
+    printf("infer_queue batches concurrent streams and matches sequential steps\n");
+}
+
+enum { RING_IN = 6, RING_FRAMES = 2000 };
+
+static void* ring_producer(void* arg) {
+    FrameRing* ring = (FrameRing*)arg;
+    for (int t = 0; t < RING_FRAMES; t++) {
+        float* slot;
+        while ((slot = frame_ring_acquire_write(ring)) == NULL) {
+            sched_yield();
+        }
+        fill_pattern(slot, RING_IN, t); // the sensor writes into the slot in place
+        frame_ring_publish(ring);
+    }
+    return NULL;
+}
+
+void test_frame_ring() {
+    FrameRing ring;
+    assert(init_frame_ring(&ring, RING_IN, 5) == MATH_SUCCESS);
+    assert(ring.capacity == 8 && ring.stride == 16);
+    assert(((uintptr_t)ring.frames & (FRAME_RING_LINE - 1)) == 0);
+    assert(frame_ring_acquire_read(&ring) == NULL);
+    for (size_t k = 0; k < ring.capacity; k++) {
+        assert(frame_ring_acquire_write(&ring) != NULL);
+        frame_ring_publish(&ring);
+    }
+    assert(frame_ring_acquire_write(&ring) == NULL);
+    float* first = frame_ring_acquire_read(&ring);
+    assert(first == ring.frames);
+    frame_ring_release(&ring);
+    assert(frame_ring_acquire_write(&ring) == first); // the released slot is reused
+    frame_ring_publish(&ring);
+    for (size_t k = 0; k < ring.capacity; k++) {
+        assert(frame_ring_acquire_read(&ring) != NULL);
+        frame_ring_release(&ring);
+    }
+    assert(frame_ring_acquire_read(&ring) == NULL);
+    free_frame_ring(&ring);
+
+    // a producer thread feeds the model through the ring, steps read the slots directly
+    RNNModelConfig config = {RNN_CELL_GRU, 1, RING_IN, 10, 2, 2};
+    RNNModel model;
+    init_rnn_model(&model, config);
+    for (int l = 0; l < config.num_layers; l++) {
+        fill_gru_layer(&model.gru_layers[l]);
+    }
+    fill_pattern(model.output_layer.weights.weights, 10 * 2, 31);
+    size_t state_size = rnn_model_state_size(&config);
+    float* state = (float*)calloc(state_size, sizeof(float));
+    float* ref = (float*)calloc(state_size, sizeof(float));
+    float out[2];
+    float ref_out[2];
+    float x[RING_IN];
+
+    assert(init_frame_ring(&ring, RING_IN, 16) == MATH_SUCCESS);
+    pthread_t producer;
+    pthread_create(&producer, NULL, ring_producer, &ring);
+    for (int t = 0; t < RING_FRAMES; t++) {
+        float* frame;
+        while ((frame = frame_ring_acquire_read(&ring)) == NULL) {
+            sched_yield();
+        }
+        rnn_model_step(&model, frame, state, out);
+        frame_ring_release(&ring);
+        fill_pattern(x, RING_IN, t);
+        rnn_model_step(&model, x, ref, ref_out);
+        assert_close(out, ref_out, 2, 1e-6f);
+    }
+    pthread_join(producer, NULL);
+    assert(frame_ring_acquire_read(&ring) == NULL);
+    assert_close(state, ref, state_size, 1e-6f);
+
+    free_frame_ring(&ring);
+    free(state);
+    free(ref);
+    free_rnn_model(&model, true);
+    printf("frame_ring hands frames across threads in order without copies\n");
+}
+
+void test_checkpoint_load() {
+    // a packed model saved once and reopened under every load mode steps the same
+    RNNModelConfig config = {RNN_CELL_GRU, 1, 7, 20, 3, 2};
+    RNNModel model;
+    init_rnn_model(&model, config);
+    for (int l = 0; l < config.num_layers; l++) {
+        fill_gru_layer(&model.gru_layers[l]);
+    }
+    fill_pattern(model.output_layer.weights.weights, 20 * 3, 41);
+    size_t state_size = rnn_model_state_size(&config);
+    float* state = (float*)calloc(state_size, sizeof(float));
+    float x[7];
+    float ref[3];
+    float out[3];
+    fill_pattern(x, 7, 5);
+    rnn_model_step(&model, x, state, ref);
+
+    char* path = "/tmp/test_rnn_checkpoint.packed.bin";
+    char* source = "/tmp/test_rnn_checkpoint.bin";
+    FILE* file = fopen(source, "wb");
+    assert(file != NULL);
+    assert(fwrite(x, sizeof(float), 7, file) == 7);
+    fclose(file);
+    PackArena arena;
+    assert(init_pack_arena(&arena, rnn_model_packed_bytes(&model)) == MATH_SUCCESS);
+    assert(pack_rnn_model(&model, &arena) == MATH_SUCCESS);
+    assert(save_packed_checkpoint(path, &arena, source) == MATH_SUCCESS);
+
+    unsigned modes[5] = {LOAD_LAZY, LOAD_WILLNEED | LOAD_SEQUENTIAL, LOAD_POPULATE | LOAD_HUGEPAGE,
+                         LOAD_POPULATE | LOAD_MLOCK, LOAD_ANON | LOAD_HUGEPAGE};
+    for (int m = 0; m < 5; m++) {
+        RNNModel loaded;
+        PackArena mapped;
+        init_rnn_model(&loaded, config);
+        assert(open_packed_checkpoint(path, &mapped, arena.used, source, modes[m]) == MATH_SUCCESS);
+        assert(mapped.mapping.size == PACK_ALIGN + arena.used);
+        assert(((uintptr_t)mapped.base & (PACK_ALIGN - 1)) == 0);
+        assert((mapped.mapping.applied & ~modes[m] & ~LOAD_POPULATE) == 0);
+        if (modes[m] & LOAD_ANON) {
+            assert(mapped.mapping.applied & LOAD_ANON);
+        }
+        assert(pack_rnn_model(&loaded, &mapped) == MATH_SUCCESS);
+        memset(state, 0, state_size * sizeof(float));
+        rnn_model_step(&loaded, x, state, out);
+        assert_close(out, ref, 3, 1e-5f);
+        free_rnn_model(&loaded, true);
+        close_packed_checkpoint(&mapped);
+        assert(mapped.mapping.base == NULL);
+    }
+
+    // replacing the float checkpoint makes the packed image stale
+    PackArena stale;
+    file = fopen(source, "ab");
+    assert(file != NULL);
+    assert(fwrite(x, sizeof(float), 1, file) == 1);
+    fclose(file);
+    assert(open_packed_checkpoint(path, &stale, arena.used, source, LOAD_LAZY) == MATH_INVALID_RANGE);
+    remove(source);
+    assert(open_packed_checkpoint(path, &stale, arena.used, source, LOAD_LAZY) == MATH_INVALID_RANGE);
+    assert(open_packed_checkpoint(path, &stale, arena.used, NULL, LOAD_LAZY) == MATH_SUCCESS);
+    close_packed_checkpoint(&stale);
+
+    MappedCheckpoint ckpt;
+    assert(map_checkpoint(&ckpt, "/tmp/test_rnn_no_such_checkpoint.bin", LOAD_POPULATE) == MATH_NULL_POINTER);
+    remove(path);
+    free_rnn_model(&model, true);
+    free_pack_arena(&arena);
+    free(state);
+    printf("checkpoint_load maps the same weights under every load mode\n");
+}
+
+static void test_layer_stream_cell(RNNCellType cell_type, int depth) {
+    RNNModelConfig config = {cell_type, 1, 9, 16, 3, 4};
+    size_t floats = 0;
+    for (int l = 0; l <= config.num_layers; l++) {
+        floats += rnn_model_layer_floats(&config, l);
+    }
+    float* weights = (float*)malloc(floats * sizeof(float));
+    for (size_t i = 0; i < floats; i++) {
+        weights[i] = 0.3f * sinf(0.37f * (float)i);
+    }
+    char* path = "/tmp/test_rnn_layer_stream.bin";
+    FILE* file = fopen(path, "wb");
+    assert(fwrite(weights, sizeof(float), floats, file) == floats);
+    fclose(file);
+
+    RNNModel resident;
+    RNNModel streamed;
+    init_rnn_model(&resident, config);
+    init_rnn_model(&streamed, config);
+    MappedCheckpoint ckpt;
+    assert(map_checkpoint(&ckpt, path, LOAD_LAZY) == MATH_SUCCESS);
+    assert(attach_rnn_checkpoint(&resident, &ckpt) == MATH_SUCCESS);
+    LayerStream stream;
+    assert(open_layer_stream(&stream, &streamed, path, depth) == MATH_SUCCESS);
+    assert(layer_stream_resident_bytes(&stream) < floats * sizeof(float) || depth >= config.num_layers);
+
+    size_t state_size = rnn_model_state_size(&config);
+    float* state = (float*)calloc(state_size, sizeof(float));
+    float* ref = (float*)calloc(state_size, sizeof(float));
+    float x[9];
+    float out[3];
+    float ref_out[3];
+    for (int t = 0; t < 12; t++) {
+        fill_pattern(x, 9, t);
+        assert(layer_stream_step(&stream, x, state, out) == MATH_SUCCESS);
+        rnn_model_step(&resident, x, ref, ref_out);
+        assert_close(out, ref_out, 3, 1e-6f);
+    }
+    assert_close(state, ref, state_size, 1e-6f);
+    // between steps no layer points into a slot the loader may be refilling
+    for (int l = 0; l < config.num_layers; l++) {
+        assert(cell_type == RNN_CELL_GRU ? streamed.gru_layers[l].weights.W_ir == NULL
+                                         : streamed.lstm_layers[l].weights.W_ii == NULL);
+    }
+    close_layer_stream(&stream);
+    assert(streamed.output_layer.weights.weights == NULL);
+    // with a slot per layer the weights are read once, otherwise every step rereads them
+    // and the loader may already be up to depth layers into the next step
+    if (depth >= config.num_layers) {
+        assert(stream.reads == config.num_layers);
+    } else {
+        assert(stream.reads >= 12 * config.num_layers && stream.reads <= 12 * config.num_layers + depth);
+    }
+
+    remove(path);
+    free(state);
+    free(ref);
+    free(weights);
+    free_rnn_model(&resident, false);
+    unmap_checkpoint(&ckpt);
+    free_rnn_model(&streamed, true);
+}
+
+void test_layer_stream() {
+    test_layer_stream_cell(RNN_CELL_GRU, 2);
+    test_layer_stream_cell(RNN_CELL_LSTM, 1);
+    test_layer_stream_cell(RNN_CELL_GRU, 8);
+    printf("layer_stream matches the resident model with a bounded window of layers\n");
+}
+
+static void write_test_checkpoint(char* path, RNNModelConfig* config, float phase) {
+    size_t floats = 0;
+    for (int l = 0; l <= config->num_layers; l++) {
+        floats += rnn_model_layer_floats(config, l);
+    }
+    FILE* file = fopen(path, "wb");
+    for (size_t i = 0; i < floats; i++) {
+        float w = 0.3f * sinf(0.37f * (float)i + phase);
+        fwrite(&w, sizeof(float), 1, file);
+    }
+    fclose(file);
+}
+
+typedef struct {
+    ModelRegistry* registry;
+    RegistryEntry* entry;
+    float* refs;           // expected output of odd and even versions, [2 x 2], NULL to only pin
+    int steps;
+} RegistryReader;
+
+static void* registry_reader(void* arg) {
+    RegistryReader* reader = (RegistryReader*)arg;
+    float x[5];
+    float out[2];
+    fill_pattern(x, 5, 3);
+    int last = 0;
+    for (int t = 0; t < reader->steps; t++) {
+        ModelVersion* version = model_registry_acquire(reader->registry, reader->entry);
+        // every step runs wholly on one version, and versions only move forward
+        assert(version->version >= last);
+        last = version->version;
+        if (reader->refs != NULL) {
+            float state[12] = {0};
+            rnn_model_step(&version->model, x, state, out);
+            assert_close(out, reader->refs + ((version->version - 1) % 2) * 2, 2, 1e-6f);
+        } else {
+            // a version's run state is not shared across threads, only touch its weights
+            volatile float weight = version->model.gru_layers[0].weights.W_ir[0];
+            (void)weight;
+        }
+        model_registry_release(reader->registry, version);
+    }
+    return NULL;
+}
+
+void test_model_registry() {
+    RNNModelConfig config = {RNN_CELL_GRU, 1, 5, 6, 2, 2};
+    char* paths[2] = {"/tmp/test_rnn_registry_v1.bin", "/tmp/test_rnn_registry_v2.bin"};
+    write_test_checkpoint(paths[0], &config, 0.0f);
+    write_test_checkpoint(paths[1], &config, 1.0f);
+
+    ModelRegistry registry;
+    assert(init_model_registry(&registry, 4) == MATH_SUCCESS);
+    assert(model_registry_load(&registry, "a", paths[0], config, LOAD_POPULATE) == MATH_SUCCESS);
+    assert(model_registry_load(&registry, "b", paths[0], config, LOAD_LAZY) == MATH_SUCCESS);
+    RegistryEntry* a = model_registry_find(&registry, "a");
+    RegistryEntry* b = model_registry_find(&registry, "b");
+    assert(a != NULL && b != NULL && model_registry_find(&registry, "c") == NULL);
+    // two models on one file share the mapping
+    ModelVersion* va = model_registry_acquire(&registry, a);
+    ModelVersion* vb = model_registry_acquire(&registry, b);
+    assert(va->mapping == vb->mapping && va->mapping->users == 2);
+    assert(va->model.gru_layers[1].weights.W_hn == vb->model.gru_layers[1].weights.W_hn);
+    model_registry_release(&registry, vb);
+
+    // reference outputs of both versions
+    float refs[2 * 2];
+    float x[5];
+    fill_pattern(x, 5, 3);
+    float state[12] = {0};
+    rnn_model_step(&va->model, x, state, refs);
+    assert(model_registry_load(&registry, "a", paths[1], config, LOAD_LAZY) == MATH_SUCCESS);
+    ModelVersion* v2 = model_registry_acquire(&registry, a);
+    assert(v2->version == 2 && v2->mapping != va->mapping);
+    memset(state, 0, sizeof(state));
+    rnn_model_step(&v2->model, x, state, refs + 2);
+    assert(fabsf(refs[0] - refs[2]) > 1e-4f);
+    // the pinned old version still steps on its own weights
+    float out[2];
+    memset(state, 0, sizeof(state));
+    rnn_model_step(&va->model, x, state, out);
+    assert_close(out, refs, 2, 1e-6f);
+    model_registry_release(&registry, va); // last user of version 1 of a, b keeps the mapping
+    assert(registry.mappings != NULL && registry.mappings->next != NULL);
+    model_registry_release(&registry, v2);
+
+    // a file rewritten in place within the same second is mapped again, not shared
+    struct stat before;
+    assert(stat(paths[0], &before) == 0);
+    write_test_checkpoint(paths[0], &config, 2.0f);
+    struct timespec times[2] = {before.st_atim, before.st_mtim};
+    times[1].tv_nsec = (times[1].tv_nsec + 1) % 1000000000L;
+    assert(utimensat(AT_FDCWD, paths[0], times, 0) == 0);
+    vb = model_registry_acquire(&registry, b);
+    SharedMapping* stale = vb->mapping;
+    model_registry_release(&registry, vb);
+    assert(model_registry_load(&registry, "b", paths[0], config, LOAD_LAZY) == MATH_SUCCESS);
+    vb = model_registry_acquire(&registry, b);
+    assert(vb->mapping != stale && vb->version == 2);
+    model_registry_release(&registry, vb);
+    write_test_checkpoint(paths[0], &config, 0.0f); // the readers below expect the first weights
+
+    // reloads racing a serving thread
+    RegistryReader reader = {&registry, a, refs, 3000};
+    pthread_t thread;
+    pthread_create(&thread, NULL, registry_reader, &reader);
+    for (int k = 0; k < 20; k++) {
+        // alternate the files, odd versions run the first one
+        assert(model_registry_load(&registry, "a", paths[k % 2], config, LOAD_LAZY) == MATH_SUCCESS);
+        sched_yield();
+    }
+    pthread_join(thread, NULL);
+    assert(registry.reloads == 22);
+
+    // back-to-back reloads while two readers spin, each reload drains the readers
+    // of both epoch slots before the version it retired can be freed. Steps on a
+    // version are serialized by the caller, so only one reader steps.
+    RegistryReader readers[2] = {{&registry, a, refs, 2000}, {&registry, a, NULL, 20000}};
+    pthread_t threads[2];
+    for (int r = 0; r < 2; r++) {
+        pthread_create(&threads[r], NULL, registry_reader, &readers[r]);
+    }
+    for (int k = 0; k < 40; k++) {
+        assert(model_registry_load(&registry, "a", paths[k % 2], config, LOAD_LAZY) == MATH_SUCCESS);
+    }
+    for (int r = 0; r < 2; r++) {
+        pthread_join(threads[r], NULL);
+    }
+    assert(registry.reloads == 62);
+
+    free_model_registry(&registry);
+    remove(paths[0]);
+    remove(paths[1]);
+    printf("model_registry shares mappings and hot swaps versions under load\n");
+}
+
+void test_shm_ring() {
+    RNNModelConfig config = {RNN_CELL_LSTM, 1, 6, 8, 3, 2};
+    RNNModel model;
+    init_rnn_model(&model, config);
+    for (int l = 0; l < config.num_layers; l++) {
+        fill_lstm_layer(&model.lstm_layers[l]);
+    }
+    fill_pattern(model.output_layer.weights.weights, 8 * 3, 52);
+
+    // a forked worker owns the ring and passes it over a socket, as server.c does
+    int socks[2];
+    assert(socketpair(AF_UNIX, SOCK_STREAM, 0, socks) == 0);
+    pid_t worker = fork();
+    if (worker == 0) {
+        close(socks[0]);
+        ShmRing ring;
+        SessionManager sessions;
+        init_session_manager(&sessions, &model, 1 << 16);
+        if (create_shm_ring(&ring, 3, 6, 3) != MATH_SUCCESS || send_shm_ring(socks[1], &ring) != MATH_SUCCESS) {
+            _exit(1);
+        }
+        bool open = true;
+        while (open) {
+            ShmSlot* slot = shm_ring_next(&ring, 1000);
+            if (slot == NULL) {
+                _exit(1);
+            }
+            if (slot->op == SHM_OP_CLOSE) {
+                slot->status = session_close(&sessions, slot->stream_id);
+                open = (slot->stream_id != 0);
+            } else {
+                if (session_state(&sessions, slot->stream_id) == NULL) {
+                    session_create(&sessions, slot->stream_id);
+                }
+                slot->status = session_step(&sessions, slot->stream_id, shm_slot_input(slot), shm_slot_output(&ring, slot));
+            }
+            shm_ring_done(&ring);
+        }
+        _exit(0);
+    }
+    close(socks[1]);
+    ShmRing ring;
+    assert(receive_shm_ring(socks[0], &ring) == MATH_SUCCESS);
+    assert(ring.capacity == 4 && ring.input_size == 6 && ring.output_size == 3);
+
+    size_t state_size = rnn_model_state_size(&config);
+    float* ref = (float*)calloc(2 * state_size, sizeof(float));
+    float ref_out[3];
+    int sent = 0;
+    int done = 0;
+    enum { N = 40 };
+    while (done < N) {
+        // pipelined: fill every free slot before waiting for the oldest one
+        ShmSlot* slot;
+        while (sent < N && (slot = shm_ring_acquire(&ring)) != NULL) {
+            slot->stream_id = 1 + sent % 2;
+            slot->op = SHM_OP_STEP;
+            fill_pattern(shm_slot_input(slot), 6, sent);
+            shm_ring_submit(&ring);
+            sent++;
+        }
+        assert(sent - done == 4 || sent == N);
+        slot = shm_ring_complete(&ring);
+        assert(slot->status == MATH_SUCCESS && slot->stream_id == (uint64_t)(1 + done % 2));
+        float x[6];
+        fill_pattern(x, 6, done);
+        rnn_model_step(&model, x, ref + (done % 2) * state_size, ref_out);
+        assert_close(shm_slot_output(&ring, slot), ref_out, 3, 1e-6f);
+        shm_ring_release(&ring);
+        done++;
+    }
+    assert(shm_ring_complete(&ring) == NULL);
+    ShmSlot* slot = shm_ring_acquire(&ring);
+    slot->stream_id = 0;
+    slot->op = SHM_OP_CLOSE;
+    shm_ring_submit(&ring);
+    assert(shm_ring_complete(&ring)->status == MATH_INVALID_RANGE); // stream 0 never existed
+    shm_ring_release(&ring);
+    int status;
+    assert(waitpid(worker, &status, 0) == worker && WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+    close_shm_ring(&ring);
+    close(socks[0]);
+
+    // a header rewritten by the other side moves no slot outside the mapping,
+    // and a ring with a forged geometry is refused on attach
+    ShmRing owner;
+    assert(create_shm_ring(&owner, 4, 6, 3) == MATH_SUCCESS);
+    owner.header->capacity = 1u << 30;
+    owner.header->slot_bytes = (uint64_t)1 << 40;
+    owner.header->input_size = 1u << 30;
+    for (int k = 0; k < 8; k++) {
+        shm_ring_submit(&owner);
+        uint8_t* at = (uint8_t*)shm_ring_next(&owner, 0);
+        assert(at >= owner.slots && shm_slot_output(&owner, (ShmSlot*)at) + 3 <= (float*)(owner.base + owner.size));
+        shm_ring_done(&owner);
+    }
+    ShmRing forged;
+    assert(attach_shm_ring(&forged, dup(owner.fd)) == MATH_INVALID_RANGE);
+    close_shm_ring(&owner);
+
+    free(ref);
+    free_rnn_model(&model, true);
+    printf("shm_ring steps a forked worker's streams from shared slots\n");
+}
+
+static void test_bulk_score_cell(RNNCellType cell_type) {
+    enum { F = 4, H = 10, O = 3, STREAMS = 5 };
+    RNNModelConfig config = {cell_type, 1, F, H, O, 2};
+    RNNModel model;
+    init_rnn_model(&model, config);
+    for (int l = 0; l < config.num_layers; l++) {
+        if (cell_type == RNN_CELL_GRU) {
+            fill_gru_layer(&model.gru_layers[l]);
+        } else {
+            fill_lstm_layer(&model.lstm_layers[l]);
+        }
+    }
+    fill_pattern(model.output_layer.weights.weights, H * O, 61);
+
+    // runs of 1 to 29 rows, an id that comes back later starts a fresh sequence
+    int lengths[STREAMS] = {7, 1, 29, 12, 3};
+    uint64_t ids[STREAMS] = {40, 3, 41, 3, 9};
+    int rows = 0;
+    for (int s = 0; s < STREAMS; s++) {
+        rows += lengths[s];
+    }
+    uint64_t* stream_ids = (uint64_t*)malloc(rows * sizeof(uint64_t));
+    float* features = (float*)malloc(rows * F * sizeof(float));
+    char* csv_path = "/tmp/test_rnn_features.csv";
+    FILE* csv = fopen(csv_path, "w");
+    fprintf(csv, "stream,f0,f1,f2,f3\n");
+    for (int s = 0, r = 0; s < STREAMS; s++) {
+        for (int t = 0; t < lengths[s]; t++, r++) {
+            stream_ids[r] = ids[s];
+            fill_pattern(features + r * F, F, r);
+            features[r * F] = (float)r * 1e-3f - 0.25f;
+            fprintf(csv, "%llu", (unsigned long long)ids[s]);
+            for (int f = 0; f < F; f++) {
+                fprintf(csv, ",%.9g", features[r * F + f]);
+            }
+            fprintf(csv, (r % 3 == 0) ? "\r\n" : "\n");
+        }
+    }
+    fclose(csv);
+    char* bin_path = "/tmp/test_rnn_features.bin";
+    assert(write_feature_file(bin_path, stream_ids, features, rows, F) == MATH_SUCCESS);
+
+    // reference: row by row from a zero state per sequence, on scaled features
+    float mean[F] = {0.1f, -0.2f, 0.0f, 0.3f};
+    float std[F] = {1.5f, 0.5f, 2.0f, 1.0f};
+    float* ref = (float*)malloc(rows * O * sizeof(float));
+    float* state = (float*)malloc(rnn_model_state_size(&config) * sizeof(float));
+    float x[F];
+    for (int r = 0; r < rows; r++) {
+        if (r == 0 || stream_ids[r] != stream_ids[r - 1]) {
+            memset(state, 0, rnn_model_state_size(&config) * sizeof(float));
+        }
+        standard_scaler(x, features + r * F, F, mean, std);
+        rnn_model_step(&model, x, state, ref + r * O);
+    }
+
+    char* paths[2] = {bin_path, csv_path};
+    char* out_path = "/tmp/test_rnn_scores.bin";
+    for (int p = 0; p < 2; p++) {
+        FeatureTable table;
+        assert(open_feature_file(&table, paths[p], F, 3) == MATH_SUCCESS);
+        assert(table.num_rows == (uint64_t)rows);
+        BulkScoreOptions options = {3, 5, mean, std}; // chunks shorter than most streams
+        BulkScoreStats stats;
+        assert(bulk_score(&model, &table, out_path, &options, &stats) == MATH_SUCCESS);
+        assert(stats.rows == (uint64_t)rows && stats.sequences == STREAMS);
+        close_feature_file(&table);
+
+        MappedCheckpoint scores;
+        assert(map_checkpoint(&scores, out_path, LOAD_LAZY) == MATH_SUCCESS);
+        FeatureFileHeader* header = (FeatureFileHeader*)scores.base;
+        assert(header->magic == SCORE_MAGIC && header->num_features == O && header->num_rows == (uint64_t)rows);
+        assert_close((float*)(scores.base + FEATURE_ALIGN), ref, rows * O, 1e-4f);
+        unmap_checkpoint(&scores);
+    }
+
+    FeatureTable table;
+    assert(open_feature_file(&table, bin_path, F + 1, 1) == MATH_INVALID_DIM);
+    // a row count whose byte size wraps around to a small number is refused
+    FILE* forged = fopen(bin_path, "r+b");
+    uint64_t huge_rows = (uint64_t)1 << 62;
+    assert(fseek(forged, offsetof(FeatureFileHeader, num_rows), SEEK_SET) == 0);
+    assert(fwrite(&huge_rows, sizeof(huge_rows), 1, forged) == 1);
+    fclose(forged);
+    assert(open_feature_file(&table, bin_path, F, 1) == MATH_INVALID_DIM);
+    remove(bin_path);
+    remove(csv_path);
+    remove(out_path);
+    free(stream_ids);
+    free(features);
+    free(ref);
+    free(state);
+    free_rnn_model(&model, true);
+}
+
+void test_bulk_score() {
+    test_bulk_score_cell(RNN_CELL_GRU);
+    test_bulk_score_cell(RNN_CELL_LSTM);
+    printf("bulk_score matches per-row steps from binary and CSV features\n");
+}
+
+// A recurrent stack and its output layer as a graph, against RNNModel on the same checkpoint
+static void test_layer_graph_stack(RNNCellType cell_type) {
+    enum { IN = 6, H = 16, L = 3, O = 4, T = 5 };
+    RNNModelConfig config = {cell_type, 1, IN, H, O, L};
+    RNNModel model;
+    init_rnn_model(&model, config);
+    GraphLayerType cell = (cell_type == RNN_CELL_GRU) ? GRAPH_GRU : GRAPH_LSTM;
+    GraphLayerSpec specs[L + 1] = {{cell, H, 0}, {cell, H, 0}, {cell, H, 0}, {GRAPH_LINEAR, O, 0}};
+    LayerGraph graph;
+    assert(init_layer_graph(&graph, IN, specs, L + 1) == MATH_SUCCESS);
+    assert(graph.output_size == O);
+    assert(graph.state_size == rnn_model_state_size(&config));
+
+    size_t floats = layer_graph_checkpoint_floats(&graph);
+    float* data = (float*)malloc(floats * sizeof(float));
+    fill_pattern(data, (int)floats, 3);
+    MappedCheckpoint ckpt = {0};
+    ckpt.base = (uint8_t*)data;
+    ckpt.size = floats * sizeof(float) - 1;
+    assert(attach_layer_graph_checkpoint(&graph, &ckpt) == MATH_INVALID_DIM);
+    ckpt.size = floats * sizeof(float);
+    assert(attach_rnn_checkpoint(&model, &ckpt) == MATH_SUCCESS);
+    assert(attach_layer_graph_checkpoint(&graph, &ckpt) == MATH_SUCCESS);
+
+    float* state = (float*)calloc(graph.state_size, sizeof(float));
+    float* ref_state = (float*)calloc(graph.state_size, sizeof(float));
+    float input[IN];
+    float output[O];
+    float ref[O];
+    for (int t = 0; t < T; t++) {
+        fill_pattern(input, IN, t);
+        // a step without output still advances every layer
+        layer_graph_step(&graph, input, state, (t == 1) ? NULL : output);
+        rnn_model_step(&model, input, ref_state, ref);
+        assert_close(state, ref_state, graph.state_size, 1e-6f);
+        if (t != 1) {
+            assert_close(output, ref, O, 1e-5f);
+        }
+    }
+    assert(layer_graph_hidden_state(&graph, state, 2) == rnn_model_hidden_state(&model, state, 2));
+    assert(layer_graph_hidden_state(&graph, state, L) == NULL);
+    free(state);
+    free(ref_state);
+    free_layer_graph(&graph, false);
+    free_rnn_model(&model, false);
+    free(data);
+}
+
+// Mixed graph: scaler, LSTM, RMSNorm, linear, softmax, against the layers run by hand
+static void test_layer_graph_mixed(void) {
+    enum { IN = 5, H = 12, O = 6, T = 4 };
+    GraphLayerSpec specs[5] = {{GRAPH_SCALER, 0, 0}, {GRAPH_LSTM, H, 0}, {GRAPH_RMS_NORM, 0, 0}, {GRAPH_LINEAR, O, 0}, {GRAPH_SOFTMAX, 0, 0}};
+    LayerGraph graph;
+    assert(init_layer_graph(&graph, IN, specs, 5) == MATH_SUCCESS);
+    assert(graph.output_size == O);
+    assert(graph.state_size == 2 * H);
+    assert(graph.stateful_ops == 2);
+
+    size_t floats = layer_graph_checkpoint_floats(&graph);
+    assert(floats == 2 * IN + 4 * (IN * H + H * H + 2 * H) + H + H * O + O);
+    float* data = (float*)malloc(floats * sizeof(float));
+    fill_pattern(data, (int)floats, 5);
+    for (int i = 0; i < IN; i++) {
+        data[IN + i] = 0.5f + 0.1f * i; // std
+    }
+    MappedCheckpoint ckpt = {0};
+    ckpt.base = (uint8_t*)data;
+    ckpt.size = floats * sizeof(float);
+    assert(attach_layer_graph_checkpoint(&graph, &ckpt) == MATH_SUCCESS);
+
+    GraphNode* nodes = graph.nodes;
+    float state[2 * H] = {0};
+    float h[H] = {0};
+    float c[H] = {0};
+    float x[IN];
+    float normed[H];
+    float logits[O];
+    float ref[O];
+    float input[IN];
+    float output[O];
+    for (int t = 0; t < T; t++) {
+        fill_pattern(input, IN, 2 * t);
+        layer_graph_step(&graph, input, state, output);
+        standard_scaler(x, input, IN, nodes[0].mean, nodes[0].std);
+        lstm_layer_forward_inplace(&nodes[1].lstm, x, h, c);
+        rms_norm(normed, h, H);
+        mul(normed, normed, nodes[2].gain, H);
+        linear_layer_forward(&nodes[3].linear, normed, logits);
+        softmax(ref, logits, O);
+        assert_close(state, h, H, 1e-6f);
+        assert_close(state + H, c, H, 1e-6f);
+        assert_close(output, ref, O, 1e-6f);
+        float sum = 0.0f;
+        for (int o = 0; o < O; o++) {
+            sum += output[o];
+        }
+        assert(fabsf(sum - 1.0f) < 1e-5f);
+    }
+    free_layer_graph(&graph, false);
+    free(data);
+
+    GraphLayerSpec bad[2] = {{GRAPH_GRU, 8, 0}, {GRAPH_LINEAR, 0, 0}};
+    assert(init_layer_graph(&graph, IN, bad, 2) == MATH_INVALID_DIM);
+}
+
+void test_layer_graph() {
+    test_layer_graph_stack(RNN_CELL_GRU);
+    test_layer_graph_stack(RNN_CELL_LSTM);
+    test_layer_graph_mixed();
+    printf("layer graph matches RNNModel and the layers run by hand\n");
+}
+
+// Both directions against two single-direction sequence runs, the backward one on the reversed inputs
+static void test_bidirectional_cell(RNNCellType cell_type, bool parallel) {
+    enum { T = 7, IN = 5, H = 12 };
+    bool lstm = (cell_type == RNN_CELL_LSTM);
+    BidirectionalLayer layer;
+    assert(init_bidirectional_layer(&layer, cell_type, IN, H, parallel) == MATH_SUCCESS);
+    for (int d = 0; d < 2; d++) {
+        float* W_in;
+        if (lstm) {
+            fill_lstm_layer(&layer.lstm_layers[d]);
+            W_in = layer.lstm_layers[d].weights.W_ii;
+        } else {
+            fill_gru_layer(&layer.gru_layers[d]);
+            W_in = layer.gru_layers[d].weights.W_ir;
+        }
+        fill_pattern(W_in, IN * H, 20 + d); // tell the directions apart
+    }
+    refresh_bidirectional_layer(&layer);
+
+    float inputs[T * IN];
+    float reversed[T * IN];
+    float state[4 * H];
+    float outputs[T * 2 * H];
+    float forward[T * H];
+    float backward[T * H];
+    fill_pattern(inputs, T * IN, 4);
+    fill_pattern(state, 4 * H, 9);
+    for (int t = 0; t < T; t++) {
+        memcpy(reversed + t * IN, inputs + (T - 1 - t) * IN, IN * sizeof(float));
+    }
+    assert(bidirectional_layer_forward_sequence(&layer, inputs, state, outputs, T) == MATH_SUCCESS);
+    if (lstm) {
+        lstm_layer_forward_sequence(&layer.lstm_layers[0], inputs, state, state + 2 * H, forward, T);
+        lstm_layer_forward_sequence(&layer.lstm_layers[1], reversed, state + H, state + 3 * H, backward, T);
+    } else {
+        gru_layer_forward_sequence(&layer.gru_layers[0], inputs, state, forward, T);
+        gru_layer_forward_sequence(&layer.gru_layers[1], reversed, state + H, backward, T);
+    }
+    for (int t = 0; t < T; t++) {
+        assert_close(outputs + t * 2 * H, forward + t * H, H, 1e-5f);
+        assert_close(outputs + t * 2 * H + H, backward + (T - 1 - t) * H, H, 1e-5f);
+    }
+
+    // a NULL state is a zero state
+    float zeros[4 * H] = {0};
+    float from_zero[T * 2 * H];
+    bidirectional_layer_forward_sequence(&layer, inputs, NULL, outputs, T);
+    bidirectional_layer_forward_sequence(&layer, inputs, zeros, from_zero, T);
+    assert_close(outputs, from_zero, T * 2 * H, 1e-7f);
+    free_bidirectional_layer(&layer, true);
+}
+
+void test_bidirectional() {
+    test_bidirectional_cell(RNN_CELL_GRU, false);
+    test_bidirectional_cell(RNN_CELL_GRU, true);
+    test_bidirectional_cell(RNN_CELL_LSTM, false);
+    test_bidirectional_cell(RNN_CELL_LSTM, true);
+    printf("bidirectional layers match a forward and a reversed sequence run\n");
+}
+
+// With proj_size == hidden_size and an identity projection LSTMP is a plain LSTM
+void test_lstmp() {
+    enum { T = 6, IN = 5, H = 10, P = 3 };
+    LSTMLayer lstm;
+    init_lstm_layer(&lstm, 1, IN, H);
+    fill_lstm_layer(&lstm);
+    LSTMPLayer full;
+    init_lstmp_layer(&full, IN, H, H);
+    LSTMLayerWeights* w = &lstm.weights;
+    float* W_i[4] = {w->W_ii, w->W_if, w->W_ig, w->W_io};
+    float* W_h[4] = {w->W_hi, w->W_hf, w->W_hg, w->W_ho};
+    float* b_i[4] = {w->b_ii, w->b_if, w->b_ig, w->b_io};
+    float* b_h[4] = {w->b_hi, w->b_hf, w->b_hg, w->b_ho};
+    for (int g = 0; g < 4; g++) {
+        for (int j = 0; j < H; j++) {
+            for (int k = 0; k < IN; k++) {
+                full.weights.W_x[k * 4 * H + g * H + j] = W_i[g][k * H + j];
+            }
+            for (int k = 0; k < H; k++) {
+                full.weights.W_h[k * 4 * H + g * H + j] = W_h[g][k * H + j];
+            }
+            full.weights.b_x[g * H + j] = b_i[g][j];
+            full.weights.b_h[g * H + j] = b_h[g][j];
+        }
+    }
+    for (int j = 0; j < H; j++) {
+        full.weights.W_p[j * H + j] = 1.0f;
+    }
+
+    float inputs[T * IN];
+    float h[H] = {0};
+    float c[H] = {0};
+    float ref_h[H] = {0};
+    float ref_c[H] = {0};
+    fill_pattern(inputs, T * IN, 3);
+    for (int t = 0; t < T; t++) {
+        lstmp_layer_forward_inplace(&full, inputs + t * IN, h, c);
+        lstm_layer_forward_inplace(&lstm, inputs + t * IN, ref_h, ref_c);
+        assert_close(h, ref_h, H, 1e-5f);
+        assert_close(c, ref_c, H, 1e-5f);
+    }
+    free_lstmp_layer(&full, true);
+    free_lstm_layer(&lstm, true);
+
+    // a real projection: the sequence run matches the step loop, and a graph node the layer
+    GraphLayerSpec specs[2] = {{GRAPH_LSTMP, H, P}, {GRAPH_LINEAR, 2, 0}};
+    LayerGraph graph;
+    assert(init_layer_graph(&graph, IN, specs, 2) == MATH_SUCCESS);
+    assert(graph.state_size == P + H);
+    size_t floats = layer_graph_checkpoint_floats(&graph);
+    assert(floats == (size_t)(IN + P) * 4 * H + 8 * H + H * P + P * 2 + 2);
+    float* data = (float*)malloc(floats * sizeof(float));
+    fill_pattern(data, (int)floats, 8);
+    MappedCheckpoint ckpt = {0};
+    ckpt.base = (uint8_t*)data;
+    ckpt.size = floats * sizeof(float);
+    assert(attach_layer_graph_checkpoint(&graph, &ckpt) == MATH_SUCCESS);
+    LSTMPLayer* layer = &graph.nodes[0].lstmp;
+
+    float h0[P];
+    float c0[H];
+    float outputs[T * P];
+    fill_pattern(h0, P, 1);
+    fill_pattern(c0, H, 2);
+    assert(lstmp_layer_forward_sequence(layer, inputs, h0, c0, outputs, T) == MATH_SUCCESS);
+    float state[P + H];
+    memcpy(state, h0, sizeof(h0));
+    memcpy(state + P, c0, sizeof(c0));
+    float out[2];
+    float ref_out[2];
+    for (int t = 0; t < T; t++) {
+        layer_graph_step(&graph, inputs + t * IN, state, out);
+        assert_close(state, outputs + t * P, P, 1e-5f);
+        linear_layer_forward(&graph.nodes[1].linear, outputs + t * P, ref_out);
+        assert_close(out, ref_out, 2, 1e-5f);
+    }
+    free_layer_graph(&graph, false);
+    free(data);
+    printf("lstmp matches an LSTM at full width and its sequence run in a graph\n");
+}
+
+// Direct causal convolution of a whole sequence, zeros before its start
+static void conv1d_reference(Conv1DLayer* layer, float* inputs, float* outputs, int seq_len) {
+    Conv1DLayerConfig* c = &layer->config;
+    for (int t = 0; t < seq_len; t++) {
+        for (int o = 0; o < c->out_channels; o++) {
+            float sum = layer->weights.bias[o];
+            for (int k = 0; k < c->kernel_size; k++) {
+                int src = t - (c->kernel_size - 1 - k) * c->dilation;
+                for (int i = 0; src >= 0 && i < c->in_channels; i++) {
+                    sum += inputs[src * c->in_channels + i] * layer->weights.weights[(k * c->in_channels + i) * c->out_channels + o];
+                }
+            }
+            outputs[t * c->out_channels + o] = sum;
+        }
+    }
+}
+
+void test_conv1d() {
+    enum { T = 23, IN = 3, OUT = 5, K = 3, D = 4, SPLIT = 9 };
+    Conv1DLayer layer;
+    init_conv1d_layer(&layer, IN, OUT, K, D);
+    fill_pattern(layer.weights.weights, K * IN * OUT, 2);
+    fill_pattern(layer.weights.bias, OUT, 7);
+    assert(conv1d_receptive_field(&layer.config) == 9);
+
+    float inputs[T * IN];
+    float ref[T * OUT];
+    float outputs[T * OUT];
+    fill_pattern(inputs, T * IN, 5);
+    conv1d_reference(&layer, inputs, ref, T);
+
+    // streaming steps, the GEMM over the whole sequence, and a sequence run split in two
+    Conv1DStream stream;
+    assert(init_conv1d_stream(&stream, &layer) == MATH_SUCCESS);
+    for (int t = 0; t < T; t++) {
+        conv1d_layer_step(&layer, &stream, inputs + t * IN, outputs + t * OUT);
+    }
+    assert_close(outputs, ref, T * OUT, 1e-5f);
+    assert(conv1d_layer_forward_sequence(&layer, NULL, inputs, outputs, T) == MATH_SUCCESS);
+    assert_close(outputs, ref, T * OUT, 1e-5f);
+    reset_conv1d_stream(&stream);
+    conv1d_layer_forward_sequence(&layer, &stream, inputs, outputs, SPLIT);
+    conv1d_layer_forward_sequence(&layer, &stream, inputs + SPLIT * IN, outputs + SPLIT * OUT, 2);
+    for (int t = SPLIT + 2; t < T; t++) {
+        conv1d_layer_step(&layer, &stream, inputs + t * IN, outputs + t * OUT);
+    }
+    assert_close(outputs, ref, T * OUT, 1e-5f);
+    free_conv1d_stream(&stream);
+    free_conv1d_layer(&layer, true);
+
+    // TCN blocks with and without a downsampling residual
+    for (int channels = IN; channels <= OUT; channels += OUT - IN) {
+        TCNBlock block;
+        assert(init_tcn_block(&block, IN, channels, K, D) == MATH_SUCCESS);
+        assert((block.downsample != NULL) == (channels != IN));
+        size_t floats = tcn_block_floats(&block);
+        float* data = (float*)malloc(floats * sizeof(float));
+        fill_pattern(data, (int)floats, 3);
+        free_conv1d_layer(&block.conv1, true);
+        free_conv1d_layer(&block.conv2, true);
+        if (block.downsample != NULL) {
+            free_conv1d_layer(block.downsample, true);
+        }
+        assert(memory_map_tcn_block(&block, data) == floats);
+
+        float tcn_ref[T * OUT];
+        float tcn_out[T * OUT];
+        float h1[T * OUT];
+        float h2[T * OUT];
+        conv1d_reference(&block.conv1, inputs, h1, T);
+        for (int i = 0; i < T * channels; i++) {
+            h1[i] = fmaxf(h1[i], 0.0f);
+        }
+        conv1d_reference(&block.conv2, h1, h2, T);
+        if (block.downsample != NULL) {
+            conv1d_reference(block.downsample, inputs, tcn_ref, T);
+        } else {
+            memcpy(tcn_ref, inputs, sizeof(float) * T * IN);
+        }
+        for (int i = 0; i < T * channels; i++) {
+            tcn_ref[i] = fmaxf(fmaxf(h2[i], 0.0f) + tcn_ref[i], 0.0f);
+        }
+
+        TCNBlockStream tcn_stream;
+        assert(init_tcn_block_stream(&tcn_stream, &block) == MATH_SUCCESS);
+        tcn_block_forward_sequence(&block, &tcn_stream, inputs, tcn_out, SPLIT);
+        for (int t = SPLIT; t < T; t++) {
+            tcn_block_step(&block, &tcn_stream, inputs + t * IN, tcn_out + t * channels);
+        }
+        assert_close(tcn_out, tcn_ref, T * channels, 1e-5f);
+        reset_tcn_block_stream(&tcn_stream);
+        tcn_block_forward_sequence(&block, NULL, inputs, tcn_out, T);
+        assert_close(tcn_out, tcn_ref, T * channels, 1e-5f);
+        free_tcn_block_stream(&tcn_stream);
+        free_tcn_block(&block, false);
+        free(data);
+    }
+    printf("conv1d and TCN streaming steps match the sequence GEMM and a direct convolution\n");
+}
+
+// out[cols] = bias + x W, plain loops
+static void naive_project(float* out, float* x, float* W, float* bias, int rows, int cols) {
+    for (int c = 0; c < cols; c++) {
+        out[c] = bias[c];
+        for (int r = 0; r < rows; r++) {
+            out[c] += x[r] * W[r * cols + c];
+        }
+    }
+}
+
+// Every step against attention recomputed from the raw inputs of its window
+static void test_attention_heads(int num_heads) {
+    enum { D = 12, W = 5, T = 11 };
+    AttentionLayer layer;
+    assert(init_attention_layer(&layer, D, num_heads, W) == MATH_SUCCESS);
+    size_t floats = attention_layer_floats(&layer.config);
+    float* data = (float*)malloc(floats * sizeof(float));
+    fill_pattern(data, (int)floats, num_heads);
+    free(layer.weights.W_qkv);
+    free(layer.weights.b_qkv);
+    free(layer.weights.W_o);
+    free(layer.weights.b_o);
+    assert(memory_map_attention_layer(&layer, data) == floats);
+    KVCache cache;
+    assert(init_kv_cache(&cache, &layer) == MATH_SUCCESS);
+
+    int hs = D / num_heads;
+    float inputs[T * D];
+    float qkv[T][3 * D];
+    float output[D];
+    float context[D];
+    float ref[D];
+    fill_pattern(inputs, T * D, 2);
+    for (int t = 0; t < T; t++) {
+        attention_layer_step(&layer, &cache, inputs + t * D, output);
+        naive_project(qkv[t], inputs + t * D, layer.weights.W_qkv, layer.weights.b_qkv, D, 3 * D);
+        int first = (t - W + 1 > 0) ? t - W + 1 : 0;
+        for (int h = 0; h < num_heads; h++) {
+            float p[W];
+            float max_val = -1e30f;
+            for (int j = first; j <= t; j++) {
+                float score = 0.0f;
+                for (int i = 0; i < hs; i++) {
+                    score += qkv[t][h * hs + i] * qkv[j][D + h * hs + i];
+                }
+                p[j - first] = score / sqrtf((float)hs);
+                max_val = fmaxf(max_val, p[j - first]);
+            }
+            float sum = 0.0f;
+            for (int j = first; j <= t; j++) {
+                p[j - first] = expf(p[j - first] - max_val);
+                sum += p[j - first];
+            }
+            for (int i = 0; i < hs; i++) {
+                context[h * hs + i] = 0.0f;
+                for (int j = first; j <= t; j++) {
+                    context[h * hs + i] += p[j - first] / sum * qkv[j][2 * D + h * hs + i];
+                }
+            }
+        }
+        naive_project(ref, context, layer.weights.W_o, layer.weights.b_o, D, D);
+        assert_close(output, ref, D, 1e-5f);
+    }
+
+    // a reset cache starts a new stream
+    reset_kv_cache(&cache);
+    float first[D];
+    attention_layer_step(&layer, &cache, inputs, first);
+    KVCache fresh;
+    init_kv_cache(&fresh, &layer);
+    attention_layer_step(&layer, &fresh, inputs, output);
+    assert_close(first, output, D, 1e-7f);
+    free_kv_cache(&fresh);
+    free_kv_cache(&cache);
+    free_attention_layer(&layer, false);
+    free(data);
+}
+
+void test_attention() {
+    test_attention_heads(1);
+    test_attention_heads(3);
+    AttentionLayer layer;
+    assert(init_attention_layer(&layer, 10, 3, 4) == MATH_INVALID_DIM);
+    printf("attention steps over the KV ring match recomputing the window\n");
+}
+
+// Map the model onto an in-memory checkpoint of pattern weights, free the returned data after the model
+static float* attach_pattern_weights(RNNModel* model, int seed) {
+    size_t floats = 0;
+    for (int l = 0; l <= model->config.num_layers; l++) {
+        floats += rnn_model_layer_floats(&model->config, l);
+    }
+    float* data = (float*)malloc(floats * sizeof(float));
+    fill_pattern(data, (int)floats, seed);
+    MappedCheckpoint ckpt = {0};
+    ckpt.base = (uint8_t*)data;
+    ckpt.size = floats * sizeof(float);
+    assert(attach_rnn_checkpoint(model, &ckpt) == MATH_SUCCESS);
+    return data;
+}
+
+static void test_packed_sequences_cell(RNNCellType cell_type) {
+    enum { IN = 5, H = 12, L = 2, O = 3, N = 5 };
+    int lengths[N] = {3, 7, 1, 7, 5};
+    RNNModelConfig config = {cell_type, 1, IN, H, O, L};
+    RNNModel model;
+    init_rnn_model(&model, config);
+    float* data = attach_pattern_weights(&model, 5);
+
+    PackedSequences packed;
+    int bad[2] = {3, 0};
+    assert(init_packed_sequences(&packed, bad, 2) == MATH_INVALID_DIM);
+    assert(init_packed_sequences(&packed, lengths, N) == MATH_SUCCESS);
+    assert(packed.total == 23 && packed.max_len == 7);
+    // longest first, ties in caller order
+    int order[N] = {1, 3, 4, 0, 2};
+    int batch_sizes[7] = {5, 4, 4, 3, 3, 2, 2};
+    for (int s = 0; s < N; s++) {
+        assert(packed.order[s] == order[s]);
+    }
+    for (int t = 0; t < 7; t++) {
+        assert(packed.batch_sizes[t] == batch_sizes[t]);
+    }
+
+    int state_size = rnn_model_state_size(&config);
+    float* sequences[N];
+    float* states[N];
+    float* ref_states[N];
+    for (int i = 0; i < N; i++) {
+        sequences[i] = (float*)malloc(lengths[i] * IN * sizeof(float));
+        fill_pattern(sequences[i], lengths[i] * IN, 7 * i);
+        states[i] = (float*)malloc(state_size * sizeof(float));
+        ref_states[i] = (float*)malloc(state_size * sizeof(float));
+        fill_pattern(states[i], state_size, i);
+        memcpy(ref_states[i], states[i], state_size * sizeof(float));
+    }
+    float* inputs = (float*)malloc(packed.total * IN * sizeof(float));
+    pack_sequences(&packed, sequences, IN, inputs);
+    float* unpacked[N];
+    for (int i = 0; i < N; i++) {
+        unpacked[i] = (float*)malloc(lengths[i] * IN * sizeof(float));
+    }
+    unpack_sequences(&packed, inputs, IN, unpacked);
+    for (int i = 0; i < N; i++) {
+        assert(memcmp(unpacked[i], sequences[i], lengths[i] * IN * sizeof(float)) == 0);
+        free(unpacked[i]);
+    }
+
+    RNNBatch batch;
+    assert(init_rnn_batch(&batch, &model, N - 1) == MATH_SUCCESS);
+    float outputs[N * O];
+    assert(rnn_batch_forward_packed(&batch, &packed, inputs, states, outputs) == MATH_INVALID_DIM);
+    assert(rnn_batch_step(&batch, N, inputs, states, outputs) == MATH_INVALID_DIM);
+    assert(rnn_batch_step(&batch, 0, inputs, states, outputs) == MATH_INVALID_DIM);
+    free_rnn_batch(&batch);
+    assert(init_rnn_batch(&batch, &model, 8) == MATH_SUCCESS);
+    assert(rnn_batch_forward_packed(&batch, &packed, inputs, states, outputs) == MATH_SUCCESS);
+
+    float ref[O];
+    for (int i = 0; i < N; i++) {
+        for (int t = 0; t < lengths[i]; t++) {
+            rnn_model_step(&model, sequences[i] + t * IN, ref_states[i], ref);
+        }
+        assert_close(states[i], ref_states[i], state_size, 1e-5f);
+        assert_close(outputs + i * O, ref, O, 1e-5f);
+        free(sequences[i]);
+        free(states[i]);
+        free(ref_states[i]);
+    }
+    free(inputs);
+    free_rnn_batch(&batch);
+    free_packed_sequences(&packed);
+    free_rnn_model(&model, false);
+    free(data);
+}
+
+void test_packed_sequences() {
+    test_packed_sequences_cell(RNN_CELL_GRU);
+    test_packed_sequences_cell(RNN_CELL_LSTM);
+}
+
+void test_ensemble() {
+    enum { IN = 5, O = 3, M = 3, T = 6 };
+    RNNModelConfig configs[M] = {{RNN_CELL_GRU, 1, IN, 8, O, 2}, {RNN_CELL_LSTM, 1, IN, 12, O, 1}, {RNN_CELL_GRU, 1, IN, 16, O, 1}};
+    RNNModel models[M];
+    RNNModel* members[M];
+    float* data[M];
+    int state_size = 0;
+    for (int m = 0; m < M; m++) {
+        init_rnn_model(&models[m], configs[m]);
+        data[m] = attach_pattern_weights(&models[m], 3 * m + 1);
+        members[m] = &models[m];
+        state_size += rnn_model_state_size(&configs[m]);
+    }
+    float mean[IN] = {0.1f, -0.2f, 0.0f, 0.3f, 0.05f};
+    float std[IN] = {1.5f, 0.5f, 2.0f, 1.0f, 0.8f};
+    float inputs[T * IN];
+    fill_pattern(inputs, T * IN, 11);
+
+    ModelEnsemble ensemble;
+    RNNModelConfig wrong = {RNN_CELL_GRU, 1, IN + 1, 8, O, 1};
+    RNNModel other;
+    init_rnn_model(&other, wrong);
+    RNNModel* mixed[2] = {&models[0], &other};
+    assert(init_model_ensemble(&ensemble, mixed, 2, ENSEMBLE_MEAN) == MATH_INVALID_DIM);
+    free_rnn_model(&other, true);
+    // the stacked projection only reads float32 first layers
+    init_rnn_model(&other, configs[0]);
+    fill_gru_layer(&other.gru_layers[0]);
+    assert(palettize_gru_layer(&other.gru_layers[0], false, 5) == MATH_SUCCESS);
+    assert(init_model_ensemble(&ensemble, mixed, 2, ENSEMBLE_MEAN) == MATH_INVALID_RANGE);
+    free_rnn_model(&other, true);
+
+    for (int reduce = ENSEMBLE_MEAN; reduce <= ENSEMBLE_VOTE; reduce++) {
+        assert(init_model_ensemble(&ensemble, members, M, (EnsembleReduce)reduce) == MATH_SUCCESS);
+        assert(ensemble.state_size == state_size);
+        ensemble.mean = mean;
+        ensemble.std = std;
+        float* state = (float*)calloc(state_size, sizeof(float));
+        float* seq_state = (float*)calloc(state_size, sizeof(float));
+        float* ref_state = (float*)calloc(state_size, sizeof(float));
+        float outputs[T * O];
+        float output[O];
+        assert(model_ensemble_forward_sequence(&ensemble, inputs, seq_state, outputs, T) == MATH_SUCCESS);
+        for (int t = 0; t < T; t++) {
+            model_ensemble_step(&ensemble, inputs + t * IN, state, output);
+            // reference: every member on its own scaled copy of the input
+            float scaled[IN];
+            float ref[O] = {0};
+            standard_scaler(scaled, inputs + t * IN, IN, mean, std);
+            for (int m = 0; m < M; m++) {
+                float y[O];
+                rnn_model_step(&models[m], scaled, model_ensemble_member_state(&ensemble, ref_state, m), y);
+                int best = 0;
+                for (int k = 0; k < O; k++) {
+                    ref[k] += (reduce == ENSEMBLE_MEAN) ? y[k] / M : 0.0f;
+                    best = (y[k] > y[best]) ? k : best;
+                }
+                ref[best] += (reduce == ENSEMBLE_VOTE) ? 1.0f / M : 0.0f;
+            }
+            assert_close(output, ref, O, 1e-5f);
+            assert_close(outputs + t * O, ref, O, 1e-5f);
+        }
+        assert_close(state, ref_state, state_size, 1e-5f);
+        assert_close(seq_state, ref_state, state_size, 1e-5f);
+        free(state);
+        free(seq_state);
+        free(ref_state);
+        free_model_ensemble(&ensemble);
+    }
+    for (int m = 0; m < M; m++) {
+        free_rnn_model(&models[m], false);
+        free(data[m]);
+    }
+}
+
+void test_tune() {
+    enum { IN = 6, H = 16, O = 3 };
+    char* path = "/tmp/test_rnn_tune_cache.txt";
+    remove(path);
+    RNNModelConfig config = {RNN_CELL_GRU, 1, IN, H, O, 2};
+    RNNModel model;
+    init_rnn_model(&model, config);
+    float* data = attach_pattern_weights(&model, 9);
+    int mc, kc;
+    gemm_get_blocking(&mc, &kc);
+
+    TuneResult tuned;
+    assert(tune_rnn_model(&model, &tuned) == MATH_SUCCESS);
+    assert(tuned.gemm_mc > 0 && tuned.gemm_kc > 0 && tuned.chunk > 0 && tuned.threads >= 1);
+    assert(model.gru_layers[0].weights.packed == NULL); // left on the float32 weights
+    int mc_after, kc_after;
+    gemm_get_blocking(&mc_after, &kc_after);
+    assert(mc_after == mc && kc_after == kc);
+
+    char key[TUNE_KEY_SIZE];
+    tune_key(&config, key, sizeof(key));
+    TuneResult loaded;
+    assert(!load_tune_cache(path, key, &loaded));
+    TuneResult other = {false, 24, 64, 128, 1};
+    assert(save_tune_cache(path, "other cpu|scalar|gru 1x1x1x1x1", &other) == MATH_SUCCESS);
+    assert(save_tune_cache(path, key, &tuned) == MATH_SUCCESS);
+    TuneResult cached = {true, 48, 64, 512, 2};
+    assert(save_tune_cache(path, key, &cached) == MATH_SUCCESS); // replaces the first entry
+    assert(load_tune_cache(path, key, &loaded));
+    assert(loaded.packed && loaded.gemm_mc == 48 && loaded.gemm_kc == 64 && loaded.chunk == 512 && loaded.threads == 2);
+    assert(load_tune_cache(path, "other cpu|scalar|gru 1x1x1x1x1", &loaded) && loaded.gemm_mc == 24);
+
+    // a cache hit is applied without timing anything
+    float* state = (float*)calloc(rnn_model_state_size(&config), sizeof(float));
+    float* ref_state = (float*)calloc(rnn_model_state_size(&config), sizeof(float));
+    float input[IN];
+    float output[O];
+    float ref[O];
+    fill_pattern(input, IN, 2);
+    rnn_model_step(&model, input, ref_state, ref);
+    PackArena arena;
+    assert(autotune_rnn_model(path, &model, &arena, &loaded) == MATH_SUCCESS);
+    assert(model.gru_layers[0].weights.packed != NULL);
+    gemm_get_blocking(&mc_after, &kc_after);
+    assert(mc_after == 48 && kc_after == 64);
+    rnn_model_step(&model, input, state, output);
+    assert_close(output, ref, O, 1e-5f);
+
+    gemm_set_blocking(mc, kc);
+    free_rnn_model_packed(&model);
+    free_pack_arena(&arena);
+    free(state);
+    free(ref_state);
+    free_rnn_model(&model, false);
+    free(data);
+    remove(path);
+}
+
+// Slices until done, returns how many the step took
+static int run_stepper(RNNStepper* stepper, float* input, float* state, float* output) {
+    int slices = 0;
+    rnn_stepper_begin(stepper, input, state, output);
+    StepperStatus status;
+    do {
+        status = rnn_stepper_resume(stepper);
+        slices++;
+    } while (status == STEPPER_PENDING);
+    assert(rnn_stepper_resume(stepper) == STEPPER_DONE);
+    return slices;
+}
+
+static void test_stepper_cell(RNNCellType cell_type) {
+    enum { IN = 5, H = 20, O = 3, L = 3, T = 4 };
+    RNNModelConfig config = {cell_type, 1, IN, H, O, L};
+    RNNModel model;
+    init_rnn_model(&model, config);
+    float* data = attach_pattern_weights(&model, 4);
+    int state_size = rnn_model_state_size(&config);
+    float* state = (float*)calloc(state_size, sizeof(float));
+    float* ref_state = (float*)calloc(state_size, sizeof(float));
+    float input[IN];
+    float output[O];
+    float ref[O];
+
+    // whole layers, 7 units with a short last slice, and wider than the layer
+    int slice_units[3] = {0, 7, 64};
+    int passes = (cell_type == RNN_CELL_GRU) ? 2 : 1;
+    int expected[3] = {L + 1, L * passes * 3 + 1, L * passes + 1};
+    for (int s = 0; s < 3; s++) {
+        RNNStepper stepper;
+        assert(init_rnn_stepper(&stepper, &model, slice_units[s]) == MATH_SUCCESS);
+        memset(state, 0, state_size * sizeof(float));
+        memset(ref_state, 0, state_size * sizeof(float));
+        for (int t = 0; t < T; t++) {
+            fill_pattern(input, IN, t);
+            // a step without output stops after the last layer
+            bool with_output = (t != 1);
+            int slices = run_stepper(&stepper, input, state, with_output ? output : NULL);
+            assert(slices == expected[s] - (with_output ? 0 : 1));
+            rnn_model_step(&model, input, ref_state, ref);
+            assert_close(state, ref_state, state_size, 1e-5f);
+            if (with_output) {
+                assert_close(output, ref, O, 1e-5f);
+            }
+        }
+        free_rnn_stepper(&stepper);
+    }
+
+    // packed layers run whole
+    PackArena arena;
+    assert(init_pack_arena(&arena, rnn_model_packed_bytes(&model)) == MATH_SUCCESS);
+    assert(pack_rnn_model(&model, &arena) == MATH_SUCCESS);
+    RNNStepper stepper;
+    assert(init_rnn_stepper(&stepper, &model, 7) == MATH_SUCCESS);
+    assert(run_stepper(&stepper, input, state, output) == L + 1);
+    rnn_model_step(&model, input, ref_state, ref);
+    assert_close(state, ref_state, state_size, 1e-5f);
+    assert_close(output, ref, O, 1e-5f);
+    free_rnn_stepper(&stepper);
+    free_rnn_model_packed(&model);
+    free_pack_arena(&arena);
+
+    // delta-mode layers run whole too, matching a twin model stepped by rnn_model_step
+    RNNModel twin;
+    init_rnn_model(&twin, config);
+    float* twin_data = attach_pattern_weights(&twin, 4);
+    for (int l = 0; l < L; l++) {
+        if (cell_type == RNN_CELL_GRU) {
+            assert(enable_gru_layer_delta(&model.gru_layers[l], 0.01f) == MATH_SUCCESS);
+            assert(enable_gru_layer_delta(&twin.gru_layers[l], 0.01f) == MATH_SUCCESS);
+        } else {
+            assert(enable_lstm_layer_delta(&model.lstm_layers[l], 0.01f) == MATH_SUCCESS);
+            assert(enable_lstm_layer_delta(&twin.lstm_layers[l], 0.01f) == MATH_SUCCESS);
+        }
+    }
+    assert(init_rnn_stepper(&stepper, &model, 7) == MATH_SUCCESS);
+    memset(state, 0, state_size * sizeof(float));
+    memset(ref_state, 0, state_size * sizeof(float));
+    for (int t = 0; t < T; t++) {
+        fill_pattern(input, IN, t);
+        assert(run_stepper(&stepper, input, state, output) == L + 1);
+        rnn_model_step(&twin, input, ref_state, ref);
+        assert_close(state, ref_state, state_size, 1e-5f);
+        assert_close(output, ref, O, 1e-5f);
+    }
+    free_rnn_stepper(&stepper);
+    for (int l = 0; l < L; l++) {
+        if (cell_type == RNN_CELL_GRU) {
+            disable_gru_layer_delta(&model.gru_layers[l]);
+            disable_gru_layer_delta(&twin.gru_layers[l]);
+        } else {
+            disable_lstm_layer_delta(&model.lstm_layers[l]);
+            disable_lstm_layer_delta(&twin.lstm_layers[l]);
+        }
+    }
+    free_rnn_model(&twin, false);
+    free(twin_data);
+
+    free(state);
+    free(ref_state);
+    free_rnn_model(&model, false);
+    free(data);
+}
+
+void test_stepper() {
+    test_stepper_cell(RNN_CELL_GRU);
+    test_stepper_cell(RNN_CELL_LSTM);
+}
+
+void test_numerics_guard() {
+    enum { IN = 5, H = 12, O = 3, L = 2, T = 3 };
+    RNNModelConfig config = {RNN_CELL_LSTM, 1, IN, H, O, L};
+    RNNModel model;
+    RNNModel ref_model;
+    init_rnn_model(&model, config);
+    init_rnn_model(&ref_model, config);
+    float* data = attach_pattern_weights(&model, 6);
+    float* ref_data = attach_pattern_weights(&ref_model, 6);
+    int state_size = rnn_model_state_size(&config);
+    float* state = (float*)calloc(state_size, sizeof(float));
+    float* ref_state = (float*)calloc(state_size, sizeof(float));
+    float input[IN];
+    float output[O];
+    float ref[O];
+
+    // the scans leave the results as they were
+    assert(rnn_numerics_status(&model) == MATH_SUCCESS);
+    assert(enable_rnn_numerics_guard(&model, 1.0f) == MATH_SUCCESS);
+    for (int t = 0; t < T; t++) {
+        fill_pattern(input, IN, t);
+        rnn_model_step(&model, input, state, output);
+        rnn_model_step(&ref_model, input, ref_state, ref);
+        assert(rnn_numerics_status(&model) == MATH_SUCCESS);
+        assert(memcmp(state, ref_state, state_size * sizeof(float)) == 0);
+        assert(memcmp(output, ref, sizeof(ref)) == 0);
+    }
+    assert(model.guard->steps == T);
+
+    // a limit below the state magnitudes counts saturation in every layer
+    assert(enable_rnn_numerics_guard(&model, 1e-6f) == MATH_SUCCESS);
+    rnn_model_step(&model, input, state, output);
+    assert(rnn_numerics_status(&model) == MATH_INVALID_RANGE);
+    for (int l = 0; l < L; l++) {
+        assert(model.guard->status[l] == MATH_INVALID_RANGE && model.guard->counts[l].saturated > 0);
+    }
+    assert(model.guard->status[L] == MATH_SUCCESS && model.guard->counts[L].saturated == 0);
+
+    // a NaN input reaches every layer and the output
+    assert(enable_rnn_numerics_guard(&model, 1.0f) == MATH_SUCCESS);
+    input[2] = NAN;
+    rnn_model_step(&model, input, state, output);
+    assert(rnn_numerics_status(&model) == MATH_OVERFLOW_RISK);
+    for (int l = 0; l <= L; l++) {
+        assert(model.guard->status[l] == MATH_OVERFLOW_RISK && model.guard->counts[l].nan > 0);
+    }
+    print_rnn_numerics_stats(&model);
+
+    // a batch step scans every row and counts one step per row
+    assert(enable_rnn_numerics_guard(&model, 1.0f) == MATH_SUCCESS);
+    RNNBatch batch;
+    assert(init_rnn_batch(&batch, &model, 2) == MATH_SUCCESS);
+    float batch_inputs[2 * IN];
+    float batch_outputs[2 * O];
+    fill_pattern(batch_inputs, 2 * IN, 8);
+    float* batch_states[2] = {state, ref_state};
+    memset(state, 0, state_size * sizeof(float));
+    memset(ref_state, 0, state_size * sizeof(float));
+    assert(rnn_batch_step(&batch, 2, batch_inputs, batch_states, batch_outputs) == MATH_SUCCESS);
+    assert(rnn_numerics_status(&model) == MATH_SUCCESS && model.guard->steps == 2);
+    batch_inputs[IN + 1] = NAN;
+    assert(rnn_batch_step(&batch, 2, batch_inputs, batch_states, batch_outputs) == MATH_SUCCESS);
+    assert(rnn_numerics_status(&model) == MATH_OVERFLOW_RISK && model.guard->counts[L].nan == O);
+    free_rnn_batch(&batch);
+
+    // an early exit scans the exit head's logits and reports the skipped layer as not run
+    memset(state, 0, state_size * sizeof(float));
+    fill_pattern(input, IN, 1);
+    assert(enable_rnn_numerics_guard(&model, 1e-6f) == MATH_SUCCESS);
+    rnn_model_step(&model, input, state, output);
+    assert(model.guard->status[1] == MATH_INVALID_RANGE);
+    assert(init_rnn_early_exit(&model, EXIT_MAX_SOFTMAX, 0.9f) == MATH_SUCCESS);
+    LinearLayer* head = add_rnn_exit_head(&model, 0);
+    fill_pattern(head->weights.weights, H * O, 9);
+    head->weights.bias[0] = -INFINITY; // still confident, but the logits hold an Inf
+    head->weights.bias[1] = 10.0f;
+    assert(rnn_model_step_early_exit(&model, input, state, NULL) == 0);
+    assert(model.guard->status[0] == MATH_INVALID_RANGE && model.guard->status[1] == MATH_SUCCESS);
+    assert(model.guard->status[L] == MATH_OVERFLOW_RISK && model.guard->counts[L].inf == 1);
+    assert(model.guard->steps == 2);
+    free_rnn_early_exit(&model);
+
+    // the stepper scans each layer as its last slice publishes the states
+    assert(enable_rnn_numerics_guard(&model, 1e-6f) == MATH_SUCCESS);
+    RNNStepper stepper;
+    assert(init_rnn_stepper(&stepper, &model, 5) == MATH_SUCCESS);
+    run_stepper(&stepper, input, state, output);
+    assert(model.guard->status[0] == MATH_INVALID_RANGE && model.guard->status[1] == MATH_INVALID_RANGE);
+    assert(model.guard->status[L] == MATH_SUCCESS && model.guard->steps == 1);
+    free_rnn_stepper(&stepper);
+
+    free(state);
+    free(ref_state);
+    free_rnn_model(&model, false);
+    free_rnn_model(&ref_model, false);
+    free(data);
+    free(ref_data);
+}
+
+int main() {
+    test_gru_forward_sequence();
+    test_lstm_forward_sequence();
+    test_session_manager();
+    test_state_store();
+    test_sliding_window();
+    test_delta_forward();
+    test_early_exit();
+    test_infer_queue();
+    test_frame_ring();
+    test_checkpoint_load();
+    test_layer_stream();
+    test_model_registry();
+    test_shm_ring();
+    test_bulk_score();
+    test_layer_graph();
+    test_bidirectional();
+    test_lstmp();
+    test_conv1d();
+    test_attention();
+    test_packed_sequences();
+    test_ensemble();
+    test_tune();
+    test_stepper();
+    test_numerics_guard();
+    printf("All tests passed!\n");
+    return 0;
+}